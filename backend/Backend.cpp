@@ -16,6 +16,7 @@
 
 #include "Backend.h"
 
+#include <algorithm>
 #include <climits>
 
 #include <aidl/android/hardware/graphics/composer3/Composition.h>
@@ -34,7 +35,7 @@ HWC2::Error Backend::ValidateDisplay(HwcDisplay *display, uint32_t *num_types,
   *num_types = 0;
   *num_requests = 0;
 
-  auto layers = display->GetOrderLayersByZPos();
+  auto &layers = display->GetOrderLayersByZPos();
 
   for (auto l : layers) {
     if ((uint32_t)l->GetSfType() == (uint32_t)aidl::android::hardware::graphics::composer3::Composition::DISPLAY_DECORATION)
@@ -48,6 +49,18 @@ HWC2::Error Backend::ValidateDisplay(HwcDisplay *display, uint32_t *num_types,
     client_start = 0;
     client_size = layers.size();
     MarkValidated(layers, client_start, client_size);
+  } else if (display->IsCompositionUnchanged()) {
+    /* Nothing but buffers changed since the last validation, keep its
+     * composition types and skip the TEST_ONLY commit
+     */
+    ++display->total_stats().validations_reused_;
+    for (size_t z_order = 0; z_order < layers.size(); ++z_order) {
+      if (layers[z_order]->GetValidatedType() == HWC2::Composition::Client) {
+        if (client_start < 0)
+          client_start = (int)z_order;
+        client_size = (z_order - client_start) + 1;
+      }
+    }
   } else {
     std::tie(client_start, client_size) = GetClientLayers(display, layers);
 
@@ -60,9 +73,8 @@ HWC2::Error Backend::ValidateDisplay(HwcDisplay *display, uint32_t *num_types,
     if (testing_needed &&
         display->CreateComposition(a_args) != HWC2::Error::None) {
       ++display->total_stats().failed_kms_validate_;
-      client_start = 0;
-      client_size = layers.size();
-      MarkValidated(layers, 0, client_size);
+      std::tie(client_start, client_size) = GetCheapestValidClientRange(
+          display, layers, client_start, client_size);
     }
   }
 
@@ -94,9 +106,18 @@ std::tuple<int, size_t> Backend::GetClientLayers(
       device_size = (z_order - device_start) + 1;
     }
   }
-  if (device_size == 0)
+  if (device_size == 0) {
+    /* The plane assignment search knows which plane can show which layer,
+     * the plane count is only a guess if it fails
+     */
+    auto range = DrmKmsPlan::FindClientRange(display->GetPipe(),
+                                             MakeClientRangeQuery(display,
+                                                                  layers));
+    if (range)
+      return std::make_tuple(range->start, range->size);
+
     return GetExtraClientRange(display, layers, client_start, client_size);
-  else {
+  } else {
     bool status = true;
     MarkValidated(layers, client_start, client_size);
     for (size_t z_order = 0; z_order < layers.size(); ++z_order) {
@@ -122,7 +143,7 @@ std::tuple<int, size_t> Backend::GetClientLayers(
 bool Backend::IsClientLayer(HwcDisplay *display, HwcLayer *layer) {
   return !HardwareSupportsLayerType(layer->GetSfType()) ||
          !layer->IsLayerUsableAsDevice() ||
-         display->color_transform_hint() != HAL_COLOR_TRANSFORM_IDENTITY ||
+         display->CtmByGpu() ||
          (layer->GetLayerData().pi.RequireScalingOrPhasing() &&
           display->GetHwc2()->GetResMan().ForcedScalingWithGpu()) ||
          (!display->IsInHeadlessMode() && display->GetPipe().device->IsIvshmDev());
@@ -131,7 +152,8 @@ bool Backend::IsClientLayer(HwcDisplay *display, HwcLayer *layer) {
 bool Backend::IsVideoLayer(HwcLayer *layer) {
   std::optional<BufferInfo> bi;
   if (layer->GetBufferHandle())
-    bi = BufferInfoGetter::GetInstance()->GetBoInfo(layer->GetBufferHandle());
+    bi = BufferInfoGetter::GetInstance()->GetCachedBoInfo(
+        layer->GetBufferHandle());
   return bi && bi->usage & GRALLOC_USAGE_HW_VIDEO_ENCODER;
 }
 
@@ -145,13 +167,83 @@ uint32_t Backend::CalcPixOps(const std::vector<HwcLayer *> &layers,
   uint32_t pixops = 0;
   for (size_t z_order = 0; z_order < layers.size(); ++z_order) {
     if (z_order >= first_z && z_order < first_z + size) {
-      hwc_rect_t &df = layers[z_order]->GetLayerData().pi.display_frame;
+      auto &df = layers[z_order]->GetHotState().display_frame;
       pixops += (df.right - df.left) * (df.bottom - df.top);
     }
   }
   return pixops;
 }
 
+auto Backend::MakeClientRangeQuery(HwcDisplay *display,
+                                   const std::vector<HwcLayer *> &layers)
+    -> DrmKmsPlan::ClientRangeQuery & {
+  auto &query = client_range_query_;
+  query.layers.clear();
+  query.layers.resize(layers.size());
+  query.client.resize(layers.size());
+  query.client_target = nullptr;
+  query.rejected.clear();
+
+  /* Video layers stay on planes like GetExtraClientRange2() keeps them,
+   * unless they're between layers which have to be client composited
+   */
+  size_t first = layers.size();
+  size_t last = 0;
+  for (size_t z_order = 0; z_order < layers.size(); ++z_order) {
+    auto *layer = layers[z_order];
+    if (IsClientLayer(display, layer)) {
+      first = std::min(first, z_order);
+      last = z_order + 1;
+      continue;
+    }
+
+    layer->PopulateLayerData(/*test = */ true);
+    if (layer->IsLayerUsableAsDevice() && layer->GetLayerData().bi)
+      query.layers[z_order] = &layer->GetLayerData();
+  }
+
+  for (size_t z_order = 0; z_order < layers.size(); ++z_order) {
+    query.client[z_order] = {
+        .allowed = !IsVideoLayer(layers[z_order]) ||
+                   (z_order >= first && z_order < last),
+        .pixels = CalcPixOps(layers, z_order, 1),
+    };
+  }
+
+  auto &client_layer = display->GetClientLayer();
+  if (client_layer.IsLayerUsableAsDevice() && client_layer.GetLayerData().bi)
+    query.client_target = &client_layer.GetLayerData();
+
+  return query;
+}
+
+std::tuple<int, size_t> Backend::GetCheapestValidClientRange(
+    HwcDisplay *display, std::vector<HwcLayer *> &layers, int rejected_start,
+    size_t rejected_size) {
+  /* TEST_ONLY commits spent after the preferred split was rejected */
+  constexpr size_t kMaxTries = 6;
+
+  auto &query = MakeClientRangeQuery(display, layers);
+  query.rejected.push_back({.start = rejected_start, .size = rejected_size});
+
+  for (size_t i = 0; i < kMaxTries; i++) {
+    auto range = DrmKmsPlan::FindClientRange(display->GetPipe(), query);
+    /* Everything on the client is the fallback anyway */
+    if (!range || range->size == layers.size())
+      break;
+
+    MarkValidated(layers, range->start, range->size);
+    AtomicCommitArgs a_args = {.test_only = true};
+    if (display->CreateComposition(a_args) == HWC2::Error::None)
+      return std::make_tuple(range->start, range->size);
+
+    query.rejected.push_back(*range);
+  }
+
+  MarkValidated(layers, 0, layers.size());
+  return std::make_tuple(0, layers.size());
+}
+
 void Backend::MarkValidated(std::vector<HwcLayer *> &layers,
                             size_t client_first_z, size_t client_size) {
   for (size_t z_order = 0; z_order < layers.size(); ++z_order) {
@@ -165,8 +257,7 @@ void Backend::MarkValidated(std::vector<HwcLayer *> &layers,
 std::tuple<int, int> Backend::GetExtraClientRange(
     HwcDisplay *display, const std::vector<HwcLayer *> &layers,
     int client_start, size_t client_size) {
-  auto planes = display->GetPipe().GetUsablePlanes();
-  size_t avail_planes = planes.size();
+  size_t avail_planes = display->GetPipe().CountAvailablePlanes();
 
   /*
    * If more layers then planes, save one plane
@@ -210,8 +301,7 @@ std::tuple<int, int> Backend::GetExtraClientRange(
 std::tuple<int, int> Backend::GetExtraClientRange2(
     HwcDisplay *display, const std::vector<HwcLayer *> &layers,
     int client_start, size_t client_size, int device_start, size_t device_size) {
-  auto planes = display->GetPipe().GetUsablePlanes();
-  size_t avail_planes = planes.size();
+  size_t avail_planes = display->GetPipe().CountAvailablePlanes();
 
   /*
    * Only video layer must to be compositing by device.
@@ -34,6 +34,19 @@ class Backend {
   static bool HardwareSupportsLayerType(HWC2::Composition comp_type);
   static uint32_t CalcPixOps(const std::vector<HwcLayer *> &layers,
                              size_t first_z, size_t size);
+  /* Falls back to the cheapest client range passing the TEST_ONLY commit,
+   * after the preferred one was rejected. Only the ranges the planes can
+   * show according to FindClientRange() get a TEST_ONLY commit.
+   */
+  std::tuple<int, size_t> GetCheapestValidClientRange(
+      HwcDisplay *display, std::vector<HwcLayer *> &layers, int rejected_start,
+      size_t rejected_size);
+  /* Input of DrmKmsPlan::FindClientRange() for the layers in z-order. Refills
+   * and returns client_range_query_, valid until the next call.
+   */
+  auto MakeClientRangeQuery(HwcDisplay *display,
+                            const std::vector<HwcLayer *> &layers)
+      -> DrmKmsPlan::ClientRangeQuery &;
   static void MarkValidated(std::vector<HwcLayer *> &layers,
                             size_t client_first_z, size_t client_size);
   static std::tuple<int, int> GetExtraClientRange(
@@ -42,6 +55,10 @@ class Backend {
   static std::tuple<int, int> GetExtraClientRange2(
       HwcDisplay *display, const std::vector<HwcLayer *> &layers,
       int client_start, size_t client_size, int device_start, size_t device_size);
+
+ private:
+  /* Kept between validations, so that its vectors keep their capacity */
+  DrmKmsPlan::ClientRangeQuery client_range_query_{};
 };
 }  // namespace android
 
@@ -24,7 +24,7 @@ HWC2::Error BackendClient::ValidateDisplay(HwcDisplay *display,
                                            uint32_t *num_types,
                                            uint32_t * /*num_requests*/) {
   for (auto &[layer_handle, layer] : display->layers()) {
-    layer.SetValidatedType(HWC2::Composition::Client);
+    layer->SetValidatedType(HWC2::Composition::Client);
     ++*num_types;
   }
   return HWC2::Error::HasChanges;
@@ -67,6 +67,58 @@ std::optional<BufferUniqueId> BufferInfoGetter::GetUniqueId(
   return static_cast<BufferUniqueId>(sb.st_ino);
 }
 
+auto BufferInfoGetter::GetCachedBoInfo(buffer_handle_t handle)
+    -> std::optional<BufferInfo> {
+  auto unique_id = GetUniqueId(handle);
+  if (!unique_id) {
+    return GetBoInfo(handle);
+  }
+
+  return GetCachedBoInfo(handle, *unique_id);
+}
+
+auto BufferInfoGetter::GetCachedBoInfo(buffer_handle_t handle,
+                                       BufferUniqueId unique_id)
+    -> std::optional<BufferInfo> {
+  {
+    const std::lock_guard<std::mutex> lock(bo_info_cache_lock_);
+    auto it = bo_info_cache_.find(unique_id);
+    if (it != bo_info_cache_.end()) {
+      if (it->second.handle == handle) {
+        bo_info_lru_.splice(bo_info_lru_.begin(), bo_info_lru_,
+                            it->second.lru_it);
+        return it->second.bi;
+      }
+      /* Same buffer imported again under another handle, refresh the fds */
+      bo_info_lru_.erase(it->second.lru_it);
+      bo_info_cache_.erase(it);
+    }
+  }
+
+  /* Don't hold the lock across the (potentially slow) gralloc calls */
+  auto bi = GetBoInfo(handle);
+  if (!bi) {
+    return bi;
+  }
+
+  const std::lock_guard<std::mutex> lock(bo_info_cache_lock_);
+  if (bo_info_cache_.count(unique_id) != 0) {
+    return bi;
+  }
+
+  if (bo_info_cache_.size() >= kBoInfoCacheSize) {
+    bo_info_cache_.erase(bo_info_lru_.back());
+    bo_info_lru_.pop_back();
+  }
+
+  bo_info_lru_.emplace_front(unique_id);
+  bo_info_cache_.emplace(unique_id,
+                         BoInfoCacheEntry{.bi = *bi,
+                                          .handle = handle,
+                                          .lru_it = bo_info_lru_.begin()});
+  return bi;
+}
+
 int LegacyBufferInfoGetter::Init() {
   int ret = hw_get_module(
       GRALLOC_HARDWARE_MODULE_ID,
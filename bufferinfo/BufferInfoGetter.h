@@ -20,7 +20,10 @@
 #include <drm/drm_fourcc.h>
 #include <hardware/gralloc.h>
 
+#include <list>
+#include <mutex>
 #include <optional>
+#include <unordered_map>
 
 #include "BufferInfo.h"
 #include "drm/DrmDevice.h"
@@ -42,9 +45,31 @@ class BufferInfoGetter {
 
   virtual std::optional<BufferUniqueId> GetUniqueId(buffer_handle_t handle);
 
+  /* Same as GetBoInfo(), but avoids querying gralloc for recently seen
+   * buffers. Safe to call from any thread.
+   */
+  auto GetCachedBoInfo(buffer_handle_t handle) -> std::optional<BufferInfo>;
+  auto GetCachedBoInfo(buffer_handle_t handle, BufferUniqueId unique_id)
+      -> std::optional<BufferInfo>;
+
   static BufferInfoGetter *GetInstance();
 
   static bool IsDrmFormatRgb(uint32_t drm_format);
+
+ private:
+  static constexpr size_t kBoInfoCacheSize = 256;
+
+  struct BoInfoCacheEntry {
+    BufferInfo bi;
+    /* prime_fds are only valid for the handle they were read from */
+    buffer_handle_t handle;
+    std::list<BufferUniqueId>::iterator lru_it;
+  };
+
+  std::mutex bo_info_cache_lock_;
+  std::unordered_map<BufferUniqueId, BoInfoCacheEntry> bo_info_cache_;
+  /* Most recently used first */
+  std::list<BufferUniqueId> bo_info_lru_;
 };
 
 class LegacyBufferInfoGetter : public BufferInfoGetter {
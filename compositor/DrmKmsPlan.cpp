@@ -18,36 +18,144 @@
 
 #include "DrmKmsPlan.h"
 
+#include <tuple>
+
 #include "drm/DrmDevice.h"
 #include "drm/DrmPlane.h"
 #include "utils/log.h"
 
 namespace android {
+
+static auto GetAvailablePlanes(DrmDisplayPipeline &pipe)
+    -> std::vector<DrmPlane *> {
+  std::vector<DrmPlane *> avail_planes;
+  for (auto *plane : pipe.GetUsablePlanes()) {
+    if (plane->IsAvailableFor(&pipe)) {
+      avail_planes.emplace_back(plane);
+    }
+  }
+  return avail_planes;
+}
+
+static auto GetValidPlanes(const LayerData &layer,
+                           const std::vector<DrmPlane *> &planes)
+    -> std::vector<bool> {
+  std::vector<bool> valid(planes.size());
+  auto layer_caps = DrmPlane::GetLayerCaps(layer);
+  for (size_t p = 0; p < planes.size(); p++) {
+    valid[p] = planes[p]->IsValidForLayer(layer, layer_caps);
+  }
+  return valid;
+}
+
+static auto GetPlaneZOrder(const std::vector<DrmPlane *> &planes)
+    -> std::vector<PlaneAssignmentSearch::PlaneZOrder> {
+  std::vector<PlaneAssignmentSearch::PlaneZOrder> z_order(planes.size());
+  for (size_t p = 0; p < planes.size(); p++) {
+    auto &zpos = planes[p]->GetZPosProperty();
+    if (!zpos) {
+      continue;
+    }
+
+    uint64_t min_zpos = 0;
+    uint64_t max_zpos = 0;
+    if (zpos.is_immutable()) {
+      std::tie(std::ignore, min_zpos) = zpos.value();
+      max_zpos = min_zpos;
+    } else {
+      std::tie(std::ignore, min_zpos) = zpos.range_min();
+      std::tie(std::ignore, max_zpos) = zpos.range_max();
+    }
+    z_order[p] = {.has_zpos = true,
+                  .min_zpos = int64_t(min_zpos),
+                  .max_zpos = int64_t(max_zpos)};
+  }
+  return z_order;
+}
+
+auto DrmKmsPlan::FindClientRange(DrmDisplayPipeline &pipe,
+                                 const ClientRangeQuery &query)
+    -> std::optional<PlaneAssignmentSearch::ClientRange> {
+  auto avail_planes = GetAvailablePlanes(pipe);
+
+  std::vector<std::vector<bool>> valid;
+  valid.reserve(query.layers.size());
+  for (const auto *layer : query.layers) {
+    valid.emplace_back(layer != nullptr
+                           ? GetValidPlanes(*layer, avail_planes)
+                           : std::vector<bool>(avail_planes.size()));
+  }
+
+  auto client_valid = query.client_target != nullptr
+                          ? GetValidPlanes(*query.client_target, avail_planes)
+                          : std::vector<bool>(avail_planes.size(), true);
+
+  PlaneAssignmentSearch search(std::move(valid), GetPlaneZOrder(avail_planes),
+                               query.client, std::move(client_valid));
+  for (const auto &range : query.rejected) {
+    search.Reject(range);
+  }
+
+  bool found = search.Run();
+  if (search.IsExhausted()) {
+    ALOGV("Client range search budget exhausted for %zu layers",
+          query.layers.size());
+  }
+  if (!found) {
+    return {};
+  }
+
+  return search.GetClientRange();
+}
+
 auto DrmKmsPlan::CreateDrmKmsPlan(DrmDisplayPipeline &pipe,
                                   std::vector<LayerData> composition)
     -> std::unique_ptr<DrmKmsPlan> {
-  auto plan = std::make_unique<DrmKmsPlan>();
+  auto avail_planes = GetAvailablePlanes(pipe);
+  if (composition.size() > avail_planes.size()) {
+    return {};
+  }
 
-  auto avail_planes = pipe.GetUsablePlanes();
+  /* Evaluate plane capabilities once per layer/plane pair */
+  std::vector<std::vector<bool>> valid;
+  valid.reserve(composition.size());
+  for (auto &layer : composition) {
+    valid.emplace_back(GetValidPlanes(layer, avail_planes));
+  }
 
-  int z_pos = 0;
-  for (auto &dhl : composition) {
-    std::shared_ptr<BindingOwner<DrmPlane>> plane;
+  PlaneAssignmentSearch search(std::move(valid), GetPlaneZOrder(avail_planes));
+  if (!search.Run()) {
+    if (search.IsExhausted()) {
+      ALOGV("Plane assignment search budget exhausted for %zu layers",
+            composition.size());
+    }
+    return {};
+  }
+
+  auto plan = std::make_unique<DrmKmsPlan>();
+  plan->plan.reserve(composition.size());
 
-    /* Skip unsupported planes */
-    do {
-      if (avail_planes.empty()) {
-        return {};
-      }
+  auto &assignment = search.GetAssignment();
+  for (size_t l = 0; l < composition.size(); l++) {
+    auto *drm_plane = avail_planes[assignment[l]];
+    /* Relative to the bottom of the plane's zpos range, as the plane sets it */
+    int z_pos = int(l);
+    if (drm_plane->GetZPosProperty()) {
+      uint64_t min_zpos = 0;
+      std::tie(std::ignore, min_zpos) = drm_plane->GetZPosProperty().range_min();
+      z_pos = int(search.GetZpos()[l] - int64_t(min_zpos));
+    }
 
-      plane = *avail_planes.begin();
-      avail_planes.erase(avail_planes.begin());
-    } while (!plane->Get()->IsValidForLayer(&dhl));
+    /* Another display may have taken the plane since it was checked */
+    auto plane = drm_plane->BindPipeline(&pipe, true);
+    if (!plane) {
+      return {};
+    }
 
     LayerToPlaneJoining joining = {
-        .layer = std::move(dhl),
-        .plane = plane,
-        .z_pos = z_pos++,
+        .layer = std::move(composition[l]),
+        .plane = std::move(plane),
+        .z_pos = z_pos,
     };
 
     plan->plan.emplace_back(std::move(joining));
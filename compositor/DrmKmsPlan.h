@@ -18,9 +18,11 @@
 #define ANDROID_DRM_KMS_PLAN_H_
 
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include "LayerData.h"
+#include "PlaneAssignmentSearch.h"
 
 namespace android {
 
@@ -38,6 +40,24 @@ struct DrmKmsPlan {
   static auto CreateDrmKmsPlan(DrmDisplayPipeline &pipe,
                                std::vector<LayerData> composition)
       -> std::unique_ptr<DrmKmsPlan>;
+
+  /* Layers of a display in z-order, as seen by FindClientRange() */
+  struct ClientRangeQuery {
+    /* Null for the layers no plane may show */
+    std::vector<const LayerData *> layers;
+    std::vector<PlaneAssignmentSearch::ClientOption> client;
+    /* Null if not known yet, any plane is assumed to take it then */
+    const LayerData *client_target;
+    std::vector<PlaneAssignmentSearch::ClientRange> rejected;
+  };
+
+  /* Cheapest range of layers to composite by the client, which lets the
+   * rest of the layers and the client target fit the planes of the pipeline.
+   * Neither binds the planes nor asks the kernel.
+   */
+  static auto FindClientRange(DrmDisplayPipeline &pipe,
+                              const ClientRangeQuery &query)
+      -> std::optional<PlaneAssignmentSearch::ClientRange>;
 };
 
 }  // namespace android
@@ -47,6 +47,13 @@ struct PresentInfo {
   uint16_t alpha = UINT16_MAX;
   hwc_frect_t source_crop{};
   hwc_rect_t display_frame{};
+  /* Buffer area changed since the buffer shown by the plane in the previous
+   * frame, in buffer coordinates. Unset means the whole buffer. Only valid
+   * when the plane showed the same damage_owner in the previous frame.
+   */
+  std::optional<std::vector<hwc_rect_t>> damage;
+  /* Never reused id of the layer, 0 if unknown */
+  uint64_t damage_owner{};
 
   bool RequireScalingOrPhasing() const {
     float src_width = source_crop.right - source_crop.left;
@@ -65,12 +72,17 @@ struct PresentInfo {
 struct LayerData {
   auto Clone() {
     LayerData clonned;
+    CloneTo(clonned);
+    return clonned;
+  }
+
+  /* Same as Clone(), but reuses the storage of an existing LayerData */
+  void CloneTo(LayerData &clonned) {
     clonned.bi = bi;
     clonned.fb = fb;
     clonned.pi = pi;
     clonned.acquire_fence = std::move(acquire_fence);
     clonned.blit_fence = std::move(blit_fence);
-    return clonned;
   }
 
   std::optional<BufferInfo> bi;
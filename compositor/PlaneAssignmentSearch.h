@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_PLANE_ASSIGNMENT_SEARCH_H_
+#define ANDROID_PLANE_ASSIGNMENT_SEARCH_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace android {
+
+/* Layer-to-plane matching with z-order constraints.
+ *
+ * Layers are walked bottom-to-top and their zpos has to grow strictly. A
+ * plane with mutable zpos takes the lowest value of its range above the
+ * previous layer, a plane with immutable zpos has a single value. Planes
+ * without zpos keep their relative order from the usable plane list.
+ *
+ * A contiguous range of layers may be composited by the client instead, if
+ * the caller allows it for these layers. The client target then takes a
+ * plane at the position of the range. Complete assignments are scored by the
+ * pixels left to the client, then by the number of planes used, and the
+ * cheapest one found within the budget is kept.
+ *
+ * Each layer tries the planes following the plane of the previous layer
+ * first, and the client last, so whenever the first-fit assignment
+ * satisfies the constraints it is the one found first.
+ */
+class PlaneAssignmentSearch {
+ public:
+  struct PlaneZOrder {
+    bool has_zpos;
+    /* Equal for immutable zpos */
+    int64_t min_zpos;
+    int64_t max_zpos;
+  };
+
+  struct ClientOption {
+    bool allowed;
+    /* Pixels the client composites when it takes the layer */
+    uint64_t pixels;
+  };
+
+  /* Layers composited by the client, start is -1 if there are none */
+  struct ClientRange {
+    int start = -1;
+    size_t size = 0;
+  };
+
+  struct Cost {
+    uint64_t client_pixels;
+    size_t planes;
+  };
+
+  /* Upper bounds for the per-frame search. The search is exhaustive for
+   * common plane counts, the limits only protect the validate path from
+   * pathological layer stacks.
+   */
+  static constexpr int kMaxSearchSteps = 4096;
+  static constexpr int kDeadlineCheckInterval = 64;
+  static constexpr auto kSearchTimeBudget = std::chrono::microseconds(500);
+
+  /* valid[layer][plane] tells whether the plane can show the layer. Every
+   * layer has to get a plane.
+   */
+  PlaneAssignmentSearch(std::vector<std::vector<bool>> valid,
+                        std::vector<PlaneZOrder> planes)
+      : PlaneAssignmentSearch(std::move(valid), std::move(planes), {}, {}) {
+  }
+
+  /* client[layer] tells whether the client may take the layer, and
+   * client_valid[plane] whether the plane can show the client target
+   */
+  PlaneAssignmentSearch(std::vector<std::vector<bool>> valid,
+                        std::vector<PlaneZOrder> planes,
+                        std::vector<ClientOption> client,
+                        std::vector<bool> client_valid)
+      : valid_(std::move(valid)),
+        planes_(std::move(planes)),
+        client_(std::move(client)),
+        client_valid_(std::move(client_valid)),
+        used_(planes_.size()),
+        assignment_(valid_.size(), -1),
+        zpos_(valid_.size()),
+        must_plane_after_(valid_.size() + 1),
+        deadline_(std::chrono::steady_clock::now() + kSearchTimeBudget) {
+    client_.resize(valid_.size(), {.allowed = false, .pixels = 0});
+    client_valid_.resize(planes_.size());
+    for (size_t layer = valid_.size(); layer > 0; layer--) {
+      must_plane_after_[layer - 1] = must_plane_after_[layer] +
+                                     (client_[layer - 1].allowed ? 0 : 1);
+    }
+  }
+
+  /* Skips the assignments with this client range, e.g. after the kernel
+   * rejected it
+   */
+  void Reject(ClientRange range) {
+    rejected_.emplace_back(range);
+  }
+
+  /* False if no assignment was found, the best one found so far is kept
+   * when the budget runs out
+   */
+  auto Run() -> bool {
+    Assign(0, -1, -1, kNoZpos, planes_.size());
+    return found_;
+  }
+
+  /* Plane index of every layer, -1 for the layers taken by the client */
+  auto GetAssignment() const -> const std::vector<int> & {
+    return best_assignment_;
+  }
+
+  /* zpos of every layer, meaningless for planes without zpos and for the
+   * layers taken by the client
+   */
+  auto GetZpos() const -> const std::vector<int64_t> & {
+    return best_zpos_;
+  }
+
+  auto GetClientRange() const {
+    return best_client_range_;
+  }
+
+  /* Plane of the client target, -1 without client range */
+  auto GetClientPlane() const {
+    return best_client_plane_;
+  }
+
+  auto GetClientZpos() const {
+    return best_client_zpos_;
+  }
+
+  auto GetCost() const {
+    return best_cost_;
+  }
+
+  auto IsExhausted() const {
+    return exhausted_;
+  }
+
+ private:
+  static constexpr int64_t kNoZpos = std::numeric_limits<int64_t>::min();
+
+  static auto IsCheaper(const Cost &a, const Cost &b) -> bool {
+    if (a.client_pixels != b.client_pixels)
+      return a.client_pixels < b.client_pixels;
+
+    return a.planes < b.planes;
+  }
+
+  auto IsRejected(const ClientRange &range) const -> bool {
+    return std::any_of(rejected_.begin(), rejected_.end(),
+                       [&range](const ClientRange &r) {
+                         return r.size == range.size &&
+                                (r.size == 0 || r.start == range.start);
+                       });
+  }
+
+  auto OutOfBudget() -> bool {
+    if (exhausted_)
+      return true;
+
+    ++steps_;
+    if (steps_ > kMaxSearchSteps ||
+        (steps_ % kDeadlineCheckInterval == 0 &&
+         std::chrono::steady_clock::now() > deadline_)) {
+      exhausted_ = true;
+    }
+
+    return exhausted_;
+  }
+
+  /* zpos the plane gets above the layers placed so far, false if the plane
+   * can't go there
+   */
+  auto Fit(size_t plane, int last_unordered, int64_t last_zpos,
+           int64_t *zpos) const -> bool {
+    if (used_[plane])
+      return false;
+
+    auto &z_order = planes_[plane];
+    if (!z_order.has_zpos) {
+      *zpos = kNoZpos;
+      return int(plane) > last_unordered;
+    }
+
+    *zpos = last_zpos == kNoZpos ? z_order.min_zpos
+                                 : std::max(last_zpos + 1, z_order.min_zpos);
+    return *zpos <= z_order.max_zpos;
+  }
+
+  /* Places the layer, or opens the client range, on the plane */
+  void AssignAbove(size_t layer, size_t plane, int last_unordered,
+                   int64_t last_zpos, int64_t zpos, size_t free_planes) {
+    bool has_zpos = planes_[plane].has_zpos;
+    used_[plane] = true;
+    cost_.planes++;
+    Assign(layer + 1, int(plane), has_zpos ? last_unordered : int(plane),
+           has_zpos ? zpos : last_zpos, free_planes - 1);
+    cost_.planes--;
+    used_[plane] = false;
+  }
+
+  void Record() {
+    found_ = true;
+    best_cost_ = cost_;
+    best_assignment_ = assignment_;
+    best_zpos_ = zpos_;
+    best_client_range_ = client_range_;
+    best_client_plane_ = client_range_.size != 0 ? client_plane_ : -1;
+    best_client_zpos_ = client_zpos_;
+  }
+
+  void Assign(size_t layer, int last_plane, int last_unordered,
+              int64_t last_zpos, size_t free_planes) {
+    /* The cost only grows further down */
+    if (found_ && !IsCheaper(cost_, best_cost_))
+      return;
+
+    if (layer == valid_.size()) {
+      if (!IsRejected(client_range_))
+        Record();
+      return;
+    }
+
+    if (must_plane_after_[layer] > free_planes || OutOfBudget())
+      return;
+
+    for (size_t i = 0; i < planes_.size() && !exhausted_; i++) {
+      size_t plane = (last_plane + 1 + i) % planes_.size();
+      int64_t zpos = kNoZpos;
+      if (!valid_[layer][plane] ||
+          !Fit(plane, last_unordered, last_zpos, &zpos))
+        continue;
+
+      assignment_[layer] = int(plane);
+      zpos_[layer] = zpos;
+      AssignAbove(layer, plane, last_unordered, last_zpos, zpos, free_planes);
+      assignment_[layer] = -1;
+    }
+
+    if (!client_[layer].allowed || exhausted_)
+      return;
+
+    cost_.client_pixels += client_[layer].pixels;
+    if (client_range_.size == 0) {
+      /* The client target takes a plane at the bottom of the range */
+      client_range_ = {.start = int(layer), .size = 1};
+      for (size_t i = 0; i < planes_.size() && !exhausted_; i++) {
+        size_t plane = (last_plane + 1 + i) % planes_.size();
+        int64_t zpos = kNoZpos;
+        if (!client_valid_[plane] ||
+            !Fit(plane, last_unordered, last_zpos, &zpos))
+          continue;
+
+        client_plane_ = int(plane);
+        client_zpos_ = zpos;
+        AssignAbove(layer, plane, last_unordered, last_zpos, zpos,
+                    free_planes);
+      }
+      client_range_ = {};
+    } else if (size_t(client_range_.start) + client_range_.size == layer) {
+      /* Joins the range right below, which already has its plane */
+      client_range_.size++;
+      Assign(layer + 1, last_plane, last_unordered, last_zpos, free_planes);
+      client_range_.size--;
+    }
+    cost_.client_pixels -= client_[layer].pixels;
+  }
+
+  std::vector<std::vector<bool>> valid_;
+  std::vector<PlaneZOrder> planes_;
+  std::vector<ClientOption> client_;
+  std::vector<bool> client_valid_;
+  std::vector<ClientRange> rejected_;
+
+  /* State of the assignment being built */
+  std::vector<bool> used_;
+  std::vector<int> assignment_;
+  std::vector<int64_t> zpos_;
+  ClientRange client_range_;
+  int client_plane_ = -1;
+  int64_t client_zpos_ = kNoZpos;
+  Cost cost_{};
+
+  /* Layers from the index up, which can't go to the client */
+  std::vector<size_t> must_plane_after_;
+
+  bool found_{};
+  Cost best_cost_{};
+  std::vector<int> best_assignment_;
+  std::vector<int64_t> best_zpos_;
+  ClientRange best_client_range_;
+  int best_client_plane_ = -1;
+  int64_t best_client_zpos_ = kNoZpos;
+
+  std::chrono::steady_clock::time_point deadline_;
+  int steps_{};
+  bool exhausted_{};
+};
+
+}  // namespace android
+
+#endif
@@ -30,11 +30,14 @@
 #include <utils/Trace.h>
 #include "utils/intel_blit.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 #include "drm/DrmCrtc.h"
@@ -42,14 +45,210 @@
 #include "drm/DrmPlane.h"
 #include "drm/DrmUnique.h"
 #include "utils/log.h"
+#include "utils/properties.h"
 
 namespace android {
 
+static uint64_t ToFixedPtBits(float in) {
+  constexpr int kBitShift = 16;
+  return uint64_t(int64_t(in * (1 << kBitShift)));
+}
+
+/* Framebuffer IDs and fences are left out on purpose, the kernel verdict
+ * depends only on the plane configuration.
+ */
+void DrmAtomicStateManager::CalcTestCommitKey(DrmKmsPlan &plan,
+                                              bool hdr_metadata_valid,
+                                              TestCommitCache::Key &key) {
+  key.clear();
+  key.push_back(hdr_metadata_valid ? 1 : 0);
+
+  for (auto &joining : plan.plan) {
+    auto &bi = joining.layer.bi;
+    auto &pi = joining.layer.pi;
+
+    key.push_back(joining.plane->Get()->GetId());
+    key.push_back(joining.z_pos);
+    key.push_back(bi->width);
+    key.push_back(bi->height);
+    key.push_back(bi->format);
+    key.push_back(bi->modifiers[0]);
+    key.push_back(bi->use_shadow_fds ? 1 : 0);
+    key.push_back(uint64_t(bi->blend_mode));
+    key.push_back(uint64_t(bi->color_space));
+    key.push_back(uint64_t(bi->sample_range));
+    key.push_back(pi.transform);
+    key.push_back(pi.alpha);
+    key.push_back(uint64_t(int64_t(pi.display_frame.left)));
+    key.push_back(uint64_t(int64_t(pi.display_frame.top)));
+    key.push_back(uint64_t(int64_t(pi.display_frame.right)));
+    key.push_back(uint64_t(int64_t(pi.display_frame.bottom)));
+    key.push_back(ToFixedPtBits(pi.source_crop.left));
+    key.push_back(ToFixedPtBits(pi.source_crop.top));
+    key.push_back(ToFixedPtBits(pi.source_crop.right));
+    key.push_back(ToFixedPtBits(pi.source_crop.bottom));
+  }
+}
+
+/* Copies all shadowed layers of the frame with as few dGPU submissions as
+ * possible, every such layer gets a duplicate of the completion fence.
+ * Fails if the shadow buffers couldn't be updated, they must not be scanned
+ * out then.
+ */
+auto DrmAtomicStateManager::BlitShadowBuffers(DrmKmsPlan &plan) -> int {
+  std::shared_ptr<IntelBlitter> blitter;
+  std::vector<IntelBlitter::BlitRequest> requests;
+  std::vector<LayerData *> blit_layers;
+
+  for (auto &joining : plan.plan) {
+    LayerData &layer = joining.layer;
+    if (!layer.bi->use_shadow_fds) {
+      continue;
+    }
+
+    blitter = layer.bi->blitter;
+    // TODO: handle multi-plane buffer
+    requests.push_back({.dst = layer.bi->shadow_buffer_handles[0],
+                        .src = layer.bi->prime_buffer_handles[0],
+                        .stride = layer.bi->pitches[0],
+                        .bpp = 4,
+                        .width = uint16_t(layer.bi->width),
+                        .height = uint16_t(layer.bi->height),
+                        .in_fence = layer.acquire_fence.Get()});
+    blit_layers.push_back(&layer);
+  }
+
+  if (requests.empty()) {
+    return 0;
+  }
+
+  int out_fence = -1;
+  if (!blitter->BlitBatch(requests, &out_fence)) {
+    ALOGE("failed to blit scan-out buffers\n");
+    return -EINVAL;
+  }
+
+  UniqueFd batch_fence(out_fence);
+  for (auto *layer : blit_layers) {
+    layer->blit_fence = UniqueFd::Dup(batch_fence.Get());
+  }
+  return 0;
+}
+
+DrmAtomicStateManager::DrmAtomicStateManager(DrmDisplayPipeline *pipe)
+    : pipe_(pipe),
+      ptt_(std::make_unique<PresentTrackerThread>(this).release()) {
+  char depth[PROPERTY_VALUE_MAX];
+  property_get("vendor.hwc.drm.present_queue_depth", depth, "2");
+  present_queue_depth_ = std::clamp(atoi(depth), 1, kMaxPresentQueueDepth);
+
+  if (present_queue_depth_ > 1) {
+    present_timeline_ = SyncTimeline::CreateInstance();
+    if (!present_timeline_) {
+      ALOGI("Pipelined present is disabled for pipeline %s",
+            pipe_->connector->Get()->GetName().c_str());
+      present_queue_depth_ = 1;
+    }
+  }
+
+  if (pipe_->device->GetColorAdjustmentEnabling()) {
+    color_manager_ = std::make_unique<DrmColorManager>(*pipe_->device,
+                                                       *pipe_->crtc->Get());
+  }
+
+  flip_listener_ = pipe_->device->GetEventListener();
+  if (flip_listener_ != nullptr) {
+    flip_listener_->RegisterFlipHandler(pipe_->crtc->Get()->GetId(),
+                                        [this](int64_t timestamp_ns) {
+                                          OnFlipComplete(timestamp_ns);
+                                        });
+  }
+}
+
+DrmAtomicStateManager::~DrmAtomicStateManager() {
+  if (flip_listener_ != nullptr) {
+    flip_listener_->UnregisterFlipHandler(pipe_->crtc->Get()->GetId());
+  }
+  ptt_->Stop();
+  /* Don't leave the client waiting for frames, which will never be shown */
+  if (present_timeline_) {
+    present_timeline_->SignalAll();
+  }
+}
+
+auto DrmAtomicStateManager::AcquirePset() -> DrmModeAtomicReqUnique {
+  if (pset_pool_.empty()) {
+    return MakeDrmModeAtomicReqUnique();
+  }
+
+  auto pset = std::move(pset_pool_.back());
+  pset_pool_.pop_back();
+  drmModeAtomicSetCursor(pset.get(), 0);
+  return pset;
+}
+
+void DrmAtomicStateManager::RecyclePset(DrmModeAtomicReqUnique pset) {
+  if (pset && pset_pool_.size() < kMaxPooledPsets) {
+    pset_pool_.emplace_back(std::move(pset));
+  }
+}
+
+auto DrmAtomicStateManager::AcquireFrameState() -> KmsState {
+  if (frame_state_pool_.empty()) {
+    return {};
+  }
+
+  auto state = std::move(frame_state_pool_.back());
+  frame_state_pool_.pop_back();
+  return state;
+}
+
+void DrmAtomicStateManager::RecycleFrameState(KmsState state) {
+  if (frame_state_pool_.size() >= kMaxPooledFrameStates) {
+    return;
+  }
+
+  KmsState spare{};
+  spare.used_planes = std::move(state.used_planes);
+  spare.used_planes.clear();
+  spare.used_framebuffers = std::move(state.used_framebuffers);
+  spare.used_framebuffers.clear();
+  spare.damage_blobs = std::move(state.damage_blobs);
+  spare.damage_blobs.clear();
+  frame_state_pool_.emplace_back(std::move(spare));
+}
+
+auto DrmAtomicStateManager::AcquireQueuedFrame()
+    -> std::unique_ptr<QueuedFrame> {
+  if (queued_frame_pool_.empty()) {
+    return std::make_unique<QueuedFrame>();
+  }
+
+  auto frame = std::move(queued_frame_pool_.back());
+  queued_frame_pool_.pop_back();
+  return frame;
+}
+
+void DrmAtomicStateManager::RecycleQueuedFrame(
+    std::unique_ptr<QueuedFrame> frame) {
+  /* The state of a submitted frame has been moved to staged_frame_state_,
+   * the one of a failed commit is dropped here.
+   */
+  RecyclePset(std::move(frame->pset));
+  if (queued_frame_pool_.size() < size_t(kMaxPresentQueueDepth)) {
+    *frame = {};
+    queued_frame_pool_.emplace_back(std::move(frame));
+  }
+}
+
 // NOLINTNEXTLINE (readability-function-cognitive-complexity): Fixme
-auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
+auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args,
+                                        std::unique_lock<std::mutex> &lk)
+    -> int {
   ATRACE_CALL();
+  auto timings = std::atomic_load(&frame_timings_);
 
-  if (args.active && *args.active == active_frame_state_.crtc_active_state) {
+  if (args.active && *args.active == LastFrameState().crtc_active_state) {
     /* Don't set the same state twice */
     args.active.reset();
   }
@@ -59,25 +258,74 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
     return 0;
   }
 
-  if (!active_frame_state_.crtc_active_state) {
+  if (!LastFrameState().crtc_active_state) {
     /* Force activate display */
     args.active = true;
   }
 
-  auto new_frame_state = NewFrameState();
-
   auto *drm = pipe_->device;
   auto *connector = pipe_->connector->Get();
   auto *crtc = pipe_->crtc->Get();
 
-  auto pset = MakeDrmModeAtomicReqUnique();
+  /* The vendor color adjustment sets the CTM on its own */
+  bool set_ctm = args.composition && crtc->GetCtmProperty() &&
+                 !args.color_adjustment &&
+                 (args.color_matrix != LastFrameState().ctm || args.active ||
+                  args.display_mode);
+
+  std::shared_ptr<const DrmColorManager::State> color_state;
+  if (args.color_adjustment && color_manager_ && args.composition) {
+    color_state = color_manager_->GetState();
+  }
+  bool set_color_state = color_state &&
+                         (color_state != LastFrameState().color_state ||
+                          args.active || args.display_mode);
+
+  /* Modesets, activation and color changes always go to the kernel */
+  bool cache_test = args.test_only && args.composition && !args.active &&
+                    !args.display_mode && !set_ctm && !set_color_state;
+
+  auto new_frame_state = NewFrameState();
+
+  /* Plain page flips are handed over to the commit worker when pipelining */
+  std::unique_ptr<QueuedFrame> queued_frame;
+  if (present_timeline_ && !args.test_only && !args.active &&
+      !args.display_mode) {
+    queued_frame = AcquireQueuedFrame();
+  }
+
+  auto pset = AcquirePset();
   if (!pset) {
     ALOGE("Failed to allocate property set");
     return -ENOMEM;
   }
 
+  if (args.test_only) {
+    /* Nothing shared with the commit worker is used until the state gets
+     * recycled, so validation doesn't wait for it to submit a frame.
+     */
+    lk.unlock();
+  }
+
+  if (cache_test) {
+    CalcTestCommitKey(*args.composition,
+                      drm->IsHdrSupportedDevice() &&
+                          connector->GetHdrMatedata().valid,
+                      test_commit_key_);
+    auto verdict = test_commit_cache_.Lookup(test_commit_key_,
+                                             drm->GetKmsConfigGeneration());
+    if (verdict) {
+      lk.lock();
+      RecyclePset(std::move(pset));
+      RecycleFrameState(std::move(new_frame_state));
+      return *verdict;
+    }
+  }
+
   int out_fence = -1;
-  if (!crtc->GetOutFencePtrProperty().AtomicSet(*pset, uint64_t(&out_fence))) {
+  int *out_fence_ptr = queued_frame ? &queued_frame->out_fence : &out_fence;
+  if (!crtc->GetOutFencePtrProperty().AtomicSet(*pset,
+                                                uint64_t(out_fence_ptr))) {
     return -EINVAL;
   }
 
@@ -100,12 +348,52 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
       return -EINVAL;
     }
 
-    if (!crtc->GetModeProperty().AtomicSet(*pset, *new_frame_state.mode_blob)) {
+    if (!crtc->GetModeProperty().AtomicSet(*pset,
+                                           new_frame_state.mode_blob->GetId())) {
+      return -EINVAL;
+    }
+  }
+
+  if (set_ctm) {
+    new_frame_state.ctm = args.color_matrix;
+    uint64_t ctm_blob_id = 0;
+    if (args.color_matrix) {
+      new_frame_state.ctm_blob = drm->GetPropertyBlobCache().Get(
+          args.color_matrix.get(), sizeof(drm_color_ctm));
+      if (!new_frame_state.ctm_blob) {
+        ALOGE("Failed to create CTM blob");
+        return -EINVAL;
+      }
+      ctm_blob_id = new_frame_state.ctm_blob->GetId();
+    }
+
+    if (!crtc->GetCtmProperty().AtomicSet(*pset, ctm_blob_id)) {
+      return -EINVAL;
+    }
+  }
+
+  if (set_color_state) {
+    new_frame_state.color_state = color_state;
+    if (color_manager_->AtomicSetState(*pset, *color_state) != 0) {
       return -EINVAL;
     }
   }
 
-  auto unused_planes = new_frame_state.used_planes;
+  auto &unused_planes = args.test_only ? test_unused_planes_ : unused_planes_;
+  unused_planes.clear();
+  for (auto &plane : new_frame_state.used_planes) {
+    unused_planes.emplace_back(plane->Get());
+  }
+  /* Planes with staged state to apply once the commit is submitted */
+  auto &staged_planes = args.test_only ? test_staged_planes_ : staged_planes_;
+  staged_planes.clear();
+
+  if (args.composition && !args.test_only) {
+    const ScopedFrameStage blit_stage(timings.get(), FrameStage::kBlit);
+    if (BlitShadowBuffers(*args.composition) != 0) {
+      return -EINVAL;
+    }
+  }
 
   bool has_hdr_layer = false;
   if (args.composition) {
@@ -115,20 +403,6 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
       DrmPlane *plane = joining.plane->Get();
       LayerData &layer = joining.layer;
 
-      if (!args.test_only && layer.bi->use_shadow_fds) {
-        int out_handle;
-	// TODO: handle multi-plane buffer
-        bool success = layer.bi->blitter->Blit(layer.bi->shadow_buffer_handles[0],
-                         layer.bi->prime_buffer_handles[0],
-                         layer.bi->pitches[0], 4,
-                         layer.bi->width, layer.bi->height,
-                         layer.acquire_fence.Get(), &out_handle);
-        if (!success) {
-          ALOGE("failed to blit scan-out buffer\n");
-        }
-        layer.blit_fence = android::UniqueFd(out_handle);
-      }
-
       if (layer.bi->color_space >= BufferColorSpace::kItuRec2020) {
         has_hdr_layer = true;
       }
@@ -138,12 +412,24 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
 
       /* Remove from 'unused' list, since plane is re-used */
       auto &v = unused_planes;
-      v.erase(std::remove(v.begin(), v.end(), joining.plane), v.end());
+      v.erase(std::remove(v.begin(), v.end(), plane), v.end());
+
+      if (args.active || args.display_mode) {
+        plane->InvalidateCommittedState();
+      }
 
-      if (plane->AtomicSetState(*pset, layer, joining.z_pos, crtc->GetId()) !=
-          0) {
+      if (plane->AtomicSetState(*pset, layer, joining.z_pos, crtc->GetId(),
+                                args.test_only) != 0) {
         return -EINVAL;
       }
+      staged_planes.emplace_back(plane);
+
+      if (!args.test_only) {
+        auto damage_blob = plane->AtomicSetDamage(*pset, layer);
+        if (damage_blob) {
+          new_frame_state.damage_blobs.emplace_back(std::move(damage_blob));
+        }
+      }
     }
   }
 
@@ -151,13 +437,14 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
     hdr_md& hdr_metadata =  connector->GetHdrMatedata();
     if (has_hdr_layer && hdr_metadata.valid) {
       struct hdr_output_metadata final_hdr_metadata;
-      uint32_t id;
+      /* Cached by content, so the padding must be deterministic too */
+      memset(&final_hdr_metadata, 0, sizeof(final_hdr_metadata));
       connector->PrepareHdrMetadata(&hdr_metadata, &final_hdr_metadata);
-      drmModeCreatePropertyBlob(drm->GetFd(), (void *)&final_hdr_metadata,
-                                sizeof(final_hdr_metadata), &id);
-      int ret = drmModeAtomicAddProperty(pset.get(), connector->GetId(),
-                               connector->GetHdrOpMetadataProp().id(), id) < 0;
-      if (ret)
+      new_frame_state.hdr_metadata_blob = drm->GetPropertyBlobCache().Get(
+          &final_hdr_metadata, sizeof(final_hdr_metadata));
+      if (!new_frame_state.hdr_metadata_blob ||
+          !connector->GetHdrOpMetadataProp().AtomicSet(
+              *pset, new_frame_state.hdr_metadata_blob->GetId()))
         ALOGE("Failed to add hdr property to plane");
 
       hdr_mdata_set_ = true;
@@ -181,24 +468,60 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
   }
 
   if (args.composition) {
-    for (auto &plane : unused_planes) {
-      if (plane->Get()->AtomicDisablePlane(*pset) != 0) {
+    for (auto *plane : unused_planes) {
+      if (plane->AtomicDisablePlane(*pset, args.test_only) != 0) {
         return -EINVAL;
       }
+      staged_planes.emplace_back(plane);
     }
   }
 
   uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
 
   if (args.test_only) {
-    return drmModeAtomicCommit(drm->GetFd(), pset.get(),
-                               flags | DRM_MODE_ATOMIC_TEST_ONLY, drm);
+    int ret = 0;
+    {
+      const ScopedFrameStage test_stage(timings.get(),
+                                        FrameStage::kTestCommit);
+      ret = drmModeAtomicCommit(drm->GetFd(), pset.get(),
+                                flags | DRM_MODE_ATOMIC_TEST_ONLY, drm);
+    }
+    /* Don't remember transient failures like -EBUSY or -ENOMEM */
+    if (cache_test && (ret == 0 || ret == -EINVAL || ret == -ERANGE)) {
+      test_commit_cache_.Store(test_commit_key_, ret);
+    }
+    lk.lock();
+    RecyclePset(std::move(pset));
+    RecycleFrameState(std::move(new_frame_state));
+    return ret;
   }
 
+  if (queued_frame) {
+    queued_frame->pset = std::move(pset);
+    queued_frame->frame_state = std::move(new_frame_state);
+    queued_frame->composition = args.composition;
+    queued_frame->color_adjustment = args.color_adjustment;
+    int ret = QueueFrame(std::move(queued_frame), args, lk);
+    if (ret == 0) {
+      /* Later frames are relative to this one, even before it's submitted.
+       * SubmitQueuedFrame() invalidates the planes if the commit fails.
+       */
+      for (auto *plane : staged_planes) {
+        plane->ApplyStagedState();
+      }
+    }
+    return ret;
+  }
+
+  /* Modesets must not overtake the frames still queued for the worker */
+  WaitForPresentQueueIdle(lk);
+
   if (last_present_fence_) {
     ATRACE_NAME("WaitPriorFramePresented");
 
     constexpr int kTimeoutMs = 500;
+    const ScopedFrameStage wait_stage(timings.get(),
+                                      FrameStage::kPriorFenceWait);
     int err = sync_wait(last_present_fence_.Get(), kTimeoutMs);
     if (err != 0) {
       ALOGE("sync_wait(fd=%i) returned: %i (errno: %i)",
@@ -212,25 +535,38 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
     flags |= DRM_MODE_ATOMIC_NONBLOCK;
   }
 
-  if (args.color_adjustment == true) {
-    SetColorSaturationHue();
-    SetColorBrightnessContrast();
+  if (ShouldRequestFlipEvent(args)) {
+    flags |= DRM_MODE_PAGE_FLIP_EVENT;
+    last_submit_ns_ = ResourceManager::GetTimeMonotonicNs();
+    last_present_start_ns_ = present_start_ns_;
   }
 
-  int err = drmModeAtomicCommit(drm->GetFd(), pset.get(), flags, drm);
+  int err = 0;
+  {
+    const ScopedFrameStage commit_stage(timings.get(),
+                                        FrameStage::kCommit);
+    err = drmModeAtomicCommit(drm->GetFd(), pset.get(), flags, drm);
+  }
 
   if (err != 0) {
     ALOGE("Failed to commit pset ret=%d\n", err);
+    last_submit_ns_ = -1;
     return err;
   }
 
+  for (auto *plane : staged_planes) {
+    plane->ApplyStagedState();
+  }
+  RecyclePset(std::move(pset));
+
   if (nonblock) {
     last_present_fence_ = UniqueFd::Dup(out_fence);
     staged_frame_state_ = std::move(new_frame_state);
     frames_staged_++;
     ptt_->Notify();
   } else {
-    active_frame_state_ = std::move(new_frame_state);
+    RecycleFrameState(std::exchange(active_frame_state_,
+                                    std::move(new_frame_state)));
   }
 
   if (args.display_mode) {
@@ -239,14 +575,17 @@ auto DrmAtomicStateManager::CommitFrame(AtomicCommitArgs &args) -> int {
     connector->SetActiveMode(*args.display_mode);
   }
 
+  if (args.display_mode || args.active) {
+    drm->BumpKmsConfigGeneration();
+  }
+
   args.out_fence = UniqueFd(out_fence);
 
   return 0;
 }
 
 PresentTrackerThread::PresentTrackerThread(DrmAtomicStateManager *st_man)
-    : st_man_(st_man),
-      mutex_(&st_man_->pipe_->device->GetResMan().GetMainLock()) {
+    : st_man_(st_man) {
   pt_ = std::thread(&PresentTrackerThread::PresentTrackerThreadFn, this);
 }
 
@@ -264,9 +603,9 @@ void PresentTrackerThread::PresentTrackerThreadFn() {
     UniqueFd present_fence;
 
     {
-      std::unique_lock lk(*mutex_);
+      std::unique_lock lk(mutex_);
       cv_.wait(lk, [&] {
-        return st_man_ == nullptr ||
+        return st_man_ == nullptr || !st_man_->present_queue_.empty() ||
                st_man_->frames_staged_ > tracking_at_the_moment;
       });
 
@@ -274,6 +613,16 @@ void PresentTrackerThread::PresentTrackerThreadFn() {
         break;
       }
 
+      if (!st_man_->present_queue_.empty()) {
+        SubmitQueuedFrame(lk);
+        if (st_man_ == nullptr) {
+          break;
+        }
+        /* Resources of the submitted frame are already cleaned-up */
+        tracking_at_the_moment = st_man_->frames_staged_;
+        continue;
+      }
+
       tracking_at_the_moment = st_man_->frames_staged_;
 
       present_fence = UniqueFd::Dup(st_man_->last_present_fence_.Get());
@@ -293,7 +642,7 @@ void PresentTrackerThread::PresentTrackerThreadFn() {
     }
 
     {
-      std::unique_lock lk(*mutex_);
+      std::unique_lock lk(mutex_);
       if (st_man_ == nullptr) {
         break;
       }
@@ -306,390 +655,354 @@ void PresentTrackerThread::PresentTrackerThreadFn() {
   }
 }
 
-void DrmAtomicStateManager::CleanupPriorFrameResources() {
-  assert(frames_staged_ - frames_tracked_ == 1);
-  assert(last_present_fence_);
-
-  ATRACE_NAME("CleanupPriorFrameResources");
-  frames_tracked_++;
-  active_frame_state_ = std::move(staged_frame_state_);
-  last_present_fence_ = {};
-}
-
-auto DrmAtomicStateManager::ExecuteAtomicCommit(AtomicCommitArgs &args) -> int {
-  int err = CommitFrame(args);
-
-  if (!args.test_only) {
+/* Called and returns with lk held, drops it while waiting for the kernel */
+void PresentTrackerThread::SubmitQueuedFrame(std::unique_lock<std::mutex> &lk) {
+  constexpr int kTimeoutMs = 500;
+
+  auto frame = std::move(st_man_->present_queue_.front());
+  st_man_->present_queue_.pop_front();
+  auto timeline = st_man_->present_timeline_;
+  auto *drm = st_man_->pipe_->device;
+  auto prior_fence = UniqueFd::Dup(st_man_->last_present_fence_.Get());
+  bool flip_event = st_man_->flip_listener_ != nullptr;
+  auto timings = std::atomic_load(&st_man_->frame_timings_);
+  lk.unlock();
+
+  /* The kernel accepts a single nonblocking flip per CRTC at a time */
+  if (prior_fence) {
+    ATRACE_NAME("WaitPriorFramePresented");
+    const ScopedFrameStage wait_stage(timings.get(),
+                                      FrameStage::kPriorFenceWait);
+    int err = sync_wait(prior_fence.Get(), kTimeoutMs);
     if (err != 0) {
-      ALOGE("Composite failed for pipeline %s",
-            pipe_->connector->Get()->GetName().c_str());
-      // Disable the hw used by the last active composition. This allows us to
-      // signal the release fences from that composition to avoid hanging.
-      AtomicCommitArgs cl_args{};
-      cl_args.composition = std::make_shared<DrmKmsPlan>();
-      if (CommitFrame(cl_args) != 0) {
-        ALOGE("Failed to clean-up active composition for pipeline %s",
-              pipe_->connector->Get()->GetName().c_str());
-      }
-      return err;
+      ALOGE("sync_wait(fd=%i) returned: %i (errno: %i)", prior_fence.Get(),
+            err, errno);
     }
   }
 
-  return err;
-}  // namespace android
+  lk.lock();
+  if (st_man_ == nullptr) {
+    timeline->SignalUpTo(frame->timeline_point);
+    return;
+  }
+  if (st_man_->frames_staged_ > st_man_->frames_tracked_) {
+    st_man_->CleanupPriorFrameResources();
+  }
 
-auto DrmAtomicStateManager::ActivateDisplayUsingDPMS() -> int {
-  return drmModeConnectorSetProperty(pipe_->device->GetFd(),
-                                     pipe_->connector->Get()->GetId(),
-                                     pipe_->connector->Get()
-                                         ->GetDpmsProperty()
-                                         .id(),
-                                     DRM_MODE_DPMS_ON);
-}
+  int64_t submit_ns = ResourceManager::GetTimeMonotonicNs();
+  uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_NONBLOCK;
+  if (flip_event) {
+    /* Queued frames are plain flips of an active CRTC */
+    flags |= DRM_MODE_PAGE_FLIP_EVENT;
+    st_man_->last_submit_ns_ = submit_ns;
+    st_man_->last_present_start_ns_ = frame->present_start_ns;
+  }
+  lk.unlock();
 
-void DrmAtomicStateManager::MatrixMult3x3(const double matrix_1[3][3], const double matrix_2[3][3], double result[3][3])
-{
-  for (int y = 0; y < 3; y++) {
-    for (int x = 0; x < 3; x++) {
-      result[y][x] = matrix_1[y][0] * matrix_2[0][x] + matrix_1[y][1] * matrix_2[1][x] + matrix_1[y][2] * matrix_2[2][x];
+  int err = -EINVAL;
+  if (frame->pset) {
+    ATRACE_NAME("SubmitQueuedFrame");
+    const ScopedFrameStage commit_stage(timings.get(), FrameStage::kCommit);
+    err = drmModeAtomicCommit(drm->GetFd(), frame->pset.get(), flags, drm);
+  }
+  /* The kernel holds its own reference to the in-fences now */
+  frame->composition.reset();
+  auto out_fence = UniqueFd(err == 0 ? frame->out_fence : -1);
+
+  lk.lock();
+  if (st_man_ == nullptr) {
+    timeline->SignalUpTo(frame->timeline_point);
+    return;
+  }
+  st_man_->queue_to_submit_hist_.Record(submit_ns - frame->queued_ns);
+  if (err != 0) {
+    ALOGE("Failed to commit queued pset ret=%d", err);
+    st_man_->last_submit_ns_ = -1;
+    st_man_->queued_commit_failures_++;
+    st_man_->RebuildPresentQueue(*frame);
+  } else {
+    st_man_->last_present_fence_ = UniqueFd::Dup(out_fence.Get());
+    st_man_->staged_frame_state_ = std::move(frame->frame_state);
+    st_man_->frames_staged_++;
+  }
+  lk.unlock();
+
+  if (out_fence) {
+    ATRACE_NAME("AsyncWaitForBuffersSwap");
+    int ret = sync_wait(out_fence.Get(), kTimeoutMs);
+    if (ret != 0) {
+      ALOGE("sync_wait(fd=%i) returned: %i (errno: %i)", out_fence.Get(), ret,
+            errno);
     }
   }
-}
+  /* The frame is on screen (or dropped), release the client */
+  timeline->SignalUpTo(frame->timeline_point);
 
-void DrmAtomicStateManager::GenerateHueSaturationMatrix(double hue, double saturation, double coeff[3][3])
-{
-  const double pi                            = 3.1415926535897932;
-  double hue_shift                           = hue * pi / 180.0;
-  double c                                   = cos(hue_shift);
-  double s                                   = sin(hue_shift);
-  double hue_rotation_matrix[3][3]           = { { 1.0, 0.0, 0.0 }, { 0.0, c, -s }, { 0.0, s, c } };
-  double saturation_enhancement_matrix[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, saturation, 0.0 }, { 0.0, 0.0, saturation } };
-  double ycbcr2rgb709[3][3]                  = { { 1.0000, 0.0000, 1.5748 }, { 1.0000, -0.1873, -0.4681 }, { 1.0000, 1.8556, 0.0000 } };
-  double rgb2ycbcr709[3][3]                  = { { 0.2126, 0.7152, 0.0722 }, { -0.1146, -0.3854, 0.5000 }, { 0.5000, -0.4542, -0.0458 } };
-  double result_1[3][3];
-  double result_2[3][3];
-
-  // Use Bt.709 coefficients for RGB to YCbCr conversion
-  MatrixMult3x3(ycbcr2rgb709, saturation_enhancement_matrix, result_1);
-  MatrixMult3x3(result_1, hue_rotation_matrix, result_2);
-  MatrixMult3x3(result_2, rgb2ycbcr709, coeff);
+  lk.lock();
+  if (st_man_ == nullptr) {
+    return;
+  }
+  if (!flip_event) {
+    st_man_->submit_to_flip_hist_.Record(
+        ResourceManager::GetTimeMonotonicNs() - submit_ns);
+  }
+  if (err == 0 && st_man_->frames_staged_ > st_man_->frames_tracked_) {
+    st_man_->CleanupPriorFrameResources();
+  }
+  st_man_->RecycleQueuedFrame(std::move(frame));
+  st_man_->frames_pending_--;
+  st_man_->present_queue_cv_.notify_all();
 }
 
-auto DrmAtomicStateManager::SetColorTransformMatrix(
-  double *color_transform_matrix,
-  int32_t color_transform_hint) ->int {
-  FILE *file_saturation = NULL;
-  FILE *file_hue = NULL;
-  int read_bytes;
-  char buf[4096] = {};
-  double hue = 0.0;
-  double saturation = 100;
-  double coeff[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
-
-  struct drm_color_ctm *ctm =
-    (struct drm_color_ctm *)malloc(sizeof(struct drm_color_ctm));
-  if (!ctm) {
-    ALOGE("Cannot allocate ctm memory");
+auto DrmAtomicStateManager::QueueFrame(std::unique_ptr<QueuedFrame> frame,
+                                       AtomicCommitArgs &args,
+                                       std::unique_lock<std::mutex> &lk)
+    -> int {
+  if (frames_pending_ >= present_queue_depth_) {
+    ATRACE_NAME("WaitPresentQueueSlot");
+    present_queue_cv_.wait(lk, [this] {
+      return frames_pending_ < present_queue_depth_;
+    });
+  }
+
+  uint32_t point = 0;
+  auto present_fence = present_timeline_->CreateNextFence(&point);
+  if (!present_fence) {
     return -ENOMEM;
   }
 
-  file_saturation = fopen("/data/vendor/color/saturation", "r+");
-  if (file_saturation != NULL) {
-    read_bytes = fread(buf, 1, 8, file_saturation);
-    if (read_bytes <= 0) {
-      ALOGE("COLOR_ fread saturation error");
-      free(ctm);
-      fclose(file_saturation);
-      return -EINVAL;
+  frame->timeline_point = point;
+  frame->queued_ns = ResourceManager::GetTimeMonotonicNs();
+  frame->present_start_ns = present_start_ns_;
+  present_queue_.emplace_back(std::move(frame));
+  frames_pending_++;
+  ptt_->Notify();
+
+  args.out_fence = std::move(present_fence);
+  return 0;
+}
+
+void DrmAtomicStateManager::RebuildPresentQueue(const QueuedFrame &failed) {
+  ATRACE_CALL();
+  /* The planes don't have the state the queued frames are based on. This
+   * includes the ones disabled by the failed frame, which are still on.
+   */
+  auto invalidate_planes = [](const KmsState &state) {
+    for (const auto &plane : state.used_planes) {
+      plane->Get()->InvalidateCommittedState();
     }
-    saturation = atof(buf);
-    fclose(file_saturation);
+  };
+  invalidate_planes(KernelFrameState());
+  invalidate_planes(failed.frame_state);
+  for (auto &queued : present_queue_) {
+    invalidate_planes(queued->frame_state);
   }
 
-  file_hue = fopen("/data/vendor/color/hue", "r+");
-  if (file_hue != NULL) {
-    read_bytes = fread(buf, 1, 8, file_hue);
-    if (read_bytes <= 0) {
-      ALOGE("COLOR_ fread hue error");
-      free(ctm);
-      fclose(file_hue);
-      return -EINVAL;
+  const KmsState *prev_state = &KernelFrameState();
+  for (auto &queued : present_queue_) {
+    if (RebuildQueuedFrame(*queued, *prev_state) != 0) {
+      /* Left without pset, which fails its submission and gets the next
+       * frames rebuilt once again.
+       */
+      ALOGE("Failed to rebuild queued frame");
+      return;
     }
-    hue = atof(buf);
-    fclose(file_hue);
+    prev_state = &queued->frame_state;
   }
+}
 
-  if (hue < 0.0 || hue > 359.0) {
-    hue = 0.0;
+/* Called with the mutex held. The shadow buffers of the frame are already
+ * blitted, its damage is dropped as the plane content is not known.
+ */
+auto DrmAtomicStateManager::RebuildQueuedFrame(QueuedFrame &frame,
+                                               const KmsState &prev_state)
+    -> int {
+  auto pset = frame.pset ? std::move(frame.pset) : AcquirePset();
+  if (!pset) {
+    return -ENOMEM;
   }
-
-  saturation = saturation/100;
-  if (saturation < 0.75 || saturation > 1.25) {
-    saturation = 1.0;
+  if (!frame.composition) {
+    return -EINVAL;
   }
 
-  ALOGD("COLOR_ hue=%f", hue);
-  ALOGD("COLOR_ saturation=%f", saturation);
-
-  GenerateHueSaturationMatrix(hue, saturation, coeff);
+  auto *drm = pipe_->device;
+  auto *crtc = pipe_->crtc->Get();
+  auto &state = frame.frame_state;
+  drmModeAtomicSetCursor(pset.get(), 0);
 
-  for (int i = 0; i < 3; i++) {
-    for (int j = 0; j < 3; j++) {
-      color_transform_matrix[i * 4 + j] = coeff[j][i];
-    }
+  if (!crtc->GetOutFencePtrProperty().AtomicSet(*pset,
+                                                uint64_t(&frame.out_fence))) {
+    return -EINVAL;
   }
 
-  switch (color_transform_hint) {
-    case HAL_COLOR_TRANSFORM_IDENTITY: {
-      memset(ctm->matrix, 0, sizeof(ctm->matrix));
-      for (int i = 0; i < 3; i++) {
-        ctm->matrix[i * 3 + i] = (1ll << 32);
-      }
-
-      ApplyPendingCTM(ctm);
-      break;
-    }
-    case HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX: {
-      for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-          if (color_transform_matrix[i * 4 + j] < 0) {
-            ctm->matrix[i * 3 + j] =
-                (int64_t) (-color_transform_matrix[i * 4 + j] *
-                ((int64_t) 1L << 32));
-            ctm->matrix[i * 3 + j] |= 1ULL << 63;
-          } else {
-            ctm->matrix[i * 3 + j] =
-              (int64_t) (color_transform_matrix[i * 4 + j] *
-              ((int64_t) 1L << 32));
-          }
-        }
+  if (crtc->GetCtmProperty() && !frame.color_adjustment) {
+    uint64_t ctm_blob_id = 0;
+    if (state.ctm) {
+      state.ctm_blob = drm->GetPropertyBlobCache().Get(state.ctm.get(),
+                                                       sizeof(drm_color_ctm));
+      if (!state.ctm_blob) {
+        return -EINVAL;
       }
-
-      ApplyPendingCTM(ctm);
-      break;
+      ctm_blob_id = state.ctm_blob->GetId();
+    }
+    if (!crtc->GetCtmProperty().AtomicSet(*pset, ctm_blob_id)) {
+      return -EINVAL;
     }
   }
-  free(ctm);
-  return 0;
-}
 
-auto DrmAtomicStateManager::ApplyPendingCTM(
-  struct drm_color_ctm *ctm) -> int {
-  if (pipe_->crtc->Get()->GetCtmProperty().id() == 0) {
-    ALOGE("GetCtmProperty().id() == 0");
+  if (frame.color_adjustment && state.color_state && color_manager_ &&
+      color_manager_->AtomicSetState(*pset, *state.color_state) != 0) {
     return -EINVAL;
   }
 
-  uint32_t ctm_id = 0;
-  drmModeCreatePropertyBlob(pipe_->device->GetFd(), ctm, sizeof(drm_color_ctm), &ctm_id);
-  if (ctm_id == 0) {
-    ALOGE("COLOR_ ctm_id == 0");
+  if (state.hdr_metadata_blob &&
+      !pipe_->connector->Get()->GetHdrOpMetadataProp().AtomicSet(
+          *pset, state.hdr_metadata_blob->GetId())) {
     return -EINVAL;
   }
 
-  drmModeObjectSetProperty(pipe_->device->GetFd(), pipe_->crtc->Get()->GetId(), DRM_MODE_OBJECT_CRTC,
-                           pipe_->crtc->Get()->GetCtmProperty().id(), ctm_id);
-  drmModeDestroyPropertyBlob(pipe_->device->GetFd(), ctm_id);
+  auto &unused_planes = unused_planes_;
+  unused_planes.clear();
+  for (const auto &plane : prev_state.used_planes) {
+    unused_planes.emplace_back(plane->Get());
+  }
+  auto &staged_planes = staged_planes_;
+  staged_planes.clear();
 
-  return 0;
-}
+  for (auto &joining : frame.composition->plan) {
+    DrmPlane *plane = joining.plane->Get();
+    auto &v = unused_planes;
+    v.erase(std::remove(v.begin(), v.end(), plane), v.end());
 
-float DrmAtomicStateManager::TransformContrastBrightness(float value, float brightness,
-                                              float contrast) {
-  float result;
-  result = (value - 0.5) * contrast + 0.5 + brightness;
+    if (plane->AtomicSetState(*pset, joining.layer, joining.z_pos,
+                              crtc->GetId(), false) != 0) {
+      return -EINVAL;
+    }
+    staged_planes.emplace_back(plane);
+  }
 
-  if (result < 0.0) {
-    result = 0.0;
+  for (auto *plane : unused_planes) {
+    if (plane->AtomicDisablePlane(*pset, false) != 0) {
+      return -EINVAL;
+    }
+    staged_planes.emplace_back(plane);
   }
-  if (result > 1.0) {
-    result = 1.0;
+
+  /* The next queued frame is relative to this one again */
+  for (auto *plane : staged_planes) {
+    plane->ApplyStagedState();
   }
-  return result;
-}
 
-float DrmAtomicStateManager::TransformGamma(float value, float gamma) {
-  float result;
+  frame.pset = std::move(pset);
+  return 0;
+}
 
-  result = pow(value, gamma);
-  if (result < 0.0) {
-    result = 0.0;
-  }
-  if (result > 1.0) {
-    result = 1.0;
+void DrmAtomicStateManager::WaitForPresentQueueIdle(
+    std::unique_lock<std::mutex> &lk) {
+  if (frames_pending_ == 0) {
+    return;
   }
 
-  return result;
+  ATRACE_NAME("WaitPresentQueueIdle");
+  present_queue_cv_.wait(lk, [this] { return frames_pending_ == 0; });
 }
 
-auto DrmAtomicStateManager::SetColorCorrection(struct gamma_colors gamma,
-                                    uint32_t contrast_c,
-                                    uint32_t brightness_c) ->int{
-  struct drm_color_lut *lut;
-  float brightness[3];
-  float contrast[3];
-  uint8_t temp[3];
-  uint64_t lut_size = 0;
-  int ret = 0;
-
-  std::tie(ret, lut_size) = pipe_->crtc->Get()->GetGammaLutSizeProperty().value();
-
-  ALOGD("COLOR_ contrast_c=0x%6x", contrast_c);
-  ALOGD("COLOR_ brightness_c=0x%6x", brightness_c);
-
-  /* reset lut when contrast and brightness are all 0 */
-  if (contrast_c == 0 && brightness_c == 0) {
-    lut = NULL;
-    ApplyPendingLUT(lut, lut_size);
-    free(lut);
-    return 0;
+auto DrmAtomicStateManager::DumpPresentStats() const -> std::string {
+  std::stringstream ss;
+  ss << "  Present queue depth: " << present_queue_depth_;
+  if (present_queue_depth_ > 1) {
+    ss << ", failed queued commits: " << queued_commit_failures_;
   }
-
-  lut = (struct drm_color_lut *)malloc(sizeof(struct drm_color_lut) * lut_size);
-  if (!lut) {
-    ALOGE("Cannot allocate LUT memory");
-    return -ENOMEM;
+  ss << "\n    Present call: " << present_call_hist_.Dump() << "\n";
+  if (present_queue_depth_ > 1) {
+    ss << "    Queued to submitted: " << queue_to_submit_hist_.Dump() << "\n";
   }
-
-  /* Unpack brightness values for each channel */
-  temp[0] = (brightness_c >> 16) & 0xFF;
-  temp[1] = (brightness_c >> 8) & 0xFF;
-  temp[2] = (brightness_c) & 0xFF;
-
-  /* Map brightness from -128 - 127 range into -0.5 - 0.5 range */
-  brightness[0] = (float)(temp[0]) / 255 - 0.5;
-  brightness[1] = (float)(temp[1]) / 255 - 0.5;
-  brightness[2] = (float)(temp[2]) / 255 - 0.5;
-
-  /* Unpack contrast values for each channel */
-  temp[0] = (contrast_c >> 16) & 0xFF;
-  temp[1] = (contrast_c >> 8) & 0xFF;
-  temp[2] = (contrast_c) & 0xFF;
-
-  /* Map contrast from 0 - 255 range into 0.0 - 2.0 range */
-  contrast[0] = (float)(temp[0]) / 128;
-  contrast[1] = (float)(temp[1]) / 128;
-  contrast[2] = (float)(temp[2]) / 128;
-
-  for (uint64_t i = 0; i < lut_size; i++) {
-    /* Set lut[0] as 0 always as the darkest color should has brightness 0 */
-    if (i == 0) {
-      lut[i].red = 0;
-      lut[i].green = 0;
-      lut[i].blue = 0;
-      continue;
-    }
-
-    lut[i].red = 0xFFFF * TransformGamma(TransformContrastBrightness(
-                                         (float)(i) / lut_size,
-                                          brightness[0], contrast[0]),
-                                          gamma.red);
-    lut[i].green = 0xFFFF * TransformGamma(TransformContrastBrightness(
-                                            (float)(i) / lut_size,
-                                             brightness[1], contrast[1]),
-                                             gamma.green);
-    lut[i].blue = 0xFFFF * TransformGamma(TransformContrastBrightness(
-                                          (float)(i) / lut_size,
-                                           brightness[2], contrast[2]),
-                                           gamma.blue);
+  if (present_queue_depth_ > 1 || flip_listener_ != nullptr) {
+    ss << "    Submitted to shown: " << submit_to_flip_hist_.Dump() << "\n";
   }
-
-  ApplyPendingLUT(lut, lut_size);
-  free(lut);
-  return 0;
+  if (color_manager_) {
+    ss << "  " << color_manager_->Dump() << "\n";
+  }
+  return ss.str();
 }
 
-auto DrmAtomicStateManager::ApplyPendingLUT(struct drm_color_lut *lut, uint64_t lut_size) -> int {
-  uint32_t lut_blob_id = 0;
+auto DrmAtomicStateManager::ShouldRequestFlipEvent(
+    const AtomicCommitArgs &args) const -> bool {
+  /* The kernel refuses flip events for commits disabling the CRTC */
+  return flip_listener_ != nullptr && (!args.active || *args.active);
+}
 
-  if (pipe_->crtc->Get()->GetGammaLutProperty().id() == 0) {
-    ALOGE("GetGammaLutProperty().id() == 0");
-    return -EINVAL;
+/* Called from the device event listener thread */
+void DrmAtomicStateManager::OnFlipComplete(int64_t timestamp_ns) {
+  int64_t submit_ns = last_submit_ns_.exchange(-1);
+  int64_t present_start_ns = last_present_start_ns_.exchange(-1);
+  if (submit_ns < 0 || timestamp_ns < submit_ns) {
+    return;
   }
 
-  drmModeCreatePropertyBlob(
-    pipe_->device->GetFd(), lut, sizeof(struct drm_color_lut) * lut_size, &lut_blob_id);
-  if (lut_blob_id == 0) {
-    ALOGE("COLOR_ lut_blob_id == 0");
-    return -EINVAL;
+  submit_to_flip_hist_.Record(timestamp_ns - submit_ns);
 
+  auto timings = std::atomic_load(&frame_timings_);
+  if (timings) {
+    timings->RecordFlip(submit_ns, timestamp_ns);
+    if (present_start_ns >= 0) {
+      timings->Record(FrameStage::kPresentToFlip,
+                      timestamp_ns - present_start_ns);
+    }
   }
-
-  drmModeObjectSetProperty(pipe_->device->GetFd(), pipe_->crtc->Get()->GetId(), DRM_MODE_OBJECT_CRTC,
-                           pipe_->crtc->Get()->GetGammaLutProperty().id(), lut_blob_id);
-  drmModeDestroyPropertyBlob(pipe_->device->GetFd(), lut_blob_id);
-  return 0;
 }
 
-auto DrmAtomicStateManager::SetColorSaturationHue(void) ->int{
-  double color_transform_matrix[16] = {1.0, 0.0, 0.0, 0.0,
-                                       0.0, 1.0, 0.0, 0.0,
-                                       0.0, 0.0, 1.0, 0.0,
-                                       0.0, 0.0, 0.0, 1.0};
+void DrmAtomicStateManager::SetFrameTimings(
+    std::shared_ptr<FrameTimings> timings) {
+  std::atomic_store(&frame_timings_, std::move(timings));
+}
 
-  int32_t color_transform_hint = HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX;
+void DrmAtomicStateManager::CleanupPriorFrameResources() {
+  assert(frames_staged_ - frames_tracked_ == 1);
+  assert(last_present_fence_);
 
-  SetColorTransformMatrix(color_transform_matrix,
-                          color_transform_hint);
-  return 0;
+  ATRACE_NAME("CleanupPriorFrameResources");
+  frames_tracked_++;
+  RecycleFrameState(std::exchange(active_frame_state_,
+                                  std::move(staged_frame_state_)));
+  last_present_fence_ = {};
 }
 
-auto DrmAtomicStateManager::SetColorBrightnessContrast(void) ->int{
-  struct gamma_colors gamma;
-  int read_bytes;
-  FILE *file_brightness = NULL;
-  FILE *file_contrast   = NULL;
-  char buf[4096]        = {};
-  uint32_t contrast_c   = 0x808080;
-  uint32_t brightness_c = 0x808080;
-
-  file_brightness = fopen("/data/vendor/color/brightness", "r+");
-  if (file_brightness != NULL) {
-    read_bytes = fread(buf, 1, 8, file_brightness);
-    if (read_bytes <= 0) {
-      ALOGE("COLOR_ fread brightness error");
-      fclose(file_brightness);
-      return -EINVAL;
-    }
-    if (atoi(buf) < 0 || atoi(buf) > 255) {
-      brightness_c = 0x80;
-    } else {
-      brightness_c = atoi(buf) &0xFF;
-    }
-
-    brightness_c = ((brightness_c<< 16) |
-                    (brightness_c << 8) |
-                    (brightness_c));
-    fclose(file_brightness);
-  }
+auto DrmAtomicStateManager::ExecuteAtomicCommit(AtomicCommitArgs &args) -> int {
+  std::unique_lock<std::mutex> lk(ptt_->mutex_);
+  int64_t start_ns = ResourceManager::GetTimeMonotonicNs();
+  present_start_ns_ = start_ns;
+  int err = CommitFrame(args, lk);
 
-  file_contrast = fopen("/data/vendor/color/contrast", "r+");
-  if (file_contrast != NULL) {
-    read_bytes = fread(buf, 1, 8, file_contrast);
-    if (read_bytes <= 0) {
-      ALOGE("COLOR_ fread contrast error");
-      fclose(file_contrast);
-      return -EINVAL;
-    }
-    if (atoi(buf) < 0 || atoi(buf) > 255) {
-      contrast_c = 0x80;
-    } else {
-      contrast_c = atoi(buf) & 0xFF;
+  if (!args.test_only) {
+    present_call_hist_.Record(ResourceManager::GetTimeMonotonicNs() -
+                              start_ns);
+    if (err != 0) {
+      ALOGE("Composite failed for pipeline %s",
+            pipe_->connector->Get()->GetName().c_str());
+      // Disable the hw used by the last active composition. This allows us to
+      // signal the release fences from that composition to avoid hanging.
+      AtomicCommitArgs cl_args{};
+      cl_args.composition = std::make_shared<DrmKmsPlan>();
+      if (CommitFrame(cl_args, lk) != 0) {
+        ALOGE("Failed to clean-up active composition for pipeline %s",
+              pipe_->connector->Get()->GetName().c_str());
+      }
+      return err;
     }
-
-    contrast_c =  ((contrast_c<< 16) |
-                   (contrast_c << 8) |
-                   (contrast_c));
-    fclose(file_contrast);
   }
 
-  gamma.red   = 1;
-  gamma.green = 1;
-  gamma.blue  = 1;
-
-  SetColorCorrection(gamma, contrast_c, brightness_c);
+  return err;
+}  // namespace android
 
-  return 0;
+auto DrmAtomicStateManager::ActivateDisplayUsingDPMS() -> int {
+  pipe_->device->BumpKmsConfigGeneration();
+  return drmModeConnectorSetProperty(pipe_->device->GetFd(),
+                                     pipe_->connector->Get()->GetId(),
+                                     pipe_->connector->Get()
+                                         ->GetDpmsProperty()
+                                         .id(),
+                                     DRM_MODE_DPMS_ON);
 }
 
 void DrmAtomicStateManager::SetHDCPState(HWCContentProtection state,
@@ -19,17 +19,27 @@
 
 #include <pthread.h>
 
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <tuple>
+#include <vector>
 
 #include "compositor/DrmKmsPlan.h"
 #include "compositor/LayerData.h"
+#include "drm/DrmColorManager.h"
 #include "drm/DrmPlane.h"
+#include "drm/DrmUnique.h"
 #include "drm/ResourceManager.h"
+#include "drm/TestCommitCache.h"
 #include "drm/VSyncWorker.h"
+#include "utils/FrameTimings.h"
+#include "utils/LatencyHistogram.h"
+#include "utils/SyncTimeline.h"
 #include "utils/cta_hdr_defs.h"
 
 namespace android {
@@ -41,6 +51,8 @@ struct AtomicCommitArgs {
   std::optional<bool> active;
   std::shared_ptr<DrmKmsPlan> composition;
   bool color_adjustment = false;
+  /* Color transform to apply on the CRTC, unset means identity */
+  std::shared_ptr<drm_color_ctm> color_matrix;
 
   /* out */
   UniqueFd out_fence;
@@ -51,13 +63,12 @@ struct AtomicCommitArgs {
   }
 };
 
-struct gamma_colors {
-  float red;
-  float green;
-  float blue;
-};
-
+/* Waits for presented frames to release their resources. When present is
+ * pipelined, also submits the queued frames to the kernel (commit worker).
+ */
 class PresentTrackerThread {
+  friend class DrmAtomicStateManager;
+
  public:
   explicit PresentTrackerThread(DrmAtomicStateManager *st_man);
 
@@ -65,7 +76,10 @@ class PresentTrackerThread {
 
   void Stop() {
     /* Exit thread by signalling that object is no longer valid */
-    st_man_ = nullptr;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      st_man_ = nullptr;
+    }
     Notify();
     pt_.detach();
   }
@@ -78,43 +92,58 @@ class PresentTrackerThread {
   DrmAtomicStateManager *st_man_{};
 
   void PresentTrackerThreadFn();
+  void SubmitQueuedFrame(std::unique_lock<std::mutex> &lk);
 
   std::condition_variable cv_;
   std::thread pt_;
-  std::mutex *mutex_;
+  /* Guards the frame state of st_man_. Owned by the thread object rather than
+   * by the state manager, as the detached thread may outlive the latter.
+   */
+  std::mutex mutex_;
 };
 
 class DrmAtomicStateManager {
   friend class PresentTrackerThread;
 
  public:
-  explicit DrmAtomicStateManager(DrmDisplayPipeline *pipe)
-      : pipe_(pipe),
-        ptt_(std::make_unique<PresentTrackerThread>(this).release()){};
+  explicit DrmAtomicStateManager(DrmDisplayPipeline *pipe);
 
   DrmAtomicStateManager(const DrmAtomicStateManager &) = delete;
-  ~DrmAtomicStateManager() {
-    ptt_->Stop();
-  }
+  ~DrmAtomicStateManager();
 
   auto ExecuteAtomicCommit(AtomicCommitArgs &args) -> int;
   auto ActivateDisplayUsingDPMS() -> int;
-  auto SetColorSaturationHue(void) ->int;
-  auto SetColorBrightnessContrast(void) ->int;
-  auto SetColorTransformMatrix(
-      double *color_transform_matrix,
-      int32_t color_transform_hint) -> int;
-  auto ApplyPendingCTM(struct drm_color_ctm *ctm) -> int;
-
-  auto SetColorCorrection(struct gamma_colors gamma,
-                                    uint32_t contrast_c,
-                                    uint32_t brightness_c) ->int;
-  auto ApplyPendingLUT(struct drm_color_lut *lut,  uint64_t lut_size) -> int;
-
   void SetHDCPState(HWCContentProtection state,
                     HWCContentType content_type);
+
+  auto GetTestCommitCacheHits() const {
+    return test_commit_cache_.GetHits();
+  }
+
+  auto GetTestCommitCacheMisses() const {
+    return test_commit_cache_.GetMisses();
+  }
+
+  auto DumpPresentStats() const -> std::string;
+
+  void SetFrameTimings(std::shared_ptr<FrameTimings> timings);
+
  private:
-  auto CommitFrame(AtomicCommitArgs &args) -> int;
+  /* Called with lk held. TEST_ONLY commits release it while they build and
+   * test the property set, they may return with it released on failure.
+   */
+  auto CommitFrame(AtomicCommitArgs &args, std::unique_lock<std::mutex> &lk)
+      -> int;
+  static auto BlitShadowBuffers(DrmKmsPlan &plan) -> int;
+
+  /* TEST_ONLY verdict cache, keyed by the plane configuration */
+  static constexpr size_t kTestCommitCacheSize = 64;
+  static void CalcTestCommitKey(DrmKmsPlan &plan, bool hdr_metadata_valid,
+                                TestCommitCache::Key &key);
+
+  TestCommitCache test_commit_cache_{kTestCommitCacheSize};
+  /* Only used by TEST_ONLY commits, the callers serialize them per display */
+  TestCommitCache::Key test_commit_key_;
 
   struct KmsState {
     /* Required to cleanup unused planes */
@@ -123,7 +152,15 @@ class DrmAtomicStateManager {
      * otherwise picture will blink */
     std::vector<std::shared_ptr<DrmFbIdHandle>> used_framebuffers;
 
-    DrmModeUserPropertyBlobUnique mode_blob;
+    DrmPropertyBlobCache::BlobRef mode_blob;
+    DrmPropertyBlobCache::BlobRef hdr_metadata_blob;
+    std::vector<DrmPropertyBlobCache::BlobRef> damage_blobs;
+
+    /* CTM set on the CRTC, only updated when it changes */
+    std::shared_ptr<drm_color_ctm> ctm;
+    DrmPropertyBlobCache::BlobRef ctm_blob;
+    /* Vendor color adjustment, shared by the frames until it changes */
+    std::shared_ptr<const DrmColorManager::State> color_state;
 
     int release_fence_pt_index{};
 
@@ -132,24 +169,34 @@ class DrmAtomicStateManager {
   } active_frame_state_;
 
   auto NewFrameState() -> KmsState {
-    auto *prev_frame_state = &active_frame_state_;
-    return (KmsState){
-        .used_planes = prev_frame_state->used_planes,
-        .crtc_active_state = prev_frame_state->crtc_active_state,
-    };
+    auto *prev_frame_state = &LastFrameState();
+    auto state = AcquireFrameState();
+    state.used_planes = prev_frame_state->used_planes;
+    state.ctm = prev_frame_state->ctm;
+    state.color_state = prev_frame_state->color_state;
+    state.crtc_active_state = prev_frame_state->crtc_active_state;
+    return state;
   }
 
-  DrmDisplayPipeline *const pipe_;
+  /* Most recent state accepted by the kernel */
+  auto KernelFrameState() -> KmsState & {
+    if (frames_staged_ > frames_tracked_) {
+      return staged_frame_state_;
+    }
+    return active_frame_state_;
+  }
 
-  void CleanupPriorFrameResources();
-  int64_t FloatToFixedPoint(float value);
-  void GenerateHueSaturationMatrix(double hue, double saturation, double coeff[3][3]);
-  void MatrixMult3x3(const double matrix_1[3][3], const double matrix_2[3][3], double result[3][3]);
+  /* Most recent state handed to the kernel or queued for it */
+  auto LastFrameState() -> KmsState & {
+    if (!present_queue_.empty()) {
+      return present_queue_.back()->frame_state;
+    }
+    return KernelFrameState();
+  }
 
-  float TransformContrastBrightness(float value, float brightness,
-                                                float contrast);
-  float TransformGamma(float value, float gamma);
+  DrmDisplayPipeline *const pipe_;
 
+  void CleanupPriorFrameResources();
 
   /* Present (swap) tracking */
   PresentTrackerThread *ptt_;
@@ -157,6 +204,89 @@ class DrmAtomicStateManager {
   UniqueFd last_present_fence_;
   int frames_staged_{};
   int frames_tracked_{};
+
+  /* Pipelined present. Up to present_queue_depth_ frames may be waiting to be
+   * shown, the caller gets a sw_sync fence signalled once its frame is on
+   * screen. Depth 1 (or missing sw_sync) keeps the synchronous behaviour.
+   */
+  static constexpr int kMaxPresentQueueDepth = 3;
+
+  struct QueuedFrame {
+    /* Null if the frame could not be rebuilt after a failed commit */
+    DrmModeAtomicReqUnique pset;
+    KmsState frame_state;
+    /* Keeps the IN_FENCE_FD descriptors of the pset open until submitted */
+    std::shared_ptr<DrmKmsPlan> composition;
+    bool color_adjustment{};
+    /* Filled in by the kernel through OUT_FENCE_PTR */
+    int out_fence = -1;
+    uint32_t timeline_point{};
+    int64_t queued_ns{};
+    int64_t present_start_ns{};
+  };
+
+  auto QueueFrame(std::unique_ptr<QueuedFrame> frame, AtomicCommitArgs &args,
+                  std::unique_lock<std::mutex> &lk) -> int;
+  void WaitForPresentQueueIdle(std::unique_lock<std::mutex> &lk);
+  /* The queued frames are deltas to the failed one, rebuild them from their
+   * full state relative to what the kernel actually shows.
+   */
+  void RebuildPresentQueue(const QueuedFrame &failed);
+  auto RebuildQueuedFrame(QueuedFrame &frame, const KmsState &prev_state)
+      -> int;
+
+  int present_queue_depth_ = 1;
+  std::shared_ptr<SyncTimeline> present_timeline_;
+  std::deque<std::unique_ptr<QueuedFrame>> present_queue_;
+  /* Queued frames not shown yet, including the one owned by the worker */
+  int frames_pending_{};
+  std::condition_variable present_queue_cv_;
+  uint64_t queued_commit_failures_{};
+
+  LatencyHistogram present_call_hist_;
+  LatencyHistogram queue_to_submit_hist_;
+  LatencyHistogram submit_to_flip_hist_;
+
+  /* Kernel flip-complete timestamps, if the device event listener runs */
+  void OnFlipComplete(int64_t timestamp_ns);
+  auto ShouldRequestFlipEvent(const AtomicCommitArgs &args) const -> bool;
+
+  DrmEventListener *flip_listener_ = nullptr;
+  std::atomic_int64_t last_submit_ns_ = -1;
+  std::atomic_int64_t last_present_start_ns_ = -1;
+  /* Start of the ExecuteAtomicCommit() call being processed */
+  int64_t present_start_ns_{};
+
+  /* Accessed with std::atomic_load/store, read by the worker and listener */
+  std::shared_ptr<FrameTimings> frame_timings_;
+
+  std::unique_ptr<DrmColorManager> color_manager_;
+
+  /* Property sets are reused rather than reallocated for every frame */
+  static constexpr size_t kMaxPooledPsets = 4;
+  auto AcquirePset() -> DrmModeAtomicReqUnique;
+  void RecyclePset(DrmModeAtomicReqUnique pset);
+  std::vector<DrmModeAtomicReqUnique> pset_pool_;
+
+  /* Same for the frame states and queued frames, so that a steady stream of
+   * page flips doesn't allocate. Recycled states keep only the capacity of
+   * their vectors, the plane and framebuffer references are dropped.
+   */
+  static constexpr size_t kMaxPooledFrameStates = kMaxPresentQueueDepth + 2;
+  auto AcquireFrameState() -> KmsState;
+  void RecycleFrameState(KmsState state);
+  std::vector<KmsState> frame_state_pool_;
+  auto AcquireQueuedFrame() -> std::unique_ptr<QueuedFrame>;
+  void RecycleQueuedFrame(std::unique_ptr<QueuedFrame> frame);
+  std::vector<std::unique_ptr<QueuedFrame>> queued_frame_pool_;
+
+  /* Scratch lists of CommitFrame(), which runs with the mutex held */
+  std::vector<DrmPlane *> unused_planes_;
+  std::vector<DrmPlane *> staged_planes_;
+  /* Same for TEST_ONLY commits, which build their set without the mutex */
+  std::vector<DrmPlane *> test_unused_planes_;
+  std::vector<DrmPlane *> test_staged_planes_;
+
   bool hdr_mdata_set_ = false;
 
   hwcomposer::HWCContentProtection current_protection_support_ =
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+#define LOG_TAG "hwc-drm-color-manager"
+
+#include "DrmColorManager.h"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include "drm/DrmCrtc.h"
+#include "drm/DrmDevice.h"
+#include "drm/ResourceManager.h"
+#include "utils/log.h"
+
+namespace android {
+
+static const char *const kColorDir = "/data/vendor/color";
+static const int64_t kOneSecondNs = 1LL * 1000 * 1000 * 1000;
+
+DrmColorManager::DrmColorManager(DrmDevice &drm, DrmCrtc &crtc)
+    : drm_(drm), crtc_(crtc) {
+  inotify_fd_ = UniqueFd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+  if (!inotify_fd_) {
+    ALOGE("Failed to create inotify instance: errno=%i", errno);
+  }
+}
+
+auto DrmColorManager::GetState() -> std::shared_ptr<const State> {
+  if (!InputsChanged()) {
+    return state_;
+  }
+
+  auto inputs = ReadInputs();
+  if (!state_ || inputs != inputs_) {
+    ATRACE_NAME("RebuildColorState");
+    auto state = std::make_shared<State>();
+    state->ctm_blob = CreateCtmBlob(inputs);
+    state->lut_blob = CreateLutBlob(inputs);
+    state_ = std::move(state);
+    inputs_ = inputs;
+    rebuilds_++;
+  }
+
+  return state_;
+}
+
+auto DrmColorManager::AtomicSetState(drmModeAtomicReq &pset,
+                                     const State &state) const -> int {
+  uint64_t ctm_id = state.ctm_blob ? state.ctm_blob->GetId() : 0;
+  uint64_t lut_id = state.lut_blob ? state.lut_blob->GetId() : 0;
+  if (!crtc_.GetCtmProperty().AtomicSet(pset, ctm_id) ||
+      !crtc_.GetGammaLutProperty().AtomicSet(pset, lut_id)) {
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+auto DrmColorManager::Dump() const -> std::string {
+  std::stringstream ss;
+  ss << "Color adjustment: " << rebuilds_ << " rebuilds, inputs "
+     << (watch_ >= 0 ? "watched" : "polled once per second");
+  return ss.str();
+}
+
+auto DrmColorManager::InputsChanged() -> bool {
+  if (watch_ < 0) {
+    /* The directory may show up later, poll the files meanwhile */
+    auto now = ResourceManager::GetTimeMonotonicNs();
+    if (state_ && now - last_watch_attempt_ns_ < kOneSecondNs) {
+      return false;
+    }
+    last_watch_attempt_ns_ = now;
+
+    if (inotify_fd_) {
+      watch_ = inotify_add_watch(inotify_fd_.Get(), kColorDir,
+                                 IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                     IN_DELETE | IN_DELETE_SELF |
+                                     IN_MOVE_SELF);
+    }
+    return true;
+  }
+
+  bool changed = false;
+  alignas(inotify_event) std::array<char, 4096> buf{};
+  for (;;) {
+    ssize_t len = read(inotify_fd_.Get(), buf.data(), buf.size());
+    if (len <= 0) {
+      break;
+    }
+
+    changed = true;
+    for (ssize_t offset = 0; offset < len;) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      auto *event = reinterpret_cast<inotify_event *>(&buf[offset]);
+      if ((event->mask & IN_IGNORED) != 0) {
+        /* Directory is gone, start over */
+        watch_ = -1;
+      }
+      offset += ssize_t(sizeof(inotify_event) + event->len);
+    }
+  }
+
+  return changed;
+}
+
+auto DrmColorManager::ReadInputs() -> Inputs {
+  return {ReadColorFile("hue"), ReadColorFile("saturation"),
+          ReadColorFile("brightness"), ReadColorFile("contrast")};
+}
+
+auto DrmColorManager::ReadColorFile(const char *name)
+    -> std::optional<double> {
+  std::string path = std::string(kColorDir) + "/" + name;
+  FILE *file = fopen(path.c_str(), "re");
+  if (file == nullptr) {
+    return {};
+  }
+
+  std::array<char, 9> buf{};
+  auto read_bytes = fread(buf.data(), 1, buf.size() - 1, file);
+  fclose(file);
+  if (read_bytes == 0) {
+    ALOGE("COLOR_ fread %s error", name);
+    return {};
+  }
+
+  return atof(buf.data());
+}
+
+auto DrmColorManager::CreateCtmBlob(const Inputs &inputs)
+    -> DrmPropertyBlobCache::BlobRef {
+  double hue = inputs[0].value_or(0);
+  double saturation = inputs[1].value_or(100);
+
+  if (hue < 0.0 || hue > 359.0) {
+    hue = 0.0;
+  }
+
+  saturation = saturation / 100;
+  if (saturation < 0.75 || saturation > 1.25) {
+    saturation = 1.0;
+  }
+
+  ALOGD("COLOR_ hue=%f", hue);
+  ALOGD("COLOR_ saturation=%f", saturation);
+
+  double coeff[3][3] = {{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0}};
+  GenerateHueSaturationMatrix(hue, saturation, coeff);
+
+  /* S31.32 sign-magnitude */
+  struct drm_color_ctm ctm {};
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      double value = coeff[j][i];
+      auto magnitude = uint64_t(std::fabs(value) * double(1ULL << 32));
+      ctm.matrix[i * 3 + j] = value < 0 ? (magnitude | (1ULL << 63))
+                                        : magnitude;
+    }
+  }
+
+  auto blob = drm_.GetPropertyBlobCache().Get(&ctm, sizeof(ctm));
+  if (!blob) {
+    ALOGE("COLOR_ Failed to create CTM blob");
+  }
+  return blob;
+}
+
+auto DrmColorManager::CreateLutBlob(const Inputs &inputs)
+    -> DrmPropertyBlobCache::BlobRef {
+  uint32_t contrast_c = 0x808080;
+  uint32_t brightness_c = 0x808080;
+
+  const auto &brightness_val = inputs[2];
+  if (brightness_val) {
+    brightness_c = (*brightness_val < 0 || *brightness_val > 255)
+                       ? 0x80
+                       : (uint32_t(*brightness_val) & 0xFF);
+    brightness_c = (brightness_c << 16) | (brightness_c << 8) | brightness_c;
+  }
+
+  const auto &contrast_val = inputs[3];
+  if (contrast_val) {
+    contrast_c = (*contrast_val < 0 || *contrast_val > 255)
+                     ? 0x80
+                     : (uint32_t(*contrast_val) & 0xFF);
+    contrast_c = (contrast_c << 16) | (contrast_c << 8) | contrast_c;
+  }
+
+  ALOGD("COLOR_ contrast_c=0x%6x", contrast_c);
+  ALOGD("COLOR_ brightness_c=0x%6x", brightness_c);
+
+  /* reset lut when contrast and brightness are all 0 */
+  if (contrast_c == 0 && brightness_c == 0) {
+    return {};
+  }
+
+  auto [ret, lut_size] = crtc_.GetGammaLutSizeProperty().value();
+  if (ret != 0 || lut_size == 0) {
+    ALOGE("COLOR_ Failed to get the gamma LUT size");
+    return {};
+  }
+
+  const gamma_colors gamma = {.red = 1, .green = 1, .blue = 1};
+  float brightness[3];
+  float contrast[3];
+  for (int c = 0; c < 3; c++) {
+    int shift = 16 - c * 8;
+    /* Map brightness from -128 - 127 range into -0.5 - 0.5 range */
+    brightness[c] = float((brightness_c >> shift) & 0xFF) / 255 - 0.5F;
+    /* Map contrast from 0 - 255 range into 0.0 - 2.0 range */
+    contrast[c] = float((contrast_c >> shift) & 0xFF) / 128;
+  }
+
+  std::vector<drm_color_lut> lut(lut_size);
+  /* lut[0] stays 0, as the darkest color should have brightness 0 */
+  for (uint64_t i = 1; i < lut_size; i++) {
+    float value = float(i) / float(lut_size);
+    lut[i].red = 0xFFFF *
+                 TransformGamma(TransformContrastBrightness(value, brightness[0],
+                                                            contrast[0]),
+                                gamma.red);
+    lut[i].green = 0xFFFF *
+                   TransformGamma(TransformContrastBrightness(value,
+                                                              brightness[1],
+                                                              contrast[1]),
+                                  gamma.green);
+    lut[i].blue = 0xFFFF *
+                  TransformGamma(TransformContrastBrightness(value,
+                                                             brightness[2],
+                                                             contrast[2]),
+                                 gamma.blue);
+  }
+
+  auto blob = drm_.GetPropertyBlobCache().Get(lut.data(),
+                                              lut.size() * sizeof(lut[0]));
+  if (!blob) {
+    ALOGE("COLOR_ Failed to create LUT blob");
+  }
+  return blob;
+}
+
+void DrmColorManager::MatrixMult3x3(const double matrix_1[3][3],
+                                    const double matrix_2[3][3],
+                                    double result[3][3]) {
+  for (int y = 0; y < 3; y++) {
+    for (int x = 0; x < 3; x++) {
+      result[y][x] = matrix_1[y][0] * matrix_2[0][x] +
+                     matrix_1[y][1] * matrix_2[1][x] +
+                     matrix_1[y][2] * matrix_2[2][x];
+    }
+  }
+}
+
+void DrmColorManager::GenerateHueSaturationMatrix(double hue,
+                                                  double saturation,
+                                                  double coeff[3][3]) {
+  const double pi = 3.1415926535897932;
+  double hue_shift = hue * pi / 180.0;
+  double c = cos(hue_shift);
+  double s = sin(hue_shift);
+  // clang-format off
+  double hue_rotation_matrix[3][3]           = { { 1.0, 0.0, 0.0 }, { 0.0, c, -s }, { 0.0, s, c } };
+  double saturation_enhancement_matrix[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, saturation, 0.0 }, { 0.0, 0.0, saturation } };
+  double ycbcr2rgb709[3][3]                  = { { 1.0000, 0.0000, 1.5748 }, { 1.0000, -0.1873, -0.4681 }, { 1.0000, 1.8556, 0.0000 } };
+  double rgb2ycbcr709[3][3]                  = { { 0.2126, 0.7152, 0.0722 }, { -0.1146, -0.3854, 0.5000 }, { 0.5000, -0.4542, -0.0458 } };
+  // clang-format on
+  double result_1[3][3];
+  double result_2[3][3];
+
+  // Use Bt.709 coefficients for RGB to YCbCr conversion
+  MatrixMult3x3(ycbcr2rgb709, saturation_enhancement_matrix, result_1);
+  MatrixMult3x3(result_1, hue_rotation_matrix, result_2);
+  MatrixMult3x3(result_2, rgb2ycbcr709, coeff);
+}
+
+float DrmColorManager::TransformContrastBrightness(float value,
+                                                   float brightness,
+                                                   float contrast) {
+  float result = (value - 0.5F) * contrast + 0.5F + brightness;
+  return std::clamp(result, 0.0F, 1.0F);
+}
+
+float DrmColorManager::TransformGamma(float value, float gamma) {
+  float result = std::pow(value, gamma);
+  return std::clamp(result, 0.0F, 1.0F);
+}
+
+}  // namespace android
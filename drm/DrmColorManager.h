@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRM_COLOR_MANAGER_H_
+#define ANDROID_DRM_COLOR_MANAGER_H_
+
+#include <xf86drmMode.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "drm/DrmPropertyBlobCache.h"
+#include "utils/UniqueFd.h"
+
+namespace android {
+
+class DrmCrtc;
+class DrmDevice;
+
+/*
+ * Vendor color adjustment of a CRTC: hue and saturation go to the CTM,
+ * brightness and contrast to the gamma LUT. The values are read from
+ * /data/vendor/color, which is watched with inotify, so the blobs are only
+ * rebuilt when one of the files changes.
+ */
+class DrmColorManager {
+ public:
+  struct State {
+    DrmPropertyBlobCache::BlobRef ctm_blob;
+    /* Unset when brightness and contrast are both 0 */
+    DrmPropertyBlobCache::BlobRef lut_blob;
+  };
+
+  DrmColorManager(DrmDevice &drm, DrmCrtc &crtc);
+
+  /* Returns the current state, rebuilt if any of the inputs changed. The
+   * pointer stays the same as long as the inputs do.
+   */
+  auto GetState() -> std::shared_ptr<const State>;
+
+  auto AtomicSetState(drmModeAtomicReq &pset, const State &state) const
+      -> int;
+
+  auto Dump() const -> std::string;
+
+ private:
+  struct gamma_colors {
+    float red;
+    float green;
+    float blue;
+  };
+
+  /* Raw hue, saturation, brightness and contrast, unset if not provided.
+   * Hue and saturation may be fractional.
+   */
+  using Inputs = std::array<std::optional<double>, 4>;
+
+  auto InputsChanged() -> bool;
+  static auto ReadInputs() -> Inputs;
+  static auto ReadColorFile(const char *name) -> std::optional<double>;
+
+  auto CreateCtmBlob(const Inputs &inputs) -> DrmPropertyBlobCache::BlobRef;
+  auto CreateLutBlob(const Inputs &inputs) -> DrmPropertyBlobCache::BlobRef;
+
+  static void GenerateHueSaturationMatrix(double hue, double saturation,
+                                          double coeff[3][3]);
+  static void MatrixMult3x3(const double matrix_1[3][3],
+                            const double matrix_2[3][3], double result[3][3]);
+  static float TransformContrastBrightness(float value, float brightness,
+                                           float contrast);
+  static float TransformGamma(float value, float gamma);
+
+  DrmDevice &drm_;
+  DrmCrtc &crtc_;
+
+  UniqueFd inotify_fd_;
+  int watch_ = -1;
+  int64_t last_watch_attempt_ns_{};
+
+  Inputs inputs_;
+  std::shared_ptr<const State> state_;
+  uint64_t rebuilds_{};
+};
+
+}  // namespace android
+
+#endif  // ANDROID_DRM_COLOR_MANAGER_H_
@@ -118,6 +118,7 @@ auto DrmConnector::CreateInstance(DrmDevice &dev, uint32_t connector_id,
 }
 
 int DrmConnector::UpdateLinkStatusProperty() {
+  drm_->RefreshProperties(GetId(), DRM_MODE_OBJECT_CONNECTOR);
   int ret = GetConnectorProperty(*drm_, *this, "link-status",
                                  &link_status_property_);
   if (!ret) {
@@ -127,6 +128,7 @@ int DrmConnector::UpdateLinkStatusProperty() {
 }
 
 int DrmConnector::UpdateEdidProperty() {
+  drm_->RefreshProperties(GetId(), DRM_MODE_OBJECT_CONNECTOR);
   return GetOptionalConnectorProperty(*drm_, *this, "EDID", &edid_property_)
              ? 0
              : -EINVAL;
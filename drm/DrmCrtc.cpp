@@ -80,6 +80,9 @@ auto DrmCrtc::CreateInstance(DrmDevice &dev, uint32_t crtc_id, uint32_t index)
       ALOGE("Failed to get GAMMA_LUT_SIZE property");
       return {};
     }
+  } else {
+    /* Optional, used to apply the client color transform */
+    GetCrtcProperty(dev, *c, "CTM", &c->ctm_property_);
   }
 
   if (dev.GetName() == "virtio_gpu") {
@@ -22,8 +22,10 @@
 #include <xf86drmMode.h>
 
 #include <cinttypes>
+#include <cstdlib>
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 #include "drm/DrmAtomicStateManager.h"
 #include "drm/DrmPlane.h"
@@ -52,6 +54,10 @@ auto DrmDevice::CreateInstance(std::string const &path,
 
 DrmDevice::DrmDevice(ResourceManager *res_man) : res_man_(res_man) {
   drm_fb_importer_ = std::make_unique<DrmFbImporter>(*this);
+  property_blob_cache_ = std::make_unique<DrmPropertyBlobCache>(
+      [this](const void *data, size_t length) {
+        return RegisterUserPropertyBlob(data, length);
+      });
 }
 
 auto DrmDevice::Init(const char *path) -> int {
@@ -63,6 +69,15 @@ auto DrmDevice::Init(const char *path) -> int {
     return -ENODEV;
   }
 
+  /* The path may be a symlink (e.g. /dev/dri/by-path/...), name the node the
+   * way the kernel does.
+   */
+  char *node_path = drmGetDeviceNameFromFd2(GetFd());
+  const std::string_view node(node_path != nullptr ? node_path : path);
+  node_name_ = std::string(node.substr(node.rfind('/') + 1));
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc): allocated by libdrm
+  free(node_path);
+
   int ret = drmSetClientCap(GetFd(), DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
   if (ret != 0) {
     ALOGE("Failed to set universal plane cap %d", ret);
@@ -124,6 +139,8 @@ auto DrmDevice::Init(const char *path) -> int {
   color_adjustment_enabling_ = atoi(property) != 0 ? true : false;
   ALOGD("COLOR_ The property 'vendor.hwcomposer.color.adjustment.enabling' value is %d", color_adjustment_enabling_);
 
+  auto objects_init_start = ResourceManager::GetTimeMonotonicNs();
+
   for (int i = 0; i < res->count_crtcs; ++i) {
     // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
     auto crtc = DrmCrtc::CreateInstance(*this, res->crtcs[i], i);
@@ -179,11 +196,34 @@ auto DrmDevice::Init(const char *path) -> int {
     }
   }
 
+  {
+    const std::lock_guard<std::mutex> lock(properties_lock_);
+    auto init_us = (ResourceManager::GetTimeMonotonicNs() -
+                    objects_init_start) / 1000;
+    ALOGI("KMS objects initialized in %" PRIi64
+          " us: %zu crtcs, %zu connectors, %zu planes, %zu objects with %zu "
+          "distinct properties",
+          init_us, crtcs_.size(), connectors_.size(), planes_.size(),
+          object_properties_.size(), property_metadata_.size());
+  }
+
   IsIvshmDev_ = IsIvshmDev(GetFd());
+
+  event_listener_ = DrmEventListener::CreateInstance(*this);
+  if (!event_listener_) {
+    ALOGW("Failed to start DRM event listener, using synthetic vsync");
+  }
+
+  memset(property, 0, PROPERTY_VALUE_MAX);
+  property_get("vendor.hwcomposer.async.fb.import", property, "1");
+  if (atoi(property) != 0) {
+    fb_import_worker_ = DrmFbImportWorker::CreateInstance();
+  }
+
   return 0;
 }
 
-auto DrmDevice::RegisterUserPropertyBlob(void *data, size_t length) const
+auto DrmDevice::RegisterUserPropertyBlob(const void *data, size_t length) const
     -> DrmModeUserPropertyBlobUnique {
   struct drm_mode_create_blob create_blob {};
   create_blob.length = length;
@@ -219,30 +259,66 @@ void DrmDevice::ResetModeId() {
   mode_id_ = 0;
 }
 
-int DrmDevice::GetProperty(uint32_t obj_id, uint32_t obj_type,
-                           const char *prop_name, DrmProperty *property) const {
+auto DrmDevice::FetchPropertiesLocked(uint32_t obj_id, uint32_t obj_type) const
+    -> PropertyTable * {
   drmModeObjectPropertiesPtr props = nullptr;
 
   props = drmModeObjectGetProperties(GetFd(), obj_id, obj_type);
   if (props == nullptr) {
     ALOGE("Failed to get properties for %d/%x", obj_id, obj_type);
-    return -ENODEV;
+    return nullptr;
   }
 
-  bool found = false;
-  for (int i = 0; !found && (size_t)i < props->count_props; ++i) {
+  PropertyTable table;
+  for (int i = 0; (size_t)i < props->count_props; ++i) {
     // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-    drmModePropertyPtr p = drmModeGetProperty(GetFd(), props->props[i]);
-    if (strcmp(p->name, prop_name) == 0) {
-      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-      property->Init(obj_id, p, props->prop_values[i]);
-      found = true;
+    uint32_t prop_id = props->props[i];
+    auto &metadata = property_metadata_[prop_id];
+    if (!metadata) {
+      metadata = MakeDrmModePropertyUnique(GetFd(), prop_id);
+      if (!metadata) {
+        continue;
+      }
     }
-    drmModeFreeProperty(p);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    table[metadata->name] = {prop_id, props->prop_values[i]};
   }
 
   drmModeFreeObjectProperties(props);
-  return found ? 0 : -ENOENT;
+
+  auto &entry = object_properties_[obj_id];
+  entry = std::move(table);
+  return &entry;
+}
+
+int DrmDevice::GetProperty(uint32_t obj_id, uint32_t obj_type,
+                           const char *prop_name, DrmProperty *property) const {
+  const std::lock_guard<std::mutex> lock(properties_lock_);
+
+  PropertyTable *table = nullptr;
+  auto it = object_properties_.find(obj_id);
+  if (it != object_properties_.end()) {
+    table = &it->second;
+  } else {
+    table = FetchPropertiesLocked(obj_id, obj_type);
+    if (table == nullptr) {
+      return -ENODEV;
+    }
+  }
+
+  auto prop = table->find(prop_name);
+  if (prop == table->end()) {
+    return -ENOENT;
+  }
+
+  auto [prop_id, value] = prop->second;
+  property->Init(obj_id, property_metadata_[prop_id].get(), value);
+  return 0;
+}
+
+int DrmDevice::RefreshProperties(uint32_t obj_id, uint32_t obj_type) const {
+  const std::lock_guard<std::mutex> lock(properties_lock_);
+  return FetchPropertiesLocked(obj_id, obj_type) != nullptr ? 0 : -ENODEV;
 }
 
 auto DrmDevice::IsIvshmDev(int fd) -> bool {
@@ -17,14 +17,21 @@
 #ifndef ANDROID_DRM_H_
 #define ANDROID_DRM_H_
 
+#include <atomic>
 #include <cstdint>
 #include <map>
+#include <mutex>
+#include <string>
 #include <tuple>
+#include <unordered_map>
 
 #include "DrmConnector.h"
 #include "DrmCrtc.h"
 #include "DrmEncoder.h"
+#include "DrmEventListener.h"
+#include "DrmFbImportWorker.h"
 #include "DrmFbImporter.h"
+#include "DrmPropertyBlobCache.h"
 #include "utils/UniqueFd.h"
 #include "utils/hwcdefs.h"
 
@@ -69,11 +76,21 @@ class DrmDevice {
 
   std::string GetName() const;
 
+  /* Name of the device node, e.g. "card0", as used by the kernel uevents */
+  auto GetNodeName() const -> const std::string & {
+    return node_name_;
+  }
+
   bool IsHdrSupportedDevice();
 
-  auto RegisterUserPropertyBlob(void *data, size_t length) const
+  auto RegisterUserPropertyBlob(const void *data, size_t length) const
       -> DrmModeUserPropertyBlobUnique;
 
+  /* Prefer over RegisterUserPropertyBlob() for the per-frame blobs */
+  auto GetPropertyBlobCache() const -> DrmPropertyBlobCache & {
+    return *property_blob_cache_;
+  }
+
   auto HasAddFb2ModifiersSupport() const {
     return HasAddFb2ModifiersSupport_;
   }
@@ -82,6 +99,16 @@ class DrmDevice {
     return *drm_fb_importer_;
   }
 
+  /* May be null, if the device events can't be read */
+  auto GetEventListener() -> DrmEventListener * {
+    return event_listener_.get();
+  }
+
+  /* Null if framebuffers have to be imported synchronously */
+  auto GetFbImportWorker() -> DrmFbImportWorker * {
+    return fb_import_worker_.get();
+  }
+
   auto FindCrtcById(uint32_t id) const -> DrmCrtc * {
     for (const auto &crtc : crtcs_) {
       if (crtc->GetId() == id) {
@@ -105,17 +132,48 @@ class DrmDevice {
   void ResetModeId();
   int GetProperty(uint32_t obj_id, uint32_t obj_type, const char *prop_name,
                   DrmProperty *property) const;
+  /* Re-reads the property values of a KMS object, e.g. the EDID or
+   * link-status of a connector. Property metadata stays cached.
+   */
+  int RefreshProperties(uint32_t obj_id, uint32_t obj_type) const;
 
   static auto IsIvshmDev(int fd) -> bool;
   auto IsIvshmDev() {return IsIvshmDev_;}
 
+  /* Bumped on every modeset, power state change or hotplug of any pipeline
+   * driven by this device. Results of TEST_ONLY commits obtained under an
+   * older generation must not be trusted anymore.
+   */
+  auto GetKmsConfigGeneration() const -> uint32_t {
+    return kms_config_generation_;
+  }
+
+  void BumpKmsConfigGeneration() {
+    ++kms_config_generation_;
+  }
+
  private:
   explicit DrmDevice(ResourceManager *res_man);
   auto Init(const char *path) -> int;
 
   static auto IsKMSDev(const char *path) -> bool;
 
+  /* Name -> (property id, value) of a KMS object, built with a single scan */
+  using PropertyTable =
+      std::unordered_map<std::string, std::pair<uint32_t, uint64_t>>;
+  auto FetchPropertiesLocked(uint32_t obj_id, uint32_t obj_type) const
+      -> PropertyTable *;
+
+  /* Object ids are unique across the object types of a device */
+  mutable std::mutex properties_lock_;
+  mutable std::unordered_map<uint32_t /*obj_id*/, PropertyTable>
+      object_properties_;
+  /* Property metadata, shared by all the objects having the property */
+  mutable std::unordered_map<uint32_t /*prop_id*/, DrmModePropertyUnique>
+      property_metadata_;
+
   UniqueFd fd_;
+  std::string node_name_;
   uint32_t mode_id_ = 0;
 
   bool is_hdr_supported_ = false;
@@ -133,9 +191,13 @@ class DrmDevice {
   bool HasAddFb2ModifiersSupport_{};
 
   std::unique_ptr<DrmFbImporter> drm_fb_importer_;
+  std::unique_ptr<DrmPropertyBlobCache> property_blob_cache_;
+  std::unique_ptr<DrmEventListener> event_listener_;
+  std::unique_ptr<DrmFbImportWorker> fb_import_worker_;
 
   ResourceManager *const res_man_;
   bool IsIvshmDev_ = false;
+  std::atomic_uint32_t kms_config_generation_{};
  public:
   bool preferred_mode_limit_ = false;
   bool planes_enabling_ = false;
@@ -18,6 +18,8 @@
 
 #include "DrmDisplayPipeline.h"
 
+#include <algorithm>
+
 #include "DrmAtomicStateManager.h"
 #include "DrmConnector.h"
 #include "DrmCrtc.h"
@@ -33,7 +35,11 @@ template <class O>
 auto PipelineBindable<O>::BindPipeline(DrmDisplayPipeline *pipeline,
                                        bool return_object_if_bound)
     -> std::shared_ptr<BindingOwner<O>> {
-  auto owner_object = owner_object_.lock();
+  /* Declared before the lock: releasing the last reference runs
+   * ~BindingOwner(), which takes the same lock */
+  std::shared_ptr<BindingOwner<O>> owner_object;
+  const std::lock_guard<std::mutex> lock(bind_lock_);
+  owner_object = owner_object_.lock();
   if (owner_object) {
     if (bound_pipeline_ == pipeline && return_object_if_bound) {
       return owner_object;
@@ -48,6 +54,14 @@ auto PipelineBindable<O>::BindPipeline(DrmDisplayPipeline *pipeline,
   return owner_object;
 }
 
+static bool ReadUseOverlayProperty() {
+  char use_overlay_planes_prop[PROPERTY_VALUE_MAX];
+  property_get("vendor.hwc.drm.use_overlay_planes", use_overlay_planes_prop,
+               "1");
+  constexpr int kStrtolBase = 10;
+  return strtol(use_overlay_planes_prop, nullptr, kStrtolBase) != 0;
+}
+
 static auto TryCreatePipeline(DrmDevice &dev, DrmConnector &connector,
                               DrmEncoder &enc, DrmCrtc &crtc)
     -> std::unique_ptr<DrmDisplayPipeline> {
@@ -98,6 +112,18 @@ static auto TryCreatePipeline(DrmDevice &dev, DrmConnector &connector,
     return {};
   }
 
+  pipe->usable_planes.emplace_back(primary_planes[0]);
+
+  static bool use_overlay_planes = ReadUseOverlayProperty();
+  if (use_overlay_planes) {
+    int32_t planes_num = int32_t(dev.planes_num_) - 1;
+    for (auto *plane : overlay_planes) {
+      if (planes_num-- <= 0)
+        break;
+      pipe->usable_planes.emplace_back(plane);
+    }
+  }
+
   pipe->atomic_state_manager = std::make_unique<DrmAtomicStateManager>(
       pipe.get());
 
@@ -160,38 +186,11 @@ auto DrmDisplayPipeline::CreatePipeline(DrmConnector &connector)
   return {};
 }
 
-static bool ReadUseOverlayProperty() {
-  char use_overlay_planes_prop[PROPERTY_VALUE_MAX];
-  property_get("vendor.hwc.drm.use_overlay_planes", use_overlay_planes_prop,
-               "1");
-  constexpr int kStrtolBase = 10;
-  return strtol(use_overlay_planes_prop, nullptr, kStrtolBase) != 0;
-}
-
-auto DrmDisplayPipeline::GetUsablePlanes()
-    -> std::vector<std::shared_ptr<BindingOwner<DrmPlane>>> {
-  std::vector<std::shared_ptr<BindingOwner<DrmPlane>>> planes;
-  planes.emplace_back(primary_plane);
-
-  static bool use_overlay_planes = ReadUseOverlayProperty();
-
-  if (use_overlay_planes) {
-    int32_t planes_num = device->planes_num_ - 1;
-    for (const auto &plane : device->GetPlanes()) {
-      if (plane->IsCrtcSupported(*crtc->Get())) {
-        if (plane->GetType() == DRM_PLANE_TYPE_OVERLAY) {
-          if (planes_num-- <= 0)
-            break;
-          auto op = plane->BindPipeline(this, true);
-          if (op) {
-            planes.emplace_back(op);
-          }
-        }
-      }
-    }
-  }
-
-  return planes;
+auto DrmDisplayPipeline::CountAvailablePlanes() -> size_t {
+  return std::count_if(usable_planes.begin(), usable_planes.end(),
+                       [this](DrmPlane *plane) {
+                         return plane->IsAvailableFor(this);
+                       });
 }
 
 auto DrmDisplayPipeline::AtomicDisablePipeline() -> int {
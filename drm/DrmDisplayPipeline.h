@@ -18,6 +18,7 @@
 #define ANDROID_DRMDISPLAYPIPELINE_H_
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace android {
@@ -47,9 +48,17 @@ class PipelineBindable {
                     bool return_object_if_bound = false)
       -> std::shared_ptr<BindingOwner<O>>;
 
+  /* True if BindPipeline(pipeline, true) would succeed at the moment */
+  auto IsAvailableFor(DrmDisplayPipeline *pipeline) -> bool {
+    const std::lock_guard<std::mutex> lock(bind_lock_);
+    return owner_object_.expired() || bound_pipeline_ == pipeline;
+  }
+
  private:
   DrmDisplayPipeline *bound_pipeline_;
   std::weak_ptr<BindingOwner<O>> owner_object_;
+  /* Overlay planes are rebound by concurrently running displays */
+  std::mutex bind_lock_;
 };
 
 template <class B>
@@ -57,7 +66,11 @@ class BindingOwner {
  public:
   explicit BindingOwner(B *pb) : bindable_(pb){};
   ~BindingOwner() {
-    bindable_->bound_pipeline_ = nullptr;
+    const std::lock_guard<std::mutex> lock(bindable_->bind_lock_);
+    /* Object may have been bound again once the last reference was dropped */
+    if (bindable_->owner_object_.expired()) {
+      bindable_->bound_pipeline_ = nullptr;
+    }
   }
 
   B *Get() {
@@ -72,8 +85,17 @@ struct DrmDisplayPipeline {
   static auto CreatePipeline(DrmConnector &connector)
       -> std::unique_ptr<DrmDisplayPipeline>;
 
-  auto GetUsablePlanes()
-      -> std::vector<std::shared_ptr<BindingOwner<DrmPlane>>>;
+  /* Primary plane first, then the overlays. The list is built once with the
+   * pipeline, which is recreated on hotplug. Overlays may be bound to other
+   * pipelines, they must be checked with IsAvailableFor() and bound before
+   * being used.
+   */
+  auto GetUsablePlanes() const -> const std::vector<DrmPlane *> & {
+    return usable_planes;
+  }
+
+  /* Usable planes which aren't bound to another pipeline */
+  auto CountAvailablePlanes() -> size_t;
 
   auto AtomicDisablePipeline() -> int;
 
@@ -83,6 +105,7 @@ struct DrmDisplayPipeline {
   std::shared_ptr<BindingOwner<DrmEncoder>> encoder;
   std::shared_ptr<BindingOwner<DrmCrtc>> crtc;
   std::shared_ptr<BindingOwner<DrmPlane>> primary_plane;
+  std::vector<DrmPlane *> usable_planes;
 
   std::unique_ptr<DrmAtomicStateManager> atomic_state_manager;
 };
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-drm-event-listener"
+
+#include "DrmEventListener.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include <cerrno>
+
+#include "drm/DrmDevice.h"
+#include "utils/log.h"
+
+/* Originally defined in system/core/libsystem/include/system/graphics.h as
+ * #define HAL_PRIORITY_URGENT_DISPLAY (-8)*/
+constexpr int kHalPriorityUrgentDisplay = -8;
+
+namespace android {
+
+static const int64_t kOneSecondNs = 1LL * 1000 * 1000 * 1000;
+
+/* The vblank user data holds the CRTC id in the low and the request sequence
+ * in the high 32 bits
+ */
+constexpr int kSequenceShift = 32;
+
+/* libdrm calls the handlers synchronously from drmHandleEvent() */
+static thread_local DrmEventListener *current_listener = nullptr;
+
+DrmEventListener::DrmEventListener(DrmDevice &drm)
+    : Worker("drm-event-listener", kHalPriorityUrgentDisplay), drm_(&drm){};
+
+auto DrmEventListener::CreateInstance(DrmDevice &drm)
+    -> std::unique_ptr<DrmEventListener> {
+  auto listener = std::unique_ptr<DrmEventListener>(new DrmEventListener(drm));
+  if (listener->Init() != 0) {
+    return {};
+  }
+
+  return listener;
+}
+
+DrmEventListener::~DrmEventListener() {
+  /* Kick the thread out of epoll_wait() before joining it. The eventfd is
+   * never drained, so the thread can't block again until it exits.
+   */
+  uint64_t val = 1;
+  if (write(wake_fd_.Get(), &val, sizeof(val)) < 0) {
+    ALOGE("Failed to wake up the event listener: errno=%i", errno);
+  }
+  Exit();
+}
+
+auto DrmEventListener::Init() -> int {
+  epoll_fd_ = UniqueFd(epoll_create1(EPOLL_CLOEXEC));
+  wake_fd_ = UniqueFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  if (!epoll_fd_ || !wake_fd_) {
+    ALOGE("Failed to create the event listener fds: errno=%i", errno);
+    return -ENOMEM;
+  }
+
+  for (int fd : {drm_->GetFd(), wake_fd_.Get()}) {
+    struct epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_.Get(), EPOLL_CTL_ADD, fd, &ev) != 0) {
+      ALOGE("Failed to add fd %d to epoll: errno=%i", fd, errno);
+      return -errno;
+    }
+  }
+
+  return InitWorker();
+}
+
+auto DrmEventListener::QueueVBlank(uint32_t crtc_id, EventHandler handler)
+    -> int {
+  const std::lock_guard<std::mutex> lock(handlers_lock_);
+  auto pending = vblank_handlers_.find(crtc_id);
+  if (pending != vblank_handlers_.end()) {
+    pending->second.handler = std::move(handler);
+    return 0;
+  }
+
+  auto sequence = ++last_vblank_sequence_;
+  int ret = drmCrtcQueueSequence(drm_->GetFd(), crtc_id,
+                                 DRM_CRTC_SEQUENCE_RELATIVE, 1, nullptr,
+                                 (uint64_t(sequence) << kSequenceShift) |
+                                     crtc_id);
+  if (ret != 0) {
+    /* Expected while the CRTC is off */
+    ALOGV("Failed to queue vblank event for crtc %u: %d", crtc_id, ret);
+    return ret;
+  }
+
+  vblank_handlers_[crtc_id] = {sequence, std::move(handler)};
+  return 0;
+}
+
+void DrmEventListener::CancelVBlank(uint32_t crtc_id) {
+  const std::lock_guard<std::mutex> dispatch_lock(dispatch_lock_);
+  const std::lock_guard<std::mutex> lock(handlers_lock_);
+  vblank_handlers_.erase(crtc_id);
+}
+
+void DrmEventListener::RegisterFlipHandler(uint32_t crtc_id,
+                                           EventHandler handler) {
+  const std::lock_guard<std::mutex> lock(handlers_lock_);
+  flip_handlers_[crtc_id] = std::move(handler);
+}
+
+void DrmEventListener::UnregisterFlipHandler(uint32_t crtc_id) {
+  const std::lock_guard<std::mutex> dispatch_lock(dispatch_lock_);
+  const std::lock_guard<std::mutex> lock(handlers_lock_);
+  flip_handlers_.erase(crtc_id);
+}
+
+void DrmEventListener::DispatchVBlank(uint32_t crtc_id, uint32_t sequence,
+                                      int64_t timestamp_ns) {
+  const std::lock_guard<std::mutex> dispatch_lock(dispatch_lock_);
+  EventHandler handler;
+  {
+    const std::lock_guard<std::mutex> lock(handlers_lock_);
+    auto it = vblank_handlers_.find(crtc_id);
+    if (it == vblank_handlers_.end() || it->second.sequence != sequence) {
+      /* Cancelled, possibly re-queued since then */
+      return;
+    }
+    handler = std::move(it->second.handler);
+    vblank_handlers_.erase(it);
+  }
+
+  if (handler) {
+    handler(timestamp_ns);
+  }
+}
+
+void DrmEventListener::DispatchFlip(uint32_t crtc_id, int64_t timestamp_ns) {
+  const std::lock_guard<std::mutex> dispatch_lock(dispatch_lock_);
+  EventHandler handler;
+  {
+    const std::lock_guard<std::mutex> lock(handlers_lock_);
+    auto it = flip_handlers_.find(crtc_id);
+    if (it == flip_handlers_.end()) {
+      return;
+    }
+    handler = it->second;
+  }
+
+  if (handler) {
+    handler(timestamp_ns);
+  }
+}
+
+void DrmEventListener::SequenceHandler(int /*fd*/, uint64_t /*sequence*/,
+                                       uint64_t ns, uint64_t user_data) {
+  current_listener->DispatchVBlank(uint32_t(user_data),
+                                   uint32_t(user_data >> kSequenceShift),
+                                   int64_t(ns));
+}
+
+void DrmEventListener::FlipHandler(int /*fd*/, unsigned int /*sequence*/,
+                                   unsigned int tv_sec, unsigned int tv_usec,
+                                   unsigned int crtc_id, void * /*user_data*/) {
+  current_listener->DispatchFlip(crtc_id, int64_t(tv_sec) * kOneSecondNs +
+                                              int64_t(tv_usec) * 1000);
+}
+
+void DrmEventListener::Routine() {
+  struct epoll_event events[2]{};
+  int n = epoll_wait(epoll_fd_.Get(), events, 2, -1);
+  if (n < 0) {
+    if (errno != EINTR) {
+      ALOGE("epoll_wait failed: errno=%i", errno);
+    }
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (events[i].data.fd == wake_fd_.Get()) {
+      /* Exit request, Worker::InternalRoutine() checks it */
+      return;
+    }
+  }
+
+  current_listener = this;
+  drmEventContext ctx{};
+  ctx.version = 4;
+  ctx.sequence_handler = SequenceHandler;
+  ctx.page_flip_handler2 = FlipHandler;
+  drmHandleEvent(drm_->GetFd(), &ctx);
+}
+}  // namespace android
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRM_EVENT_LISTENER_H_
+#define ANDROID_DRM_EVENT_LISTENER_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "utils/UniqueFd.h"
+#include "utils/Worker.h"
+
+namespace android {
+
+class DrmDevice;
+
+/*
+ * Single thread per DRM device, which reads the events of the DRM file and
+ * dispatches them to the per-CRTC subscribers. Timestamps are the kernel ones
+ * in CLOCK_MONOTONIC nanoseconds.
+ */
+class DrmEventListener : public Worker {
+ public:
+  using EventHandler = std::function<void(int64_t /*timestamp_ns*/)>;
+
+  static auto CreateInstance(DrmDevice &drm)
+      -> std::unique_ptr<DrmEventListener>;
+
+  ~DrmEventListener() override;
+  DrmEventListener(const DrmEventListener &) = delete;
+  DrmEventListener(DrmEventListener &&) = delete;
+  auto operator=(const DrmEventListener &) = delete;
+  auto operator=(DrmEventListener &&) = delete;
+
+  /* Arms a single event for the next vblank of the CRTC. The handler is
+   * called from the listener thread and may re-arm itself from there.
+   */
+  auto QueueVBlank(uint32_t crtc_id, EventHandler handler) -> int;
+  /* Once returned, the vblank handler of the CRTC is no longer running and
+   * will not be called again. The kernel event may still be in flight, it is
+   * dropped once it arrives. Must not be called from the handler itself.
+   */
+  void CancelVBlank(uint32_t crtc_id);
+
+  /* Called for every commit of the CRTC flagged DRM_MODE_PAGE_FLIP_EVENT */
+  void RegisterFlipHandler(uint32_t crtc_id, EventHandler handler);
+  void UnregisterFlipHandler(uint32_t crtc_id);
+
+ protected:
+  void Routine() override;
+
+ private:
+  explicit DrmEventListener(DrmDevice &drm);
+  auto Init() -> int;
+
+  static void SequenceHandler(int fd, uint64_t sequence, uint64_t ns,
+                              uint64_t user_data);
+  static void FlipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                          unsigned int tv_usec, unsigned int crtc_id,
+                          void *user_data);
+
+  void DispatchVBlank(uint32_t crtc_id, uint32_t sequence,
+                      int64_t timestamp_ns);
+  void DispatchFlip(uint32_t crtc_id, int64_t timestamp_ns);
+
+  DrmDevice *const drm_;
+  UniqueFd epoll_fd_;
+  UniqueFd wake_fd_;
+
+  std::mutex handlers_lock_;
+  /* Held while a handler runs, lets Cancel/Unregister wait for it */
+  std::mutex dispatch_lock_;
+  /* Every queued kernel event carries its own sequence number, so that the
+   * event of a cancelled request can't trigger the next request of the CRTC.
+   */
+  struct PendingVBlank {
+    uint32_t sequence;
+    EventHandler handler;
+  };
+  std::map<uint32_t, PendingVBlank> vblank_handlers_;
+  uint32_t last_vblank_sequence_ = 0;
+  std::map<uint32_t, EventHandler> flip_handlers_;
+};
+}  // namespace android
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+#define LOG_TAG "hwc-drm-fb-import-worker"
+
+#include "DrmFbImportWorker.h"
+
+#include <utils/Trace.h>
+
+#include <cerrno>
+
+#include "utils/log.h"
+
+/* Originally defined in system/core/libsystem/include/system/graphics.h as
+ * #define HAL_PRIORITY_URGENT_DISPLAY (-8)*/
+constexpr int kHalPriorityUrgentDisplay = -8;
+
+namespace android {
+
+DrmFbImportWorker::DrmFbImportWorker()
+    : Worker("drm-fb-import", kHalPriorityUrgentDisplay){};
+
+auto DrmFbImportWorker::CreateInstance() -> std::unique_ptr<DrmFbImportWorker> {
+  auto worker = std::unique_ptr<DrmFbImportWorker>(new DrmFbImportWorker());
+  if (worker->InitWorker() != 0) {
+    ALOGE("Failed to start the framebuffer import worker");
+    return {};
+  }
+
+  return worker;
+}
+
+DrmFbImportWorker::~DrmFbImportWorker() {
+  Exit();
+
+  /* Whoever queued them may be waiting for the results */
+  for (auto &task : tasks_) {
+    task();
+  }
+}
+
+void DrmFbImportWorker::Queue(Task task) {
+  Lock();
+  tasks_.emplace_back(std::move(task));
+  Unlock();
+  Signal();
+}
+
+void DrmFbImportWorker::Routine() {
+  Lock();
+  if (tasks_.empty() && WaitForSignalOrExitLocked() == -EINTR) {
+    Unlock();
+    return;
+  }
+
+  if (tasks_.empty()) {
+    Unlock();
+    return;
+  }
+
+  auto task = std::move(tasks_.front());
+  tasks_.pop_front();
+  Unlock();
+
+  ATRACE_NAME("AsyncFbImport");
+  task();
+}
+
+}  // namespace android
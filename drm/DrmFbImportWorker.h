@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRM_FB_IMPORT_WORKER_H_
+#define ANDROID_DRM_FB_IMPORT_WORKER_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "utils/Worker.h"
+
+namespace android {
+
+/*
+ * Single thread per DRM device, which imports the framebuffers of newly
+ * seen layer buffers ahead of validation. Tasks are run in order, the
+ * remaining ones are run by the destructor.
+ */
+class DrmFbImportWorker : public Worker {
+ public:
+  using Task = std::function<void()>;
+
+  static auto CreateInstance() -> std::unique_ptr<DrmFbImportWorker>;
+
+  ~DrmFbImportWorker() override;
+  DrmFbImportWorker(const DrmFbImportWorker &) = delete;
+  DrmFbImportWorker(DrmFbImportWorker &&) = delete;
+  auto operator=(const DrmFbImportWorker &) = delete;
+  auto operator=(DrmFbImportWorker &&) = delete;
+
+  void Queue(Task task);
+
+ protected:
+  void Routine() override;
+
+ private:
+  DrmFbImportWorker();
+
+  std::deque<Task> tasks_;
+};
+
+}  // namespace android
+
+#endif  // ANDROID_DRM_FB_IMPORT_WORKER_H_
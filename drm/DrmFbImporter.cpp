@@ -22,13 +22,17 @@
 #include "DrmFbImporter.h"
 
 #include <hardware/gralloc.h>
+#include <sys/stat.h>
 #include <utils/Trace.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <algorithm>
 #include <cinttypes>
+#include <sstream>
 #include <system_error>
 
+#include "drm/ResourceManager.h"
 #include "utils/log.h"
 #include "utils/properties.h"
 
@@ -50,6 +54,7 @@ auto DrmFbIdHandle::CreateInstance(BufferInfo *bo, GemHandle first_gem_handle,
   local->use_shadow_buffers_ = bo->use_shadow_fds;
   if (local->use_shadow_buffers_) {
     local->blitter_ = bo->blitter;
+    local->blit_src_handle_ = bo->prime_buffer_handles[0];
     local->shadow_fds_[0] = bo->shadow_fds[0];
     local->shadow_handles_[0] = bo->shadow_buffer_handles[0];
   }
@@ -165,26 +170,71 @@ DrmFbIdHandle::~DrmFbIdHandle() {
       ALOGE("Failed to close gem handle %d, errno: %d", gem_handles_[i], errno);
     }
     if (use_shadow_buffers_) {
-      gem_close.handle = shadow_handles_[i];
-      err = drmIoctl(blitter_->GetFd(), DRM_IOCTL_GEM_CLOSE, &gem_close);
-      if (err != 0) {
-        ALOGE("Failed to close shadow handle %d, errno: %d", gem_handles_[i], errno);
-      }
+      blitter_->ReleaseBuffer(shadow_handles_[i]);
       close(shadow_fds_[i]);
     }
   }
 
   if (use_shadow_buffers_) {
+    blitter_->ReleaseBuffer(blit_src_handle_);
     ATRACE_INT("Destroy shadow buffer count", ++destroy_count);
   }
 }
 
+auto DrmFbImporter::EstimateSize(const BufferInfo &bo) -> uint64_t {
+  uint64_t size = 0;
+  for (size_t i = 0; i < kBufferMaxPlanes; i++) {
+    size += uint64_t(bo.pitches[i]) * bo.height;
+  }
+  return size;
+}
+
+void DrmFbImporter::RemoveExpiredEntries() {
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    if (it->second.fb.expired()) {
+      it = cache_.erase(it);
+      expired_++;
+    } else {
+      ++it;
+    }
+  }
+
+  for (auto it = inode_cache_.begin(); it != inode_cache_.end();) {
+    if (it->second.expired()) {
+      it = inode_cache_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 auto DrmFbImporter::GetOrCreateFbId(BufferInfo *bo, bool is_pixel_blend_mode_supported)
     -> std::shared_ptr<DrmFbIdHandle> {
-  /* Lookup DrmFbIdHandle in cache first. First handle serves as a cache key. */
-  GemHandle first_handle = 0;
   int *fds = bo->use_shadow_fds ? bo->shadow_fds : bo->prime_fds;
 
+  std::optional<ino_t> inode;
+  struct stat sb {};
+  if (fstat(fds[0], &sb) == 0) {
+    inode = sb.st_ino;
+  }
+
+  const std::lock_guard<std::mutex> lock(cache_lock_);
+
+  if (inode) {
+    auto it = inode_cache_.find(*inode);
+    if (it != inode_cache_.end()) {
+      if (auto drm_fb_id_handle_shared = it->second.lock()) {
+        hits_++;
+        inode_hits_++;
+        return drm_fb_id_handle_shared;
+      }
+      /* Buffer released, the inode number may be reused already */
+      inode_cache_.erase(it);
+    }
+  }
+
+  /* Lookup DrmFbIdHandle in cache first. First handle serves as a cache key. */
+  GemHandle first_handle = 0;
   int32_t err = drmPrimeFDToHandle(drm_->GetFd(), fds[0], &first_handle);
 
   if (err != 0) {
@@ -192,28 +242,71 @@ auto DrmFbImporter::GetOrCreateFbId(BufferInfo *bo, bool is_pixel_blend_mode_sup
     return {};
   }
 
-  auto drm_fb_id_cached = drm_fb_id_handle_cache_.find(first_handle);
+  auto drm_fb_id_cached = cache_.find(first_handle);
 
-  if (drm_fb_id_cached != drm_fb_id_handle_cache_.end()) {
-    if (auto drm_fb_id_handle_shared = drm_fb_id_cached->second) {
+  if (drm_fb_id_cached != cache_.end()) {
+    if (auto drm_fb_id_handle_shared = drm_fb_id_cached->second.fb.lock()) {
+      hits_++;
+      if (inode) {
+        inode_cache_[*inode] = drm_fb_id_handle_shared;
+      }
       return drm_fb_id_handle_shared;
     }
-    drm_fb_id_handle_cache_.erase(drm_fb_id_cached);
+    cache_.erase(drm_fb_id_cached);
+    expired_++;
   }
 
-  /* Cleanup cached empty weak pointers */
-  const int minimal_cleanup_size = 128;
-  if (drm_fb_id_handle_cache_.size() > minimal_cleanup_size) {
-    CleanupEmptyCacheElements();
-  }
+  misses_++;
 
   /* No DrmFbIdHandle found in cache, create framebuffer object */
+  int64_t start_ns = ResourceManager::GetTimeMonotonicNs();
   auto fb_id_handle = DrmFbIdHandle::CreateInstance(bo, first_handle, *drm_, is_pixel_blend_mode_supported);
-  if (fb_id_handle) {
-    drm_fb_id_handle_cache_[first_handle] = fb_id_handle;
+  import_hist_.Record(ResourceManager::GetTimeMonotonicNs() - start_ns);
+
+  if (!fb_id_handle) {
+    import_failures_++;
+    return fb_id_handle;
+  }
+
+  auto &entry = cache_[first_handle];
+  entry.fb = fb_id_handle;
+  entry.size_bytes = EstimateSize(*bo);
+
+  if (inode) {
+    inode_cache_[*inode] = fb_id_handle;
+  }
+
+  if (cache_.size() + inode_cache_.size() > sweep_threshold_) {
+    RemoveExpiredEntries();
+    sweep_threshold_ = std::max(kMinSweepThreshold,
+                                (cache_.size() + inode_cache_.size()) * 2);
   }
 
   return fb_id_handle;
 }
 
+auto DrmFbImporter::Dump() -> std::string {
+  const std::lock_guard<std::mutex> lock(cache_lock_);
+  uint64_t lookups = hits_ + misses_;
+
+  size_t live = 0;
+  uint64_t live_bytes = 0;
+  for (auto &[handle, entry] : cache_) {
+    if (!entry.fb.expired()) {
+      live++;
+      live_bytes += entry.size_bytes;
+    }
+  }
+
+  std::stringstream ss;
+  ss << "  FB import cache: " << cache_.size() << " entries, " << live
+     << " alive (" << live_bytes / 1024 << " KiB), hit rate "
+     << (lookups != 0 ? hits_ * 100 / lookups : 0) << "% (" << hits_
+     << " hits, " << inode_hits_ << " without PRIME import / " << misses_
+     << " misses), " << expired_
+     << " released, " << import_failures_ << " failed imports\n"
+     << "    Import: " << import_hist_.Dump() << "\n";
+  return ss.str();
+}
+
 }  // namespace android
@@ -19,12 +19,16 @@
 
 #include <drm/drm_fourcc.h>
 #include <hardware/gralloc.h>
+#include <sys/types.h>
 
 #include <array>
-#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include "bufferinfo/BufferInfo.h"
 #include "drm/DrmDevice.h"
+#include "utils/LatencyHistogram.h"
 
 #ifndef DRM_FORMAT_INVALID
 #define DRM_FORMAT_INVALID 0
@@ -50,6 +54,10 @@ class DrmFbIdHandle {
     return fb_id_;
   }
 
+  auto GetFirstGemHandle [[nodiscard]] () const -> GemHandle {
+    return gem_handles_[0];
+  }
+
  private:
   explicit DrmFbIdHandle(DrmDevice &drm) : drm_(&drm){};
 
@@ -59,6 +67,8 @@ class DrmFbIdHandle {
   std::array<GemHandle, kBufferMaxPlanes> gem_handles_{};
   std::array<GemHandle, kBufferMaxPlanes> shadow_handles_{};
   std::array<int, kBufferMaxPlanes> shadow_fds_{};
+  /* Client buffer imported into the blitter, the source of the shadow copy */
+  GemHandle blit_src_handle_{};
   bool use_shadow_buffers_ = false;
   std::shared_ptr<IntelBlitter> blitter_;
 };
@@ -74,17 +84,47 @@ class DrmFbImporter {
 
   auto GetOrCreateFbId(BufferInfo *bo, bool is_pixel_blend_mode_supported) -> std::shared_ptr<DrmFbIdHandle>;
 
+  auto Dump() -> std::string;
+
  private:
-  void CleanupEmptyCacheElements() {
-    for (auto it = drm_fb_id_handle_cache_.begin();
-         it != drm_fb_id_handle_cache_.end();) {
-      it = drm_fb_id_handle_cache_.erase(it);
-    }
-  }
+  /*
+   * The cache only keeps weak references, an entry dies together with the
+   * last layer or frame holding its buffer, so freed client buffers are never
+   * pinned. Dead entries are swept once the cache has doubled in size since
+   * the last sweep, as the property blob cache does.
+   */
+  struct CacheEntry {
+    std::weak_ptr<DrmFbIdHandle> fb;
+    uint64_t size_bytes{};
+  };
+
+  static constexpr size_t kMinSweepThreshold = 32;
+
+  static auto EstimateSize(const BufferInfo &bo) -> uint64_t;
+
+  void RemoveExpiredEntries();
 
   DrmDevice *const drm_;
 
-  std::map<GemHandle, std::shared_ptr<DrmFbIdHandle>> drm_fb_id_handle_cache_;
+  /* Shared by all the displays driven by the device */
+  std::mutex cache_lock_;
+  std::unordered_map<GemHandle, CacheEntry> cache_;
+
+  /* Looked up before the cache above, to skip the PRIME import ioctl on hits.
+   * The dma-buf inode is only a valid key while the FB is alive: its GEM
+   * handle keeps the dma-buf, and so the inode number, from being released
+   * and reused by another buffer.
+   */
+  std::unordered_map<ino_t, std::weak_ptr<DrmFbIdHandle>> inode_cache_;
+
+  size_t sweep_threshold_ = kMinSweepThreshold;
+
+  uint64_t hits_{};
+  uint64_t inode_hits_{};
+  uint64_t misses_{};
+  uint64_t expired_{};
+  uint64_t import_failures_{};
+  LatencyHistogram import_hist_;
 };
 
 }  // namespace android
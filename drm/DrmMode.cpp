@@ -122,7 +122,7 @@ void DrmMode::SetId(uint32_t id) {
 }
 
 auto DrmMode::CreateModeBlob(const DrmDevice &drm)
-    -> DrmModeUserPropertyBlobUnique {
+    -> DrmPropertyBlobCache::BlobRef {
   struct drm_mode_modeinfo drm_mode = {
       .clock = clock_,
       .hdisplay = h_display_,
@@ -141,7 +141,7 @@ auto DrmMode::CreateModeBlob(const DrmDevice &drm)
   };
   strncpy(drm_mode.name, name_.c_str(), DRM_DISPLAY_MODE_LEN);
 
-  return drm.RegisterUserPropertyBlob(&drm_mode,
+  return drm.GetPropertyBlobCache().Get(&drm_mode,
                                        sizeof(struct drm_mode_modeinfo));
 }
 
@@ -22,6 +22,7 @@
 #include <cstdio>
 #include <string>
 
+#include "DrmPropertyBlobCache.h"
 #include "DrmUnique.h"
 
 namespace android {
@@ -59,7 +60,7 @@ class DrmMode {
   
   void SetId(uint32_t id);
 
-  auto CreateModeBlob(const DrmDevice &drm) -> DrmModeUserPropertyBlobUnique;
+  auto CreateModeBlob(const DrmDevice &drm) -> DrmPropertyBlobCache::BlobRef;
 
  private:
   uint32_t id_ = 0;
@@ -19,8 +19,10 @@
 #include "DrmPlane.h"
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cinttypes>
+#include <cmath>
 #include <cstdint>
 
 #include "DrmDevice.h"
@@ -29,6 +31,25 @@
 
 namespace android {
 
+/* Formats with a bit in DrmPlane::Caps, others are looked up in formats_ */
+static constexpr std::array<uint32_t, 20> kCapsFormats = {
+    DRM_FORMAT_ARGB8888,    DRM_FORMAT_XRGB8888,    DRM_FORMAT_ABGR8888,
+    DRM_FORMAT_XBGR8888,    DRM_FORMAT_BGR888,      DRM_FORMAT_RGB565,
+    DRM_FORMAT_BGR565,      DRM_FORMAT_ABGR2101010, DRM_FORMAT_XBGR2101010,
+    DRM_FORMAT_ABGR4444,    DRM_FORMAT_XBGR4444,    DRM_FORMAT_ABGR1555,
+    DRM_FORMAT_XBGR1555,    DRM_FORMAT_NV12,        DRM_FORMAT_NV12_INTEL,
+    DRM_FORMAT_P010,        DRM_FORMAT_YUV420,      DRM_FORMAT_YVU420,
+    DRM_FORMAT_AYUV,        DRM_FORMAT_XYUV8888,
+};
+
+static uint64_t GetFormatBit(uint32_t format) {
+  for (size_t i = 0; i < kCapsFormats.size(); i++) {
+    if (kCapsFormats[i] == format)
+      return uint64_t(1) << i;
+  }
+  return 0;
+}
+
 auto DrmPlane::CreateInstance(DrmDevice &dev, uint32_t plane_id)
     -> std::unique_ptr<DrmPlane> {
   auto p = MakeDrmModePlaneUnique(dev.GetFd(), plane_id);
@@ -119,6 +140,9 @@ int DrmPlane::Init() {
 
   GetPlaneProperty("IN_FENCE_FD", in_fence_fd_property_, Presence::kOptional);
 
+  GetPlaneProperty("FB_DAMAGE_CLIPS", fb_damage_clips_property_,
+                   Presence::kOptional);
+
   if (HasNonRgbFormat()) {
     if (GetPlaneProperty("COLOR_ENCODING", color_encoding_propery_,
                          Presence::kOptional)) {
@@ -144,6 +168,24 @@ int DrmPlane::Init() {
     }
   }
 
+  if (rotation_property_) {
+    for (const auto &[transform, value] : transform_enum_map_)
+      caps_.transforms |= 1U << transform;
+  } else {
+    caps_.transforms = 1U << LayerTransform::kIdentity;
+  }
+
+  caps_.blend_modes = (1U << uint32_t(BufferBlendMode::kNone)) |
+                      (1U << uint32_t(BufferBlendMode::kPreMult));
+  for (const auto &[mode, value] : blending_enum_map_)
+    caps_.blend_modes |= 1U << uint32_t(mode);
+
+  caps_.alpha = alpha_property_.id() != 0;
+
+  for (auto format : formats_)
+    caps_.formats |= GetFormatBit(format);
+  caps_.formats |= GetFormatBit(DRM_FORMAT_NV12_INTEL);
+
   return 0;
 }
 
@@ -152,38 +194,48 @@ bool DrmPlane::IsCrtcSupported(const DrmCrtc &crtc) const {
 }
 
 bool DrmPlane::IsValidForLayer(LayerData *layer) {
-  if (!rotation_property_) {
-    if (layer->pi.transform != LayerTransform::kIdentity) {
-      ALOGV("No rotation property on plane %d", GetId());
-      return false;
-    }
-  } else {
-    if (transform_enum_map_.count(layer->pi.transform) == 0) {
-      ALOGV("Transform is not supported on plane %d", GetId());
-      return false;
-    }
+  return IsValidForLayer(*layer, GetLayerCaps(*layer));
+}
+
+auto DrmPlane::GetLayerCaps(const LayerData &layer) -> Caps {
+  constexpr uint32_t kMaskBits = 32;
+  return {
+      .transforms = layer.pi.transform < kMaskBits ? 1U << layer.pi.transform
+                                                   : 0,
+      .blend_modes = 1U << uint32_t(layer.bi->blend_mode),
+      .formats = GetFormatBit(layer.bi->format),
+      .alpha = layer.pi.alpha != UINT16_MAX,
+  };
+}
+
+bool DrmPlane::IsValidForLayer(const LayerData &layer,
+                               const Caps &layer_caps) {
+  if ((layer_caps.transforms & caps_.transforms) == 0) {
+    ALOGV("Transform is not supported on plane %d", GetId());
+    return false;
   }
 
-  if (alpha_property_.id() == 0 && layer->pi.alpha != UINT16_MAX) {
+  if (layer_caps.alpha && !caps_.alpha) {
     ALOGV("Alpha is not supported on plane %d", GetId());
     return false;
   }
 
-  if (blending_enum_map_.count(layer->bi->blend_mode) == 0 &&
-      layer->bi->blend_mode != BufferBlendMode::kNone &&
-      layer->bi->blend_mode != BufferBlendMode::kPreMult) {
+  if ((layer_caps.blend_modes & caps_.blend_modes) == 0) {
     ALOGV("Blending is not supported on plane %d", GetId());
     return false;
   }
 
-  uint32_t format = layer->bi->format;
-  if (!IsFormatSupported(format)) {
+  uint32_t format = layer.bi->format;
+  bool format_supported = layer_caps.formats != 0
+                              ? (layer_caps.formats & caps_.formats) != 0
+                              : IsFormatSupported(format);
+  if (!format_supported) {
     ALOGV("Plane %d does not supports %c%c%c%c format", GetId(), format,
           format >> 8, format >> 16, format >> 24);
     return false;
   }
 
-  hwc_rect_t frame = layer->pi.display_frame;
+  hwc_rect_t frame = layer.pi.display_frame;
   if (!IsResolutionSupported(frame)) {
     ALOGV("Plane %d does not supports %dx%d resolution",
           GetId(), int (frame.right - frame.left), int (frame.bottom - frame.top));
@@ -248,20 +300,48 @@ static int To1616FixPt(float in) {
   return int(in * (1 << kBitShift));
 }
 
+static auto FindPropertyValue(
+    std::vector<std::pair<uint32_t, uint64_t>> &values, uint32_t id) {
+  return std::find_if(values.begin(), values.end(),
+                      [id](auto &entry) { return entry.first == id; });
+}
+
+auto DrmPlane::AtomicSetDelta(drmModeAtomicReq &pset,
+                              const DrmProperty &property, uint64_t value,
+                              bool test_only) -> bool {
+  if (!test_only) {
+    staged_values_.emplace_back(property.id(), value);
+    auto it = FindPropertyValue(committed_values_, property.id());
+    if (it != committed_values_.end() && it->second == value) {
+      return true;
+    }
+  }
+
+  return property.AtomicSet(pset, value);
+}
+
 auto DrmPlane::AtomicSetState(drmModeAtomicReq &pset, LayerData &layer,
-                              uint32_t zpos, uint32_t crtc_id) -> int {
+                              uint32_t zpos, uint32_t crtc_id, bool test_only)
+    -> int {
   if (!layer.fb) {
     ALOGE("Expected a valid framebuffer for pset");
     return -EINVAL;
   }
 
+  const std::lock_guard<std::mutex> lock(committed_lock_);
+  if (!test_only) {
+    staged_values_.clear();
+    staged_disable_ = false;
+    staged_damage_owner_ = 0;
+  }
+
   if (zpos_property_ && !zpos_property_.is_immutable()) {
     uint64_t min_zpos = 0;
 
     // Ignore ret and use min_zpos as 0 by default
     std::tie(std::ignore, min_zpos) = zpos_property_.range_min();
 
-    if (!zpos_property_.AtomicSet(pset, zpos + min_zpos)) {
+    if (!AtomicSetDelta(pset, zpos_property_, zpos + min_zpos, test_only)) {
       return -EINVAL;
     }
   }
@@ -274,57 +354,140 @@ auto DrmPlane::AtomicSetState(drmModeAtomicReq &pset, LayerData &layer,
 
   auto &disp = layer.pi.display_frame;
   auto &src = layer.pi.source_crop;
-  if (!crtc_property_.AtomicSet(pset, crtc_id) ||
-      !fb_property_.AtomicSet(pset, layer.fb->GetFbId()) ||
-      !crtc_x_property_.AtomicSet(pset, disp.left) ||
-      !crtc_y_property_.AtomicSet(pset, disp.top) ||
-      !crtc_w_property_.AtomicSet(pset, disp.right - disp.left) ||
-      !crtc_h_property_.AtomicSet(pset, disp.bottom - disp.top) ||
-      !src_x_property_.AtomicSet(pset, To1616FixPt(src.left)) ||
-      !src_y_property_.AtomicSet(pset, To1616FixPt(src.top)) ||
-      !src_w_property_.AtomicSet(pset, To1616FixPt(src.right - src.left)) ||
-      !src_h_property_.AtomicSet(pset, To1616FixPt(src.bottom - src.top))) {
+  auto set = [&](const DrmProperty &property, uint64_t value) {
+    return AtomicSetDelta(pset, property, value, test_only);
+  };
+  if (!set(crtc_property_, crtc_id) ||
+      !set(fb_property_, layer.fb->GetFbId()) ||
+      !set(crtc_x_property_, disp.left) || !set(crtc_y_property_, disp.top) ||
+      !set(crtc_w_property_, disp.right - disp.left) ||
+      !set(crtc_h_property_, disp.bottom - disp.top) ||
+      !set(src_x_property_, To1616FixPt(src.left)) ||
+      !set(src_y_property_, To1616FixPt(src.top)) ||
+      !set(src_w_property_, To1616FixPt(src.right - src.left)) ||
+      !set(src_h_property_, To1616FixPt(src.bottom - src.top))) {
     return -EINVAL;
   }
 
   if (rotation_property_ &&
-      !rotation_property_.AtomicSet(pset, ToDrmRotation(layer.pi.transform))) {
+      !set(rotation_property_, ToDrmRotation(layer.pi.transform))) {
     return -EINVAL;
   }
 
-  if (alpha_property_ && !alpha_property_.AtomicSet(pset, layer.pi.alpha)) {
+  if (alpha_property_ && !set(alpha_property_, layer.pi.alpha)) {
     return -EINVAL;
   }
 
   if (blending_enum_map_.count(layer.bi->blend_mode) != 0 &&
-      !blend_property_.AtomicSet(pset,
-                                 blending_enum_map_[layer.bi->blend_mode])) {
+      !set(blend_property_, blending_enum_map_[layer.bi->blend_mode])) {
     return -EINVAL;
   }
 
   if (color_encoding_enum_map_.count(layer.bi->color_space) != 0 &&
-      !color_encoding_propery_
-           .AtomicSet(pset, color_encoding_enum_map_[layer.bi->color_space])) {
+      !set(color_encoding_propery_,
+           color_encoding_enum_map_[layer.bi->color_space])) {
     return -EINVAL;
   }
 
   if (color_range_enum_map_.count(layer.bi->sample_range) != 0 &&
-      !color_range_property_
-           .AtomicSet(pset, color_range_enum_map_[layer.bi->sample_range])) {
+      !set(color_range_property_,
+           color_range_enum_map_[layer.bi->sample_range])) {
     return -EINVAL;
   }
 
   return 0;
 }
 
-auto DrmPlane::AtomicDisablePlane(drmModeAtomicReq &pset) -> int {
+auto DrmPlane::AtomicSetDamage(drmModeAtomicReq &pset, const LayerData &layer)
+    -> DrmPropertyBlobCache::BlobRef {
+  /* Damage is relative to what the plane showed in the previous frame */
+  bool same_owner = false;
+  {
+    const std::lock_guard<std::mutex> lock(committed_lock_);
+    same_owner = layer.pi.damage_owner != 0 &&
+                 layer.pi.damage_owner == last_damage_owner_;
+    staged_damage_owner_ = layer.pi.damage_owner;
+  }
+
+  if (!fb_damage_clips_property_ || !same_owner || !layer.pi.damage) {
+    /* No FB_DAMAGE_CLIPS means the whole framebuffer */
+    return {};
+  }
+
+  auto &src = layer.pi.source_crop;
+  std::vector<drm_mode_rect> clips;
+  for (const auto &r : *layer.pi.damage) {
+    drm_mode_rect clip{
+        .x1 = std::max(r.left, int(std::floor(src.left))),
+        .y1 = std::max(r.top, int(std::floor(src.top))),
+        .x2 = std::min(r.right, int(std::ceil(src.right))),
+        .y2 = std::min(r.bottom, int(std::ceil(src.bottom))),
+    };
+    if (clip.x2 > clip.x1 && clip.y2 > clip.y1) {
+      clips.emplace_back(clip);
+    }
+  }
+
+  if (clips.empty()) {
+    /* A single empty clip tells the driver nothing has to be flushed */
+    clips.emplace_back(drm_mode_rect{});
+  }
+
+  auto blob = drm_->GetPropertyBlobCache().Get(clips.data(),
+                                               clips.size() * sizeof(clips[0]));
+  if (!blob || !fb_damage_clips_property_.AtomicSet(pset, blob->GetId())) {
+    return {};
+  }
+
+  return blob;
+}
+
+auto DrmPlane::AtomicDisablePlane(drmModeAtomicReq &pset, bool test_only)
+    -> int {
   if (!crtc_property_.AtomicSet(pset, 0) || !fb_property_.AtomicSet(pset, 0)) {
     return -EINVAL;
   }
 
+  if (!test_only) {
+    const std::lock_guard<std::mutex> lock(committed_lock_);
+    staged_values_.clear();
+    staged_disable_ = true;
+    staged_damage_owner_ = 0;
+  }
+
   return 0;
 }
 
+void DrmPlane::ApplyStagedState() {
+  const std::lock_guard<std::mutex> lock(committed_lock_);
+  if (staged_disable_) {
+    /* Rarely re-enabled with the same state, keep it simple */
+    committed_values_.clear();
+  } else {
+    for (auto &[id, value] : staged_values_) {
+      auto it = FindPropertyValue(committed_values_, id);
+      if (it != committed_values_.end()) {
+        it->second = value;
+      } else {
+        committed_values_.emplace_back(id, value);
+      }
+    }
+  }
+  staged_values_.clear();
+  staged_disable_ = false;
+  last_damage_owner_ = staged_damage_owner_;
+  staged_damage_owner_ = 0;
+}
+
+void DrmPlane::InvalidateCommittedState() {
+  const std::lock_guard<std::mutex> lock(committed_lock_);
+  committed_values_.clear();
+  staged_values_.clear();
+  staged_disable_ = false;
+  last_damage_owner_ = 0;
+  staged_damage_owner_ = 0;
+}
+
 auto DrmPlane::GetPlaneProperty(const char *prop_name, DrmProperty &property,
                                 Presence presence) -> bool {
   int err = drm_->GetProperty(GetId(), DRM_MODE_OBJECT_PLANE, prop_name,
@@ -19,10 +19,13 @@
 #include <cstdint>
 #include <xf86drmMode.h>
 
+#include <mutex>
+#include <utility>
 #include <vector>
 
 #include "DrmCrtc.h"
 #include "DrmProperty.h"
+#include "DrmPropertyBlobCache.h"
 #include "compositor/LayerData.h"
 
 namespace android {
@@ -42,6 +45,19 @@ class DrmPlane : public PipelineBindable<DrmPlane> {
   bool IsPixBlendModeSupported() { return blend_property_ ? true : false;}
   bool IsValidForLayer(LayerData *layer);
 
+  /* Layer requirements and plane capabilities as bitmasks, matching a layer
+   * against several planes only takes a few bit tests per plane.
+   */
+  struct Caps {
+    uint32_t transforms;  /* 1 << LayerTransform (combination) */
+    uint32_t blend_modes; /* 1 << BufferBlendMode */
+    uint64_t formats;     /* Only formats listed in DrmPlane.cpp have a bit */
+    bool alpha;
+  };
+
+  static auto GetLayerCaps(const LayerData &layer) -> Caps;
+  bool IsValidForLayer(const LayerData &layer, const Caps &layer_caps);
+
   auto GetType() const {
     return type_;
   }
@@ -50,9 +66,21 @@ class DrmPlane : public PipelineBindable<DrmPlane> {
   bool IsResolutionSupported(hwc_rect_t display_frame);
   bool HasNonRgbFormat() const;
 
+  /* Real commits only get the properties which differ from the last commit,
+   * test commits get all of them.
+   */
   auto AtomicSetState(drmModeAtomicReq &pset, LayerData &layer, uint32_t zpos,
-                      uint32_t crtc_id) -> int;
-  auto AtomicDisablePlane(drmModeAtomicReq &pset) -> int;
+                      uint32_t crtc_id, bool test_only) -> int;
+  /* Only for real commits. The returned blob (if any) has to outlive the
+   * commit.
+   */
+  auto AtomicSetDamage(drmModeAtomicReq &pset, const LayerData &layer)
+      -> DrmPropertyBlobCache::BlobRef;
+  auto AtomicDisablePlane(drmModeAtomicReq &pset, bool test_only) -> int;
+  /* Called once the real commit set up by the above is submitted */
+  void ApplyStagedState();
+  /* For modesets and failed commits, the next commit sets every property */
+  void InvalidateCommittedState();
   auto &GetZPosProperty() const {
     return zpos_property_;
   }
@@ -69,11 +97,15 @@ class DrmPlane : public PipelineBindable<DrmPlane> {
 
   enum class Presence { kOptional, kMandatory };
 
+  auto AtomicSetDelta(drmModeAtomicReq &pset, const DrmProperty &property,
+                      uint64_t value, bool test_only) -> bool;
+
   auto Init() -> int;
   auto GetPlaneProperty(const char *prop_name, DrmProperty &property,
                         Presence presence = Presence::kMandatory) -> bool;
 
   uint32_t type_{};
+  Caps caps_{};
 
   std::vector<uint32_t> formats_;
 
@@ -94,6 +126,24 @@ class DrmPlane : public PipelineBindable<DrmPlane> {
   DrmProperty in_fence_fd_property_;
   DrmProperty color_encoding_propery_;
   DrmProperty color_range_property_;
+  DrmProperty fb_damage_clips_property_;
+
+  /* Layer shown by the plane as of the last commit accepted by the kernel,
+   * or queued after it. Guarded by committed_lock_.
+   */
+  uint64_t last_damage_owner_{};
+  uint64_t staged_damage_owner_{};
+
+  /* Property values by id as of the last commit, missing if unknown. A plane
+   * may move between CRTCs, which are committed from different threads.
+   * Flat lists, as there are a dozen entries at most and they keep their
+   * capacity across frames.
+   */
+  using PropertyValues = std::vector<std::pair<uint32_t, uint64_t>>;
+  std::mutex committed_lock_;
+  PropertyValues committed_values_;
+  PropertyValues staged_values_;
+  bool staged_disable_{};
 
   std::map<BufferBlendMode, uint64_t> blending_enum_map_;
   std::map<BufferColorSpace, uint64_t> color_encoding_enum_map_;
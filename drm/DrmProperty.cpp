@@ -46,6 +46,10 @@ void DrmProperty::Init(uint32_t obj_id, drmModePropertyPtr p, uint64_t value) {
   name_ = p->name;
   value_ = value;
 
+  values_.clear();
+  enums_.clear();
+  blob_ids_.clear();
+
   for (int i = 0; i < p->count_values; ++i)
     values_.emplace_back(p->values[i]);
 
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-drm-property-blob-cache"
+
+#include "DrmPropertyBlobCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "utils/log.h"
+
+namespace android {
+
+auto DrmPropertyBlobCache::Hash(const void *data, size_t length) -> uint64_t {
+  /* FNV-1a */
+  constexpr uint64_t kOffsetBasis = 0xcbf29ce484222325ULL;
+  constexpr uint64_t kPrime = 0x100000001b3ULL;
+
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = kOffsetBasis;
+  for (size_t i = 0; i < length; i++) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    hash = (hash ^ bytes[i]) * kPrime;
+  }
+
+  return hash;
+}
+
+auto DrmPropertyBlobCache::Get(const void *data, size_t length) -> BlobRef {
+  if (data == nullptr || length == 0) {
+    return {};
+  }
+
+  auto hash = Hash(data, length);
+  const std::lock_guard<std::mutex> lock(lock_);
+
+  auto it = cache_.find(hash);
+  if (it != cache_.end()) {
+    auto blob = it->second.lock();
+    if (blob && blob->data.size() == length &&
+        memcmp(blob->data.data(), data, length) == 0) {
+      hits_++;
+      return blob;
+    }
+  }
+
+  misses_++;
+  auto id = register_blob_(data, length);
+  if (!id) {
+    return {};
+  }
+
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  auto blob = std::make_shared<Blob>();
+  blob->id = std::move(id);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  blob->data.assign(bytes, bytes + length);
+
+  /* On a hash collision the older blob stays alive, just uncached */
+  cache_[hash] = blob;
+
+  if (cache_.size() > sweep_threshold_) {
+    RemoveExpiredEntries();
+    sweep_threshold_ = std::max(kMinSweepThreshold, cache_.size() * 2);
+  }
+
+  return blob;
+}
+
+void DrmPropertyBlobCache::RemoveExpiredEntries() {
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    if (it->second.expired()) {
+      it = cache_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+auto DrmPropertyBlobCache::Dump() -> std::string {
+  const std::lock_guard<std::mutex> lock(lock_);
+  RemoveExpiredEntries();
+
+  size_t live_bytes = 0;
+  for (auto &entry : cache_) {
+    auto blob = entry.second.lock();
+    if (blob) {
+      live_bytes += blob->data.size();
+    }
+  }
+
+  uint64_t lookups = hits_ + misses_;
+  std::stringstream ss;
+  ss << "  Property blob cache: " << cache_.size() << " live blobs ("
+     << live_bytes << " bytes), hit rate "
+     << (lookups != 0 ? hits_ * 100 / lookups : 0) << "% (" << hits_
+     << " hits / " << misses_ << " misses)\n";
+  return ss.str();
+}
+
+}  // namespace android
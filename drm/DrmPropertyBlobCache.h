@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRM_PROPERTY_BLOB_CACHE_H_
+#define ANDROID_DRM_PROPERTY_BLOB_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "drm/DrmUnique.h"
+
+namespace android {
+
+/*
+ * Property blobs (modes, HDR metadata, CTM, LUT, damage clips) of a device,
+ * deduplicated by content. A blob lives as long as some frame state holds a
+ * reference to it, the cache itself only keeps weak references.
+ */
+class DrmPropertyBlobCache {
+ public:
+  struct Blob {
+    DrmModeUserPropertyBlobUnique id;
+    std::vector<uint8_t> data;
+
+    auto GetId() const -> uint32_t {
+      return *id;
+    }
+  };
+
+  using BlobRef = std::shared_ptr<const Blob>;
+
+  /* Creates the kernel blob, DrmDevice::RegisterUserPropertyBlob() */
+  using RegisterBlob = std::function<DrmModeUserPropertyBlobUnique(
+      const void *data, size_t length)>;
+
+  explicit DrmPropertyBlobCache(RegisterBlob register_blob)
+      : register_blob_(std::move(register_blob)){};
+
+  /* Returns the live blob with the same content or creates a new one */
+  auto Get(const void *data, size_t length) -> BlobRef;
+
+  auto Dump() -> std::string;
+
+ private:
+  static constexpr size_t kMinSweepThreshold = 32;
+
+  static auto Hash(const void *data, size_t length) -> uint64_t;
+  void RemoveExpiredEntries();
+
+  const RegisterBlob register_blob_;
+
+  std::mutex lock_;
+  std::unordered_map<uint64_t /*hash*/, std::weak_ptr<const Blob>> cache_;
+  size_t sweep_threshold_ = kMinSweepThreshold;
+  uint64_t hits_{};
+  uint64_t misses_{};
+};
+
+}  // namespace android
+
+#endif  // ANDROID_DRM_PROPERTY_BLOB_CACHE_H_
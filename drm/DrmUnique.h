@@ -78,6 +78,14 @@ auto inline MakeDrmModePropertyBlobUnique(int fd, uint32_t blob_id) {
                                    });
 }
 
+using DrmModePropertyUnique = DUniquePtr<drmModePropertyRes>;
+auto inline MakeDrmModePropertyUnique(int fd, uint32_t prop_id) {
+  return DrmModePropertyUnique(drmModeGetProperty(fd, prop_id),
+                               [](drmModePropertyRes *it) {
+                                 drmModeFreeProperty(it);
+                               });
+}
+
 using DrmModeResUnique = DUniquePtr<drmModeRes>;
 auto inline MakeDrmModeResUnique(int fd) {
   return DrmModeResUnique(drmModeGetResources(fd),
@@ -19,6 +19,7 @@
 #include "ResourceManager.h"
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <ctime>
 #include <sstream>
@@ -189,12 +190,12 @@ void ResourceManager::Init() {
     return;
   }
 
-  uevent_listener_.RegisterHotplugHandler([this] {
-    const std::lock_guard<std::mutex> lock(GetMainLock());
-    UpdateFrontendDisplays();
-  });
+  uevent_listener_.RegisterHotplugHandler(
+      [this](std::string_view node, std::optional<uint32_t> connector_id) {
+        HandleHotplug(std::string(node), connector_id);
+      });
 
-  UpdateFrontendDisplays();
+  UpdateFrontendDisplays({}, {}, /*final_attempt=*/true);
   pt_ = std::thread(&ResourceManager::HwcServiceThread, this);
   initialized_ = true;
 }
@@ -217,7 +218,8 @@ void ResourceManager::DeInit() {
     return;
   }
 
-  uevent_listener_.RegisterHotplugHandler([] {});
+  uevent_listener_.RegisterHotplugHandler(
+      [](std::string_view, std::optional<uint32_t>) {});
 
   DetachAllFrontendDisplays();
   drms_.clear();
@@ -232,21 +234,82 @@ auto ResourceManager::GetTimeMonotonicNs() -> int64_t {
   return int64_t(ts.tv_sec) * kNsInSec + int64_t(ts.tv_nsec);
 }
 
+void ResourceManager::HandleHotplug(const std::string &node,
+                                    std::optional<uint32_t> connector_id) {
+  /* Some boards (e.g. RPI4) report no modes right after the hotplug event.
+   * Retry with an exponential backoff, 630 ms at most in total.
+   */
+  constexpr int kMaxModeRetries = 6;
+  constexpr useconds_t kFirstRetryDelayUs = 10000;
+
+  useconds_t delay_us = kFirstRetryDelayUs;
+  for (int attempt = 0;; attempt++) {
+    bool final_attempt = attempt == kMaxModeRetries;
+    bool modes_pending = false;
+    {
+      const std::lock_guard<std::shared_mutex> lock(GetMainLock());
+      modes_pending = UpdateFrontendDisplays(node, connector_id,
+                                             final_attempt);
+    }
+
+    if (!modes_pending || final_attempt) {
+      break;
+    }
+
+    ALOGI("Connector reports no modes yet, retrying in %u ms",
+          delay_us / 1000);
+    usleep(delay_us);
+    delay_us *= 2;
+  }
+}
+
 #define DRM_MODE_LINK_STATUS_GOOD       0
 #define DRM_MODE_LINK_STATUS_BAD        1
-void ResourceManager::UpdateFrontendDisplays() {
+auto ResourceManager::UpdateFrontendDisplays(
+    const std::string &node, std::optional<uint32_t> connector_id,
+    bool final_attempt) -> bool {
   if (!reloaded_)
     ReloadNode();
   auto ordered_connectors = GetOrderedConnectors();
+  bool modes_pending = false;
+
+  /* Connector ids are only unique within a DRM device */
+  DrmDevice *connector_dev = nullptr;
+  if (connector_id) {
+    for (auto &drm : drms_) {
+      if (!node.empty() && drm->GetNodeName() == node) {
+        connector_dev = drm.get();
+        break;
+      }
+    }
+
+    if (connector_dev == nullptr) {
+      ALOGV("Hotplug event for unknown node '%s', probing all connectors",
+            node.c_str());
+      connector_id.reset();
+    }
+  }
 
   for (auto *conn : ordered_connectors) {
+    if (connector_id && (&conn->GetDev() != connector_dev ||
+                         conn->GetId() != *connector_id)) {
+      continue;
+    }
+
     conn->UpdateModes();
     bool connected = conn->IsConnected();
     bool attached = attached_pipelines_.count(conn) != 0;
 
+    if (connected && !attached && conn->GetModes().empty() &&
+        !final_attempt) {
+      modes_pending = true;
+      continue;
+    }
+
     if (connected != attached) {
       ALOGI("%s connector %s", connected ? "Attaching" : "Detaching",
             conn->GetName().c_str());
+      conn->GetDev().BumpKmsConfigGeneration();
 
       if (connected) {
         auto pipeline = DrmDisplayPipeline::CreatePipeline(*conn);
@@ -288,6 +351,7 @@ void ResourceManager::UpdateFrontendDisplays() {
     }
   }
   frontend_interface_->FinalizeDisplayBinding();
+  return modes_pending;
 }
 
 void ResourceManager::DetachAllFrontendDisplays() {
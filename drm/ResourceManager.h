@@ -18,6 +18,9 @@
 #define RESOURCEMANAGER_H
 
 #include <cstring>
+#include <optional>
+#include <shared_mutex>
+#include <string>
 
 #include "DrmDevice.h"
 #include "DrmDisplayPipeline.h"
@@ -54,6 +57,10 @@ class ResourceManager {
     return scale_with_gpu_;
   }
 
+  /* Topology lock. Taken exclusively for hotplug and device-wide calls,
+   * shared by per-display HWC2 calls which then serialize on the display's
+   * own lock (see HwcDisplay::GetDisplayLock()).
+   */
   auto &GetMainLock() {
     return main_lock_;
   }
@@ -62,7 +69,15 @@ class ResourceManager {
 
  private:
   auto GetOrderedConnectors() -> std::vector<DrmConnector *>;
-  void UpdateFrontendDisplays();
+  void HandleHotplug(const std::string &node,
+                     std::optional<uint32_t> connector_id);
+  /* Re-probes the given connector of the given DRM node, or all of them if
+   * either is unknown. Returns true if a connected connector reported no
+   * modes yet, it is left alone unless final_attempt.
+   */
+  auto UpdateFrontendDisplays(const std::string &node,
+                              std::optional<uint32_t> connector_id,
+                              bool final_attempt) -> bool;
   void DetachAllFrontendDisplays();
   void ReloadNode();
   void HwcServiceThread();
@@ -73,7 +88,7 @@ class ResourceManager {
 
   UEventListener uevent_listener_;
 
-  std::mutex main_lock_;
+  std::shared_mutex main_lock_;
 
   std::map<DrmConnector *, std::unique_ptr<DrmDisplayPipeline>>
       attached_pipelines_;
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_TEST_COMMIT_CACHE_H_
+#define ANDROID_TEST_COMMIT_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+
+/*
+ * LRU of TEST_ONLY commit verdicts. The key is the flattened plane
+ * configuration, it is stored next to the verdict and compared in full on
+ * lookup so that a hash collision can never return the verdict of another
+ * configuration. All entries are dropped when the KMS configuration
+ * generation of the device changes.
+ */
+class TestCommitCache {
+ public:
+  using Key = std::vector<uint64_t>;
+
+  explicit TestCommitCache(size_t max_entries) : max_entries_(max_entries){};
+
+  auto Lookup(const Key &key, uint32_t generation) -> std::optional<int> {
+    if (generation != generation_) {
+      index_.clear();
+      lru_.clear();
+      generation_ = generation;
+    }
+
+    auto it = index_.find(Hash(key));
+    if (it == index_.end() || it->second->key != key) {
+      misses_++;
+      return {};
+    }
+
+    hits_++;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->verdict;
+  }
+
+  /* Only valid for the generation of the preceding Lookup() */
+  void Store(const Key &key, int verdict) {
+    auto hash = Hash(key);
+    auto it = index_.find(hash);
+    if (it != index_.end()) {
+      if (it->second->key == key) {
+        return;
+      }
+      /* Collision, the newer configuration takes the slot */
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+
+    if (lru_.size() >= max_entries_) {
+      index_.erase(lru_.back().hash);
+      lru_.pop_back();
+    }
+
+    lru_.push_front({key, hash, verdict});
+    index_[hash] = lru_.begin();
+  }
+
+  auto GetSize() const {
+    return lru_.size();
+  }
+
+  auto GetHits() const {
+    return hits_;
+  }
+
+  auto GetMisses() const {
+    return misses_;
+  }
+
+ private:
+  struct Entry {
+    Key key;
+    uint64_t hash;
+    int verdict;
+  };
+
+  static auto Hash(const Key &key) -> uint64_t {
+    constexpr uint64_t kGoldenRatio = 0x9e3779b97f4a7c15ULL;
+    constexpr int kShiftLeft = 6;
+    constexpr int kShiftRight = 2;
+    uint64_t hash = key.size();
+    for (auto value : key) {
+      hash ^= value + kGoldenRatio + (hash << kShiftLeft) +
+              (hash >> kShiftRight);
+    }
+    return hash;
+  }
+
+  const size_t max_entries_;
+  std::list<Entry> lru_;
+  std::unordered_map<uint64_t /*hash*/, std::list<Entry>::iterator> index_;
+  uint32_t generation_{};
+  uint64_t hits_{};
+  uint64_t misses_{};
+};
+
+}  // namespace android
+
+#endif
@@ -32,7 +32,8 @@ UEventListener::UEventListener()
     : Worker("uevent-listener", kHalPriorityUrgentDisplay){};
 
 int UEventListener::Init() {
-  uevent_ = UEvent::CreateInstance();
+  /* Keeps USB, power supply, input etc. uevents from waking this thread up */
+  uevent_ = UEvent::CreateInstance("drm");
   if (!uevent_) {
     return -ENODEV;
   }
@@ -42,20 +43,26 @@ int UEventListener::Init() {
 
 void UEventListener::Routine() {
   while (true) {
-    auto uevent_str = uevent_->ReadNext();
+    auto uevent = uevent_->ReadNextMessage();
 
-    if (!hotplug_handler_ || !uevent_str)
+    if (!hotplug_handler_ || !uevent)
       continue;
 
-    bool drm_event = uevent_str->find("DEVTYPE=drm_minor") != std::string::npos;
-    bool hotplug_event = uevent_str->find("HOTPLUG=1") != std::string::npos;
+    /* The kernel filter passes some messages through unchecked */
+    if (uevent->subsystem != "drm")
+      continue;
 
-    if (drm_event && hotplug_event) {
-      constexpr useconds_t kDelayAfterUeventUs = 200000;
-      /* We need some delay to ensure DrmConnector::UpdateModes() will query
-       * correct modes list, otherwise at least RPI4 board may report 0 modes */
-      usleep(kDelayAfterUeventUs);
-      hotplug_handler_();
+    if (uevent->devtype == "drm_minor" && uevent->hotplug) {
+      /* Set for per-connector events, along with PROPERTY= for property
+       * changes like link-status or content protection.
+       */
+      if (uevent->connector) {
+        auto node = uevent->GetNodeName();
+        ALOGV("Hotplug event for connector %u of %.*s (property %d)",
+              *uevent->connector, int(node.size()), node.data(),
+              int(uevent->property.value_or(0)));
+      }
+      hotplug_handler_(uevent->GetNodeName(), uevent->connector);
     }
   }
 }
@@ -17,7 +17,10 @@
 #ifndef ANDROID_UEVENT_LISTENER_H_
 #define ANDROID_UEVENT_LISTENER_H_
 
+#include <cstdint>
 #include <functional>
+#include <optional>
+#include <string_view>
 
 #include "utils/UEvent.h"
 #include "utils/Worker.h"
@@ -31,7 +34,15 @@ class UEventListener : public Worker {
 
   int Init();
 
-  void RegisterHotplugHandler(std::function<void()> hotplug_handler) {
+  /* node is the DRM node name ("card0"), empty if unknown. connector_id is
+   * unset when the kernel didn't tell which one changed, it is only unique
+   * within the node.
+   */
+  using HotplugHandler =
+      std::function<void(std::string_view /*node*/,
+                         std::optional<uint32_t> /*connector_id*/)>;
+
+  void RegisterHotplugHandler(HotplugHandler hotplug_handler) {
     hotplug_handler_ = std::move(hotplug_handler);
   }
 
@@ -41,7 +52,7 @@ class UEventListener : public Worker {
  private:
   std::unique_ptr<UEvent> uevent_;
 
-  std::function<void()> hotplug_handler_;
+  HotplugHandler hotplug_handler_;
 };
 }  // namespace android
 
@@ -31,13 +31,33 @@ namespace android {
 
 VSyncWorker::VSyncWorker() : Worker("vsync", HAL_PRIORITY_URGENT_DISPLAY){};
 
+VSyncWorker::~VSyncWorker() {
+  if (listener_ != nullptr) {
+    listener_->CancelVBlank(crtc_id_);
+  }
+  Exit();
+}
+
 auto VSyncWorker::Init(DrmDisplayPipeline *pipe,
                        std::function<void(uint64_t /*timestamp*/)> callback)
     -> int {
+  /* Make sure the old callback is neither running nor armed anymore */
+  if (listener_ != nullptr) {
+    listener_->CancelVBlank(crtc_id_);
+  }
+
+  Lock();
   pipe_ = pipe;
   callback_ = std::move(callback);
+  listener_ = pipe != nullptr ? pipe->device->GetEventListener() : nullptr;
+  crtc_id_ = pipe != nullptr ? pipe->crtc->Get()->GetId() : 0;
+  Unlock();
 
-  return InitWorker();
+  if (enabled_ && (listener_ == nullptr || !ArmHwVBlank())) {
+    StartSyntheticVSync();
+  }
+
+  return 0;
 }
 
 void VSyncWorker::VSyncControl(bool enabled) {
@@ -46,6 +66,47 @@ void VSyncWorker::VSyncControl(bool enabled) {
   last_timestamp_ = -1;
   Unlock();
 
+  if (enabled) {
+    if (listener_ != nullptr && ArmHwVBlank()) {
+      use_synthetic_ = false;
+    } else {
+      StartSyntheticVSync();
+    }
+  }
+
+  Signal();
+}
+
+auto VSyncWorker::ArmHwVBlank() -> bool {
+  return listener_->QueueVBlank(crtc_id_, [this](int64_t timestamp) {
+    OnHwVBlank(timestamp);
+  }) == 0;
+}
+
+/* Called from the event listener thread */
+void VSyncWorker::OnHwVBlank(int64_t timestamp) {
+  if (!enabled_) {
+    /* Don't re-arm, until enabled again */
+    return;
+  }
+
+  if (callback_) {
+    callback_(timestamp);
+  }
+
+  last_timestamp_ = timestamp;
+
+  if (enabled_ && !ArmHwVBlank()) {
+    /* CRTC got disabled, keep the client running with emulated vsync */
+    StartSyntheticVSync();
+  }
+}
+
+void VSyncWorker::StartSyntheticVSync() {
+  use_synthetic_ = true;
+  if (!initialized()) {
+    InitWorker();
+  }
   Signal();
 }
 
@@ -104,51 +165,40 @@ void VSyncWorker::Routine() {
   int ret = 0;
 
   Lock();
-  if (!enabled_) {
+  if (!enabled_ || !use_synthetic_) {
     ret = WaitForSignalOrExitLocked();
     if (ret == -EINTR) {
       Unlock();
       return;
     }
   }
-
-  auto *pipe = pipe_;
   Unlock();
 
-  ret = -EAGAIN;
-  int64_t timestamp = 0;
-  drmVBlank vblank{};
-
-  if (pipe != nullptr) {
-    uint32_t high_crtc = (pipe->crtc->Get()->GetIndexInResArray()
-                          << DRM_VBLANK_HIGH_CRTC_SHIFT);
-
-    vblank.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE |
-                                             (high_crtc &
-                                              DRM_VBLANK_HIGH_CRTC_MASK));
-    vblank.request.sequence = 1;
+  if (!enabled_ || !use_synthetic_)
+    return;
 
-    ret = drmWaitVBlank(pipe->device->GetFd(), &vblank);
-    if (ret == -EINTR)
-      return;
-  }
+  int64_t timestamp = 0;
+  ret = SyntheticWaitVBlank(&timestamp);
+  if (ret)
+    return;
 
-  if (ret) {
-    ret = SyntheticWaitVBlank(&timestamp);
-    if (ret)
-      return;
-  } else {
-    timestamp = (int64_t)vblank.reply.tval_sec * kOneSecondNs +
-                (int64_t)vblank.reply.tval_usec * 1000;
-  }
+  /* Init() may replace the callback while this thread is running */
+  Lock();
+  auto callback = callback_;
+  Unlock();
 
-  if (!enabled_)
+  if (!enabled_ || !use_synthetic_)
     return;
 
-  if (callback_) {
-    callback_(timestamp);
+  if (callback) {
+    callback(timestamp);
   }
 
   last_timestamp_ = timestamp;
+
+  /* Switch back to the kernel events once the CRTC is able to deliver them */
+  if (enabled_ && listener_ != nullptr && ArmHwVBlank()) {
+    use_synthetic_ = false;
+  }
 }
 }  // namespace android
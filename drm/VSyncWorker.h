@@ -31,10 +31,15 @@
 
 namespace android {
 
+/*
+ * Delivers vsync from the kernel vblank events read by the DrmEventListener
+ * of the device. The worker thread is only started to emulate vsync, when
+ * there is no pipeline or the CRTC can't deliver vblank events.
+ */
 class VSyncWorker : public Worker {
  public:
   VSyncWorker();
-  ~VSyncWorker() override = default;
+  ~VSyncWorker() override;
 
   auto Init(DrmDisplayPipeline *pipe,
             std::function<void(uint64_t /*timestamp*/)> callback) -> int;
@@ -48,11 +53,18 @@ class VSyncWorker : public Worker {
   int64_t GetPhasedVSync(int64_t frame_ns, int64_t current) const;
   int SyntheticWaitVBlank(int64_t *timestamp);
 
+  auto ArmHwVBlank() -> bool;
+  void OnHwVBlank(int64_t timestamp);
+  void StartSyntheticVSync();
+
   std::function<void(uint64_t /*timestamp*/)> callback_;
 
   DrmDisplayPipeline *pipe_ = nullptr;
+  DrmEventListener *listener_ = nullptr;
+  uint32_t crtc_id_ = 0;
   std::atomic_bool enabled_ = false;
-  int64_t last_timestamp_ = -1;
+  std::atomic_bool use_synthetic_ = false;
+  std::atomic_int64_t last_timestamp_ = -1;
 };
 }  // namespace android
 
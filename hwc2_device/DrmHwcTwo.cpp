@@ -19,13 +19,71 @@
 #include "DrmHwcTwo.h"
 
 #include <cinttypes>
+#include <shared_mutex>
 
 #include "backend/Backend.h"
 #include "utils/log.h"
 
 namespace android {
 
-DrmHwcTwo::DrmHwcTwo() : resource_manager_(this){};
+DrmHwcTwo::DrmHwcTwo() : resource_manager_(this) {
+  disposal_thread_ = std::thread(&DrmHwcTwo::DisposalRoutine, this);
+}
+
+DrmHwcTwo::~DrmHwcTwo() {
+  {
+    const std::lock_guard<std::mutex> lock(disposal_mutex_);
+    disposal_exit_ = true;
+  }
+  disposal_cv_.notify_all();
+  disposal_thread_.join();
+}
+
+void DrmHwcTwo::DisposalRoutine() {
+  std::unique_lock<std::mutex> lock(disposal_mutex_);
+  for (;;) {
+    if (disposal_exit_) {
+      return;
+    }
+
+    if (pending_disposals_.empty()) {
+      disposal_cv_.wait(lock);
+      continue;
+    }
+
+    /* Deadlines are queued in order, the front one expires first */
+    auto deadline = pending_disposals_.front().deadline;
+    if (std::chrono::steady_clock::now() < deadline) {
+      disposal_cv_.wait_until(lock, deadline);
+      continue;
+    }
+
+    std::vector<hwc2_display_t> handles;
+    while (!pending_disposals_.empty() &&
+           pending_disposals_.front().deadline <= deadline) {
+      handles.emplace_back(pending_disposals_.front().handle);
+      pending_disposals_.pop_front();
+    }
+    lock.unlock();
+
+    std::vector<std::unique_ptr<HwcDisplay>> for_disposal;
+    {
+      const std::lock_guard<std::shared_mutex> main_lock(
+          GetResMan().GetMainLock());
+      for (auto handle : handles) {
+        auto it = displays_.find(handle);
+        if (it != displays_.end()) {
+          for_disposal.emplace_back(std::move(it->second));
+          displays_.erase(it);
+        }
+      }
+    }
+    /* Destroy HwcDisplays while unlocked to avoid vsyncworker deadlocks */
+    for_disposal.clear();
+
+    lock.lock();
+  }
+}
 
 /* Must be called after every display attach/detach cycle */
 void DrmHwcTwo::FinalizeDisplayBinding() {
@@ -54,23 +112,24 @@ void DrmHwcTwo::FinalizeDisplayBinding() {
   }
   deferred_hotplug_events_.clear();
 
-  /* Wait 0.2s before removing the displays to flush pending HWC2 transactions
+  if (displays_for_removal_list_.empty()) {
+    return;
+  }
+
+  /* Give SF 0.2s to flush pending HWC2 transactions before removing the
+   * displays, see DisposalRoutine()
    */
-  auto &mutex = GetResMan().GetMainLock();
-  mutex.unlock();
-  const int kTimeForSFToDisposeDisplayUs = 200000;
-  usleep(kTimeForSFToDisposeDisplayUs);
-  mutex.lock();
-  std::vector<std::unique_ptr<HwcDisplay>> for_disposal;
-  for (auto handle : displays_for_removal_list_) {
-    for_disposal.emplace_back(
-        std::unique_ptr<HwcDisplay>(displays_[handle].release()));
-    displays_.erase(handle);
+  constexpr auto kTimeForSFToDisposeDisplay = std::chrono::milliseconds(200);
+  auto deadline = std::chrono::steady_clock::now() +
+                  kTimeForSFToDisposeDisplay;
+  {
+    const std::lock_guard<std::mutex> lock(disposal_mutex_);
+    for (auto handle : displays_for_removal_list_) {
+      pending_disposals_.push_back({handle, deadline});
+    }
   }
-  /* Destroy HwcDisplays while unlocked to avoid vsyncworker deadlocks */
-  mutex.unlock();
-  for_disposal.clear();
-  mutex.lock();
+  displays_for_removal_list_.clear();
+  disposal_cv_.notify_all();
 }
 
 HwcDisplay *DrmHwcTwo::GetDisplay(DrmDisplayPipeline *pipeline) {
@@ -175,6 +234,13 @@ void DrmHwcTwo::Dump(uint32_t *outSize, char *outBuffer) {
   *outSize = static_cast<uint32_t>(mDumpString.size());
 }
 
+auto DrmHwcTwo::GetFrameTimings(hwc2_display_t display_handle)
+    -> std::shared_ptr<FrameTimings> {
+  const std::shared_lock<std::shared_mutex> lock(GetResMan().GetMainLock());
+  auto *display = GetDisplay(display_handle);
+  return display != nullptr ? display->GetFrameTimings() : nullptr;
+}
+
 uint32_t DrmHwcTwo::GetMaxVirtualDisplayCount() {
   // TODO(nobody): Implement virtual display
   return 0;
@@ -185,7 +251,10 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
                                         hwc2_function_pointer_t function) {
   switch (static_cast<HWC2::Callback>(descriptor)) {
     case HWC2::Callback::Hotplug: {
-      hotplug_callback_ = std::make_pair(HWC2_PFN_HOTPLUG(function), data);
+      {
+        const std::lock_guard<std::mutex> lock(callbacks_lock_);
+        hotplug_callback_ = std::make_pair(HWC2_PFN_HOTPLUG(function), data);
+      }
       if (function != nullptr) {
         resource_manager_.Init();
       } else {
@@ -202,19 +271,23 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
       break;
     }
     case HWC2::Callback::Refresh: {
+      const std::lock_guard<std::mutex> lock(callbacks_lock_);
       refresh_callback_ = std::make_pair(HWC2_PFN_REFRESH(function), data);
       break;
     }
     case HWC2::Callback::Vsync: {
+      const std::lock_guard<std::mutex> lock(callbacks_lock_);
       vsync_callback_ = std::make_pair(HWC2_PFN_VSYNC(function), data);
       break;
     }
 #if PLATFORM_SDK_VERSION > 29
     case HWC2::Callback::Vsync_2_4: {
+      const std::lock_guard<std::mutex> lock(callbacks_lock_);
       vsync_2_4_callback_ = std::make_pair(HWC2_PFN_VSYNC_2_4(function), data);
       break;
     }
     case HWC2::Callback::VsyncPeriodTimingChanged: {
+      const std::lock_guard<std::mutex> lock(callbacks_lock_);
       period_timing_changed_callback_ = std::
           make_pair(HWC2_PFN_VSYNC_PERIOD_TIMING_CHANGED(function), data);
       break;
@@ -235,7 +308,9 @@ void DrmHwcTwo::SendHotplugEventToClient(hwc2_display_t displayid,
     return;
   }
 
+  std::unique_lock<std::mutex> lock(callbacks_lock_);
   auto hc = hotplug_callback_;
+  lock.unlock();
   if (hc.first != nullptr && hc.second != nullptr) {
     /* For some reason CLIENT will call HWC2 API in hotplug callback handler,
      * which will cause deadlock . Unlock main mutex to prevent this.
@@ -298,17 +373,21 @@ void DrmHwcTwo::DisableHDCPSessionForAllDisplays() {
 void DrmHwcTwo::SendVsyncEventToClient(
     hwc2_display_t displayid, int64_t timestamp,
     [[maybe_unused]] uint32_t vsync_period) const {
+  std::unique_lock<std::mutex> lock(callbacks_lock_);
+#if PLATFORM_SDK_VERSION > 29
+  auto vc_2_4 = vsync_2_4_callback_;
+#endif
+  auto vc = vsync_callback_;
+  lock.unlock();
+
   /* vsync callback */
 #if PLATFORM_SDK_VERSION > 29
-  if (vsync_2_4_callback_.first != nullptr &&
-      vsync_2_4_callback_.second != nullptr) {
-    vsync_2_4_callback_.first(vsync_2_4_callback_.second, displayid, timestamp,
-                              vsync_period);
+  if (vc_2_4.first != nullptr && vc_2_4.second != nullptr) {
+    vc_2_4.first(vc_2_4.second, displayid, timestamp, vsync_period);
   } else
 #endif
-      if (vsync_callback_.first != nullptr &&
-          vsync_callback_.second != nullptr) {
-    vsync_callback_.first(vsync_callback_.second, displayid, timestamp);
+      if (vc.first != nullptr && vc.second != nullptr) {
+    vc.first(vc.second, displayid, timestamp);
   }
 }
 
@@ -321,12 +400,28 @@ void DrmHwcTwo::SendVsyncPeriodTimingChangedEventToClient(
       .refreshRequired = false,
       .refreshTimeNanos = 0,
   };
-  if (period_timing_changed_callback_.first != nullptr &&
-      period_timing_changed_callback_.second != nullptr) {
-    period_timing_changed_callback_
-        .first(period_timing_changed_callback_.second, displayid, &timeline);
+  std::unique_lock<std::mutex> lock(callbacks_lock_);
+  auto ptc = period_timing_changed_callback_;
+  lock.unlock();
+
+  if (ptc.first != nullptr && ptc.second != nullptr) {
+    ptc.first(ptc.second, displayid, &timeline);
   }
 #endif
 }
 
+auto DrmHwcTwo::SendRefreshEventToClient(hwc2_display_t displayid) const
+    -> bool {
+  std::unique_lock<std::mutex> lock(callbacks_lock_);
+  auto rc = refresh_callback_;
+  lock.unlock();
+
+  if (rc.first == nullptr || rc.second == nullptr) {
+    return false;
+  }
+
+  rc.first(rc.second, displayid);
+  return true;
+}
+
 }  // namespace android
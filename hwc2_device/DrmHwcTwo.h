@@ -19,6 +19,12 @@
 
 #include <hardware/hwcomposer2.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include "drm/ResourceManager.h"
 #include "hwc2_device/HwcDisplay.h"
 
@@ -27,16 +33,7 @@ namespace android {
 class DrmHwcTwo : public PipelineToFrontendBindingInterface {
  public:
   DrmHwcTwo();
-  ~DrmHwcTwo() override = default;
-
-  std::pair<HWC2_PFN_HOTPLUG, hwc2_callback_data_t> hotplug_callback_{};
-  std::pair<HWC2_PFN_VSYNC, hwc2_callback_data_t> vsync_callback_{};
-#if PLATFORM_SDK_VERSION > 29
-  std::pair<HWC2_PFN_VSYNC_2_4, hwc2_callback_data_t> vsync_2_4_callback_{};
-  std::pair<HWC2_PFN_VSYNC_PERIOD_TIMING_CHANGED, hwc2_callback_data_t>
-      period_timing_changed_callback_{};
-#endif
-  std::pair<HWC2_PFN_REFRESH, hwc2_callback_data_t> refresh_callback_{};
+  ~DrmHwcTwo() override;
 
   // Device functions
   HWC2::Error CreateVirtualDisplay(uint32_t width, uint32_t height,
@@ -47,14 +44,18 @@ class DrmHwcTwo : public PipelineToFrontendBindingInterface {
   HWC2::Error RegisterCallback(int32_t descriptor, hwc2_callback_data_t data,
                                hwc2_function_pointer_t function);
 
-  auto GetDisplay(hwc2_display_t display_handle) {
-    return displays_.count(display_handle) != 0
-               ? displays_[display_handle].get()
-               : nullptr;
+  /* Called concurrently by per-display hooks, must not modify displays_ */
+  auto GetDisplay(hwc2_display_t display_handle) -> HwcDisplay * {
+    auto it = displays_.find(display_handle);
+    return it != displays_.end() ? it->second.get() : nullptr;
   }
 
   HwcDisplay *GetDisplay(DrmDisplayPipeline *pipeline) override;
 
+  /* For the diagnostic service, null if there's no such display */
+  auto GetFrameTimings(hwc2_display_t display_handle)
+      -> std::shared_ptr<FrameTimings>;
+
   auto &GetResMan() {
     return resource_manager_;
   }
@@ -72,6 +73,8 @@ class DrmHwcTwo : public PipelineToFrontendBindingInterface {
                               uint32_t vsync_period) const;
   void SendVsyncPeriodTimingChangedEventToClient(hwc2_display_t displayid,
                                                  int64_t timestamp) const;
+  /* Returns false if the client has no refresh callback registered */
+  auto SendRefreshEventToClient(hwc2_display_t displayid) const -> bool;
 
   void EnableHDCPSessionForDisplay(uint32_t connector,
                                    EHwcsContentType content_type);
@@ -83,6 +86,21 @@ class DrmHwcTwo : public PipelineToFrontendBindingInterface {
   void DisableHDCPSessionForAllDisplays();
  private:
   void SendHotplugEventToClient(hwc2_display_t displayid, bool connected);
+  void DisposalRoutine();
+
+  /* The vsync events are sent from the vsync threads without the main lock,
+   * so the callbacks are only accessed under callbacks_lock_. They are copied
+   * out and called without holding it.
+   */
+  mutable std::mutex callbacks_lock_;
+  std::pair<HWC2_PFN_HOTPLUG, hwc2_callback_data_t> hotplug_callback_{};
+  std::pair<HWC2_PFN_VSYNC, hwc2_callback_data_t> vsync_callback_{};
+#if PLATFORM_SDK_VERSION > 29
+  std::pair<HWC2_PFN_VSYNC_2_4, hwc2_callback_data_t> vsync_2_4_callback_{};
+  std::pair<HWC2_PFN_VSYNC_PERIOD_TIMING_CHANGED, hwc2_callback_data_t>
+      period_timing_changed_callback_{};
+#endif
+  std::pair<HWC2_PFN_REFRESH, hwc2_callback_data_t> refresh_callback_{};
 
   ResourceManager resource_manager_;
   std::map<hwc2_display_t, std::unique_ptr<HwcDisplay>> displays_;
@@ -93,8 +111,27 @@ class DrmHwcTwo : public PipelineToFrontendBindingInterface {
   std::map<hwc2_display_t, bool> deferred_hotplug_events_;
   std::vector<hwc2_display_t> displays_for_removal_list_;
 
+  /* Detached displays are removed by a separate thread after a grace period,
+   * so the hotplug handler doesn't have to wait for it.
+   */
+  struct PendingDisposal {
+    hwc2_display_t handle;
+    std::chrono::steady_clock::time_point deadline;
+  };
+  std::mutex disposal_mutex_;
+  std::condition_variable disposal_cv_;
+  std::deque<PendingDisposal> pending_disposals_;
+  bool disposal_exit_ = false;
+  std::thread disposal_thread_;
+
   uint32_t last_display_handle_ = kPrimaryDisplay;
 };
+
+/* Opens the HWC2 device in-process for frontends linking the HWC statically.
+ * The returned DrmHwcTwo is owned by the device and freed when it's closed.
+ */
+auto OpenDrmHwc2Device(hwc2_device_t **out_device) -> DrmHwcTwo *;
+
 }  // namespace android
 
 #endif
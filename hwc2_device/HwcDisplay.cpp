@@ -27,9 +27,20 @@
 #include "utils/properties.h"
 #include <sync/sync.h>
 #include <cinttypes>
+#include <cmath>
+#include <cstring>
 
 namespace android {
 
+/* DRM CTM entries are S31.32 sign-magnitude fixed point */
+static auto ToFixedPointS3132(float value) -> uint64_t {
+  constexpr uint64_t kSignBit = 1ULL << 63;
+  constexpr auto kOne = static_cast<double>(1ULL << 32);
+  auto magnitude = static_cast<uint64_t>(std::fabs(double(value)) * kOne) &
+                   ~kSignBit;
+  return value < 0 ? (magnitude | kSignBit) : magnitude;
+}
+
 std::string HwcDisplay::DumpDelta(HwcDisplay::Stats delta) {
   if (delta.total_pixops_ == 0)
     return "No stats yet";
@@ -43,6 +54,8 @@ std::string HwcDisplay::DumpDelta(HwcDisplay::Stats delta) {
              ? " !!! Internal failure, FIX it please\n"
              : "")
      << " Flattened frames: " << delta.frames_flattened_ << "\n"
+     << " Reused validations: " << delta.validations_reused_ << "\n"
+     << " Layers waiting for FB import: " << delta.deferred_fb_imports_ << "\n"
      << " Pixel operations (free units)"
      << " : [TOTAL: " << delta.total_pixops_ << " / GPU: " << delta.gpu_pixops_
      << "]\n"
@@ -77,8 +90,17 @@ std::string HwcDisplay::Dump() {
 
   std::stringstream ss;
   ss << "- Display on: " << connector_name << "\n"
-     << "  Flattening state: " << flattening_state_str << "\n"
-     << "Statistics since system boot:\n"
+     << "  Flattening state: " << flattening_state_str << "\n";
+  if (!IsInHeadlessMode()) {
+    auto &st_man = *GetPipe().atomic_state_manager;
+    ss << "  Test commit cache: " << st_man.GetTestCommitCacheHits()
+       << " hits / " << st_man.GetTestCommitCacheMisses() << " misses\n"
+       << st_man.DumpPresentStats()
+       << GetPipe().device->GetDrmFbImporter().Dump()
+       << GetPipe().device->GetPropertyBlobCache().Dump();
+  }
+  ss << frame_timings_->Dump();
+  ss << "Statistics since system boot:\n"
      << DumpDelta(total_stats_) << "\n\n"
      << "Statistics since last dumpsys request:\n"
      << DumpDelta(total_stats_.minus(prev_stats_)) << "\n\n";
@@ -128,6 +150,7 @@ void HwcDisplay::Deinit() {
 
     vsync_worker_.Init(nullptr, [](int64_t) {});
     current_plan_.reset();
+    composition_dirty_ = true;
     backend_.reset();
   }
 
@@ -137,12 +160,18 @@ void HwcDisplay::Deinit() {
 HWC2::Error HwcDisplay::Init() {
   ChosePreferredConfig();
 
+  if (pipeline_ != nullptr) {
+    GetPipe().atomic_state_manager->SetFrameTimings(frame_timings_);
+  }
+
+  /* Vsync delivery doesn't take the main or the display lock: everything it
+   * touches is atomic, and DrmHwcTwo reads the client callbacks under its own
+   * lock. The vsync worker cancels its vblank events and stops its thread
+   * before the display is destroyed.
+   */
   int ret = vsync_worker_.Init(pipeline_, [this](int64_t timestamp) {
-    const std::lock_guard<std::mutex> lock(hwc2_->GetResMan().GetMainLock());
     if (vsync_event_en_) {
-      uint32_t period_ns{};
-      GetDisplayVsyncPeriod(&period_ns);
-      hwc2_->SendVsyncEventToClient(handle_, timestamp, period_ns);
+      hwc2_->SendVsyncEventToClient(handle_, timestamp, vsync_period_ns_);
     }
     if (vsync_flattening_en_) {
       ProcessFlatenningVsyncInternal();
@@ -183,31 +212,31 @@ HWC2::Error HwcDisplay::ChosePreferredConfig() {
     return HWC2::Error::BadDisplay;
   }
 
-  return SetActiveConfig(configs_.preferred_config_id);
+  auto ret = SetActiveConfig(configs_.preferred_config_id);
+  UpdateVsyncPeriod();
+  return ret;
 }
 
 HWC2::Error HwcDisplay::AcceptDisplayChanges() {
-  for (std::pair<const hwc2_layer_t, HwcLayer> &l : layers_)
-    l.second.AcceptTypeChange();
+  for (auto &hot : layers_.GetHotStates())
+    hot.sf_type = hot.validated_type;
   return HWC2::Error::None;
 }
 
 HWC2::Error HwcDisplay::CreateLayer(hwc2_layer_t *layer) {
   bool allow_p2p = !IsInHeadlessMode() && GetPipe().crtc->Get()
       && GetPipe().crtc->Get()->GetAllowP2P();
-  layers_.emplace(static_cast<hwc2_layer_t>(layer_idx_),
-                  HwcLayer(this, allow_p2p));
-  *layer = static_cast<hwc2_layer_t>(layer_idx_);
-  ++layer_idx_;
+  *layer = layers_.Emplace(this, allow_p2p, /*async_fb_import=*/true);
+  composition_dirty_ = true;
   return HWC2::Error::None;
 }
 
 HWC2::Error HwcDisplay::DestroyLayer(hwc2_layer_t layer) {
-  if (!get_layer(layer)) {
+  if (!layers_.Erase(layer)) {
     return HWC2::Error::BadLayer;
   }
 
-  layers_.erase(layer);
+  composition_dirty_ = true;
   return HWC2::Error::None;
 }
 
@@ -228,12 +257,14 @@ HWC2::Error HwcDisplay::GetChangedCompositionTypes(uint32_t *num_elements,
   }
 
   uint32_t num_changes = 0;
-  for (std::pair<const hwc2_layer_t, HwcLayer> &l : layers_) {
-    if (l.second.IsTypeChanged()) {
+  auto &hot_states = layers_.GetHotStates();
+  for (size_t i = 0; i < hot_states.size(); i++) {
+    auto &hot = hot_states[i];
+    if (hot.sf_type != hot.validated_type) {
       if (layers && num_changes < *num_elements)
-        layers[num_changes] = l.first;
+        layers[num_changes] = layers_.GetEntry(i).handle;
       if (types && num_changes < *num_elements)
-        types[num_changes] = static_cast<int32_t>(l.second.GetValidatedType());
+        types[num_changes] = static_cast<int32_t>(hot.validated_type);
       ++num_changes;
     }
   }
@@ -487,8 +518,9 @@ HWC2::Error HwcDisplay::GetReleaseFences(uint32_t *num_elements,
 
   uint32_t num_layers = 0;
 
-  for (auto &l : layers_) {
-    if (!l.second.GetPriorBufferScanOutFlag() || !present_fence_) {
+  auto &hot_states = layers_.GetHotStates();
+  for (size_t i = 0; i < hot_states.size(); i++) {
+    if (!hot_states[i].prior_buffer_scanout || !present_fence_) {
       continue;
     }
 
@@ -502,7 +534,7 @@ HWC2::Error HwcDisplay::GetReleaseFences(uint32_t *num_elements,
       return HWC2::Error::None;
     }
 
-    layers[num_layers - 1] = l.first;
+    layers[num_layers - 1] = layers_.GetEntry(i).handle;
     fences[num_layers - 1] = UniqueFd::Dup(present_fence_.Get()).Release();
   }
   *num_elements = num_layers;
@@ -530,6 +562,7 @@ HWC2::Error HwcDisplay::CreateComposition(AtomicCommitArgs &a_args) {
                      .bottom = static_cast<int>(staged_mode_->v_display())});
 
     configs_.active_config_id = staged_mode_config_id_;
+    UpdateVsyncPeriod();
 
     a_args.display_mode = *staged_mode_;
     if (!a_args.test_only) {
@@ -538,41 +571,62 @@ HWC2::Error HwcDisplay::CreateComposition(AtomicCommitArgs &a_args) {
   }
 
   a_args.color_adjustment = GetPipe().device->GetColorAdjustmentEnabling();
+  if (!CtmByGpu()) {
+    a_args.color_matrix = color_matrix_;
+  }
 
   // order the layers by z-order
   bool use_client_layer = false;
   uint32_t client_z_order = UINT32_MAX;
-  std::map<uint32_t, HwcLayer *> z_map;
-  for (std::pair<const hwc2_layer_t, HwcLayer> &l : layers_) {
-    switch (l.second.GetValidatedType()) {
+  composition_z_order_.clear();
+  auto add_layer = [this](uint32_t z_order, HwcLayer *layer) {
+    composition_z_order_.emplace_back((uint64_t(z_order) << 32) |
+                                          composition_z_order_.size(),
+                                      layer);
+  };
+  auto &hot_states = layers_.GetHotStates();
+  for (size_t i = 0; i < hot_states.size(); i++) {
+    auto &hot = hot_states[i];
+    switch (hot.validated_type) {
       case HWC2::Composition::Device:
-        z_map.emplace(std::make_pair(l.second.GetZOrder(), &l.second));
+        add_layer(hot.z_order, layers_.GetEntry(i).layer);
         break;
       case HWC2::Composition::Client:
         // Place it at the z_order of the lowest client layer
         use_client_layer = true;
-        client_z_order = std::min(client_z_order, l.second.GetZOrder());
+        client_z_order = std::min(client_z_order, hot.z_order);
+        if (!a_args.test_only) {
+          layers_.GetEntry(i).layer->ResetDamageTracking();
+        }
         break;
       default:
         continue;
     }
   }
   if (use_client_layer)
-    z_map.emplace(std::make_pair(client_z_order, &client_layer_));
+    add_layer(client_z_order, &client_layer_);
+  else if (!a_args.test_only)
+    client_layer_.ResetDamageTracking();
 
-  if (z_map.empty())
+  if (composition_z_order_.empty())
     return HWC2::Error::BadLayer;
 
-  std::vector<LayerData> composition_layers;
+  /* Sort by z_order, keeping only the first added layer of each z_order */
+  std::sort(composition_z_order_.begin(), composition_z_order_.end());
+  composition_z_order_.erase(
+      std::unique(composition_z_order_.begin(), composition_z_order_.end(),
+                  [](const auto &a, const auto &b) {
+                    return a.first >> 32 == b.first >> 32;
+                  }),
+      composition_z_order_.end());
 
   /* Import & populate */
-  for (std::pair<const uint32_t, HwcLayer *> &l : z_map) {
-    l.second->PopulateLayerData(a_args.test_only);
+  for (auto &[key, layer] : composition_z_order_) {
+    layer->PopulateLayerData(a_args.test_only);
   }
 
-  // now that they're ordered by z, add them to the composition
-  for (std::pair<const uint32_t, HwcLayer *> &l : z_map) {
-    if (!l.second->IsLayerUsableAsDevice()) {
+  for (auto &[key, layer] : composition_z_order_) {
+    if (!layer->IsLayerUsableAsDevice()) {
       /* This will be normally triggered on validation of the first frame
        * containing CLIENT layer. At this moment client buffer is not yet
        * provided by the CLIENT.
@@ -582,14 +636,30 @@ HWC2::Error HwcDisplay::CreateComposition(AtomicCommitArgs &a_args) {
        */
       return HWC2::Error::BadLayer;
     }
-    composition_layers.emplace_back(l.second->GetLayerData().Clone());
   }
 
   /* Store plan to ensure shared planes won't be stolen by other display
-   * in between of ValidateDisplay() and PresentDisplay() calls
+   * in between of ValidateDisplay() and PresentDisplay() calls.
+   * An unchanged layer stack keeps the planes and is updated in place.
    */
-  current_plan_ = DrmKmsPlan::CreateDrmKmsPlan(GetPipe(),
-                                               std::move(composition_layers));
+  if (plan_reusable_ && current_plan_ && current_plan_.use_count() == 1 &&
+      current_plan_->plan.size() == composition_z_order_.size()) {
+    for (size_t i = 0; i < composition_z_order_.size(); i++) {
+      composition_z_order_[i].second->GetLayerData().CloneTo(
+          current_plan_->plan[i].layer);
+    }
+  } else {
+    std::vector<LayerData> composition_layers;
+    composition_layers.reserve(composition_z_order_.size());
+    // now that they're ordered by z, add them to the composition
+    for (auto &[key, layer] : composition_z_order_) {
+      composition_layers.emplace_back(layer->GetLayerData().Clone());
+    }
+
+    const ScopedFrameStage plan_stage(frame_timings_.get(), FrameStage::kPlan);
+    current_plan_ = DrmKmsPlan::CreateDrmKmsPlan(GetPipe(),
+                                                 std::move(composition_layers));
+  }
   if (!current_plan_) {
     if (!a_args.test_only) {
       ALOGE("Failed to create DrmKmsPlan");
@@ -648,8 +718,10 @@ HWC2::Error HwcDisplay::PresentDisplay(int32_t *out_present_fence) {
   AtomicCommitArgs a_args{};
   ret = CreateComposition(a_args);
 
-  if (ret != HWC2::Error::None)
+  if (ret != HWC2::Error::None) {
     ++total_stats_.failed_kms_present_;
+    composition_dirty_ = true;
+  }
 
   if (ret == HWC2::Error::BadLayer) {
     // Can we really have no client or device layers?
@@ -676,6 +748,7 @@ HWC2::Error HwcDisplay::SetActiveConfigInternal(uint32_t config,
   staged_mode_ = configs_.hwc_configs[config].mode;
   staged_mode_change_time_ = change_time;
   staged_mode_config_id_ = config;
+  composition_dirty_ = true;
 
   return HWC2::Error::None;
 }
@@ -690,9 +763,10 @@ HWC2::Error HwcDisplay::SetActiveConfig(hwc2_config_t config) {
 HWC2::Error HwcDisplay::SetClientTarget(buffer_handle_t target,
                                         int32_t acquire_fence,
                                         int32_t dataspace,
-                                        hwc_region_t /*damage*/) {
+                                        hwc_region_t damage) {
   client_layer_.SetLayerBuffer(target, acquire_fence);
   client_layer_.SetLayerDataspace(dataspace);
+  client_layer_.SetLayerSurfaceDamage(damage);
 
   /*
    * target can be nullptr, this does mean the Composer Service is calling
@@ -744,13 +818,63 @@ HWC2::Error HwcDisplay::SetColorTransform(const float *matrix, int32_t hint) {
   if (!matrix && hint == HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX)
     return HWC2::Error::BadParameter;
 
+  bool changed = color_transform_hint_ != hint;
   color_transform_hint_ = static_cast<android_color_transform_t>(hint);
-  if (color_transform_hint_ == HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX)
+  if (color_transform_hint_ == HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX) {
+    changed |= !std::equal(matrix, matrix + MATRIX_SIZE,
+                           color_transform_matrix_.begin());
     std::copy(matrix, matrix + MATRIX_SIZE, color_transform_matrix_.begin());
+  }
+
+  if (changed)
+    composition_dirty_ = true;
+
+  if (color_transform_hint_ == HAL_COLOR_TRANSFORM_IDENTITY || !matrix) {
+    color_matrix_.reset();
+    matrix_needs_gpu_ = false;
+    return HWC2::Error::None;
+  }
+
+  /* The matrix is applied as out = in * M, the CTM as out = CTM * in */
+  drm_color_ctm ctm{};
+  for (size_t row = 0; row < 3; row++) {
+    for (size_t col = 0; col < 3; col++) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      ctm.matrix[row * 3 + col] = ToFixedPointS3132(matrix[col * 4 + row]);
+    }
+  }
+
+  /* Frames compare the CTM by pointer, keep it for an unchanged matrix */
+  if (!color_matrix_ ||
+      memcmp(color_matrix_.get(), &ctm, sizeof(ctm)) != 0) {
+    color_matrix_ = std::make_shared<drm_color_ctm>(ctm);
+  }
+
+  /* The offset row and the alpha column have no place in the 3x3 CTM */
+  matrix_needs_gpu_ = false;
+  for (size_t i : {3, 7, 11, 12, 13, 14}) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    matrix_needs_gpu_ |= matrix[i] != 0.0F;
+  }
 
   return HWC2::Error::None;
 }
 
+bool HwcDisplay::CtmByGpu() {
+  if (color_transform_hint_ == HAL_COLOR_TRANSFORM_IDENTITY)
+    return false;
+
+  /* The GPU applies the matrix when the 3x3 CTM can't express it, or when
+   * the CRTC has no CTM free for it: missing, or owned by the vendor color
+   * adjustment.
+   */
+  if (!color_matrix_ || matrix_needs_gpu_ || IsInHeadlessMode() ||
+      GetPipe().device->GetColorAdjustmentEnabling())
+    return true;
+
+  return !GetPipe().crtc->Get()->GetCtmProperty();
+}
+
 HWC2::Error HwcDisplay::SetOutputBuffer(buffer_handle_t /*buffer*/,
                                         int32_t /*release_fence*/) {
   // TODO(nobody): Need virtual display support
@@ -763,6 +887,8 @@ HWC2::Error HwcDisplay::SetPowerMode(int32_t mode_in) {
 
   AtomicCommitArgs a_args{};
 
+  composition_dirty_ = true;
+
   switch (mode) {
     case HWC2::PowerMode::Off:
       a_args.active = false;
@@ -828,32 +954,81 @@ HWC2::Error HwcDisplay::ValidateDisplay(uint32_t *num_types,
     return HWC2::Error::None;
   }
 
+  const ScopedFrameStage validate_stage(frame_timings_.get(),
+                                        FrameStage::kValidate);
+
   /* In current drm_hwc design in case previous frame layer was not validated as
    * a CLIENT, it is used by display controller (Front buffer). We have to store
    * this state to provide the CLIENT with the release fences for such buffers.
    */
-  for (auto &l : layers_) {
-    l.second.SetPriorBufferScanOutFlag(l.second.GetValidatedType() !=
-                                       HWC2::Composition::Client);
+  for (auto &hot : layers_.GetHotStates()) {
+    hot.prior_buffer_scanout = hot.validated_type != HWC2::Composition::Client;
+  }
+
+  /* Layers whose new buffer is still being imported go to the CLIENT, rather
+   * than stalling the frame
+   */
+  constexpr auto kFbImportWaitBudget = std::chrono::milliseconds(2);
+  auto import_deadline = std::chrono::steady_clock::now() + kFbImportWaitBudget;
+  bool fb_import_deferred = false;
+  for (auto &[handle, layer] : layers_) {
+    if (!layer->WaitFbImport(import_deadline)) {
+      total_stats_.deferred_fb_imports_++;
+      fb_import_deferred = true;
+    }
+  }
+
+  plan_reusable_ = false;
+  auto failed_kms_validate = total_stats_.failed_kms_validate_;
+
+  auto ret = backend_->ValidateDisplay(this, num_types, num_requests);
+
+  for (auto &hot : layers_.GetHotStates()) {
+    hot.state_changed = false;
   }
 
-  return backend_->ValidateDisplay(this, num_types, num_requests);
+  /* Flattened frames, frames that failed the test commit and frames with
+   * deferred imports have to be followed by a full validation
+   */
+  composition_dirty_ = ret == HWC2::Error::Unsupported ||
+                       flattenning_state_ == ClientFlattenningState::Flattened ||
+                       total_stats_.failed_kms_validate_ !=
+                           failed_kms_validate ||
+                       fb_import_deferred;
+
+  return ret;
 }
 
-std::vector<HwcLayer *> HwcDisplay::GetOrderLayersByZPos() {
-  std::vector<HwcLayer *> ordered_layers;
-  ordered_layers.reserve(layers_.size());
+bool HwcDisplay::IsCompositionUnchanged() {
+  if (composition_dirty_ || staged_mode_ || !current_plan_) {
+    return false;
+  }
 
   for (auto &[handle, layer] : layers_) {
-    ordered_layers.emplace_back(&layer);
+    /* A CLIENT layer may only be waiting for its buffer import */
+    if (layer->IsFbImportDeferred()) {
+      return false;
+    }
+
+    /* Import new buffers now to catch format or modifier changes */
+    if (layer->GetValidatedType() == HWC2::Composition::Device) {
+      layer->PopulateLayerData(/*test = */ true);
+      if (!layer->IsLayerUsableAsDevice()) {
+        return false;
+      }
+    }
+
+    if (layer->IsStateChanged()) {
+      return false;
+    }
   }
 
-  std::sort(std::begin(ordered_layers), std::end(ordered_layers),
-            [](const HwcLayer *lhs, const HwcLayer *rhs) {
-              return lhs->GetZOrder() < rhs->GetZOrder();
-            });
+  plan_reusable_ = true;
+  return true;
+}
 
-  return ordered_layers;
+std::vector<HwcLayer *> &HwcDisplay::GetOrderLayersByZPos() {
+  return layers_.GetZOrdered();
 }
 
 HWC2::Error HwcDisplay::GetDisplayVsyncPeriod(
@@ -863,6 +1038,13 @@ HWC2::Error HwcDisplay::GetDisplayVsyncPeriod(
                              (int32_t *)(outVsyncPeriod));
 }
 
+void HwcDisplay::UpdateVsyncPeriod() {
+  uint32_t period_ns{};
+  GetDisplayVsyncPeriod(&period_ns);
+  vsync_period_ns_ = period_ns;
+  frame_timings_->SetVsyncPeriod(period_ns);
+}
+
 #if PLATFORM_SDK_VERSION > 29
 HWC2::Error HwcDisplay::GetDisplayConnectionType(uint32_t *outType) {
   if (IsInHeadlessMode()) {
@@ -1088,9 +1270,7 @@ bool HwcDisplay::ProcessClientFlatteningState(bool skip) {
 void HwcDisplay::ProcessFlatenningVsyncInternal() {
   if (flattenning_state_ > ClientFlattenningState::ClientRefreshRequested &&
       --flattenning_state_ == ClientFlattenningState::ClientRefreshRequested &&
-      hwc2_->refresh_callback_.first != nullptr &&
-      hwc2_->refresh_callback_.second != nullptr) {
-    hwc2_->refresh_callback_.first(hwc2_->refresh_callback_.second, handle_);
+      hwc2_->SendRefreshEventToClient(handle_)) {
     vsync_flattening_en_ = false;
   }
 }
@@ -19,6 +19,8 @@
 
 #include <hardware/hwcomposer2.h>
 
+#include <atomic>
+#include <mutex>
 #include <optional>
 
 #include "HwcDisplayConfigs.h"
@@ -27,6 +29,8 @@
 #include "drm/ResourceManager.h"
 #include "drm/VSyncWorker.h"
 #include "hwc2_device/HwcLayer.h"
+#include "hwc2_device/HwcLayerMap.h"
+#include "utils/FrameTimings.h"
 #include "utils/hwc3.h"
 using namespace aidl::android::hardware::graphics::composer3;
 
@@ -47,7 +51,11 @@ class HwcDisplay {
   void SetPipeline(DrmDisplayPipeline *pipeline);
 
   HWC2::Error CreateComposition(AtomicCommitArgs &a_args);
-  std::vector<HwcLayer *> GetOrderLayersByZPos();
+  /* Valid until a layer is created or destroyed */
+  std::vector<HwcLayer *> &GetOrderLayersByZPos();
+
+  /* Returns true if the result of the previous validation can be reused */
+  bool IsCompositionUnchanged();
 
   void ClearDisplay();
 
@@ -123,10 +131,7 @@ class HwcDisplay {
   HWC3::Error setExpectedPresentTime(
       const std::optional<ClockMonotonicTimestamp>& expectedPresentTime);
   HwcLayer *get_layer(hwc2_layer_t layer) {
-    auto it = layers_.find(layer);
-    if (it == layers_.end())
-      return nullptr;
-    return &it->second;
+    return layers_.Get(layer);
   }
 
   /* Statistics */
@@ -137,7 +142,9 @@ class HwcDisplay {
               gpu_pixops_ - b.gpu_pixops_,
               failed_kms_validate_ - b.failed_kms_validate_,
               failed_kms_present_ - b.failed_kms_present_,
-              frames_flattened_ - b.frames_flattened_};
+              frames_flattened_ - b.frames_flattened_,
+              validations_reused_ - b.validations_reused_,
+              deferred_fb_imports_ - b.deferred_fb_imports_};
     }
 
     uint32_t total_frames_ = 0;
@@ -146,6 +153,8 @@ class HwcDisplay {
     uint32_t failed_kms_validate_ = 0;
     uint32_t failed_kms_present_ = 0;
     uint32_t frames_flattened_ = 0;
+    uint32_t validations_reused_ = 0;
+    uint32_t deferred_fb_imports_ = 0;
   };
 
   const Backend *backend() const;
@@ -155,10 +164,20 @@ class HwcDisplay {
     return hwc2_;
   }
 
-  std::map<hwc2_layer_t, HwcLayer> &layers() {
+  /* Serializes HWC2 calls to this display, see DisplayHook in hwc2_device */
+  auto &GetDisplayLock() {
+    return display_lock_;
+  }
+
+  HwcLayerMap &layers() {
     return layers_;
   }
 
+  /* Holds the buffer composited by the client */
+  auto &GetClientLayer() {
+    return client_layer_;
+  }
+
   auto &GetPipe() {
     return *pipeline_;
   }
@@ -167,10 +186,17 @@ class HwcDisplay {
     return color_transform_hint_;
   }
 
+  /* True if the color transform can't be applied by the CRTC */
+  bool CtmByGpu();
+
   Stats &total_stats() {
     return total_stats_;
   }
 
+  auto GetFrameTimings() -> std::shared_ptr<FrameTimings> {
+    return frame_timings_;
+  }
+
   /* returns true if composition should be sent to client */
   bool ProcessClientFlatteningState(bool skip);
   void ProcessFlatenningVsyncInternal();
@@ -214,30 +240,51 @@ class HwcDisplay {
 
   std::unique_ptr<Backend> backend_;
 
+  std::mutex display_lock_;
+
+  /* Accessed by the vsync thread without taking any lock */
   VSyncWorker vsync_worker_;
-  bool vsync_event_en_{};
-  bool vsync_flattening_en_{};
-  bool vsync_tracking_en_{};
-  int64_t last_vsync_ts_{};
+  std::atomic_bool vsync_event_en_{};
+  std::atomic_bool vsync_flattening_en_{};
+  std::atomic_bool vsync_tracking_en_{};
+  std::atomic_int64_t last_vsync_ts_{};
+  std::atomic_uint32_t vsync_period_ns_{};
+
+  void UpdateVsyncPeriod();
 
   const hwc2_display_t handle_;
   HWC2::DisplayType type_;
 
-  uint32_t layer_idx_{};
-
-  std::map<hwc2_layer_t, HwcLayer> layers_;
+  HwcLayerMap layers_;
   HwcLayer client_layer_;
   int32_t color_mode_{};
   std::vector<int32_t> current_color_mode_ = {HAL_COLOR_MODE_NATIVE, HAL_COLOR_MODE_BT2020, HAL_COLOR_MODE_BT2100_PQ, HAL_COLOR_MODE_BT2100_HLG, /*HAL_COLOR_MODE_DISPLAY_BT2020*/};
   std::array<float, MATRIX_SIZE> color_transform_matrix_{};
   android_color_transform_t color_transform_hint_;
+  /* color_transform_matrix_ converted for the CRTC, unset for identity */
+  std::shared_ptr<drm_color_ctm> color_matrix_;
+  /* The matrix has an offset or alpha terms, which the CTM can't express */
+  bool matrix_needs_gpu_{};
 
   std::shared_ptr<DrmKmsPlan> current_plan_;
 
+  /* (z_order << 32 | insertion index, layer) of the layers to compose. Kept
+   * to avoid heap allocations once the layer stack is stable.
+   */
+  std::vector<std::pair<uint64_t, HwcLayer *>> composition_z_order_;
+
+  /* Set when the display or layer stack changed since the last validation */
+  bool composition_dirty_ = true;
+  /* Set when current_plan_ may be reused for the frame being presented */
+  bool plan_reusable_{};
+
   std::optional<ClockMonotonicTimestamp> expectedPresentTime_ = std::nullopt;
   uint32_t frame_no_ = 0;
   Stats total_stats_;
   Stats prev_stats_;
+  /* Shared with the commit worker and the DRM event listener */
+  std::shared_ptr<FrameTimings> frame_timings_ =
+      std::make_shared<FrameTimings>();
   std::string DumpDelta(HwcDisplay::Stats delta);
 
   HWC2::Error Init();
@@ -16,6 +16,8 @@
 
 #define LOG_TAG "hwc-layer"
 
+#include <algorithm>
+
 #include <xf86drm.h>
 #include <linux/dma-buf.h>
 
@@ -28,12 +30,17 @@
 
 namespace android {
 
+HwcLayer::~HwcLayer() {
+  DropPendingFbImport();
+}
+
 // NOLINTNEXTLINE(readability-convert-member-functions-to-static)
 HWC2::Error HwcLayer::SetCursorPosition(int32_t /*x*/, int32_t /*y*/) {
   return HWC2::Error::None;
 }
 
 HWC2::Error HwcLayer::SetLayerBlendMode(int32_t mode) {
+  auto prev_blend_mode = blend_mode_;
   switch (static_cast<HWC2::BlendMode>(mode)) {
     case HWC2::BlendMode::None:
       blend_mode_ = BufferBlendMode::kNone;
@@ -49,6 +56,7 @@ HWC2::Error HwcLayer::SetLayerBlendMode(int32_t mode) {
       blend_mode_ = BufferBlendMode::kUndefined;
       break;
   }
+  GetHotState().state_changed |= prev_blend_mode != blend_mode_;
   return HWC2::Error::None;
 }
 
@@ -58,8 +66,13 @@ HWC2::Error HwcLayer::SetLayerBlendMode(int32_t mode) {
 HWC2::Error HwcLayer::SetLayerBuffer(buffer_handle_t buffer,
                                      int32_t acquire_fence) {
   acquire_fence_ = UniqueFd(acquire_fence);
+  GetHotState().state_changed |= (buffer == nullptr) !=
+                                 (buffer_handle_ == nullptr);
   buffer_handle_ = buffer;
   buffer_handle_updated_ = true;
+  buffer_presented_ = false;
+
+  StartFbImport();
 
   return HWC2::Error::None;
 }
@@ -71,11 +84,16 @@ HWC2::Error HwcLayer::SetLayerColor(hwc_color_t /*color*/) {
 }
 
 HWC2::Error HwcLayer::SetLayerCompositionType(int32_t type) {
-  sf_type_ = static_cast<HWC2::Composition>(type);
+  auto sf_type = static_cast<HWC2::Composition>(type);
+  auto &hot = GetHotState();
+  hot.state_changed |= sf_type != hot.sf_type;
+  hot.sf_type = sf_type;
   return HWC2::Error::None;
 }
 
 HWC2::Error HwcLayer::SetLayerDataspace(int32_t dataspace) {
+  auto prev_color_space = color_space_;
+  auto prev_sample_range = sample_range_;
   switch (dataspace & HAL_DATASPACE_STANDARD_MASK) {
     case HAL_DATASPACE_STANDARD_BT709:
       color_space_ = BufferColorSpace::kItuRec709;
@@ -104,16 +122,25 @@ HWC2::Error HwcLayer::SetLayerDataspace(int32_t dataspace) {
     default:
       sample_range_ = BufferSampleRange::kUndefined;
   }
+  GetHotState().state_changed |= prev_color_space != color_space_ ||
+                                 prev_sample_range != sample_range_;
   return HWC2::Error::None;
 }
 
 HWC2::Error HwcLayer::SetLayerDisplayFrame(hwc_rect_t frame) {
+  auto &hot = GetHotState();
+  auto &df = hot.display_frame;
+  hot.state_changed |= df.left != frame.left || df.top != frame.top ||
+                       df.right != frame.right || df.bottom != frame.bottom;
+  df = frame;
   layer_data_.pi.display_frame = frame;
   return HWC2::Error::None;
 }
 
 HWC2::Error HwcLayer::SetLayerPlaneAlpha(float alpha) {
-  layer_data_.pi.alpha = std::lround(alpha * UINT16_MAX);
+  auto new_alpha = static_cast<uint16_t>(std::lround(alpha * UINT16_MAX));
+  GetHotState().state_changed |= layer_data_.pi.alpha != new_alpha;
+  layer_data_.pi.alpha = new_alpha;
   return HWC2::Error::None;
 }
 
@@ -125,13 +152,29 @@ HWC2::Error HwcLayer::SetLayerSidebandStream(
 }
 
 HWC2::Error HwcLayer::SetLayerSourceCrop(hwc_frect_t crop) {
-  layer_data_.pi.source_crop = crop;
+  auto &sc = layer_data_.pi.source_crop;
+  GetHotState().state_changed |= sc.left != crop.left || sc.top != crop.top ||
+                                 sc.right != crop.right ||
+                                 sc.bottom != crop.bottom;
+  sc = crop;
   return HWC2::Error::None;
 }
 
-// NOLINTNEXTLINE(readability-convert-member-functions-to-static)
-HWC2::Error HwcLayer::SetLayerSurfaceDamage(hwc_region_t /*damage*/) {
-  // TODO(nobody): We don't use surface damage, marking as unsupported
+HWC2::Error HwcLayer::SetLayerSurfaceDamage(hwc_region_t damage) {
+  /* No rects means the whole buffer, a single empty rect means no damage */
+  if (damage.numRects == 0 || damage.rects == nullptr) {
+    surface_damage_.reset();
+    return HWC2::Error::None;
+  }
+
+  surface_damage_.emplace();
+  for (size_t i = 0; i < damage.numRects; i++) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const auto &r = damage.rects[i];
+    if (r.right > r.left && r.bottom > r.top) {
+      surface_damage_->emplace_back(r);
+    }
+  }
   return HWC2::Error::None;
 }
 
@@ -155,6 +198,7 @@ HWC2::Error HwcLayer::SetLayerTransform(int32_t transform) {
       l_transform |= LayerTransform::kRotate90;
   }
 
+  GetHotState().state_changed |= layer_data_.pi.transform != l_transform;
   layer_data_.pi.transform = static_cast<LayerTransform>(l_transform);
   return HWC2::Error::None;
 }
@@ -166,7 +210,9 @@ HWC2::Error HwcLayer::SetLayerVisibleRegion(hwc_region_t /*visible*/) {
 }
 
 HWC2::Error HwcLayer::SetLayerZOrder(uint32_t order) {
-  z_order_ = order;
+  auto &hot = GetHotState();
+  hot.state_changed |= hot.z_order != order;
+  hot.z_order = order;
   return HWC2::Error::None;
 }
 
@@ -237,7 +283,7 @@ HWC2::Error HwcLayer::SetLayerPerFrameMetadata(uint32_t numElements,
 }
 
 static bool InitializeBlitter(BufferInfo &bi) {
-  bi.blitter = std::make_shared<IntelBlitter>();
+  bi.blitter = IntelBlitter::GetInstance();
   if (!bi.blitter->Initialized()) {
     ALOGE("failed to initialize intel blitter\n");
     return false;
@@ -256,58 +302,60 @@ static bool InitializeBlitter(BufferInfo &bi) {
   int ret = drmPrimeHandleToFD(dgpu_fd, handle, 0, &bi.shadow_fds[0]);
   if (ret) {
     ALOGE("failed to export shadow buffer\n");
-    drmCloseBufferHandle(dgpu_fd, handle);
+    bi.blitter->ReleaseBuffer(handle);
     bi.blitter = nullptr;
     return false;
   }
-  ret = drmPrimeFDToHandle(dgpu_fd, bi.prime_fds[0], &bi.prime_buffer_handles[0]);
-  if (ret) {
+  /* Both handles are released by the DrmFbIdHandle of the shadow buffer */
+  if (!bi.blitter->ImportBuffer(bi.prime_fds[0], &bi.prime_buffer_handles[0])) {
     ALOGE("failed convert prime fd to handle\n");
     close(bi.shadow_fds[0]);
-    drmCloseBufferHandle(dgpu_fd, handle);
+    bi.blitter->ReleaseBuffer(handle);
     bi.blitter = nullptr;
     return false;
   }
   return true;
 }
 
-void HwcLayer::ImportFb() {
-  if (!IsLayerUsableAsDevice() || !buffer_handle_updated_) {
-    return;
-  }
-  buffer_handle_updated_ = false;
-
-  layer_data_.fb = {};
-
-  auto unique_id = BufferInfoGetter::GetInstance()->GetUniqueId(buffer_handle_);
-  if (unique_id && SwChainGetBufferFromCache(*unique_id)) {
-    return;
-  }
-
-  layer_data_.bi = BufferInfoGetter::GetInstance()->GetBoInfo(buffer_handle_);
-  if (!layer_data_.bi) {
-    ALOGW("Unable to get buffer information (0x%p)", buffer_handle_);
-    bi_get_failed_ = true;
-    return;
-  }
+auto HwcLayer::CreateFbImportRequest(std::optional<BufferUniqueId> unique_id)
+    -> FbImportRequest {
+  FbImportRequest request{};
+  request.handle = buffer_handle_;
+  request.unique_id = unique_id;
+  request.device = parent_->GetPipe().device;
+  request.timings = parent_->GetFrameTimings();
+  request.allow_p2p = allow_p2p_;
 
   /*
     consider device is virtio-gpu
     check if pixel blend mode is supported
   */
-  bool is_pixel_blend_mode_supported = true;
-  auto planes = parent_->GetPipe().GetUsablePlanes();
-  if (planes.size() == 1 && !planes.begin()->get()->Get()->IsPixBlendModeSupported())
-    is_pixel_blend_mode_supported = false;
-
-  int kms_fd = parent_->GetPipe().device->GetFd();
-  bool use_shadow_fds = parent_->GetPipe().device->GetName() == "virtio_gpu" &&
-      !allow_p2p_ && (intel_dgpu_fd() >= 0) &&
-      !virtio_gpu_allow_p2p(kms_fd) && InitializeBlitter(layer_data_.bi.value());
-  layer_data_.bi->use_shadow_fds = use_shadow_fds;
-
-  if (allow_p2p_) {
-    for (int fd: layer_data_.bi->prime_fds) {
+  const auto &planes = parent_->GetPipe().GetUsablePlanes();
+  if (planes.size() == 1 && !planes[0]->IsPixBlendModeSupported())
+    request.is_pixel_blend_mode_supported = false;
+
+  request.try_shadow_fds = request.device->GetName() == "virtio_gpu" &&
+                           !allow_p2p_ && (intel_dgpu_fd() >= 0) &&
+                           !virtio_gpu_allow_p2p(request.device->GetFd());
+  return request;
+}
+
+auto HwcLayer::ImportBuffer(const FbImportRequest &request) -> FbImportResult {
+  FbImportResult result;
+
+  auto *bi_getter = BufferInfoGetter::GetInstance();
+  result.bi = request.unique_id ? bi_getter->GetCachedBoInfo(request.handle,
+                                                             *request.unique_id)
+                                : bi_getter->GetBoInfo(request.handle);
+  if (!result.bi) {
+    return result;
+  }
+
+  result.bi->use_shadow_fds = request.try_shadow_fds &&
+                              InitializeBlitter(result.bi.value());
+
+  if (request.allow_p2p) {
+    for (int fd: result.bi->prime_fds) {
       if (fd <= 0) {
         break;
       }
@@ -321,10 +369,23 @@ void HwcLayer::ImportFb() {
     }
   }
 
-  layer_data_
-      .fb = parent_->GetPipe().device->GetDrmFbImporter().GetOrCreateFbId(
-      &layer_data_.bi.value(), is_pixel_blend_mode_supported);
+  const ScopedFrameStage import_stage(request.timings.get(),
+                                      FrameStage::kFbImport);
+  result.fb = request.device->GetDrmFbImporter().GetOrCreateFbId(
+      &result.bi.value(), request.is_pixel_blend_mode_supported);
+  return result;
+}
+
+void HwcLayer::ApplyFbImportResult(FbImportResult result,
+                                   std::optional<BufferUniqueId> unique_id) {
+  layer_data_.bi = std::move(result.bi);
+  if (!layer_data_.bi) {
+    ALOGW("Unable to get buffer information (0x%p)", buffer_handle_);
+    bi_get_failed_ = true;
+    return;
+  }
 
+  layer_data_.fb = std::move(result.fb);
   if (!layer_data_.fb) {
     ALOGV("Unable to create framebuffer object for buffer 0x%p",
           buffer_handle_);
@@ -337,6 +398,110 @@ void HwcLayer::ImportFb() {
   }
 }
 
+void HwcLayer::StartFbImport() {
+  if (pending_fb_import_ && pending_fb_import_->request.handle == buffer_handle_) {
+    return;
+  }
+  DropPendingFbImport();
+
+  if (!async_fb_import_ || !IsLayerUsableAsDevice() ||
+      parent_->IsInHeadlessMode()) {
+    return;
+  }
+
+  auto *worker = parent_->GetPipe().device->GetFbImportWorker();
+  if (worker == nullptr) {
+    return;
+  }
+
+  auto unique_id = BufferInfoGetter::GetInstance()->GetUniqueId(buffer_handle_);
+  if (unique_id && SwChainHasBuffer(*unique_id)) {
+    return;
+  }
+
+  auto request = CreateFbImportRequest(unique_id);
+  if (request.try_shadow_fds) {
+    /* The blitter setup stays on the HWC thread */
+    return;
+  }
+
+  auto import = std::make_shared<PendingFbImport>();
+  import->request = std::move(request);
+  pending_fb_import_ = import;
+
+  worker->Queue([import]() {
+    {
+      const std::lock_guard<std::mutex> lock(import->mutex);
+      if (import->cancelled) {
+        return;
+      }
+      import->started = true;
+    }
+
+    auto result = ImportBuffer(import->request);
+    const std::lock_guard<std::mutex> lock(import->mutex);
+    import->result = std::move(result);
+    import->done = true;
+    import->cv.notify_all();
+  });
+}
+
+void HwcLayer::DropPendingFbImport() {
+  if (pending_fb_import_) {
+    std::unique_lock<std::mutex> lock(pending_fb_import_->mutex);
+    pending_fb_import_->cancelled = true;
+    pending_fb_import_->cv.wait(lock, [this] {
+      return !pending_fb_import_->started || pending_fb_import_->done;
+    });
+  }
+  pending_fb_import_.reset();
+  fb_import_deferred_ = false;
+}
+
+auto HwcLayer::WaitFbImport(std::chrono::steady_clock::time_point deadline)
+    -> bool {
+  bool done = true;
+  if (pending_fb_import_) {
+    std::unique_lock<std::mutex> lock(pending_fb_import_->mutex);
+    done = pending_fb_import_->cv.wait_until(lock, deadline, [this] {
+      return pending_fb_import_->done;
+    });
+  }
+
+  fb_import_deferred_ = !done;
+  return done;
+}
+
+void HwcLayer::ImportFb() {
+  if (pending_fb_import_) {
+    if (!WaitFbImport(std::chrono::steady_clock::now())) {
+      return;
+    }
+
+    auto import = std::move(pending_fb_import_);
+    buffer_handle_updated_ = false;
+    buffer_id_ = import->request.unique_id;
+    ApplyFbImportResult(std::move(import->result), import->request.unique_id);
+    return;
+  }
+
+  if (!IsLayerUsableAsDevice() || !buffer_handle_updated_) {
+    return;
+  }
+  buffer_handle_updated_ = false;
+
+  layer_data_.fb = {};
+
+  auto unique_id = BufferInfoGetter::GetInstance()->GetUniqueId(buffer_handle_);
+  buffer_id_ = unique_id;
+  if (unique_id && SwChainGetBufferFromCache(*unique_id)) {
+    return;
+  }
+
+  ApplyFbImportResult(ImportBuffer(CreateFbImportRequest(unique_id)),
+                      unique_id);
+}
+
 void HwcLayer::PopulateLayerData(bool test) {
   ImportFb();
 
@@ -350,13 +515,96 @@ void HwcLayer::PopulateLayerData(bool test) {
     layer_data_.bi->sample_range = sample_range_;
   }
 
+  if (layer_data_.bi &&
+      (layer_data_.bi->format != populated_format_ ||
+       layer_data_.bi->modifiers[0] != populated_modifier_ ||
+       layer_data_.bi->usage != populated_usage_)) {
+    populated_format_ = layer_data_.bi->format;
+    populated_modifier_ = layer_data_.bi->modifiers[0];
+    populated_usage_ = layer_data_.bi->usage;
+    GetHotState().state_changed = true;
+  }
+
   if (!test) {
     layer_data_.acquire_fence = std::move(acquire_fence_);
+    UpdatePresentDamage();
+  }
+}
+
+void HwcLayer::AccumulateDamage(DamageRegion &acc, const DamageRegion &damage) {
+  if (!acc) {
+    return;
+  }
+
+  if (!damage) {
+    acc.reset();
+    return;
+  }
+
+  acc->insert(acc->end(), damage->begin(), damage->end());
+  if (acc->size() > kMaxDamageRects) {
+    /* Collapse into the bounding box */
+    hwc_rect_t bounds = acc->front();
+    for (const auto &r : *acc) {
+      bounds.left = std::min(bounds.left, r.left);
+      bounds.top = std::min(bounds.top, r.top);
+      bounds.right = std::max(bounds.right, r.right);
+      bounds.bottom = std::max(bounds.bottom, r.bottom);
+    }
+    *acc = {bounds};
   }
 }
 
+void HwcLayer::UpdatePresentDamage() {
+  auto &pi = layer_data_.pi;
+  pi.damage_owner = id_;
+
+  if (buffer_presented_) {
+    /* Same buffer as in the previous frame */
+    pi.damage = std::vector<hwc_rect_t>{};
+    return;
+  }
+  buffer_presented_ = true;
+
+  if (!buffer_id_) {
+    pi.damage.reset();
+    return;
+  }
+
+  for (auto &[id, damage] : buffer_damage_) {
+    if (id != *buffer_id_) {
+      AccumulateDamage(damage, surface_damage_);
+    }
+  }
+
+  /* A buffer not seen before has to be shown whole */
+  DamageRegion damage;
+  auto it = buffer_damage_.find(*buffer_id_);
+  if (it != buffer_damage_.end()) {
+    damage = std::move(it->second);
+    AccumulateDamage(damage, surface_damage_);
+  }
+  pi.damage = std::move(damage);
+
+  if (it == buffer_damage_.end() && buffer_damage_.size() >= kMaxDamageBuffers) {
+    /* Swapchain got replaced, forget the old buffers */
+    buffer_damage_.clear();
+  }
+  buffer_damage_[*buffer_id_] = std::vector<hwc_rect_t>{};
+}
+
 /* SwapChain Cache */
 
+bool HwcLayer::SwChainHasBuffer(BufferUniqueId unique_id) const {
+  auto it = swchain_lookup_table_.find(unique_id);
+  if (it == swchain_lookup_table_.end()) {
+    return false;
+  }
+
+  auto el = swchain_cache_.find(it->second);
+  return el != swchain_cache_.end() && el->second.bi;
+}
+
 bool HwcLayer::SwChainGetBufferFromCache(BufferUniqueId unique_id) {
   if (swchain_lookup_table_.count(unique_id) == 0) {
     return false;
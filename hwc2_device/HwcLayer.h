@@ -19,40 +19,82 @@
 
 #include <hardware/hwcomposer2.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
 #include "bufferinfo/BufferInfoGetter.h"
 #include "compositor/LayerData.h"
+#include "utils/FrameTimings.h"
 
 namespace android {
 
 class HwcDisplay;
 
+/* Layer state read by the per-frame loops over all the layers of a display.
+ * HwcLayerMap keeps it in one contiguous array for the layers it owns, so
+ * these loops don't have to touch the layer objects themselves.
+ */
+struct HwcLayerHotState {
+  uint32_t z_order{};
+  // sf_type stores the initial type given to us by surfaceflinger,
+  // validated_type stores the type after running ValidateDisplay
+  HWC2::Composition sf_type = HWC2::Composition::Invalid;
+  HWC2::Composition validated_type = HWC2::Composition::Invalid;
+  hwc_rect_t display_frame{};
+  bool state_changed = true;
+  bool prior_buffer_scanout = false;
+};
+
 class HwcLayer {
  public:
-  explicit HwcLayer(HwcDisplay *parent_display, bool allow_p2p)
-    : parent_(parent_display), allow_p2p_(allow_p2p) {}
+  explicit HwcLayer(HwcDisplay *parent_display, bool allow_p2p,
+                    bool async_fb_import = false)
+    : parent_(parent_display),
+      async_fb_import_(async_fb_import),
+      allow_p2p_(allow_p2p) {
+    static std::atomic_uint64_t last_id;
+    id_ = ++last_id;
+  }
+  ~HwcLayer();
+  HwcLayer(HwcLayer &&) = delete;
+
+  using HotState = HwcLayerHotState;
+
+  /* Makes the layer use the state kept by its HwcLayerMap, which has to hold
+   * the current state already.
+   */
+  void BindHotState(HwcLayerHotState *state) {
+    hot_state_ = state;
+  }
+  auto GetHotState() -> HwcLayerHotState & {
+    return hot_state_ != nullptr ? *hot_state_ : own_hot_state_;
+  }
+  auto GetHotState() const -> const HwcLayerHotState & {
+    return hot_state_ != nullptr ? *hot_state_ : own_hot_state_;
+  }
 
   HWC2::Composition GetSfType() const {
-    return sf_type_;
+    return GetHotState().sf_type;
   }
   HWC2::Composition GetValidatedType() const {
-    return validated_type_;
-  }
-  void AcceptTypeChange() {
-    sf_type_ = validated_type_;
+    return GetHotState().validated_type;
   }
   void SetValidatedType(HWC2::Composition type) {
-    validated_type_ = type;
-  }
-  bool IsTypeChanged() const {
-    return sf_type_ != validated_type_;
+    GetHotState().validated_type = type;
   }
-
-  bool GetPriorBufferScanOutFlag() const {
-    return prior_buffer_scanout_flag_;
+  /* Set by any change that may affect the composition (geometry, z-order,
+   * blending, dataspace, transform or buffer format), but not by buffer swaps.
+   */
+  bool IsStateChanged() const {
+    return GetHotState().state_changed;
   }
 
-  void SetPriorBufferScanOutFlag(bool state) {
-    prior_buffer_scanout_flag_ = state;
+  /* Layer content was not scanned out, so its damage history is lost */
+  void ResetDamageTracking() {
+    buffer_damage_.clear();
   }
 
   void SetAllowP2P(bool allow_p2p) {
@@ -60,7 +102,7 @@ class HwcLayer {
   }
 
   uint32_t GetZOrder() const {
-    return z_order_;
+    return GetHotState().z_order;
   }
 
   auto &GetLayerData() {
@@ -87,13 +129,13 @@ class HwcLayer {
                                      const float *metadata);
 
  private:
-  // sf_type_ stores the initial type given to us by surfaceflinger,
-  // validated_type_ stores the type after running ValidateDisplay
-  HWC2::Composition sf_type_ = HWC2::Composition::Invalid;
-  HWC2::Composition validated_type_ = HWC2::Composition::Invalid;
+  /* Points into the HwcLayerMap owning the layer, if any */
+  HwcLayerHotState *hot_state_{};
+  HwcLayerHotState own_hot_state_;
 
-  uint32_t z_order_ = 0;
   LayerData layer_data_;
+  /* Unlike the address of the layer, never reused by another layer */
+  uint64_t id_{};
 
   /* Should be populated to layer_data_.acquire_fence only before presenting */
   UniqueFd acquire_fence_;
@@ -112,7 +154,22 @@ class HwcLayer {
   buffer_handle_t buffer_handle_{};
   bool buffer_handle_updated_{};
 
-  bool prior_buffer_scanout_flag_{};
+  /* Surface damage. SurfaceFlinger reports it relative to the previous
+   * buffer of the layer, but drivers flushing per buffer object (virtio-gpu)
+   * need it relative to the last time the same buffer was shown. Hence the
+   * damage is accumulated per swapchain buffer.
+   */
+  static constexpr size_t kMaxDamageRects = 16;
+  static constexpr size_t kMaxDamageBuffers = 8;
+  using DamageRegion = std::optional<std::vector<hwc_rect_t>>;
+
+  static void AccumulateDamage(DamageRegion &acc, const DamageRegion &damage);
+  void UpdatePresentDamage();
+
+  DamageRegion surface_damage_;
+  bool buffer_presented_ = true;
+  std::optional<BufferUniqueId> buffer_id_;
+  std::map<BufferUniqueId, DamageRegion> buffer_damage_;
 
   HwcDisplay *const parent_;
 
@@ -122,14 +179,71 @@ class HwcLayer {
 
   buffer_handle_t GetBufferHandle() {return buffer_handle_;}
   bool IsLayerUsableAsDevice() const {
-    return !bi_get_failed_ && !fb_import_failed_ && buffer_handle_ != nullptr;
+    return !bi_get_failed_ && !fb_import_failed_ && !fb_import_deferred_ &&
+           buffer_handle_ != nullptr;
+  }
+
+  /* Waits until the deadline for the framebuffer import started by
+   * SetLayerBuffer(). If it's still running, the layer can't be used as DEVICE
+   * in this frame. Returns false in that case.
+   */
+  auto WaitFbImport(std::chrono::steady_clock::time_point deadline) -> bool;
+  bool IsFbImportDeferred() const {
+    return fb_import_deferred_;
   }
 
  private:
+  struct FbImportRequest {
+    buffer_handle_t handle{};
+    std::optional<BufferUniqueId> unique_id;
+    DrmDevice *device{};
+    std::shared_ptr<FrameTimings> timings;
+    bool is_pixel_blend_mode_supported = true;
+    /* virtio-gpu without P2P scans out copies made by the Intel blitter */
+    bool try_shadow_fds = false;
+    bool allow_p2p = false;
+  };
+
+  struct FbImportResult {
+    std::optional<BufferInfo> bi;
+    std::shared_ptr<DrmFbIdHandle> fb;
+  };
+
+  /* Shared with the device's import worker */
+  struct PendingFbImport {
+    FbImportRequest request;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool started = false;
+    bool cancelled = false;
+    bool done = false;
+    FbImportResult result;
+  };
+
+  auto CreateFbImportRequest(std::optional<BufferUniqueId> unique_id)
+      -> FbImportRequest;
+  static auto ImportBuffer(const FbImportRequest &request) -> FbImportResult;
+  void ApplyFbImportResult(FbImportResult result,
+                           std::optional<BufferUniqueId> unique_id);
+  void StartFbImport();
+  /* Cancels the queued import. Only waits for an import already started by
+   * the worker, as it uses the buffer handle.
+   */
+  void DropPendingFbImport();
+
   void ImportFb();
   bool bi_get_failed_{};
   bool fb_import_failed_{};
 
+  const bool async_fb_import_;
+  std::shared_ptr<PendingFbImport> pending_fb_import_;
+  bool fb_import_deferred_{};
+
+  /* Buffer properties of the last populated buffer */
+  uint32_t populated_format_{};
+  uint64_t populated_modifier_{};
+  uint64_t populated_usage_{};
+
   /* SwapChain Cache */
  public:
   void SwChainClearCache();
@@ -140,6 +254,7 @@ class HwcLayer {
     std::shared_ptr<DrmFbIdHandle> fb;
   };
 
+  bool SwChainHasBuffer(BufferUniqueId unique_id) const;
   bool SwChainGetBufferFromCache(BufferUniqueId unique_id);
   void SwChainReassemble(BufferUniqueId unique_id);
   void SwChainAddCurrentBuffer(BufferUniqueId unique_id);
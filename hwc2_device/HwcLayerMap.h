@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HWC2_DEVICE_HWC_LAYER_MAP_H
+#define ANDROID_HWC2_DEVICE_HWC_LAYER_MAP_H
+
+#include <hardware/hwcomposer2.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+namespace android {
+
+class HwcLayer;
+
+/* Layers of a display, addressed by (generation << 32 | slot) handles.
+ * Looking a layer up is an index into the slots, and the generation catches
+ * handles of destroyed layers. Slots are reused but never move, so pointers
+ * to a layer stay valid until it is destroyed.
+ *
+ * The live layers are also kept densely, in creation order for iteration and
+ * sorted by z-order for composition. Their hot state (Layer::HotState: z-order,
+ * composition types, display frame and flags) is kept in an array parallel to
+ * the creation order, so the per-frame loops over all the layers and the
+ * z-order sort walk contiguous memory.
+ */
+template <typename Layer>
+class LayerMap {
+ public:
+  using HotState = typename Layer::HotState;
+
+  struct Entry {
+    hwc2_layer_t handle;
+    Layer *layer;
+  };
+
+  template <typename... Args>
+  auto Emplace(Args &&...args) -> hwc2_layer_t {
+    uint32_t index = 0;
+    if (!free_slots_.empty()) {
+      index = free_slots_.back();
+      free_slots_.pop_back();
+    } else {
+      index = uint32_t(slots_.size());
+      slots_.emplace_back();
+    }
+
+    auto &slot = slots_[index];
+    slot.layer.emplace(std::forward<Args>(args)...);
+    slot.entry_index = uint32_t(entries_.size());
+
+    auto handle = (hwc2_layer_t(slot.generation) << kGenerationShift) | index;
+    entries_.push_back({.handle = handle, .layer = &*slot.layer});
+    z_index_.push_back(slot.entry_index);
+
+    auto *hot_states = hot_states_.data();
+    hot_states_.emplace_back(slot.layer->GetHotState());
+    if (hot_states != hot_states_.data()) {
+      BindHotStates(0);
+    } else {
+      slot.layer->BindHotState(&hot_states_.back());
+    }
+
+    return handle;
+  }
+
+  auto Get(hwc2_layer_t handle) -> Layer * {
+    auto *slot = GetSlot(handle);
+    return slot != nullptr ? &*slot->layer : nullptr;
+  }
+
+  auto Erase(hwc2_layer_t handle) -> bool {
+    auto *slot = GetSlot(handle);
+    if (slot == nullptr) {
+      return false;
+    }
+
+    /* Keep the creation order, destroying a layer isn't a per-frame call */
+    auto entry_index = slot->entry_index;
+    entries_.erase(entries_.begin() + entry_index);
+    hot_states_.erase(hot_states_.begin() + entry_index);
+    for (size_t i = entry_index; i < entries_.size(); i++) {
+      slots_[SlotIndex(entries_[i].handle)].entry_index = uint32_t(i);
+    }
+    BindHotStates(entry_index);
+
+    z_index_.erase(std::find(z_index_.begin(), z_index_.end(), entry_index));
+    for (auto &i : z_index_) {
+      if (i > entry_index) {
+        i--;
+      }
+    }
+
+    slot->layer->BindHotState(nullptr);
+    slot->layer.reset();
+    slot->generation++;
+    free_slots_.push_back(SlotIndex(handle));
+    return true;
+  }
+
+  /* Layers sorted by z-order, valid until the layer set changes. The order
+   * of the previous call is the starting point: an insertion sort is linear
+   * for an unchanged layer stack and cheap when a few layers moved.
+   */
+  auto GetZOrdered() -> std::vector<Layer *> & {
+    for (size_t i = 1; i < z_index_.size(); i++) {
+      auto index = z_index_[i];
+      auto z_order = hot_states_[index].z_order;
+      size_t j = i;
+      for (; j > 0 && hot_states_[z_index_[j - 1]].z_order > z_order; j--) {
+        z_index_[j] = z_index_[j - 1];
+      }
+      z_index_[j] = index;
+    }
+
+    z_ordered_.resize(z_index_.size());
+    for (size_t i = 0; i < z_index_.size(); i++) {
+      z_ordered_[i] = entries_[z_index_[i]].layer;
+    }
+    return z_ordered_;
+  }
+
+  /* Hot state of the layers, in the same order as the entries */
+  auto GetHotStates() -> std::vector<HotState> & {
+    return hot_states_;
+  }
+
+  auto GetEntry(size_t index) const -> const Entry & {
+    return entries_[index];
+  }
+
+  auto size() const {
+    return entries_.size();
+  }
+
+  auto begin() {
+    return entries_.begin();
+  }
+
+  auto end() {
+    return entries_.end();
+  }
+
+ private:
+  static constexpr int kGenerationShift = 32;
+
+  struct Slot {
+    std::optional<Layer> layer;
+    uint32_t generation{};
+    uint32_t entry_index{};
+  };
+
+  static auto SlotIndex(hwc2_layer_t handle) -> uint32_t {
+    return uint32_t(handle & UINT32_MAX);
+  }
+
+  auto GetSlot(hwc2_layer_t handle) -> Slot * {
+    auto index = SlotIndex(handle);
+    if (index >= slots_.size()) {
+      return nullptr;
+    }
+
+    auto &slot = slots_[index];
+    if (!slot.layer ||
+        slot.generation != uint32_t(handle >> kGenerationShift)) {
+      return nullptr;
+    }
+    return &slot;
+  }
+
+  /* The hot states moved, starting at the given entry */
+  void BindHotStates(size_t first) {
+    for (size_t i = first; i < entries_.size(); i++) {
+      entries_[i].layer->BindHotState(&hot_states_[i]);
+    }
+  }
+
+  /* Declared first to outlive the layers bound to it */
+  std::vector<HotState> hot_states_;
+  /* std::deque doesn't move the elements when growing */
+  std::deque<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  std::vector<Entry> entries_;
+  /* Entry indices sorted by z-order */
+  std::vector<uint32_t> z_index_;
+  std::vector<Layer *> z_ordered_;
+};
+
+using HwcLayerMap = LayerMap<HwcLayer>;
+
+}  // namespace android
+
+#endif
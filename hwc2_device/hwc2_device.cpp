@@ -20,6 +20,8 @@
 #define LOG_TAG "hwc2-device"
 
 #include <cinttypes>
+#include <mutex>
+#include <shared_mutex>
 
 #include "DrmHwcTwo.h"
 #include "backend/Backend.h"
@@ -63,7 +65,8 @@ template <typename T, typename HookType, HookType func, typename... Args>
 static T DeviceHook(hwc2_device_t *dev, Args... args) {
   ALOGV("Device hook: %s", GetFuncName(__PRETTY_FUNCTION__).c_str());
   DrmHwcTwo *hwc = ToDrmHwcTwo(dev);
-  const std::lock_guard<std::mutex> lock(hwc->GetResMan().GetMainLock());
+  const std::lock_guard<std::shared_mutex> lock(
+      hwc->GetResMan().GetMainLock());
   return static_cast<T>(((*hwc).*func)(std::forward<Args>(args)...));
 }
 
@@ -73,11 +76,18 @@ static int32_t DisplayHook(hwc2_device_t *dev, hwc2_display_t display_handle,
   ALOGV("Display #%" PRIu64 " hook: %s", display_handle,
         GetFuncName(__PRETTY_FUNCTION__).c_str());
   DrmHwcTwo *hwc = ToDrmHwcTwo(dev);
-  const std::lock_guard<std::mutex> lock(hwc->GetResMan().GetMainLock());
+  /* Displays are only added or removed with the main lock held exclusively,
+   * so sharing it keeps the display alive while calls to other displays run
+   * in parallel.
+   */
+  const std::shared_lock<std::shared_mutex> lock(
+      hwc->GetResMan().GetMainLock());
   auto *display = hwc->GetDisplay(display_handle);
   if (display == nullptr)
     return static_cast<int32_t>(HWC2::Error::BadDisplay);
 
+  const std::lock_guard<std::mutex> display_lock(display->GetDisplayLock());
+
   return static_cast<int32_t>((display->*func)(std::forward<Args>(args)...));
 }
 
@@ -87,11 +97,14 @@ static int32_t LayerHook(hwc2_device_t *dev, hwc2_display_t display_handle,
   ALOGV("Display #%" PRIu64 " Layer: #%" PRIu64 " hook: %s", display_handle,
         layer_handle, GetFuncName(__PRETTY_FUNCTION__).c_str());
   DrmHwcTwo *hwc = ToDrmHwcTwo(dev);
-  const std::lock_guard<std::mutex> lock(hwc->GetResMan().GetMainLock());
+  const std::shared_lock<std::shared_mutex> lock(
+      hwc->GetResMan().GetMainLock());
   auto *display = hwc->GetDisplay(display_handle);
   if (display == nullptr)
     return static_cast<int32_t>(HWC2::Error::BadDisplay);
 
+  const std::lock_guard<std::mutex> display_lock(display->GetDisplayLock());
+
   HwcLayer *layer = display->get_layer(layer_handle);
   if (!layer)
     return static_cast<int32_t>(HWC2::Error::BadLayer);
@@ -428,3 +441,18 @@ hw_module_t HAL_MODULE_INFO_SYM = {
     .dso = nullptr,
     .reserved = {0},
 };
+
+namespace android {
+
+auto OpenDrmHwc2Device(hwc2_device_t **out_device) -> DrmHwcTwo * {
+  hw_device_t *dev = nullptr;
+  if (HookDevOpen(&HAL_MODULE_INFO_SYM, HWC_HARDWARE_COMPOSER, &dev) != 0) {
+    return nullptr;
+  }
+
+  // NOLINTNEXTLINE (cppcoreguidelines-pro-type-reinterpret-cast): Safe
+  *out_device = reinterpret_cast<hwc2_device_t *>(dev);
+  return ToDrmHwcTwo(*out_device);
+}
+
+}  // namespace android
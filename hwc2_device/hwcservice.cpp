@@ -103,6 +103,27 @@ void HwcService::Diagnostic::MaskLayer(uint32_t, uint32_t, bool) { /* nothing */
 void HwcService::Diagnostic::DumpFrames(uint32_t, int32_t, bool) { /* nothing */
 }
 
+status_t HwcService::Diagnostic::ReadFrameTimings(uint32_t d, Parcel *reply) {
+  auto timings = mHwc.GetFrameTimings(d);
+  if (!timings)
+    return BAD_VALUE;
+
+  reply->writeInt64(static_cast<int64_t>(timings->GetMissedVsyncs()));
+  reply->writeInt32(static_cast<int32_t>(FrameTimings::kNumStages));
+  for (size_t i = 0; i < FrameTimings::kNumStages; i++) {
+    auto stage = static_cast<FrameStage>(i);
+    auto &hist = timings->GetHistogram(stage);
+    reply->writeString8(String8(FrameTimings::GetStageName(stage)));
+    reply->writeInt64(static_cast<int64_t>(hist.GetCount()));
+    reply->writeInt64(static_cast<int64_t>(hist.GetAverageUs()));
+    reply->writeInt64(static_cast<int64_t>(hist.GetPercentileUs(50)));
+    reply->writeInt64(static_cast<int64_t>(hist.GetPercentileUs(99)));
+    reply->writeInt64(static_cast<int64_t>(hist.GetMaxUs()));
+  }
+
+  return OK;
+}
+
 HwcService::Controls::Controls(DrmHwcTwo &hwc, HwcService &hwcService)
     : mHwc(hwc),
       mHwcService(hwcService),
@@ -44,6 +44,7 @@ class HwcService : public BnService {
     void DisableDisplay(uint32_t d, bool bBlank) override;
     void MaskLayer(uint32_t d, uint32_t layer, bool bHide) override;
     void DumpFrames(uint32_t d, int32_t frames, bool bSync) override;
+    status_t ReadFrameTimings(uint32_t d, Parcel* reply) override;
 
    private:
     DrmHwcTwo& mHwc;
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CommandWorkerPool.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <android-base/logging.h>
+
+namespace aidl::android::hardware::graphics::composer3::impl {
+
+CommandWorkerPool::CommandWorkerPool(size_t numThreads) {
+    int policy = SCHED_OTHER;
+    struct sched_param param = {0};
+    pthread_getschedparam(pthread_self(), &policy, &param);
+
+    for (size_t i = 0; i < numThreads; i++) {
+        mThreads.emplace_back([this] { threadLoop(); });
+        if (pthread_setschedparam(mThreads.back().native_handle(), policy, &param) != 0) {
+            LOG(WARNING) << "Couldn't set the command worker scheduling policy";
+        }
+    }
+}
+
+CommandWorkerPool::~CommandWorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit = true;
+    }
+    mTaskCv.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void CommandWorkerPool::runAll(std::vector<std::function<void()>>& tasks) {
+    if (tasks.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (size_t i = 1; i < tasks.size(); i++) {
+            mQueue.push_back(&tasks[i]);
+        }
+        mPending += tasks.size() - 1;
+    }
+    mTaskCv.notify_all();
+
+    tasks[0]();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDoneCv.wait(lock, [this] { return mPending == 0; });
+}
+
+void CommandWorkerPool::threadLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+        mTaskCv.wait(lock, [this] { return mExit || !mQueue.empty(); });
+        if (mExit) {
+            return;
+        }
+
+        auto* task = mQueue.front();
+        mQueue.pop_front();
+        lock.unlock();
+        (*task)();
+        lock.lock();
+
+        if (--mPending == 0) {
+            mDoneCv.notify_all();
+        }
+    }
+}
+
+} // namespace aidl::android::hardware::graphics::composer3::impl
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aidl::android::hardware::graphics::composer3::impl {
+
+// Small fixed set of threads running the per-display command batches of one
+// executeCommands call concurrently. The workers inherit the scheduling policy
+// of the thread creating the pool, so they run at the same priority as the
+// binder thread they're helping.
+class CommandWorkerPool {
+  public:
+    explicit CommandWorkerPool(size_t numThreads);
+    ~CommandWorkerPool();
+
+    CommandWorkerPool(const CommandWorkerPool&) = delete;
+    CommandWorkerPool& operator=(const CommandWorkerPool&) = delete;
+
+    // Runs the first task on the calling thread and the others on the workers.
+    // Returns once all of them have finished.
+    void runAll(std::vector<std::function<void()>>& tasks);
+
+  private:
+    void threadLoop();
+
+    std::vector<std::thread> mThreads;
+
+    std::mutex mMutex;
+    std::condition_variable mTaskCv;
+    std::condition_variable mDoneCv;
+    std::deque<std::function<void()>*> mQueue;
+    size_t mPending = 0;
+    bool mExit = false;
+};
+
+} // namespace aidl::android::hardware::graphics::composer3::impl
@@ -14,8 +14,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <iterator>
+#include <map>
 #include <set>
 
+#include <cutils/properties.h>
+
 #include "ComposerCommandEngine.h"
 #include "Util.h"
 
@@ -57,16 +62,23 @@ namespace aidl::android::hardware::graphics::composer3::impl {
 
 bool ComposerCommandEngine::init() {
     mWriter = std::make_unique<ComposerServiceWriter>();
+    mParallelDisplays = property_get_bool("vendor.hwcomposer.hwc3.parallel_displays", true);
     return (mWriter != nullptr);
 }
 
 int32_t ComposerCommandEngine::execute(const std::vector<DisplayCommand>& commands,
                                        std::vector<CommandResultPayload>* result) {
     std::set<int64_t> displaysPendingBrightenssChange;
-    mCommandIndex = 0;
-    for (const auto& command : commands) {
-        dispatchDisplayCommand(command);
-        ++mCommandIndex;
+    std::map<int64_t, size_t> displayBatch;
+    std::vector<std::vector<size_t>> displayCommands;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const auto& command = commands[i];
+        auto [it, inserted] = displayBatch.try_emplace(command.display, displayCommands.size());
+        if (inserted) {
+            displayCommands.emplace_back();
+        }
+        displayCommands[it->second].push_back(i);
+
         // The input commands could have 2+ commands for the same display.
         // If the first has pending brightness change, the second presentDisplay will apply it.
         if (command.validateDisplay || command.presentDisplay ||
@@ -77,8 +89,18 @@ int32_t ComposerCommandEngine::execute(const std::vector<DisplayCommand>& comman
         }
     }
 
-    *result = mWriter->getPendingCommandResults();
-    mWriter->reset();
+    if (mParallelDisplays && displayCommands.size() > 1) {
+        executeParallel(commands, displayCommands, result);
+    } else {
+        mCommandIndex = 0;
+        for (const auto& command : commands) {
+            dispatchDisplayCommand(command);
+            ++mCommandIndex;
+        }
+
+        *result = mWriter->getPendingCommandResults();
+        mWriter->reset();
+    }
 
     // standalone display brightness command shouldn't wait for next present or validate
     for (auto display : displaysPendingBrightenssChange) {
@@ -90,7 +112,50 @@ int32_t ComposerCommandEngine::execute(const std::vector<DisplayCommand>& comman
     return ::android::NO_ERROR;
 }
 
+void ComposerCommandEngine::executeParallel(
+        const std::vector<DisplayCommand>& commands,
+        const std::vector<std::vector<size_t>>& displayCommands,
+        std::vector<CommandResultPayload>* result) {
+    ATRACE_CALL();
+    if (!mPool) {
+        mPool = std::make_unique<CommandWorkerPool>(kMaxParallelDisplays - 1);
+    }
+    while (mDisplayEngines.size() < displayCommands.size()) {
+        auto engine = std::make_unique<ComposerCommandEngine>(mHal, mResources);
+        engine->init();
+        mDisplayEngines.push_back(std::move(engine));
+    }
+
+    std::vector<std::vector<CommandResultPayload>> commandResults(commands.size());
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(displayCommands.size());
+    for (size_t i = 0; i < displayCommands.size(); i++) {
+        tasks.emplace_back([&, i] {
+            mDisplayEngines[i]->executeDisplayBatch(commands, displayCommands[i],
+                                                    commandResults);
+        });
+    }
+    mPool->runAll(tasks);
+
+    result->clear();
+    for (auto& payloads : commandResults) {
+        std::move(payloads.begin(), payloads.end(), std::back_inserter(*result));
+    }
+}
+
+void ComposerCommandEngine::executeDisplayBatch(
+        const std::vector<DisplayCommand>& commands, const std::vector<size_t>& indices,
+        std::vector<std::vector<CommandResultPayload>>& results) {
+    for (auto index : indices) {
+        mCommandIndex = static_cast<int32_t>(index);
+        dispatchDisplayCommand(commands[index]);
+        results[index] = mWriter->getPendingCommandResults();
+        mWriter->reset();
+    }
+}
+
 void ComposerCommandEngine::dispatchDisplayCommand(const DisplayCommand& command) {
+    mHal->beginDisplayCommand(command.display);
     //  place SetDisplayBrightness before SetLayerWhitePointNits since current
     //  display brightness is used to validate the layer white point nits.
     DISPATCH_DISPLAY_COMMAND(command, brightness, SetDisplayBrightness);
@@ -107,6 +172,7 @@ void ComposerCommandEngine::dispatchDisplayCommand(const DisplayCommand& command
     DISPATCH_DISPLAY_BOOL_COMMAND(command, presentDisplay, PresentDisplay);
     DISPATCH_DISPLAY_BOOL_COMMAND_AND_DATA(command, presentOrValidateDisplay, expectedPresentTime,
                                            PresentOrValidateDisplay);
+    mHal->endDisplayCommand(command.display);
 }
 
 void ComposerCommandEngine::dispatchLayerCommand(int64_t display, const LayerCommand& command) {
@@ -19,8 +19,11 @@
 #include <android/hardware/graphics/composer3/ComposerServiceWriter.h>
 #include <utils/Mutex.h>
 
+#include <functional>
 #include <memory>
+#include <vector>
 
+#include "CommandWorkerPool.h"
 #include "include/IComposerHal.h"
 #include "include/IResourceManager.h"
 
@@ -44,6 +47,18 @@ class ComposerCommandEngine {
       }
 
   private:
+      // Displays whose commands run concurrently, the calling thread included
+      static constexpr size_t kMaxParallelDisplays = 4;
+
+      void executeParallel(const std::vector<DisplayCommand>& commands,
+                           const std::vector<std::vector<size_t>>& displayCommands,
+                           std::vector<CommandResultPayload>* result);
+      // Runs the commands of one display in order, keeping the results of
+      // each command apart so they can be merged in submission order.
+      void executeDisplayBatch(const std::vector<DisplayCommand>& commands,
+                               const std::vector<size_t>& indices,
+                               std::vector<std::vector<CommandResultPayload>>& results);
+
       void dispatchDisplayCommand(const DisplayCommand& displayCommand);
       void dispatchLayerCommand(int64_t display, const LayerCommand& displayCommand);
 
@@ -100,6 +115,11 @@ class ComposerCommandEngine {
       IResourceManager* mResources;
       std::unique_ptr<ComposerServiceWriter> mWriter;
       int32_t mCommandIndex = 0;
+
+      bool mParallelDisplays = false;
+      std::unique_ptr<CommandWorkerPool> mPool;
+      // One engine per display batch, each with its own writer
+      std::vector<std::unique_ptr<ComposerCommandEngine>> mDisplayEngines;
 };
 
 template <typename InputType, typename Functor>
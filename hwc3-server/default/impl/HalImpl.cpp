@@ -22,13 +22,23 @@
 #include "TranslateHwcAidl.h"
 #include "Util.h"
 #include "HwcLoader.h"
+#include "NativeHalImpl.h"
 #include <cmath>
+#include <cutils/properties.h>
 
 using namespace aidl::android::hardware::graphics::composer3::passthrough;
 
 namespace aidl::android::hardware::graphics::composer3::impl {
 
 std::unique_ptr<IComposerHal> IComposerHal::create() {
+    if (property_get_bool("vendor.hwcomposer.hwc3.native", true)) {
+        auto hal = NativeHalImpl::create();
+        if (hal) {
+            return hal;
+        }
+        ALOGW("In-process HWC is not available, loading the HWC2 module");
+    }
+
     hwc2_device_t* device = HwcLoader::load();
     if (!device) {
         ALOGE("HwcLoader::load() failed");
@@ -943,6 +953,7 @@ int32_t HalImpl::setLayerColor(int64_t display, int64_t layer, Color color) {
 int32_t HalImpl::setLayerColorTransform(int64_t display, int64_t layer,
                                         const std::vector<float>& matrix) {
     if (!mDispatch.setLayerColorTransform) {
+        std::lock_guard<std::mutex> lock(mClientCompositionLayersMutex);
         const bool isIdentity = (std::equal(matrix.begin(), matrix.end(), mkIdentity.begin()));
         if (isIdentity) {
             mClientCompositionLayers[display].erase(layer);
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <unordered_set>
 #include <map>
 
@@ -34,8 +35,8 @@ namespace aidl::android::hardware::graphics::composer3::impl {
 class HalImpl : public IComposerHal {
   public:
     HalImpl(hwc2_device_t* device);
-    HalImpl(const HalImpl &) = default;
-    HalImpl &operator=(const HalImpl &) = default;
+    HalImpl(const HalImpl &) = delete;
+    HalImpl &operator=(const HalImpl &) = delete;
     virtual ~HalImpl();
 
     void getCapabilities(std::vector<Capability>* caps) override;
@@ -161,6 +162,14 @@ class HalImpl : public IComposerHal {
 
     EventCallback* getEventCallback() { return mEventCallback; }
 
+protected:
+    constexpr static std::array<float, 16> mkIdentity = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f,
+    };
+
 private:
     template <typename T>
     bool initOptionalDispatch(hwc2_function_descriptor_t desc, T* outPfn); 
@@ -261,15 +270,9 @@ private:
     EventCallback* mEventCallback;
     std::unordered_set<Capability> mCaps;
     
+    // Displays may be driven from several command threads at once
+    std::mutex mClientCompositionLayersMutex;
     std::map<int64_t, std::unordered_set<int64_t>> mClientCompositionLayers;
-
-    constexpr static std::array<float, 16> mkIdentity = {
-        1.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f,
-    };
-
 };
 
 } // namespace aidl::android::hardware::graphics::composer3::impl
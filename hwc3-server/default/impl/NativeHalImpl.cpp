@@ -0,0 +1,376 @@
+/*
+ * Copyright 2024, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NativeHalImpl.h"
+
+#include <android-base/logging.h>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <shared_mutex>
+#include <unistd.h>
+
+#include "TranslateHwcAidl.h"
+#include "Util.h"
+
+using ::android::HwcDisplay;
+using ::android::HwcLayer;
+
+namespace aidl::android::hardware::graphics::composer3::impl {
+
+namespace {
+
+// Locks held by a binder thread for the DisplayCommand it is executing
+struct DisplayBatch {
+    int64_t display = -1;
+    HwcDisplay* hwcDisplay = nullptr;
+    std::shared_lock<std::shared_mutex> mainLock;
+    std::unique_lock<std::mutex> displayLock;
+};
+
+thread_local DisplayBatch tBatch;
+
+template <typename T>
+int32_t toHalError(T err) {
+    return static_cast<int32_t>(err);
+}
+
+} // namespace
+
+std::unique_ptr<IComposerHal> NativeHalImpl::create() {
+    hwc2_device_t* device = nullptr;
+    auto* hwc = ::android::OpenDrmHwc2Device(&device);
+    if (!hwc) {
+        ALOGE("Failed to open the in-process HWC2 device");
+        return nullptr;
+    }
+    return std::make_unique<NativeHalImpl>(device, hwc);
+}
+
+NativeHalImpl::NativeHalImpl(hwc2_device_t* device, ::android::DrmHwcTwo* hwc)
+      : HalImpl(device), mHwc(hwc) {}
+
+void NativeHalImpl::beginDisplayCommand(int64_t display) {
+    // Displays are only added or removed with the main lock held exclusively
+    std::shared_lock<std::shared_mutex> mainLock(mHwc->GetResMan().GetMainLock());
+    auto* hwcDisplay = mHwc->GetDisplay(display);
+    if (!hwcDisplay) {
+        // Each command of the batch reports BAD_DISPLAY on its own
+        return;
+    }
+
+    tBatch.displayLock = std::unique_lock<std::mutex>(hwcDisplay->GetDisplayLock());
+    tBatch.mainLock = std::move(mainLock);
+    tBatch.hwcDisplay = hwcDisplay;
+    tBatch.display = display;
+}
+
+void NativeHalImpl::endDisplayCommand(int64_t /*display*/) {
+    if (!tBatch.hwcDisplay) {
+        return;
+    }
+
+    tBatch.hwcDisplay = nullptr;
+    tBatch.display = -1;
+    tBatch.displayLock.unlock();
+    tBatch.mainLock.unlock();
+}
+
+template <typename Func>
+int32_t NativeHalImpl::withDisplay(int64_t display, Func&& func) {
+    if (tBatch.hwcDisplay && tBatch.display == display) {
+        return toHalError(func(*tBatch.hwcDisplay));
+    }
+
+    const std::shared_lock<std::shared_mutex> lock(mHwc->GetResMan().GetMainLock());
+    auto* hwcDisplay = mHwc->GetDisplay(display);
+    if (!hwcDisplay) {
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    const std::lock_guard<std::mutex> displayLock(hwcDisplay->GetDisplayLock());
+    return toHalError(func(*hwcDisplay));
+}
+
+template <typename Func>
+int32_t NativeHalImpl::withLayer(int64_t display, int64_t layer, Func&& func) {
+    return withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        auto* hwcLayer = hwcDisplay.get_layer(layer);
+        if (!hwcLayer) {
+            return static_cast<int32_t>(HWC2_ERROR_BAD_LAYER);
+        }
+        return toHalError(func(*hwcLayer));
+    });
+}
+
+int32_t NativeHalImpl::acceptDisplayChanges(int64_t display) {
+    return withDisplay(display,
+                       [](HwcDisplay& hwcDisplay) { return hwcDisplay.AcceptDisplayChanges(); });
+}
+
+int32_t NativeHalImpl::presentDisplay(int64_t display, ndk::ScopedFileDescriptor& fence,
+                                      std::vector<int64_t>* outLayers,
+                                      std::vector<ndk::ScopedFileDescriptor>* outReleaseFences) {
+    ATRACE_CALL();
+    return withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        int32_t hwcFence = -1;
+        RET_IF_ERR(toHalError(hwcDisplay.PresentDisplay(&hwcFence)));
+        h2a::translate(hwcFence, fence);
+
+        uint32_t count = 0;
+        RET_IF_ERR(toHalError(hwcDisplay.GetReleaseFences(&count, nullptr, nullptr)));
+
+        std::vector<hwc2_layer_t> hwcLayers(count);
+        std::vector<int32_t> hwcFences(count);
+        RET_IF_ERR(toHalError(
+                hwcDisplay.GetReleaseFences(&count, hwcLayers.data(), hwcFences.data())));
+
+        h2a::translate(hwcLayers, *outLayers);
+        h2a::translate(hwcFences, *outReleaseFences);
+        return toHalError(HWC2_ERROR_NONE);
+    });
+}
+
+int32_t NativeHalImpl::setClientTarget(int64_t display, buffer_handle_t target,
+                                       const ndk::ScopedFileDescriptor& fence,
+                                       common::Dataspace dataspace,
+                                       const std::vector<common::Rect>& damage) {
+    int32_t hwcFence;
+    int32_t hwcDataspace;
+    std::vector<hwc_rect_t> hwcDamage;
+
+    a2h::translate(fence, hwcFence);
+    a2h::translate(dataspace, hwcDataspace);
+    a2h::translate(damage, hwcDamage);
+    hwc_region_t region = { hwcDamage.size(), hwcDamage.data() };
+    return withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        return hwcDisplay.SetClientTarget(target, hwcFence, hwcDataspace, region);
+    });
+}
+
+int32_t NativeHalImpl::setColorTransform(int64_t display, const std::vector<float>& matrix) {
+    const bool isIdentity = (std::equal(matrix.begin(), matrix.end(), mkIdentity.begin()));
+    const common::ColorTransform hint = isIdentity ? common::ColorTransform::IDENTITY
+                                                   : common::ColorTransform::ARBITRARY_MATRIX;
+    int32_t hwcHint;
+    a2h::translate(hint, hwcHint);
+    return withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        return hwcDisplay.SetColorTransform(matrix.data(), hwcHint);
+    });
+}
+
+int32_t NativeHalImpl::setDisplayBrightness(int64_t display, float brightness) {
+    if (std::isnan(brightness) || brightness > 1.0f ||
+         (brightness < 0.0f && brightness != -1.0f)) {
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    return withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        return hwcDisplay.SetDisplayBrightness(brightness);
+    });
+}
+
+int32_t NativeHalImpl::setOutputBuffer(int64_t display, buffer_handle_t buffer,
+                                       const ndk::ScopedFileDescriptor& releaseFence) {
+    int32_t hwcFence;
+    a2h::translate(releaseFence, hwcFence);
+
+    auto err = withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        return hwcDisplay.SetOutputBuffer(buffer, hwcFence);
+    });
+    if (err == HWC2_ERROR_NONE && hwcFence >= 0) {
+        close(hwcFence);
+    }
+    return err;
+}
+
+int32_t NativeHalImpl::validateDisplay(int64_t display, std::vector<int64_t>* outChangedLayers,
+                                       std::vector<Composition>* outCompositionTypes,
+                                       uint32_t* outDisplayRequestMask,
+                                       std::vector<int64_t>* outRequestedLayers,
+                                       std::vector<int32_t>* outRequestMasks,
+                                       ClientTargetProperty* /*outClientTargetProperty*/,
+                                       DimmingStage* /*outDimmingStage*/) {
+    return withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        uint32_t typesCount = 0;
+        uint32_t reqsCount = 0;
+        auto err = toHalError(hwcDisplay.ValidateDisplay(&typesCount, &reqsCount));
+        if (err != HWC2_ERROR_NONE && err != HWC2_ERROR_HAS_CHANGES) {
+            return err;
+        }
+
+        RET_IF_ERR(toHalError(
+                hwcDisplay.GetChangedCompositionTypes(&typesCount, nullptr, nullptr)));
+        std::vector<hwc2_layer_t> hwcChangedLayers(typesCount);
+        std::vector<int32_t> hwcCompositionTypes(typesCount);
+        RET_IF_ERR(toHalError(
+                hwcDisplay.GetChangedCompositionTypes(&typesCount, hwcChangedLayers.data(),
+                                                      hwcCompositionTypes.data())));
+
+        int32_t displayReqs = 0;
+        RET_IF_ERR(toHalError(
+                hwcDisplay.GetDisplayRequests(&displayReqs, &reqsCount, nullptr, nullptr)));
+        std::vector<hwc2_layer_t> hwcRequestedLayers(reqsCount);
+        outRequestMasks->resize(reqsCount);
+        RET_IF_ERR(toHalError(
+                hwcDisplay.GetDisplayRequests(&displayReqs, &reqsCount,
+                                              hwcRequestedLayers.data(),
+                                              outRequestMasks->data())));
+
+        h2a::translate(hwcChangedLayers, *outChangedLayers);
+        h2a::translate(hwcCompositionTypes, *outCompositionTypes);
+        *outDisplayRequestMask = displayReqs;
+        h2a::translate(hwcRequestedLayers, *outRequestedLayers);
+        return toHalError(HWC2_ERROR_NONE);
+    });
+}
+
+int32_t NativeHalImpl::setExpectedPresentTime(
+        int64_t display, const std::optional<ClockMonotonicTimestamp> expectedPresentTime) {
+    return withDisplay(display, [&](HwcDisplay& hwcDisplay) {
+        return hwcDisplay.setExpectedPresentTime(expectedPresentTime);
+    });
+}
+
+int32_t NativeHalImpl::setLayerBlendMode(int64_t display, int64_t layer,
+                                         common::BlendMode mode) {
+    int32_t hwcMode;
+    a2h::translate(mode, hwcMode);
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetLayerBlendMode(hwcMode); });
+}
+
+int32_t NativeHalImpl::setLayerBuffer(int64_t display, int64_t layer, buffer_handle_t buffer,
+                                      const ndk::ScopedFileDescriptor& acquireFence) {
+    int32_t hwcFd;
+    a2h::translate(acquireFence, hwcFd);
+    return withLayer(display, layer, [&](HwcLayer& hwcLayer) {
+        return hwcLayer.SetLayerBuffer(buffer, hwcFd);
+    });
+}
+
+int32_t NativeHalImpl::setLayerColor(int64_t display, int64_t layer, Color color) {
+    hwc_color_t hwcColor;
+    a2h::translate(color, hwcColor);
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetLayerColor(hwcColor); });
+}
+
+int32_t NativeHalImpl::setLayerCompositionType(int64_t display, int64_t layer,
+                                               Composition type) {
+    int32_t hwcType;
+    a2h::translate(type, hwcType);
+    return withLayer(display, layer, [&](HwcLayer& hwcLayer) {
+        return hwcLayer.SetLayerCompositionType(hwcType);
+    });
+}
+
+int32_t NativeHalImpl::setLayerCursorPosition(int64_t display, int64_t layer, int32_t x,
+                                              int32_t y) {
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetCursorPosition(x, y); });
+}
+
+int32_t NativeHalImpl::setLayerDataspace(int64_t display, int64_t layer,
+                                         common::Dataspace dataspace) {
+    int32_t hwcDataspace;
+    a2h::translate(dataspace, hwcDataspace);
+    return withLayer(display, layer, [&](HwcLayer& hwcLayer) {
+        return hwcLayer.SetLayerDataspace(hwcDataspace);
+    });
+}
+
+int32_t NativeHalImpl::setLayerDisplayFrame(int64_t display, int64_t layer,
+                                            const common::Rect& frame) {
+    hwc_rect_t hwcFrame;
+    a2h::translate(frame, hwcFrame);
+    return withLayer(display, layer, [&](HwcLayer& hwcLayer) {
+        return hwcLayer.SetLayerDisplayFrame(hwcFrame);
+    });
+}
+
+int32_t NativeHalImpl::setLayerPerFrameMetadata(int64_t display, int64_t layer,
+                            const std::vector<std::optional<PerFrameMetadata>>& metadata) {
+    std::vector<int32_t> keys;
+    std::vector<float> values;
+
+    for (const auto& m : metadata) {
+        if (m) {
+            int32_t key;
+            a2h::translate(m->key, key);
+            keys.push_back(key);
+            values.push_back(m->value);
+        }
+    }
+
+    return withLayer(display, layer, [&](HwcLayer& hwcLayer) {
+        return hwcLayer.SetLayerPerFrameMetadata(keys.size(), keys.data(), values.data());
+    });
+}
+
+int32_t NativeHalImpl::setLayerPlaneAlpha(int64_t display, int64_t layer, float alpha) {
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetLayerPlaneAlpha(alpha); });
+}
+
+int32_t NativeHalImpl::setLayerSidebandStream(int64_t display, int64_t layer,
+                                              buffer_handle_t stream) {
+    return withLayer(display, layer, [&](HwcLayer& hwcLayer) {
+        return hwcLayer.SetLayerSidebandStream(stream);
+    });
+}
+
+int32_t NativeHalImpl::setLayerSourceCrop(int64_t display, int64_t layer,
+                                          const common::FRect& crop) {
+    hwc_frect_t hwcCrop;
+    a2h::translate(crop, hwcCrop);
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetLayerSourceCrop(hwcCrop); });
+}
+
+int32_t NativeHalImpl::setLayerSurfaceDamage(int64_t display, int64_t layer,
+                                  const std::vector<std::optional<common::Rect>>& damage) {
+    std::vector<hwc_rect_t> hwcDamage;
+    a2h::translate(damage, hwcDamage);
+    hwc_region_t region = { hwcDamage.size(), hwcDamage.data() };
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetLayerSurfaceDamage(region); });
+}
+
+int32_t NativeHalImpl::setLayerTransform(int64_t display, int64_t layer,
+                                         common::Transform transform) {
+    int32_t hwcTransform;
+    a2h::translate(transform, hwcTransform);
+    return withLayer(display, layer, [&](HwcLayer& hwcLayer) {
+        return hwcLayer.SetLayerTransform(hwcTransform);
+    });
+}
+
+int32_t NativeHalImpl::setLayerVisibleRegion(int64_t display, int64_t layer,
+                               const std::vector<std::optional<common::Rect>>& visible) {
+    std::vector<hwc_rect_t> hwcVisible;
+    a2h::translate(visible, hwcVisible);
+    hwc_region_t region = { hwcVisible.size(), hwcVisible.data() };
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetLayerVisibleRegion(region); });
+}
+
+int32_t NativeHalImpl::setLayerZOrder(int64_t display, int64_t layer, uint32_t z) {
+    return withLayer(display, layer,
+                     [&](HwcLayer& hwcLayer) { return hwcLayer.SetLayerZOrder(z); });
+}
+
+} // namespace aidl::android::hardware::graphics::composer3::impl
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2024, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "HalImpl.h"
+
+#include "hwc2_device/DrmHwcTwo.h"
+
+namespace aidl::android::hardware::graphics::composer3::impl {
+
+// In-process backend: drm_hwcomposer is linked statically and the per-frame
+// commands call HwcDisplay/HwcLayer directly instead of going through the
+// HWC2 function pointers. Everything else is still served by HalImpl through
+// the hooks of the same device.
+//
+// The display is locked once per DisplayCommand (see beginDisplayCommand), so
+// the layer commands of a frame don't take the locks again one by one.
+class NativeHalImpl : public HalImpl {
+  public:
+    static std::unique_ptr<IComposerHal> create();
+
+    NativeHalImpl(hwc2_device_t* device, ::android::DrmHwcTwo* hwc);
+
+    void beginDisplayCommand(int64_t display) override;
+    void endDisplayCommand(int64_t display) override;
+
+    int32_t acceptDisplayChanges(int64_t display) override;
+    int32_t presentDisplay(int64_t display, ndk::ScopedFileDescriptor& fence,
+                           std::vector<int64_t>* outLayers,
+                           std::vector<ndk::ScopedFileDescriptor>* outReleaseFences) override;
+    int32_t setClientTarget(int64_t display, buffer_handle_t target,
+                            const ndk::ScopedFileDescriptor& fence, common::Dataspace dataspace,
+                            const std::vector<common::Rect>& damage) override;
+    int32_t setColorTransform(int64_t display, const std::vector<float>& matrix) override;
+    int32_t setDisplayBrightness(int64_t display, float brightness) override;
+    int32_t setOutputBuffer(int64_t display, buffer_handle_t buffer,
+                            const ndk::ScopedFileDescriptor& releaseFence) override;
+    int32_t validateDisplay(int64_t display, std::vector<int64_t>* outChangedLayers,
+                            std::vector<Composition>* outCompositionTypes,
+                            uint32_t* outDisplayRequestMask,
+                            std::vector<int64_t>* outRequestedLayers,
+                            std::vector<int32_t>* outRequestMasks,
+                            ClientTargetProperty* outClientTargetProperty,
+                            DimmingStage* outDimmingStage) override;
+    int32_t setExpectedPresentTime(
+            int64_t display,
+            const std::optional<ClockMonotonicTimestamp> expectedPresentTime) override;
+
+    int32_t setLayerBlendMode(int64_t display, int64_t layer, common::BlendMode mode) override;
+    int32_t setLayerBuffer(int64_t display, int64_t layer, buffer_handle_t buffer,
+                           const ndk::ScopedFileDescriptor& acquireFence) override;
+    int32_t setLayerColor(int64_t display, int64_t layer, Color color) override;
+    int32_t setLayerCompositionType(int64_t display, int64_t layer, Composition type) override;
+    int32_t setLayerCursorPosition(int64_t display, int64_t layer, int32_t x, int32_t y) override;
+    int32_t setLayerDataspace(int64_t display, int64_t layer, common::Dataspace dataspace) override;
+    int32_t setLayerDisplayFrame(int64_t display, int64_t layer,
+                                 const common::Rect& frame) override;
+    int32_t setLayerPerFrameMetadata(int64_t display, int64_t layer,
+                            const std::vector<std::optional<PerFrameMetadata>>& metadata) override;
+    int32_t setLayerPlaneAlpha(int64_t display, int64_t layer, float alpha) override;
+    int32_t setLayerSidebandStream(int64_t display, int64_t layer,
+                                   buffer_handle_t stream) override;
+    int32_t setLayerSourceCrop(int64_t display, int64_t layer, const common::FRect& crop) override;
+    int32_t setLayerSurfaceDamage(int64_t display, int64_t layer,
+                                  const std::vector<std::optional<common::Rect>>& damage) override;
+    int32_t setLayerTransform(int64_t display, int64_t layer, common::Transform transform) override;
+    int32_t setLayerVisibleRegion(int64_t display, int64_t layer,
+                          const std::vector<std::optional<common::Rect>>& visible) override;
+    int32_t setLayerZOrder(int64_t display, int64_t layer, uint32_t z) override;
+
+  private:
+    // Runs func on the display, reusing the locks of the current batch if it
+    // is for the same display.
+    template <typename Func>
+    int32_t withDisplay(int64_t display, Func&& func);
+
+    template <typename Func>
+    int32_t withLayer(int64_t display, int64_t layer, Func&& func);
+
+    ::android::DrmHwcTwo* const mHwc;
+};
+
+} // namespace aidl::android::hardware::graphics::composer3::impl
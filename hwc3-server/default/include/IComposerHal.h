@@ -108,6 +108,11 @@ class IComposerHal {
     virtual void registerEventCallback(EventCallback* callback) = 0;
     virtual void unregisterEventCallback() = 0;
 
+    // Bracket all commands of one DisplayCommand. In between only calls for that
+    // display are made, so a backend may keep the display locked for the batch.
+    virtual void beginDisplayCommand(int64_t /*display*/) {}
+    virtual void endDisplayCommand(int64_t /*display*/) {}
+
     virtual int32_t acceptDisplayChanges(int64_t display) = 0;
     virtual int32_t createLayer(int64_t display, int64_t* outLayer) = 0;
     virtual int32_t createVirtualDisplay(uint32_t width, uint32_t height, AidlPixelFormat format,
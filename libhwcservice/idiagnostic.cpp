@@ -34,7 +34,8 @@ class BpDiagnostic : public BpInterface<IDiagnostic> {
     TRANSACT_ENABLE_DISPLAY,
     TRANSACT_DISABLE_DISPLAY,
     TRANSACT_MASK_LAYER,
-    TRANSACT_DUMP_FRAMES
+    TRANSACT_DUMP_FRAMES,
+    TRANSACT_READ_FRAME_TIMINGS
   };
 
   virtual ~BpDiagnostic() {
@@ -101,6 +102,17 @@ class BpDiagnostic : public BpInterface<IDiagnostic> {
     }
   }
 
+  status_t ReadFrameTimings(uint32_t d, Parcel* reply) {
+    Parcel data;
+    data.writeInterfaceToken(IDiagnostic::getInterfaceDescriptor());
+    data.writeInt32(d);
+    status_t ret = remote()->transact(TRANSACT_READ_FRAME_TIMINGS, data, reply);
+    if (ret != NO_ERROR) {
+      ALOGW("%s() transact failed: %d", __FUNCTION__, ret);
+    }
+    return ret;
+  }
+
  private:
   Parcel* mReply;
 };
@@ -149,6 +161,12 @@ status_t BnDiagnostic::onTransact(uint32_t code, const Parcel& data,
       return NO_ERROR;
     }
 
+    case BpDiagnostic::TRANSACT_READ_FRAME_TIMINGS: {
+      CHECK_INTERFACE(IDiagnostic, data, reply);
+      uint32_t d = data.readInt32();
+      return ReadFrameTimings(d, reply);
+    }
+
     default:
       return BBinder::onTransact(code, data, reply, flags);
   }
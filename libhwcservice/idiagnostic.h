@@ -43,6 +43,11 @@ class IDiagnostic : public IInterface {
   virtual void DisableDisplay(uint32_t d, bool bBlank) = 0;
   virtual void MaskLayer(uint32_t d, uint32_t layer, bool bHide) = 0;
   virtual void DumpFrames(uint32_t d, int32_t frames, bool bSync) = 0;
+
+  // Per-stage frame latency of display d. Reply layout: int64 missed vsyncs,
+  // int32 number of stages, then per stage: String8 name, int64 sample count,
+  // int64 average, p50, p99 and max latency in microseconds.
+  virtual status_t ReadFrameTimings(uint32_t d, android::Parcel* reply) = 0;
 };
 
 class BnDiagnostic : public android::BnInterface<IDiagnostic> {
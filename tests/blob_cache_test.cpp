@@ -0,0 +1,128 @@
+#include "drm/DrmPropertyBlobCache.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <set>
+
+using android::DrmPropertyBlobCache;
+
+namespace {
+
+/* Stands in for the kernel, hands out blob ids and tracks the live ones */
+class FakeBlobs {
+ public:
+  auto MakeCache() {
+    return DrmPropertyBlobCache(
+        [this](const void * /*data*/, size_t /*length*/) {
+          return Register();
+        });
+  }
+
+  auto Register() -> DrmModeUserPropertyBlobUnique {
+    registered++;
+    if (fail) {
+      return {};
+    }
+
+    auto id = next_id_++;
+    live.insert(id);
+    return {new uint32_t(id), [this](const uint32_t *it) {
+              live.erase(*it);
+              delete it;
+            }};
+  }
+
+  int registered = 0;
+  bool fail = false;
+  std::set<uint32_t> live;
+
+ private:
+  uint32_t next_id_ = 1;
+};
+
+}  // namespace
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(BlobCacheTest, SameContentSharesBlob) {
+  FakeBlobs kernel;
+  auto cache = kernel.MakeCache();
+  std::array<uint32_t, 4> data = {1, 2, 3, 4};
+  auto copy = data;
+
+  auto a = cache.Get(data.data(), sizeof(data));
+  auto b = cache.Get(copy.data(), sizeof(copy));
+  ASSERT_TRUE(a);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(kernel.registered, 1);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(BlobCacheTest, DifferentContentGetsNewBlob) {
+  FakeBlobs kernel;
+  auto cache = kernel.MakeCache();
+  std::array<uint32_t, 4> data = {1, 2, 3, 4};
+  std::array<uint32_t, 4> other = {1, 2, 3, 5};
+
+  auto a = cache.Get(data.data(), sizeof(data));
+  auto b = cache.Get(other.data(), sizeof(other));
+  /* A prefix of the same bytes is a different blob too */
+  auto c = cache.Get(data.data(), sizeof(data) - sizeof(data[0]));
+  ASSERT_TRUE(a && b && c);
+  EXPECT_NE(a->GetId(), b->GetId());
+  EXPECT_NE(a->GetId(), c->GetId());
+  EXPECT_EQ(kernel.registered, 3);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(BlobCacheTest, BlobDiesWithLastReference) {
+  FakeBlobs kernel;
+  auto cache = kernel.MakeCache();
+  std::array<uint32_t, 2> data = {7, 8};
+
+  auto a = cache.Get(data.data(), sizeof(data));
+  ASSERT_TRUE(a);
+  EXPECT_EQ(kernel.live.size(), 1);
+  a.reset();
+  EXPECT_TRUE(kernel.live.empty());
+
+  /* The cache doesn't keep the blob alive, it has to be created again */
+  auto b = cache.Get(data.data(), sizeof(data));
+  ASSERT_TRUE(b);
+  EXPECT_EQ(kernel.registered, 2);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(BlobCacheTest, InvalidInputAndFailures) {
+  FakeBlobs kernel;
+  auto cache = kernel.MakeCache();
+  std::array<uint32_t, 2> data = {7, 8};
+
+  EXPECT_FALSE(cache.Get(nullptr, sizeof(data)));
+  EXPECT_FALSE(cache.Get(data.data(), 0));
+  EXPECT_EQ(kernel.registered, 0);
+
+  kernel.fail = true;
+  EXPECT_FALSE(cache.Get(data.data(), sizeof(data)));
+  kernel.fail = false;
+  EXPECT_TRUE(cache.Get(data.data(), sizeof(data)));
+  EXPECT_EQ(kernel.registered, 2);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(BlobCacheTest, OnlyLiveBlobsAreKept) {
+  FakeBlobs kernel;
+  auto cache = kernel.MakeCache();
+  std::array<uint32_t, 1> kept_data = {0};
+  auto kept = cache.Get(kept_data.data(), sizeof(kept_data));
+
+  constexpr uint32_t kBlobs = 1000;
+  for (uint32_t i = 1; i <= kBlobs; i++) {
+    std::array<uint32_t, 1> data = {i};
+    EXPECT_TRUE(cache.Get(data.data(), sizeof(data)));
+  }
+
+  EXPECT_EQ(kernel.live.size(), 1);
+  EXPECT_NE(cache.Dump().find(" 1 live blobs"), std::string::npos);
+  EXPECT_EQ(cache.Get(kept_data.data(), sizeof(kept_data)), kept);
+}
@@ -0,0 +1,578 @@
+#include "fake_drm.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+namespace android {
+
+namespace {
+
+constexpr uint32_t kCrtcId = 10;
+constexpr uint32_t kEncoderId = 20;
+constexpr uint32_t kConnectorId = 30;
+constexpr std::array<uint32_t, FakeDrmNode::kPlanes> kPlaneIds = {40, 41, 42,
+                                                                  43};
+constexpr std::array<uint32_t, 2> kPlaneFormats = {DRM_FORMAT_ARGB8888,
+                                                   DRM_FORMAT_ABGR8888};
+
+enum PropertyId : uint32_t {
+  kActive = 100,
+  kModeId,
+  kOutFencePtr,
+  kDpms,
+  kCrtcIdProp,
+  kType,
+  kFbId,
+  kCrtcX,
+  kCrtcY,
+  kCrtcW,
+  kCrtcH,
+  kSrcX,
+  kSrcY,
+  kSrcW,
+  kSrcH,
+  kZpos,
+  kInFenceFd,
+};
+
+struct FakeProperty {
+  uint32_t id;
+  const char *name;
+  uint32_t flags;
+  std::vector<uint64_t> values;
+  /* For enums, the values are the indexes of the names */
+  std::vector<const char *> enum_names;
+};
+
+auto Range(uint32_t id, const char *name, uint64_t max) -> FakeProperty {
+  return {id, name, DRM_MODE_PROP_RANGE, {0, max}, {}};
+}
+
+const std::array<FakeProperty, 17> kProperties = {{
+    Range(kActive, "ACTIVE", 1),
+    {kModeId, "MODE_ID", DRM_MODE_PROP_BLOB, {}, {}},
+    Range(kOutFencePtr, "OUT_FENCE_PTR", UINT64_MAX),
+    {kDpms, "DPMS", DRM_MODE_PROP_ENUM, {0, 1, 2, 3},
+     {"On", "Standby", "Suspend", "Off"}},
+    {kCrtcIdProp, "CRTC_ID", DRM_MODE_PROP_OBJECT, {DRM_MODE_OBJECT_CRTC}, {}},
+    {kType, "type", DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE, {0, 1, 2},
+     {"Overlay", "Primary", "Cursor"}},
+    {kFbId, "FB_ID", DRM_MODE_PROP_OBJECT, {DRM_MODE_OBJECT_FB}, {}},
+    Range(kCrtcX, "CRTC_X", INT32_MAX),
+    Range(kCrtcY, "CRTC_Y", INT32_MAX),
+    Range(kCrtcW, "CRTC_W", INT32_MAX),
+    Range(kCrtcH, "CRTC_H", INT32_MAX),
+    Range(kSrcX, "SRC_X", UINT32_MAX),
+    Range(kSrcY, "SRC_Y", UINT32_MAX),
+    Range(kSrcW, "SRC_W", UINT32_MAX),
+    Range(kSrcH, "SRC_H", UINT32_MAX),
+    Range(kZpos, "zpos", FakeDrmNode::kPlanes - 1),
+    Range(kInFenceFd, "IN_FENCE_FD", INT32_MAX),
+}};
+
+struct FakeObject {
+  uint32_t id;
+  uint32_t type;
+  std::vector<std::pair<uint32_t, uint64_t>> props;
+};
+
+auto MakeObjects() -> std::vector<FakeObject> {
+  std::vector<FakeObject> objects = {
+      {kCrtcId, DRM_MODE_OBJECT_CRTC, {{kActive, 0}, {kModeId, 0},
+                                       {kOutFencePtr, 0}}},
+      {kConnectorId, DRM_MODE_OBJECT_CONNECTOR, {{kDpms, 0},
+                                                 {kCrtcIdProp, 0}}},
+  };
+
+  for (size_t i = 0; i < kPlaneIds.size(); i++) {
+    uint64_t type = i == 0 ? DRM_PLANE_TYPE_PRIMARY : DRM_PLANE_TYPE_OVERLAY;
+    objects.push_back({kPlaneIds[i],
+                       DRM_MODE_OBJECT_PLANE,
+                       {{kType, type},
+                        {kCrtcIdProp, 0},
+                        {kFbId, 0},
+                        {kCrtcX, 0},
+                        {kCrtcY, 0},
+                        {kCrtcW, 0},
+                        {kCrtcH, 0},
+                        {kSrcX, 0},
+                        {kSrcY, 0},
+                        {kSrcW, 0},
+                        {kSrcH, 0},
+                        {kZpos, i},
+                        {kInFenceFd, 0}}});
+  }
+  return objects;
+}
+
+const std::vector<FakeObject> kObjects = MakeObjects();
+
+auto MakeMode() -> drmModeModeInfo {
+  drmModeModeInfo mode{};
+  mode.clock = 148500;
+  mode.hdisplay = FakeDrmNode::kWidth;
+  mode.hsync_start = 2008;
+  mode.hsync_end = 2052;
+  mode.htotal = 2200;
+  mode.vdisplay = FakeDrmNode::kHeight;
+  mode.vsync_start = 1084;
+  mode.vsync_end = 1089;
+  mode.vtotal = 1125;
+  mode.vrefresh = 60;
+  mode.flags = DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC;
+  mode.type = DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED;
+  strncpy(mode.name, "1920x1080", sizeof(mode.name) - 1);
+  return mode;
+}
+
+/* Write end of the FIFO, a byte per page flip event */
+std::atomic_int event_fd = -1;
+std::atomic_uint32_t last_fb_id = 0;
+std::atomic_uint32_t last_blob_id = 0;
+std::atomic_uint64_t commit_count = 0;
+
+template <typename T>
+auto Alloc(size_t count = 1) -> T * {
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc): freed by the drmModeFree*()
+  return static_cast<T *>(calloc(count, sizeof(T)));
+}
+
+template <typename T, typename C>
+auto AllocCopy(const C &src) -> T * {
+  auto *dst = Alloc<T>(src.size());
+  std::copy(src.begin(), src.end(), dst);
+  return dst;
+}
+
+}  // namespace
+
+FakeDrmNode::FakeDrmNode() {
+  dir_ = testing::TempDir() + "fake-drm-XXXXXX";
+  if (mkdtemp(dir_.data()) == nullptr) {
+    ADD_FAILURE() << "mkdtemp failed: errno=" << errno;
+    return;
+  }
+
+  path_ = dir_ + "/card0";
+  if (mkfifo(path_.c_str(), S_IRUSR | S_IWUSR) != 0) {
+    ADD_FAILURE() << "mkfifo failed: errno=" << errno;
+    return;
+  }
+
+  event_fd_ = UniqueFd(open(path_.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC));
+  event_fd = event_fd_.Get();
+}
+
+FakeDrmNode::~FakeDrmNode() {
+  event_fd = -1;
+  unlink(path_.c_str());
+  rmdir(dir_.c_str());
+}
+
+auto FakeDrmNode::GetCommitCount() -> uint64_t {
+  return commit_count;
+}
+
+}  // namespace android
+
+using android::kObjects;
+using android::kProperties;
+
+extern "C" {
+
+struct _drmModeAtomicReq {
+  uint32_t cursor;
+  uint32_t size;
+  struct Item {
+    uint32_t object_id;
+    uint32_t property_id;
+    uint64_t value;
+  } * items;
+};
+
+int drmIoctl(int /*fd*/, unsigned long request, void *arg) {
+  switch (request) {
+    case DRM_IOCTL_MODE_CREATEPROPBLOB: {
+      auto *blob = static_cast<drm_mode_create_blob *>(arg);
+      blob->blob_id = ++android::last_blob_id;
+      return 0;
+    }
+    case DRM_IOCTL_MODE_DESTROYPROPBLOB:
+    case DRM_IOCTL_GEM_CLOSE:
+      return 0;
+    default:
+      errno = ENOTTY;
+      return -1;
+  }
+}
+
+drmVersionPtr drmGetVersion(int /*fd*/) {
+  auto *ver = android::Alloc<drmVersion>();
+  ver->name = strdup("fake");
+  ver->name_len = int(strlen(ver->name));
+  return ver;
+}
+
+void drmFreeVersion(drmVersionPtr ver) {
+  if (ver != nullptr) {
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    free(ver->name);
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ver);
+}
+
+char *drmGetDeviceNameFromFd2(int /*fd*/) {
+  return nullptr;
+}
+
+int drmSetClientCap(int /*fd*/, uint64_t /*capability*/, uint64_t /*value*/) {
+  return 0;
+}
+
+int drmGetCap(int /*fd*/, uint64_t /*capability*/, uint64_t *value) {
+  *value = 0;
+  return 0;
+}
+
+int drmSetMaster(int /*fd*/) {
+  return 0;
+}
+
+int drmIsMaster(int /*fd*/) {
+  return 1;
+}
+
+int drmPrimeFDToHandle(int /*fd*/, int prime_fd, uint32_t *handle) {
+  /* Same buffer, same handle */
+  struct stat sb {};
+  if (fstat(prime_fd, &sb) != 0) {
+    return -errno;
+  }
+  *handle = uint32_t(sb.st_ino);
+  return 0;
+}
+
+int drmCrtcQueueSequence(int /*fd*/, uint32_t /*crtcId*/, uint32_t /*flags*/,
+                         uint64_t /*sequence*/, uint64_t *sequence_queued,
+                         uint64_t /*user_data*/) {
+  if (sequence_queued != nullptr) {
+    *sequence_queued = 0;
+  }
+  return 0;
+}
+
+int drmHandleEvent(int fd, drmEventContextPtr evctx) {
+  std::array<char, 64> events{};
+  auto count = read(fd, events.data(), events.size());
+  if (count <= 0) {
+    return -1;
+  }
+
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  for (ssize_t i = 0; i < count; i++) {
+    if (evctx->page_flip_handler2 != nullptr) {
+      evctx->page_flip_handler2(fd, 0, unsigned(ts.tv_sec),
+                                unsigned(ts.tv_nsec / 1000), android::kCrtcId,
+                                nullptr);
+    }
+  }
+  return 0;
+}
+
+drmModeResPtr drmModeGetResources(int /*fd*/) {
+  auto *res = android::Alloc<drmModeRes>();
+  res->count_crtcs = 1;
+  res->crtcs = android::AllocCopy<uint32_t>(
+      std::array<uint32_t, 1>{android::kCrtcId});
+  res->count_encoders = 1;
+  res->encoders = android::AllocCopy<uint32_t>(
+      std::array<uint32_t, 1>{android::kEncoderId});
+  res->count_connectors = 1;
+  res->connectors = android::AllocCopy<uint32_t>(
+      std::array<uint32_t, 1>{android::kConnectorId});
+  res->min_width = 1;
+  res->min_height = 1;
+  res->max_width = 8192;
+  res->max_height = 8192;
+  return res;
+}
+
+void drmModeFreeResources(drmModeResPtr ptr) {
+  if (ptr != nullptr) {
+    // NOLINTBEGIN(cppcoreguidelines-no-malloc)
+    free(ptr->crtcs);
+    free(ptr->encoders);
+    free(ptr->connectors);
+    // NOLINTEND(cppcoreguidelines-no-malloc)
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+drmModeCrtcPtr drmModeGetCrtc(int /*fd*/, uint32_t crtcId) {
+  if (crtcId != android::kCrtcId) {
+    return nullptr;
+  }
+  auto *crtc = android::Alloc<drmModeCrtc>();
+  crtc->crtc_id = crtcId;
+  return crtc;
+}
+
+void drmModeFreeCrtc(drmModeCrtcPtr ptr) {
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+drmModeEncoderPtr drmModeGetEncoder(int /*fd*/, uint32_t encoder_id) {
+  if (encoder_id != android::kEncoderId) {
+    return nullptr;
+  }
+  auto *enc = android::Alloc<drmModeEncoder>();
+  enc->encoder_id = encoder_id;
+  enc->encoder_type = DRM_MODE_ENCODER_TMDS;
+  enc->crtc_id = android::kCrtcId;
+  enc->possible_crtcs = 1;
+  return enc;
+}
+
+void drmModeFreeEncoder(drmModeEncoderPtr ptr) {
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+drmModeConnectorPtr drmModeGetConnector(int /*fd*/, uint32_t connectorId) {
+  if (connectorId != android::kConnectorId) {
+    return nullptr;
+  }
+  auto *conn = android::Alloc<drmModeConnector>();
+  conn->connector_id = connectorId;
+  conn->encoder_id = android::kEncoderId;
+  conn->connector_type = DRM_MODE_CONNECTOR_HDMIA;
+  conn->connector_type_id = 1;
+  conn->connection = DRM_MODE_CONNECTED;
+  conn->mmWidth = 520;
+  conn->mmHeight = 290;
+  conn->count_modes = 1;
+  conn->modes = android::AllocCopy<drmModeModeInfo>(
+      std::array<drmModeModeInfo, 1>{android::MakeMode()});
+  conn->count_encoders = 1;
+  conn->encoders = android::AllocCopy<uint32_t>(
+      std::array<uint32_t, 1>{android::kEncoderId});
+  return conn;
+}
+
+void drmModeFreeConnector(drmModeConnectorPtr ptr) {
+  if (ptr != nullptr) {
+    // NOLINTBEGIN(cppcoreguidelines-no-malloc)
+    free(ptr->modes);
+    free(ptr->encoders);
+    // NOLINTEND(cppcoreguidelines-no-malloc)
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+drmModePlaneResPtr drmModeGetPlaneResources(int /*fd*/) {
+  auto *res = android::Alloc<drmModePlaneRes>();
+  res->count_planes = android::kPlaneIds.size();
+  res->planes = android::AllocCopy<uint32_t>(android::kPlaneIds);
+  return res;
+}
+
+void drmModeFreePlaneResources(drmModePlaneResPtr ptr) {
+  if (ptr != nullptr) {
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    free(ptr->planes);
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+drmModePlanePtr drmModeGetPlane(int /*fd*/, uint32_t plane_id) {
+  auto &ids = android::kPlaneIds;
+  if (std::find(ids.begin(), ids.end(), plane_id) == ids.end()) {
+    return nullptr;
+  }
+  auto *plane = android::Alloc<drmModePlane>();
+  plane->plane_id = plane_id;
+  plane->possible_crtcs = 1;
+  plane->count_formats = android::kPlaneFormats.size();
+  plane->formats = android::AllocCopy<uint32_t>(android::kPlaneFormats);
+  return plane;
+}
+
+void drmModeFreePlane(drmModePlanePtr ptr) {
+  if (ptr != nullptr) {
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    free(ptr->formats);
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+drmModeObjectPropertiesPtr drmModeObjectGetProperties(int /*fd*/,
+                                                      uint32_t object_id,
+                                                      uint32_t object_type) {
+  for (const auto &obj : kObjects) {
+    if (obj.id != object_id || obj.type != object_type) {
+      continue;
+    }
+    auto *props = android::Alloc<drmModeObjectProperties>();
+    props->count_props = obj.props.size();
+    props->props = android::Alloc<uint32_t>(obj.props.size());
+    props->prop_values = android::Alloc<uint64_t>(obj.props.size());
+    for (size_t i = 0; i < obj.props.size(); i++) {
+      // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      props->props[i] = obj.props[i].first;
+      props->prop_values[i] = obj.props[i].second;
+      // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+    return props;
+  }
+  return nullptr;
+}
+
+void drmModeFreeObjectProperties(drmModeObjectPropertiesPtr ptr) {
+  if (ptr != nullptr) {
+    // NOLINTBEGIN(cppcoreguidelines-no-malloc)
+    free(ptr->props);
+    free(ptr->prop_values);
+    // NOLINTEND(cppcoreguidelines-no-malloc)
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+drmModePropertyPtr drmModeGetProperty(int /*fd*/, uint32_t propertyId) {
+  for (const auto &p : kProperties) {
+    if (p.id != propertyId) {
+      continue;
+    }
+    auto *prop = android::Alloc<drmModePropertyRes>();
+    prop->prop_id = p.id;
+    prop->flags = p.flags;
+    strncpy(prop->name, p.name, sizeof(prop->name) - 1);
+    prop->count_values = int(p.values.size());
+    prop->values = android::AllocCopy<uint64_t>(p.values);
+    prop->count_enums = int(p.enum_names.size());
+    prop->enums = android::Alloc<drm_mode_property_enum>(p.enum_names.size());
+    for (size_t i = 0; i < p.enum_names.size(); i++) {
+      // NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      prop->enums[i].value = i;
+      strncpy(prop->enums[i].name, p.enum_names[i],
+              sizeof(prop->enums[i].name) - 1);
+      // NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+    return prop;
+  }
+  return nullptr;
+}
+
+void drmModeFreeProperty(drmModePropertyPtr ptr) {
+  if (ptr != nullptr) {
+    // NOLINTBEGIN(cppcoreguidelines-no-malloc)
+    free(ptr->values);
+    free(ptr->enums);
+    // NOLINTEND(cppcoreguidelines-no-malloc)
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+int drmModeConnectorSetProperty(int /*fd*/, uint32_t /*connector_id*/,
+                                uint32_t /*property_id*/, uint64_t /*value*/) {
+  return 0;
+}
+
+drmModeAtomicReqPtr drmModeAtomicAlloc() {
+  return android::Alloc<drmModeAtomicReq>();
+}
+
+void drmModeAtomicFree(drmModeAtomicReqPtr req) {
+  if (req != nullptr) {
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    free(req->items);
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(req);
+}
+
+void drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor) {
+  req->cursor = cursor;
+}
+
+int drmModeAtomicAddProperty(drmModeAtomicReqPtr req, uint32_t object_id,
+                             uint32_t property_id, uint64_t value) {
+  /* Grows like libdrm, keeping the capacity when the cursor is reset */
+  if (req->cursor == req->size) {
+    auto size = req->size + 16;
+    // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+    auto *items = realloc(req->items, size * sizeof(*req->items));
+    if (items == nullptr) {
+      return -ENOMEM;
+    }
+    req->items = static_cast<_drmModeAtomicReq::Item *>(items);
+    req->size = size;
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  req->items[req->cursor++] = {object_id, property_id, value};
+  return int(req->cursor);
+}
+
+int drmModeAtomicCommit(int /*fd*/, drmModeAtomicReqPtr req, uint32_t flags,
+                        void * /*user_data*/) {
+  if ((flags & DRM_MODE_ATOMIC_TEST_ONLY) != 0) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < req->cursor; i++) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    auto &item = req->items[i];
+    if (item.property_id == android::kOutFencePtr && item.value != 0) {
+      /* A readable eventfd passes for a signalled fence in poll() */
+      // NOLINTNEXTLINE(performance-no-int-to-ptr)
+      *reinterpret_cast<int *>(item.value) = eventfd(1, EFD_CLOEXEC);
+    }
+  }
+
+  if ((flags & DRM_MODE_PAGE_FLIP_EVENT) != 0) {
+    const char flip = 'f';
+    if (write(android::event_fd, &flip, 1) != 1) {
+      return -errno;
+    }
+  }
+
+  android::commit_count++;
+  return 0;
+}
+
+int drmModeAddFB2(int /*fd*/, uint32_t /*width*/, uint32_t /*height*/,
+                  uint32_t /*pixel_format*/, const uint32_t /*bo_handles*/[4],
+                  const uint32_t /*pitches*/[4], const uint32_t /*offsets*/[4],
+                  uint32_t *buf_id, uint32_t /*flags*/) {
+  *buf_id = ++android::last_fb_id;
+  return 0;
+}
+
+int drmModeRmFB(int /*fd*/, uint32_t /*bufferId*/) {
+  return 0;
+}
+
+}  // extern "C"
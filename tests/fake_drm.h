@@ -0,0 +1,47 @@
+#ifndef ANDROID_TESTS_FAKE_DRM_H_
+#define ANDROID_TESTS_FAKE_DRM_H_
+
+#include <cstdint>
+#include <string>
+
+#include "utils/UniqueFd.h"
+
+namespace android {
+
+/*
+ * In-process stand-in for the libdrm calls of the HWC, the test binary links
+ * it instead of the libdrm ones. It describes a single connected 1920x1080
+ * HDMI output, driven by one CRTC with a primary and three overlay planes.
+ *
+ * Atomic commits always succeed. The out-fences are already signalled and
+ * every page flip event is delivered right away, vblank events never are.
+ * Like libdrm, the fake allocates with malloc() only.
+ */
+class FakeDrmNode {
+ public:
+  static constexpr uint32_t kWidth = 1920;
+  static constexpr uint32_t kHeight = 1080;
+  static constexpr size_t kPlanes = 4;
+
+  FakeDrmNode();
+  ~FakeDrmNode();
+  FakeDrmNode(const FakeDrmNode &) = delete;
+  auto operator=(const FakeDrmNode &) = delete;
+
+  /* Opened by DrmDevice, a FIFO carrying the DRM events */
+  auto GetPath() const -> const std::string & {
+    return path_;
+  }
+
+  /* Commits which weren't TEST_ONLY */
+  static auto GetCommitCount() -> uint64_t;
+
+ private:
+  std::string dir_;
+  std::string path_;
+  UniqueFd event_fd_;
+};
+
+}  // namespace android
+
+#endif
@@ -0,0 +1,236 @@
+#include <cutils/native_handle.h>
+#include <gtest/gtest.h>
+#include <sync/sync.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "bufferinfo/BufferInfoGetter.h"
+#include "drm/DrmDevice.h"
+#include "drm/DrmDisplayPipeline.h"
+#include "fake_drm.h"
+#include "hwc2_device/DrmHwcTwo.h"
+#include "hwc2_device/HwcDisplay.h"
+#include "utils/log.h"
+
+namespace android {
+
+/* Describes the test buffers: data[0] is a memfd, data[1] and data[2] are the
+ * width and height.
+ */
+class FakeBufferInfoGetter : public LegacyBufferInfoGetter {
+ public:
+  /* Hides the gralloc module lookup of LegacyBufferInfoGetter */
+  auto Init() -> int {
+    return 0;
+  }
+
+  auto GetBoInfo(buffer_handle_t handle)
+      -> std::optional<BufferInfo> override {
+    BufferInfo bi{};
+    bi.width = handle->data[1];
+    bi.height = handle->data[2];
+    bi.format = DRM_FORMAT_ABGR8888;
+    bi.pitches[0] = bi.width * 4;
+    bi.prime_fds[0] = handle->data[0];
+    bi.blend_mode = BufferBlendMode::kPreMult;
+    return bi;
+  }
+};
+
+LEGACY_BUFFER_INFO_GETTER(FakeBufferInfoGetter)
+
+}  // namespace android
+
+namespace {
+
+thread_local bool count_allocations = false;
+thread_local size_t allocations = 0;
+
+constexpr int kWarmupFrames = 60;
+constexpr int kMeasuredFrames = 300;
+constexpr size_t kSwapchainSize = 3;
+constexpr size_t kLayers = 4;
+
+using android::FakeDrmNode;
+using Swapchain = std::array<native_handle_t *, kSwapchainSize>;
+
+auto CreateBuffer(uint32_t width, uint32_t height) -> native_handle_t * {
+  auto *handle = native_handle_create(1, 2);
+  handle->data[0] = memfd_create("frame-alloc-test", MFD_CLOEXEC);
+  /* BufferInfoGetter::GetUniqueId() needs a non-empty file */
+  if (ftruncate(handle->data[0], 4096) != 0) {
+    ADD_FAILURE() << "ftruncate failed: errno=" << errno;
+  }
+  handle->data[1] = int(width);
+  handle->data[2] = int(height);
+  return handle;
+}
+
+void DestroyBuffer(native_handle_t *handle) {
+  native_handle_close(handle);
+  native_handle_delete(handle);
+}
+
+class FrameAllocTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    hwc2_ = std::make_unique<android::DrmHwcTwo>();
+    device_ = android::DrmDevice::CreateInstance(node_.GetPath(),
+                                                 &hwc2_->GetResMan());
+    ASSERT_NE(device_, nullptr);
+    ASSERT_EQ(device_->GetConnectors().size(), 1U);
+    pipe_ = android::DrmDisplayPipeline::CreatePipeline(
+        *device_->GetConnectors()[0]);
+    ASSERT_NE(pipe_, nullptr);
+    ASSERT_TRUE(hwc2_->BindDisplay(pipe_.get()));
+    display_ = hwc2_->GetDisplay(android::kPrimaryDisplay);
+    ASSERT_NE(display_, nullptr);
+    ASSERT_EQ(display_->SetPowerMode(HWC2_POWER_MODE_ON), HWC2::Error::None);
+
+    /* Three layers on the overlays, the top one composed by the client */
+    for (size_t i = 0; i < kLayers; i++) {
+      auto width = FakeDrmNode::kWidth / (i + 1);
+      auto height = FakeDrmNode::kHeight / (i + 1);
+      for (auto &buffer : swapchains_[i]) {
+        buffer = CreateBuffer(width, height);
+      }
+
+      hwc2_layer_t id{};
+      ASSERT_EQ(display_->CreateLayer(&id), HWC2::Error::None);
+      auto *layer = display_->get_layer(id);
+      auto type = i == kLayers - 1 ? HWC2_COMPOSITION_CLIENT
+                                   : HWC2_COMPOSITION_DEVICE;
+      layer->SetLayerCompositionType(type);
+      layer->SetLayerBlendMode(HWC2_BLEND_MODE_PREMULTIPLIED);
+      layer->SetLayerDisplayFrame({.left = 0,
+                                   .top = 0,
+                                   .right = int(width),
+                                   .bottom = int(height)});
+      layer->SetLayerSourceCrop({.left = 0,
+                                 .top = 0,
+                                 .right = float(width),
+                                 .bottom = float(height)});
+      layer->SetLayerZOrder(i);
+      layers_[i] = layer;
+    }
+
+    for (auto &buffer : client_swapchain_) {
+      buffer = CreateBuffer(FakeDrmNode::kWidth, FakeDrmNode::kHeight);
+    }
+  }
+
+  void TearDown() override {
+    if (pipe_) {
+      hwc2_->UnbindDisplay(pipe_.get());
+    }
+    /* Releases the layers and their framebuffers before the device */
+    hwc2_.reset();
+    pipe_.reset();
+    device_.reset();
+
+    for (auto &swapchain : swapchains_) {
+      for (auto *buffer : swapchain) {
+        if (buffer != nullptr) {
+          DestroyBuffer(buffer);
+        }
+      }
+    }
+    for (auto *buffer : client_swapchain_) {
+      if (buffer != nullptr) {
+        DestroyBuffer(buffer);
+      }
+    }
+  }
+
+  /* Returns the number of allocations made by the validate/present calls */
+  auto RunFrame(size_t frame) -> size_t {
+    for (size_t i = 0; i < kLayers; i++) {
+      layers_[i]->SetLayerBuffer(swapchains_[i][frame % kSwapchainSize], -1);
+    }
+    display_->SetClientTarget(client_swapchain_[frame % kSwapchainSize], -1,
+                              HAL_DATASPACE_UNKNOWN,
+                              {.numRects = 0, .rects = nullptr});
+
+    uint32_t num_types{};
+    uint32_t num_requests{};
+    int32_t present_fence = -1;
+
+    allocations = 0;
+    count_allocations = true;
+    auto validated = display_->ValidateDisplay(&num_types, &num_requests);
+    display_->AcceptDisplayChanges();
+    auto presented = display_->PresentDisplay(&present_fence);
+    count_allocations = false;
+
+    EXPECT_EQ(validated, HWC2::Error::None);
+    EXPECT_EQ(presented, HWC2::Error::None);
+
+    /* Like a client waiting for its previous frame, which leaves the queued
+     * composition released to be reused.
+     */
+    if (present_fence >= 0) {
+      constexpr int kTimeoutMs = 1000;
+      EXPECT_EQ(sync_wait(present_fence, kTimeoutMs), 0);
+      close(present_fence);
+    }
+
+    return allocations;
+  }
+
+  FakeDrmNode node_;
+  std::unique_ptr<android::DrmHwcTwo> hwc2_;
+  std::unique_ptr<android::DrmDevice> device_;
+  std::unique_ptr<android::DrmDisplayPipeline> pipe_;
+  android::HwcDisplay *display_{};
+  std::array<android::HwcLayer *, kLayers> layers_{};
+  std::array<Swapchain, kLayers> swapchains_{};
+  Swapchain client_swapchain_{};
+};
+
+}  // namespace
+
+// NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+void *operator new(size_t size) {
+  if (count_allocations) {
+    allocations++;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  void *ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    abort();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST_F(FrameAllocTest, SteadyStateFramesDontAllocate) {
+  size_t frame = 0;
+  for (int i = 0; i < kWarmupFrames; i++) {
+    RunFrame(frame++);
+  }
+
+  auto commits = FakeDrmNode::GetCommitCount();
+  size_t total = 0;
+  for (int i = 0; i < kMeasuredFrames; i++) {
+    total += RunFrame(frame++);
+  }
+
+  EXPECT_EQ(total, 0U);
+  EXPECT_GE(FakeDrmNode::GetCommitCount() - commits, size_t(kMeasuredFrames));
+}
@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: Apache-2.0
+
+/* Measures ComposerCommandEngine::execute with several displays against a fake
+ * HAL, which sleeps for a configurable time on every TEST_ONLY (validate) and
+ * real (present) commit. Submitting the displays one at a time gives the
+ * serial cost, submitting them in one call lets the engine run the displays
+ * concurrently, which should bring the frame time close to the slowest
+ * display instead of the sum of all of them.
+ *
+ * Usage: hwc3-command-bench [latency_us,latency_us,...] [frames]
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ComposerCommandEngine.h"
+
+using namespace aidl::android::hardware::graphics::composer3;
+using namespace aidl::android::hardware::graphics::composer3::impl;
+
+namespace {
+
+constexpr int kDefaultFrames = 200;
+constexpr int kLayersPerDisplay = 6;
+
+class FakeHal : public IComposerHal {
+ public:
+  explicit FakeHal(std::vector<std::chrono::microseconds> commit_latency)
+      : commit_latency_(std::move(commit_latency)) {
+  }
+
+  /* One TEST_ONLY commit per validation, which moves the bottom layer to
+   * client composition so every display reports a change.
+   */
+  int32_t validateDisplay(int64_t display,
+                          std::vector<int64_t> *out_changed_layers,
+                          std::vector<Composition> *out_composition_types,
+                          uint32_t *, std::vector<int64_t> *,
+                          std::vector<int32_t> *, ClientTargetProperty *,
+                          DimmingStage *) override {
+    std::this_thread::sleep_for(commit_latency_[display]);
+    *out_changed_layers = {0};
+    *out_composition_types = {Composition::CLIENT};
+    return 0;
+  }
+
+  /* One real commit per present */
+  int32_t presentDisplay(int64_t display, ndk::ScopedFileDescriptor &,
+                         std::vector<int64_t> *,
+                         std::vector<ndk::ScopedFileDescriptor> *) override {
+    std::this_thread::sleep_for(commit_latency_[display]);
+    return 0;
+  }
+
+  bool hasCapability(Capability) override {
+    return false;
+  }
+
+  // clang-format off
+  void getCapabilities(std::vector<Capability>*) override {}
+  void dumpDebugInfo(std::string*) override {}
+  void registerEventCallback(EventCallback*) override {}
+  void unregisterEventCallback() override {}
+  int32_t acceptDisplayChanges(int64_t) override { return 0; }
+  int32_t createLayer(int64_t, int64_t*) override { return 0; }
+  int32_t createVirtualDisplay(uint32_t, uint32_t, AidlPixelFormat, VirtualDisplay*) override { return 0; }
+  int32_t destroyLayer(int64_t, int64_t) override { return 0; }
+  int32_t destroyVirtualDisplay(int64_t) override { return 0; }
+  int32_t flushDisplayBrightnessChange(int64_t) override { return 0; }
+  int32_t getActiveConfig(int64_t, int32_t*) override { return 0; }
+  int32_t getColorModes(int64_t, std::vector<ColorMode>*) override { return 0; }
+  int32_t getDataspaceSaturationMatrix(common::Dataspace, std::vector<float>*) override { return 0; }
+  int32_t getDisplayAttribute(int64_t, int32_t, DisplayAttribute, int32_t*) override { return 0; }
+  int32_t getDisplayBrightnessSupport(int64_t, bool&) override { return 0; }
+  int32_t getDisplayIdleTimerSupport(int64_t, bool&) override { return 0; }
+  int32_t getDisplayCapabilities(int64_t, std::vector<DisplayCapability>*) override { return 0; }
+  int32_t getDisplayConfigs(int64_t, std::vector<int32_t>*) override { return 0; }
+  int32_t getDisplayConfigurations(int64_t, int32_t, std::vector<DisplayConfiguration>*) override { return 0; }
+  int32_t notifyExpectedPresent(int64_t, const ClockMonotonicTimestamp&, int32_t) override { return 0; }
+  int32_t getDisplayConnectionType(int64_t, DisplayConnectionType*) override { return 0; }
+  int32_t getDisplayIdentificationData(int64_t, DisplayIdentification*) override { return 0; }
+  int32_t getDisplayName(int64_t, std::string*) override { return 0; }
+  int32_t getDisplayVsyncPeriod(int64_t, int32_t*) override { return 0; }
+  int32_t getDisplayedContentSample(int64_t, int64_t, int64_t, DisplayContentSample*) override { return 0; }
+  int32_t getDisplayedContentSamplingAttributes(int64_t, DisplayContentSamplingAttributes*) override { return 0; }
+  int32_t getDisplayPhysicalOrientation(int64_t, common::Transform*) override { return 0; }
+  int32_t getDozeSupport(int64_t, bool&) override { return 0; }
+  int32_t getHdrCapabilities(int64_t, HdrCapabilities*) override { return 0; }
+  int32_t getMaxVirtualDisplayCount(int32_t*) override { return 0; }
+  int32_t getPerFrameMetadataKeys(int64_t, std::vector<PerFrameMetadataKey>*) override { return 0; }
+  int32_t getReadbackBufferAttributes(int64_t, ReadbackBufferAttributes*) override { return 0; }
+  int32_t getReadbackBufferFence(int64_t, ndk::ScopedFileDescriptor*) override { return 0; }
+  int32_t getRenderIntents(int64_t, ColorMode, std::vector<RenderIntent>*) override { return 0; }
+  int32_t getSupportedContentTypes(int64_t, std::vector<ContentType>*) override { return 0; }
+  int32_t setActiveConfig(int64_t, int32_t) override { return 0; }
+  int32_t setActiveConfigWithConstraints(int64_t, int32_t, const VsyncPeriodChangeConstraints&, VsyncPeriodChangeTimeline*) override { return 0; }
+  int32_t setBootDisplayConfig(int64_t, int32_t) override { return 0; }
+  int32_t clearBootDisplayConfig(int64_t) override { return 0; }
+  int32_t getPreferredBootDisplayConfig(int64_t, int32_t*) override { return 0; }
+  int32_t setAutoLowLatencyMode(int64_t, bool) override { return 0; }
+  int32_t setClientTarget(int64_t, buffer_handle_t, const ndk::ScopedFileDescriptor&, common::Dataspace, const std::vector<common::Rect>&) override { return 0; }
+  int32_t setColorMode(int64_t, ColorMode, RenderIntent) override { return 0; }
+  int32_t setColorTransform(int64_t, const std::vector<float>&) override { return 0; }
+  int32_t setContentType(int64_t, ContentType) override { return 0; }
+  int32_t setDisplayBrightness(int64_t, float) override { return 0; }
+  int32_t setDisplayedContentSamplingEnabled(int64_t, bool, FormatColorComponent, int64_t) override { return 0; }
+  int32_t setLayerBlendMode(int64_t, int64_t, common::BlendMode) override { return 0; }
+  int32_t setLayerBuffer(int64_t, int64_t, buffer_handle_t, const ndk::ScopedFileDescriptor&) override { return 0; }
+  int32_t setLayerColor(int64_t, int64_t, Color) override { return 0; }
+  int32_t setLayerColorTransform(int64_t, int64_t, const std::vector<float>&) override { return 0; }
+  int32_t setLayerCompositionType(int64_t, int64_t, Composition) override { return 0; }
+  int32_t setLayerCursorPosition(int64_t, int64_t, int32_t, int32_t) override { return 0; }
+  int32_t setLayerDataspace(int64_t, int64_t, common::Dataspace) override { return 0; }
+  int32_t setLayerDisplayFrame(int64_t, int64_t, const common::Rect&) override { return 0; }
+  int32_t setLayerPerFrameMetadata(int64_t, int64_t, const std::vector<std::optional<PerFrameMetadata>>&) override { return 0; }
+  int32_t setLayerPerFrameMetadataBlobs(int64_t, int64_t, const std::vector<std::optional<PerFrameMetadataBlob>>&) override { return 0; }
+  int32_t setLayerPlaneAlpha(int64_t, int64_t, float) override { return 0; }
+  int32_t setLayerSidebandStream(int64_t, int64_t, buffer_handle_t) override { return 0; }
+  int32_t setLayerSourceCrop(int64_t, int64_t, const common::FRect&) override { return 0; }
+  int32_t setLayerSurfaceDamage(int64_t, int64_t, const std::vector<std::optional<common::Rect>>&) override { return 0; }
+  int32_t setLayerTransform(int64_t, int64_t, common::Transform) override { return 0; }
+  int32_t setLayerVisibleRegion(int64_t, int64_t, const std::vector<std::optional<common::Rect>>&) override { return 0; }
+  int32_t setLayerBrightness(int64_t, int64_t, float) override { return 0; }
+  int32_t setLayerZOrder(int64_t, int64_t, uint32_t) override { return 0; }
+  int32_t setOutputBuffer(int64_t, buffer_handle_t, const ndk::ScopedFileDescriptor&) override { return 0; }
+  int32_t setPowerMode(int64_t, PowerMode) override { return 0; }
+  int32_t setReadbackBuffer(int64_t, buffer_handle_t, const ndk::ScopedFileDescriptor&) override { return 0; }
+  int32_t setVsyncEnabled(int64_t, bool) override { return 0; }
+  int32_t setExpectedPresentTime(int64_t, const std::optional<ClockMonotonicTimestamp>) override { return 0; }
+  int32_t setIdleTimerEnabled(int64_t, int32_t) override { return 0; }
+  int32_t getRCDLayerSupport(int64_t, bool&) override { return 0; }
+  int32_t setLayerBlockingRegion(int64_t, int64_t, const std::vector<std::optional<common::Rect>>&) override { return 0; }
+  // clang-format on
+
+ private:
+  std::vector<std::chrono::microseconds> commit_latency_;
+};
+
+class FakeResources : public IResourceManager {
+ public:
+  // clang-format off
+  std::unique_ptr<IBufferReleaser> createReleaser(bool) override { return std::make_unique<IBufferReleaser>(); }
+  void clear(RemoveDisplay) override {}
+  bool hasDisplay(int64_t) override { return true; }
+  int32_t addPhysicalDisplay(int64_t) override { return 0; }
+  int32_t addVirtualDisplay(int64_t, uint32_t) override { return 0; }
+  int32_t removeDisplay(int64_t) override { return 0; }
+  int32_t setDisplayClientTargetCacheSize(int64_t, uint32_t) override { return 0; }
+  int32_t getDisplayClientTargetCacheSize(int64_t, size_t*) override { return 0; }
+  int32_t getDisplayOutputBufferCacheSize(int64_t, size_t*) override { return 0; }
+  int32_t addLayer(int64_t, int64_t, uint32_t) override { return 0; }
+  int32_t removeLayer(int64_t, int64_t) override { return 0; }
+  void setDisplayMustValidateState(int64_t, bool) override {}
+  bool mustValidateDisplay(int64_t) override { return false; }
+  int32_t getDisplayReadbackBuffer(int64_t, const buffer_handle_t handle, buffer_handle_t& out, IBufferReleaser*) override { out = handle; return 0; }
+  int32_t getDisplayClientTarget(int64_t, uint32_t, bool, const buffer_handle_t handle, buffer_handle_t& out, IBufferReleaser*) override { out = handle; return 0; }
+  int32_t getDisplayOutputBuffer(int64_t, uint32_t, bool, const buffer_handle_t handle, buffer_handle_t& out, IBufferReleaser*) override { out = handle; return 0; }
+  int32_t getLayerBuffer(int64_t, int64_t, uint32_t, bool, const buffer_handle_t handle, buffer_handle_t& out, IBufferReleaser*) override { out = handle; return 0; }
+  int32_t getLayerSidebandStream(int64_t, int64_t, const buffer_handle_t handle, buffer_handle_t& out, IBufferReleaser*) override { out = handle; return 0; }
+  // clang-format on
+};
+
+auto CreateFrame(int64_t display, int frame) -> DisplayCommand {
+  DisplayCommand command;
+  command.display = display;
+  for (int i = 0; i < kLayersPerDisplay; i++) {
+    LayerCommand layer;
+    layer.layer = i;
+    common::Rect frame_rect;
+    frame_rect.right = 64 + (frame & 1);
+    frame_rect.bottom = 64;
+    layer.displayFrame = frame_rect;
+    PlaneAlpha alpha;
+    alpha.alpha = 1.0F;
+    layer.planeAlpha = alpha;
+    ZOrder z_order;
+    z_order.z = i;
+    layer.z = z_order;
+    command.layers.emplace_back(std::move(layer));
+  }
+  command.validateDisplay = true;
+  command.acceptDisplayChanges = true;
+  command.presentDisplay = true;
+  return command;
+}
+
+auto ParseLatencies(const char *arg) -> std::vector<std::chrono::microseconds> {
+  std::vector<std::chrono::microseconds> latencies;
+  std::stringstream ss(arg);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    latencies.emplace_back(atoi(item.c_str()));
+  }
+  return latencies;
+}
+
+/* Checks that the validation results come back in submission order */
+auto ResultsInOrder(const std::vector<CommandResultPayload> &results,
+                    size_t num_displays) -> bool {
+  int64_t expected = 0;
+  for (const auto &result : results) {
+    if (result.getTag() != CommandResultPayload::Tag::changedTypes) {
+      continue;
+    }
+    if (result.get<CommandResultPayload::Tag::changedTypes>().display !=
+        expected) {
+      return false;
+    }
+    expected++;
+  }
+  return expected == static_cast<int64_t>(num_displays);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  auto latencies = ParseLatencies(argc > 1 ? argv[1] : "2000,4000,8000");
+  int frames = argc > 2 ? atoi(argv[2]) : kDefaultFrames;
+  if (latencies.empty() || frames <= 0) {
+    std::cout << "Usage: " << argv[0] << " [latency_us,...] [frames]"
+              << std::endl;
+    return -EINVAL;
+  }
+
+  FakeHal hal(latencies);
+  FakeResources resources;
+  ComposerCommandEngine engine(&hal, &resources);
+  engine.init();
+
+  std::chrono::microseconds sum{};
+  std::chrono::microseconds slowest{};
+  for (auto latency : latencies) {
+    sum += latency * 2;
+    slowest = std::max(slowest, latency * 2);
+  }
+
+  std::chrono::steady_clock::duration serial{};
+  std::chrono::steady_clock::duration parallel{};
+  bool in_order = true;
+  for (int frame = 0; frame < frames; frame++) {
+    std::vector<DisplayCommand> commands;
+    for (size_t display = 0; display < latencies.size(); display++) {
+      commands.emplace_back(CreateFrame(static_cast<int64_t>(display), frame));
+    }
+
+    std::vector<CommandResultPayload> results;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &command : commands) {
+      engine.execute({command}, &results);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    engine.execute(commands, &results);
+    auto end = std::chrono::steady_clock::now();
+
+    serial += mid - start;
+    parallel += end - mid;
+    in_order &= ResultsInOrder(results, latencies.size());
+  }
+
+  auto per_frame_us = [frames](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count() /
+           frames;
+  };
+
+  std::cout << latencies.size() << " displays, " << frames << " frames"
+            << std::endl;
+  std::cout << "  commit time per frame: sum " << sum.count()
+            << " us, slowest display " << slowest.count() << " us"
+            << std::endl;
+  std::cout << "  one display per execute: " << per_frame_us(serial)
+            << " us per frame" << std::endl;
+  std::cout << "  all displays in one execute: " << per_frame_us(parallel)
+            << " us per frame" << std::endl;
+  std::cout << "  results in submission order: " << (in_order ? "yes" : "NO")
+            << std::endl;
+
+  return in_order ? 0 : -1;
+}
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: Apache-2.0
+
+/* Checks that the validate/present path of an unchanged layer stack doesn't
+ * allocate once it reached the steady state. The layers have no buffers, so
+ * they are composed by the client into a single client target, which is
+ * presented with a page flip every frame.
+ *
+ * Only operator new calls made on the thread driving the displays are counted,
+ * the work done by the HWC threads (commit worker, vsync, uevents) is not.
+ *
+ * The composer service must be stopped while running this tool, as it opens
+ * its own instance of the HWC2 device.
+ */
+
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer2.h>
+#include <ui/GraphicBuffer.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace {
+
+constexpr int kWarmupFrames = 60;
+constexpr int kMeasuredFrames = 300;
+constexpr int kLayersPerDisplay = 4;
+
+thread_local bool count_allocations = false;
+thread_local size_t allocations = 0;
+
+struct Hwc2Funcs {
+  HWC2_PFN_REGISTER_CALLBACK register_callback;
+  HWC2_PFN_CREATE_LAYER create_layer;
+  HWC2_PFN_DESTROY_LAYER destroy_layer;
+  HWC2_PFN_SET_LAYER_DISPLAY_FRAME set_layer_display_frame;
+  HWC2_PFN_SET_LAYER_Z_ORDER set_layer_z_order;
+  HWC2_PFN_GET_ACTIVE_CONFIG get_active_config;
+  HWC2_PFN_GET_DISPLAY_ATTRIBUTE get_display_attribute;
+  HWC2_PFN_SET_POWER_MODE set_power_mode;
+  HWC2_PFN_SET_CLIENT_TARGET set_client_target;
+  HWC2_PFN_VALIDATE_DISPLAY validate_display;
+  HWC2_PFN_ACCEPT_DISPLAY_CHANGES accept_display_changes;
+  HWC2_PFN_PRESENT_DISPLAY present_display;
+};
+
+struct TestDisplay {
+  hwc2_display_t handle;
+  std::vector<hwc2_layer_t> layers;
+  android::sp<android::GraphicBuffer> client_target;
+};
+
+std::mutex displays_lock;
+std::vector<hwc2_display_t> connected_displays;
+
+void HotplugCallback(hwc2_callback_data_t /*data*/, hwc2_display_t display,
+                     int32_t connection) {
+  if (connection == HWC2_CONNECTION_CONNECTED) {
+    const std::lock_guard<std::mutex> lock(displays_lock);
+    connected_displays.emplace_back(display);
+  }
+}
+
+template <typename PFN>
+PFN GetFunction(hwc2_device_t *dev, hwc2_function_descriptor_t descriptor) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  return reinterpret_cast<PFN>(dev->getFunction(dev, descriptor));
+}
+
+auto SetupDisplay(hwc2_device_t *dev, const Hwc2Funcs &f, TestDisplay &disp)
+    -> bool {
+  hwc2_config_t config{};
+  int32_t width = 0;
+  int32_t height = 0;
+  if (f.get_active_config(dev, disp.handle, &config) != HWC2_ERROR_NONE ||
+      f.get_display_attribute(dev, disp.handle, config, HWC2_ATTRIBUTE_WIDTH,
+                              &width) != HWC2_ERROR_NONE ||
+      f.get_display_attribute(dev, disp.handle, config, HWC2_ATTRIBUTE_HEIGHT,
+                              &height) != HWC2_ERROR_NONE) {
+    return false;
+  }
+
+  f.set_power_mode(dev, disp.handle, HWC2_POWER_MODE_ON);
+
+  disp.client_target = new android::GraphicBuffer(
+      width, height, android::PIXEL_FORMAT_RGBA_8888, 1,
+      GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_RENDER,
+      "hwc-frame-alloc-check");
+  if (disp.client_target->initCheck() != android::OK) {
+    return false;
+  }
+
+  for (int i = 0; i < kLayersPerDisplay; i++) {
+    hwc2_layer_t layer{};
+    if (f.create_layer(dev, disp.handle, &layer) != HWC2_ERROR_NONE) {
+      return false;
+    }
+    f.set_layer_display_frame(dev, disp.handle, layer,
+                              {.left = 0,
+                               .top = 0,
+                               .right = width / (i + 1),
+                               .bottom = height / (i + 1)});
+    f.set_layer_z_order(dev, disp.handle, layer, i);
+    disp.layers.emplace_back(layer);
+  }
+
+  return true;
+}
+
+/* Returns the number of allocations made by the validate/present calls */
+auto RunFrame(hwc2_device_t *dev, const Hwc2Funcs &f, TestDisplay &disp)
+    -> size_t {
+  f.set_client_target(dev, disp.handle, disp.client_target->handle, -1,
+                      HAL_DATASPACE_UNKNOWN, {.numRects = 0, .rects = nullptr});
+
+  uint32_t num_types{};
+  uint32_t num_requests{};
+  int32_t present_fence = -1;
+
+  allocations = 0;
+  count_allocations = true;
+  f.validate_display(dev, disp.handle, &num_types, &num_requests);
+  f.accept_display_changes(dev, disp.handle);
+  f.present_display(dev, disp.handle, &present_fence);
+  count_allocations = false;
+
+  if (present_fence >= 0) {
+    close(present_fence);
+  }
+
+  return allocations;
+}
+
+}  // namespace
+
+// NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+void *operator new(size_t size) {
+  if (count_allocations) {
+    allocations++;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  void *ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    abort();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t /*size*/) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  free(ptr);
+}
+
+int main() {
+  const hw_module_t *module = nullptr;
+  if (hw_get_module(HWC_HARDWARE_MODULE_ID, &module) != 0) {
+    std::cout << "Can't load the HWC2 module" << std::endl;
+    return -ENODEV;
+  }
+
+  hw_device_t *hw_dev = nullptr;
+  if (module->methods->open(module, HWC_HARDWARE_COMPOSER, &hw_dev) != 0) {
+    std::cout << "Can't open the HWC2 device" << std::endl;
+    return -ENODEV;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  auto *dev = reinterpret_cast<hwc2_device_t *>(hw_dev);
+
+  const Hwc2Funcs f = {
+      .register_callback = GetFunction<HWC2_PFN_REGISTER_CALLBACK>(
+          dev, HWC2_FUNCTION_REGISTER_CALLBACK),
+      .create_layer = GetFunction<HWC2_PFN_CREATE_LAYER>(
+          dev, HWC2_FUNCTION_CREATE_LAYER),
+      .destroy_layer = GetFunction<HWC2_PFN_DESTROY_LAYER>(
+          dev, HWC2_FUNCTION_DESTROY_LAYER),
+      .set_layer_display_frame = GetFunction<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(
+          dev, HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME),
+      .set_layer_z_order = GetFunction<HWC2_PFN_SET_LAYER_Z_ORDER>(
+          dev, HWC2_FUNCTION_SET_LAYER_Z_ORDER),
+      .get_active_config = GetFunction<HWC2_PFN_GET_ACTIVE_CONFIG>(
+          dev, HWC2_FUNCTION_GET_ACTIVE_CONFIG),
+      .get_display_attribute = GetFunction<HWC2_PFN_GET_DISPLAY_ATTRIBUTE>(
+          dev, HWC2_FUNCTION_GET_DISPLAY_ATTRIBUTE),
+      .set_power_mode = GetFunction<HWC2_PFN_SET_POWER_MODE>(
+          dev, HWC2_FUNCTION_SET_POWER_MODE),
+      .set_client_target = GetFunction<HWC2_PFN_SET_CLIENT_TARGET>(
+          dev, HWC2_FUNCTION_SET_CLIENT_TARGET),
+      .validate_display = GetFunction<HWC2_PFN_VALIDATE_DISPLAY>(
+          dev, HWC2_FUNCTION_VALIDATE_DISPLAY),
+      .accept_display_changes = GetFunction<HWC2_PFN_ACCEPT_DISPLAY_CHANGES>(
+          dev, HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES),
+      .present_display = GetFunction<HWC2_PFN_PRESENT_DISPLAY>(
+          dev, HWC2_FUNCTION_PRESENT_DISPLAY),
+  };
+
+  /* Registering the hotplug callback reports the connected displays */
+  f.register_callback(dev, HWC2_CALLBACK_HOTPLUG, nullptr,
+                      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+                      reinterpret_cast<hwc2_function_pointer_t>(
+                          HotplugCallback));
+
+  std::vector<TestDisplay> displays;
+  {
+    const std::lock_guard<std::mutex> lock(displays_lock);
+    for (auto handle : connected_displays) {
+      displays.emplace_back(TestDisplay{.handle = handle});
+    }
+  }
+
+  if (displays.empty()) {
+    std::cout << "No displays connected" << std::endl;
+    hw_dev->close(hw_dev);
+    return -ENODEV;
+  }
+
+  int failures = 0;
+  for (auto &disp : displays) {
+    if (!SetupDisplay(dev, f, disp)) {
+      std::cout << "Display " << disp.handle << ": setup failed" << std::endl;
+      failures++;
+      continue;
+    }
+
+    for (int i = 0; i < kWarmupFrames; i++) {
+      RunFrame(dev, f, disp);
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < kMeasuredFrames; i++) {
+      total += RunFrame(dev, f, disp);
+    }
+
+    std::cout << "Display " << disp.handle << ": " << total
+              << " allocations in " << kMeasuredFrames << " frames"
+              << std::endl;
+    if (total != 0) {
+      failures++;
+    }
+
+    for (auto layer : disp.layers) {
+      f.destroy_layer(dev, disp.handle, layer);
+    }
+  }
+
+  hw_dev->close(hw_dev);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: Apache-2.0
+
+/* Measures HWC2 call throughput when every connected display is driven by its
+ * own client thread, compared to driving all of them from a single thread.
+ * With the per-display locking the parallel run should scale with the number
+ * of displays instead of serializing on the main lock.
+ *
+ * The composer service must be stopped while running this tool, as it opens
+ * its own instance of the HWC2 device.
+ */
+
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer2.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kDefaultIterations = 2000;
+constexpr int kLayersPerDisplay = 4;
+
+struct Hwc2Funcs {
+  HWC2_PFN_REGISTER_CALLBACK register_callback;
+  HWC2_PFN_CREATE_LAYER create_layer;
+  HWC2_PFN_DESTROY_LAYER destroy_layer;
+  HWC2_PFN_SET_LAYER_DISPLAY_FRAME set_layer_display_frame;
+  HWC2_PFN_SET_LAYER_PLANE_ALPHA set_layer_plane_alpha;
+  HWC2_PFN_SET_LAYER_Z_ORDER set_layer_z_order;
+  HWC2_PFN_GET_ACTIVE_CONFIG get_active_config;
+  HWC2_PFN_VALIDATE_DISPLAY validate_display;
+  HWC2_PFN_ACCEPT_DISPLAY_CHANGES accept_display_changes;
+};
+
+struct BenchDisplay {
+  hwc2_display_t handle;
+  std::vector<hwc2_layer_t> layers;
+};
+
+std::mutex displays_lock;
+std::vector<hwc2_display_t> connected_displays;
+
+void HotplugCallback(hwc2_callback_data_t /*data*/, hwc2_display_t display,
+                     int32_t connection) {
+  if (connection == HWC2_CONNECTION_CONNECTED) {
+    const std::lock_guard<std::mutex> lock(displays_lock);
+    connected_displays.emplace_back(display);
+  }
+}
+
+template <typename PFN>
+PFN GetFunction(hwc2_device_t *dev, hwc2_function_descriptor_t descriptor) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  return reinterpret_cast<PFN>(dev->getFunction(dev, descriptor));
+}
+
+void RunFrames(hwc2_device_t *dev, const Hwc2Funcs &f, BenchDisplay &disp,
+               int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    int z = 0;
+    for (auto layer : disp.layers) {
+      f.set_layer_display_frame(dev, disp.handle, layer,
+                                {.left = 0,
+                                 .top = 0,
+                                 .right = 64 + (i & 1),
+                                 .bottom = 64});
+      f.set_layer_plane_alpha(dev, disp.handle, layer, 1.0F);
+      f.set_layer_z_order(dev, disp.handle, layer, z++);
+    }
+
+    hwc2_config_t config{};
+    f.get_active_config(dev, disp.handle, &config);
+
+    uint32_t num_types{};
+    uint32_t num_requests{};
+    f.validate_display(dev, disp.handle, &num_types, &num_requests);
+    f.accept_display_changes(dev, disp.handle);
+  }
+}
+
+auto MeasureUs(const std::function<void()> &fn) -> int64_t {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : kDefaultIterations;
+
+  const hw_module_t *module = nullptr;
+  if (hw_get_module(HWC_HARDWARE_MODULE_ID, &module) != 0) {
+    std::cout << "Can't load the HWC2 module" << std::endl;
+    return -ENODEV;
+  }
+
+  hw_device_t *hw_dev = nullptr;
+  if (module->methods->open(module, HWC_HARDWARE_COMPOSER, &hw_dev) != 0) {
+    std::cout << "Can't open the HWC2 device" << std::endl;
+    return -ENODEV;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  auto *dev = reinterpret_cast<hwc2_device_t *>(hw_dev);
+
+  const Hwc2Funcs f = {
+      .register_callback = GetFunction<HWC2_PFN_REGISTER_CALLBACK>(
+          dev, HWC2_FUNCTION_REGISTER_CALLBACK),
+      .create_layer = GetFunction<HWC2_PFN_CREATE_LAYER>(
+          dev, HWC2_FUNCTION_CREATE_LAYER),
+      .destroy_layer = GetFunction<HWC2_PFN_DESTROY_LAYER>(
+          dev, HWC2_FUNCTION_DESTROY_LAYER),
+      .set_layer_display_frame = GetFunction<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(
+          dev, HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME),
+      .set_layer_plane_alpha = GetFunction<HWC2_PFN_SET_LAYER_PLANE_ALPHA>(
+          dev, HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA),
+      .set_layer_z_order = GetFunction<HWC2_PFN_SET_LAYER_Z_ORDER>(
+          dev, HWC2_FUNCTION_SET_LAYER_Z_ORDER),
+      .get_active_config = GetFunction<HWC2_PFN_GET_ACTIVE_CONFIG>(
+          dev, HWC2_FUNCTION_GET_ACTIVE_CONFIG),
+      .validate_display = GetFunction<HWC2_PFN_VALIDATE_DISPLAY>(
+          dev, HWC2_FUNCTION_VALIDATE_DISPLAY),
+      .accept_display_changes = GetFunction<HWC2_PFN_ACCEPT_DISPLAY_CHANGES>(
+          dev, HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES),
+  };
+
+  /* Registering the hotplug callback reports the connected displays */
+  f.register_callback(dev, HWC2_CALLBACK_HOTPLUG, nullptr,
+                      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+                      reinterpret_cast<hwc2_function_pointer_t>(
+                          HotplugCallback));
+
+  std::vector<BenchDisplay> displays;
+  {
+    const std::lock_guard<std::mutex> lock(displays_lock);
+    for (auto handle : connected_displays) {
+      displays.emplace_back(BenchDisplay{.handle = handle});
+    }
+  }
+
+  if (displays.empty()) {
+    std::cout << "No displays connected" << std::endl;
+    hw_dev->close(hw_dev);
+    return -ENODEV;
+  }
+
+  for (auto &disp : displays) {
+    for (int i = 0; i < kLayersPerDisplay; i++) {
+      hwc2_layer_t layer{};
+      if (f.create_layer(dev, disp.handle, &layer) == HWC2_ERROR_NONE) {
+        disp.layers.emplace_back(layer);
+      }
+    }
+  }
+
+  std::cout << displays.size() << " display(s), " << iterations
+            << " frames per display" << std::endl;
+
+  auto serial_us = MeasureUs([&] {
+    for (auto &disp : displays) {
+      RunFrames(dev, f, disp, iterations);
+    }
+  });
+
+  auto parallel_us = MeasureUs([&] {
+    std::vector<std::thread> threads;
+    threads.reserve(displays.size());
+    for (auto &disp : displays) {
+      threads.emplace_back(RunFrames, dev, std::cref(f), std::ref(disp),
+                           iterations);
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+  });
+
+  auto total_frames = static_cast<double>(iterations * displays.size());
+  std::cout << "Single thread: " << serial_us << " us, "
+            << total_frames * 1E6 / static_cast<double>(serial_us)
+            << " frames/s" << std::endl
+            << "Thread per display: " << parallel_us << " us, "
+            << total_frames * 1E6 / static_cast<double>(parallel_us)
+            << " frames/s" << std::endl;
+
+  for (auto &disp : displays) {
+    for (auto layer : disp.layers) {
+      f.destroy_layer(dev, disp.handle, layer);
+    }
+  }
+
+  hw_dev->close(hw_dev);
+  return 0;
+}
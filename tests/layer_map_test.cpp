@@ -0,0 +1,162 @@
+#include "hwc2_device/HwcLayerMap.h"
+
+#include <gtest/gtest.h>
+
+using android::LayerMap;
+
+namespace {
+
+/* Minimal stand-in for HwcLayer */
+class TestLayer {
+ public:
+  struct HotState {
+    uint32_t z_order{};
+  };
+
+  explicit TestLayer(int *live_count) : live_count_(live_count) {
+    ++*live_count_;
+  }
+  ~TestLayer() {
+    --*live_count_;
+  }
+  TestLayer(TestLayer &&) = delete;
+
+  void BindHotState(HotState *state) {
+    hot_state_ = state;
+  }
+  auto GetHotState() -> HotState & {
+    return hot_state_ != nullptr ? *hot_state_ : own_hot_state_;
+  }
+
+  void SetZOrder(uint32_t z_order) {
+    GetHotState().z_order = z_order;
+  }
+
+ private:
+  int *live_count_;
+  HotState *hot_state_{};
+  HotState own_hot_state_;
+};
+
+auto ZOrders(LayerMap<TestLayer> &map) {
+  std::vector<uint32_t> z_orders;
+  for (auto *layer : map.GetZOrdered()) {
+    z_orders.push_back(layer->GetHotState().z_order);
+  }
+  return z_orders;
+}
+
+}  // namespace
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(LayerMapTest, LookupAndErase) {
+  int live = 0;
+  LayerMap<TestLayer> map;
+  auto a = map.Emplace(&live);
+  auto b = map.Emplace(&live);
+  EXPECT_EQ(live, 2);
+  EXPECT_NE(a, b);
+  EXPECT_NE(map.Get(a), nullptr);
+  EXPECT_NE(map.Get(a), map.Get(b));
+
+  EXPECT_TRUE(map.Erase(a));
+  EXPECT_EQ(live, 1);
+  EXPECT_EQ(map.Get(a), nullptr);
+  EXPECT_FALSE(map.Erase(a));
+  EXPECT_EQ(map.size(), 1);
+  EXPECT_EQ(map.GetEntry(0).handle, b);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(LayerMapTest, StaleHandleAfterSlotReuse) {
+  int live = 0;
+  LayerMap<TestLayer> map;
+  auto a = map.Emplace(&live);
+  auto *layer_a = map.Get(a);
+  map.Erase(a);
+
+  /* Same slot, so same address, but a new generation */
+  auto b = map.Emplace(&live);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(map.Get(b), layer_a);
+  EXPECT_EQ(map.Get(a), nullptr);
+  EXPECT_FALSE(map.Erase(a));
+  EXPECT_EQ(live, 1);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(LayerMapTest, UnknownHandle) {
+  int live = 0;
+  LayerMap<TestLayer> map;
+  map.Emplace(&live);
+  EXPECT_EQ(map.Get(12345), nullptr);
+  EXPECT_FALSE(map.Erase(12345));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(LayerMapTest, IterationKeepsCreationOrder) {
+  int live = 0;
+  LayerMap<TestLayer> map;
+  std::vector<hwc2_layer_t> handles;
+  for (int i = 0; i < 5; i++) {
+    handles.push_back(map.Emplace(&live));
+  }
+  map.Erase(handles[1]);
+  handles.erase(handles.begin() + 1);
+
+  std::vector<hwc2_layer_t> iterated;
+  for (auto &[handle, layer] : map) {
+    EXPECT_EQ(map.Get(handle), layer);
+    iterated.push_back(handle);
+  }
+  EXPECT_EQ(iterated, handles);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(LayerMapTest, HotStatesFollowTheLayers) {
+  /* Enough layers to make the hot state array grow several times */
+  constexpr uint32_t kLayers = 40;
+  int live = 0;
+  LayerMap<TestLayer> map;
+  std::vector<hwc2_layer_t> handles;
+  for (uint32_t i = 0; i < kLayers; i++) {
+    handles.push_back(map.Emplace(&live));
+    map.Get(handles.back())->SetZOrder(i);
+  }
+
+  map.Erase(handles[0]);
+  map.Erase(handles[kLayers / 2]);
+
+  auto &hot_states = map.GetHotStates();
+  ASSERT_EQ(hot_states.size(), map.size());
+  for (size_t i = 0; i < map.size(); i++) {
+    auto *layer = map.GetEntry(i).layer;
+    EXPECT_EQ(&layer->GetHotState(), &hot_states[i]);
+  }
+  EXPECT_EQ(map.Get(handles[1])->GetHotState().z_order, 1);
+  EXPECT_EQ(map.Get(handles[kLayers - 1])->GetHotState().z_order,
+            kLayers - 1);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(LayerMapTest, ZOrderFollowsChanges) {
+  int live = 0;
+  LayerMap<TestLayer> map;
+  auto a = map.Emplace(&live);
+  auto b = map.Emplace(&live);
+  auto c = map.Emplace(&live);
+  map.Get(a)->SetZOrder(3);
+  map.Get(b)->SetZOrder(1);
+  map.Get(c)->SetZOrder(2);
+  EXPECT_EQ(ZOrders(map), (std::vector<uint32_t>{1, 2, 3}));
+  EXPECT_EQ(map.GetZOrdered().front(), map.Get(b));
+
+  map.Get(b)->SetZOrder(4);
+  EXPECT_EQ(ZOrders(map), (std::vector<uint32_t>{2, 3, 4}));
+
+  map.Erase(c);
+  auto d = map.Emplace(&live);
+  map.Get(d)->SetZOrder(0);
+  EXPECT_EQ(ZOrders(map), (std::vector<uint32_t>{0, 3, 4}));
+  EXPECT_EQ(map.GetZOrdered().front(), map.Get(d));
+}
@@ -0,0 +1,251 @@
+#include "compositor/PlaneAssignmentSearch.h"
+
+#include <gtest/gtest.h>
+
+using android::PlaneAssignmentSearch;
+using PlaneZOrder = PlaneAssignmentSearch::PlaneZOrder;
+using ClientOption = PlaneAssignmentSearch::ClientOption;
+using ClientRange = PlaneAssignmentSearch::ClientRange;
+
+namespace {
+
+constexpr PlaneZOrder kNoZpos = {
+    .has_zpos = false, .min_zpos = 0, .max_zpos = 0};
+
+auto Immutable(int64_t zpos) -> PlaneZOrder {
+  return {.has_zpos = true, .min_zpos = zpos, .max_zpos = zpos};
+}
+
+auto Mutable(int64_t min, int64_t max) -> PlaneZOrder {
+  return {.has_zpos = true, .min_zpos = min, .max_zpos = max};
+}
+
+auto AllValid(size_t layers, size_t planes) {
+  return std::vector<std::vector<bool>>(layers,
+                                        std::vector<bool>(planes, true));
+}
+
+auto ClientPixels(std::vector<uint64_t> pixels) {
+  std::vector<ClientOption> client;
+  for (auto p : pixels) {
+    client.push_back({.allowed = true, .pixels = p});
+  }
+  return client;
+}
+
+void ExpectClientRange(const PlaneAssignmentSearch &search, int start,
+                       size_t size) {
+  EXPECT_EQ(search.GetClientRange().start, start);
+  EXPECT_EQ(search.GetClientRange().size, size);
+}
+
+}  // namespace
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, FirstFitIsFoundFirst) {
+  PlaneAssignmentSearch search(AllValid(3, 4),
+                               {Mutable(0, 3), Mutable(0, 3), Mutable(0, 3),
+                                Mutable(0, 3)});
+  ASSERT_TRUE(search.Run());
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{0, 1, 2}));
+  EXPECT_EQ(search.GetZpos(), (std::vector<int64_t>{0, 1, 2}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, SkippedPlanesAreTriedLast) {
+  /* First-fit drops plane 0 for layer 0 and never comes back to it */
+  auto valid = AllValid(2, 3);
+  valid[0][0] = false;
+  PlaneAssignmentSearch search(valid, {Mutable(0, 2), Mutable(0, 2),
+                                       Mutable(0, 2)});
+  ASSERT_TRUE(search.Run());
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{1, 2}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, ReusesSkippedMutablePlane) {
+  /* Layer 1 only fits the plane first-fit skipped for layer 0 */
+  auto valid = AllValid(2, 2);
+  valid[0][0] = false;
+  valid[1][1] = false;
+  PlaneAssignmentSearch search(valid, {Mutable(0, 1), Mutable(0, 1)});
+  ASSERT_TRUE(search.Run());
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{1, 0}));
+  EXPECT_EQ(search.GetZpos(), (std::vector<int64_t>{0, 1}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, ImmutableZposOrdersLayers) {
+  /* Primary at immutable zpos 0 can only take the bottom layer */
+  auto valid = AllValid(2, 2);
+  valid[0][0] = false;
+  PlaneAssignmentSearch search(valid, {Immutable(0), Mutable(0, 3)});
+  EXPECT_FALSE(search.Run());
+  EXPECT_FALSE(search.IsExhausted());
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, MutableZposAboveImmutable) {
+  /* The overlay has to go above the primary, not tie with it */
+  PlaneAssignmentSearch search(AllValid(2, 2), {Immutable(0), Mutable(0, 3)});
+  ASSERT_TRUE(search.Run());
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{0, 1}));
+  EXPECT_EQ(search.GetZpos(), (std::vector<int64_t>{0, 1}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, MutableZposBelowImmutable) {
+  auto valid = AllValid(2, 2);
+  valid[0][0] = false;
+  valid[1][1] = false;
+  PlaneAssignmentSearch search(valid, {Immutable(2), Mutable(0, 3)});
+  ASSERT_TRUE(search.Run());
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{1, 0}));
+  EXPECT_EQ(search.GetZpos(), (std::vector<int64_t>{0, 2}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, MutableRangeExhausted) {
+  /* Nothing fits above the cursor at the top of the overlay range */
+  auto valid = AllValid(2, 2);
+  valid[0][1] = false;
+  PlaneAssignmentSearch search(valid, {Immutable(3), Mutable(0, 3)});
+  EXPECT_FALSE(search.Run());
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, PlanesWithoutZposKeepListOrder) {
+  auto valid = AllValid(2, 2);
+  valid[0][0] = false;
+  PlaneAssignmentSearch search(valid, {kNoZpos, kNoZpos});
+  EXPECT_FALSE(search.Run());
+
+  PlaneAssignmentSearch in_order(AllValid(2, 2), {kNoZpos, kNoZpos});
+  ASSERT_TRUE(in_order.Run());
+  EXPECT_EQ(in_order.GetAssignment(), (std::vector<int>{0, 1}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, MoreLayersThanPlanes) {
+  PlaneAssignmentSearch search(AllValid(3, 2), {Mutable(0, 3), Mutable(0, 3)});
+  EXPECT_FALSE(search.Run());
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, SearchIsBounded) {
+  /* No plane takes the top layer, which the search only finds out after
+   * trying every assignment of the layers below
+   */
+  constexpr size_t kLayers = 8;
+  constexpr size_t kPlanes = 10;
+  auto valid = AllValid(kLayers, kPlanes);
+  for (size_t p = 0; p < kPlanes; p++) {
+    valid[kLayers - 1][p] = false;
+  }
+  std::vector<PlaneZOrder> planes(kPlanes, Mutable(0, 100));
+  PlaneAssignmentSearch search(valid, planes);
+  EXPECT_FALSE(search.Run());
+  EXPECT_TRUE(search.IsExhausted());
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, NoClientWhenAllLayersFit) {
+  PlaneAssignmentSearch search(AllValid(2, 3),
+                               {Mutable(0, 2), Mutable(0, 2), Mutable(0, 2)},
+                               ClientPixels({100, 100}),
+                               std::vector<bool>(3, true));
+  ASSERT_TRUE(search.Run());
+  ExpectClientRange(search, -1, 0);
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{0, 1}));
+  EXPECT_EQ(search.GetClientPlane(), -1);
+  EXPECT_EQ(search.GetCost().client_pixels, 0);
+  EXPECT_EQ(search.GetCost().planes, 2);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, ClientTakesFewestPixels) {
+  /* Two of the three layers have to share the client target */
+  PlaneAssignmentSearch search(AllValid(3, 2), {Mutable(0, 2), Mutable(0, 2)},
+                               ClientPixels({100, 10, 50}),
+                               std::vector<bool>(2, true));
+  ASSERT_TRUE(search.Run());
+  ExpectClientRange(search, 1, 2);
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{0, -1, -1}));
+  EXPECT_EQ(search.GetClientPlane(), 1);
+  EXPECT_EQ(search.GetClientZpos(), 1);
+  EXPECT_EQ(search.GetCost().client_pixels, 60);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, MatchingBeatsClient) {
+  /* First-fit has already passed the only plane of layer 1, the search finds
+   * a matching rather than leaving a layer to the client
+   */
+  auto valid = AllValid(3, 3);
+  for (size_t p = 0; p < 3; p++) {
+    valid[1][p] = p == 0;
+  }
+  valid[0][0] = false;
+  PlaneAssignmentSearch search(valid,
+                               {Mutable(0, 2), Mutable(0, 2), Mutable(0, 2)},
+                               ClientPixels({30, 20, 10}),
+                               std::vector<bool>(3, true));
+  ASSERT_TRUE(search.Run());
+  EXPECT_EQ(search.GetCost().client_pixels, 0);
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{1, 0, 2}));
+  EXPECT_EQ(search.GetZpos(), (std::vector<int64_t>{0, 1, 2}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, FewerPlanesBreakTies) {
+  PlaneAssignmentSearch search(AllValid(2, 2), {Mutable(0, 1), Mutable(0, 1)},
+                               ClientPixels({0, 0}),
+                               std::vector<bool>(2, true));
+  ASSERT_TRUE(search.Run());
+  ExpectClientRange(search, 0, 2);
+  EXPECT_EQ(search.GetCost().planes, 1);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, RejectedRangeIsSkipped) {
+  PlaneAssignmentSearch search(AllValid(3, 2), {Mutable(0, 2), Mutable(0, 2)},
+                               ClientPixels({100, 10, 50}),
+                               std::vector<bool>(2, true));
+  search.Reject({.start = 1, .size = 2});
+  ASSERT_TRUE(search.Run());
+  ExpectClientRange(search, 0, 2);
+  EXPECT_EQ(search.GetAssignment(), (std::vector<int>{-1, -1, 1}));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, LayersKeptOffTheClient) {
+  /* Layer 1 isn't allowed on the client, e.g. video */
+  auto client = ClientPixels({100, 10, 50});
+  client[1].allowed = false;
+  PlaneAssignmentSearch search(AllValid(3, 2), {Mutable(0, 2), Mutable(0, 2)},
+                               client, std::vector<bool>(2, true));
+  EXPECT_FALSE(search.Run());
+
+  client[0].allowed = false;
+  client[1].allowed = true;
+  PlaneAssignmentSearch top(AllValid(3, 2), {Mutable(0, 2), Mutable(0, 2)},
+                            client, std::vector<bool>(2, true));
+  ASSERT_TRUE(top.Run());
+  ExpectClientRange(top, 1, 2);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(PlaneAssignmentTest, ClientTargetKeepsZOrder) {
+  /* Layer 0 has to go to the client, whose target only fits the overlay.
+   * The primary can't go above it, so the client takes both layers.
+   */
+  auto valid = AllValid(2, 2);
+  valid[0][0] = false;
+  valid[0][1] = false;
+  PlaneAssignmentSearch search(valid, {Immutable(0), Mutable(1, 3)},
+                               ClientPixels({10, 10}), {false, true});
+  ASSERT_TRUE(search.Run());
+  ExpectClientRange(search, 0, 2);
+  EXPECT_EQ(search.GetClientPlane(), 1);
+  EXPECT_EQ(search.GetClientZpos(), 1);
+}
@@ -0,0 +1,87 @@
+#include "drm/TestCommitCache.h"
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+
+using android::TestCommitCache;
+
+namespace {
+
+/* Generation of a new cache */
+constexpr uint32_t kGeneration = 0;
+
+auto PlaneKey(uint64_t plane_id, uint64_t width, uint64_t height)
+    -> TestCommitCache::Key {
+  return {0, plane_id, 0, width, height};
+}
+
+}  // namespace
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(TestCommitCacheTest, ReturnsStoredVerdict) {
+  TestCommitCache cache(4);
+  auto key = PlaneKey(31, 1920, 1080);
+  EXPECT_FALSE(cache.Lookup(key, kGeneration));
+  cache.Store(key, -EINVAL);
+
+  auto verdict = cache.Lookup(key, kGeneration);
+  ASSERT_TRUE(verdict);
+  EXPECT_EQ(*verdict, -EINVAL);
+  EXPECT_EQ(cache.GetHits(), 1);
+  EXPECT_EQ(cache.GetMisses(), 1);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(TestCommitCacheTest, KeyIsComparedInFull) {
+  /* Same plane and frame, only the buffer size differs */
+  TestCommitCache cache(4);
+  cache.Store(PlaneKey(31, 1920, 1080), 0);
+  EXPECT_FALSE(cache.Lookup(PlaneKey(31, 3840, 2160), kGeneration));
+  EXPECT_TRUE(cache.Lookup(PlaneKey(31, 1920, 1080), kGeneration));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(TestCommitCacheTest, PrefixIsNotAMatch) {
+  TestCommitCache cache(4);
+  TestCommitCache::Key two_planes = {0, 31, 0, 1920, 1080, 32, 1, 640, 480};
+  TestCommitCache::Key one_plane(two_planes.begin(), two_planes.begin() + 5);
+  cache.Store(two_planes, 0);
+  EXPECT_FALSE(cache.Lookup(one_plane, kGeneration));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(TestCommitCacheTest, EvictsLeastRecentlyUsed) {
+  TestCommitCache cache(2);
+  cache.Store(PlaneKey(1, 64, 64), 0);
+  cache.Store(PlaneKey(2, 64, 64), 0);
+  /* Makes plane 2 the oldest entry */
+  EXPECT_TRUE(cache.Lookup(PlaneKey(1, 64, 64), kGeneration));
+  cache.Store(PlaneKey(3, 64, 64), 0);
+
+  EXPECT_EQ(cache.GetSize(), 2);
+  EXPECT_TRUE(cache.Lookup(PlaneKey(1, 64, 64), kGeneration));
+  EXPECT_FALSE(cache.Lookup(PlaneKey(2, 64, 64), kGeneration));
+  EXPECT_TRUE(cache.Lookup(PlaneKey(3, 64, 64), kGeneration));
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(TestCommitCacheTest, GenerationChangeDropsEntries) {
+  TestCommitCache cache(4);
+  auto key = PlaneKey(31, 1920, 1080);
+  EXPECT_FALSE(cache.Lookup(key, kGeneration));
+  cache.Store(key, 0);
+
+  EXPECT_FALSE(cache.Lookup(key, kGeneration + 1));
+  EXPECT_EQ(cache.GetSize(), 0);
+}
+
+// NOLINTNEXTLINE: required by gtest macros
+TEST(TestCommitCacheTest, StoreKeepsFirstVerdict) {
+  TestCommitCache cache(4);
+  auto key = PlaneKey(31, 1920, 1080);
+  cache.Store(key, 0);
+  cache.Store(key, -EINVAL);
+  EXPECT_EQ(cache.GetSize(), 1);
+  EXPECT_EQ(cache.Lookup(key, kGeneration), 0);
+}
@@ -1,11 +1,108 @@
 // SPDX-License-Identifier: Apache-2.0
 
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "utils/UEvent.h"
 
-int main() {
-  auto uevent = android::UEvent::CreateInstance();
+/*
+ * Usage:
+ *   hwc-drm-uevent-print                 dump all uevents
+ *   hwc-drm-uevent-print --drm           dump drm uevents, filtered by kernel
+ *   hwc-drm-uevent-print --record FILE   dump all uevents and record them
+ *   hwc-drm-uevent-print --bench FILE    benchmark parsing of a recording
+ *
+ * Recordings are raw uevent messages, each prefixed with its uint32_t length.
+ */
+
+static auto LoadRecording(const char *path) -> std::vector<std::string> {
+  std::vector<std::string> events;
+  std::ifstream file(path, std::ios::binary);
+  uint32_t length = 0;
+  while (file.read(reinterpret_cast<char *>(&length), sizeof(length))) {
+    std::string event(length, '\0');
+    if (!file.read(event.data(), length)) {
+      break;
+    }
+    events.emplace_back(std::move(event));
+  }
+  return events;
+}
+
+/* What UEventListener did before the kernel filter and the parser */
+static auto IsDrmHotplugLegacy(const std::string &raw) -> bool {
+  std::string str(raw);
+  for (size_t i = 0; i + 1 < str.size(); i++) {
+    if (str[i] == '\0') {
+      str[i] = '\n';
+    }
+  }
+  return str.find("DEVTYPE=drm_minor") != std::string::npos &&
+         str.find("HOTPLUG=1") != std::string::npos;
+}
+
+static auto IsDrmHotplug(const std::string &raw) -> bool {
+  auto msg = android::UEventMessage::Parse(raw.data(), raw.size());
+  return msg.devtype == "drm_minor" && msg.hotplug;
+}
+
+template <typename F>
+static void RunBenchmark(const char *name,
+                         const std::vector<std::string> &events, F &&check) {
+  constexpr int kIterations = 10000;
+  size_t hotplugs = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; i++) {
+    for (const auto &event : events) {
+      hotplugs += check(event) ? 1 : 0;
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+
+  std::cout << name << ": "
+            << double(ns.count()) / double(kIterations * events.size())
+            << " ns/event, " << hotplugs / kIterations << " drm hotplugs"
+            << std::endl;
+}
+
+static auto Benchmark(const char *path) -> int {
+  auto events = LoadRecording(path);
+  if (events.empty()) {
+    std::cout << "No events in " << path << std::endl;
+    return -EINVAL;
+  }
+
+  size_t drm_events = 0;
+  for (const auto &event : events) {
+    auto msg = android::UEventMessage::Parse(event.data(), event.size());
+    drm_events += msg.subsystem == "drm" ? 1 : 0;
+  }
+  std::cout << events.size() << " events, " << drm_events
+            << " pass the kernel drm filter" << std::endl;
+
+  RunBenchmark("legacy string search", events, IsDrmHotplugLegacy);
+  RunBenchmark("in-place parser", events, IsDrmHotplug);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+    return Benchmark(argv[2]);
+  }
+
+  bool drm_only = argc == 2 && strcmp(argv[1], "--drm") == 0;
+  std::ofstream recording;
+  if (argc == 3 && strcmp(argv[1], "--record") == 0) {
+    recording.open(argv[2], std::ios::binary);
+  }
+
+  auto uevent = android::UEvent::CreateInstance(drm_only ? "drm" : nullptr);
   if (!uevent) {
     std::cout << "Can't initialize UEvent class" << std::endl;
     return -ENODEV;
@@ -13,13 +110,27 @@ int main() {
 
   int number = 0;
   for (;;) {
-    auto msg = uevent->ReadNext();
-    if (!msg) {
+    auto raw = uevent->ReadNextRaw();
+    if (!raw) {
       continue;
     }
 
+    if (recording.is_open()) {
+      auto length = uint32_t(raw->size());
+      recording.write(reinterpret_cast<const char *>(&length), sizeof(length));
+      recording.write(raw->data(), std::streamsize(raw->size()));
+      recording.flush();
+    }
+
+    std::string msg(*raw);
+    for (size_t i = 0; i + 1 < msg.size(); i++) {
+      if (msg[i] == '\0') {
+        msg[i] = '\n';
+      }
+    }
+
     std::cout << "New event #" << number++ << std::endl
-              << *msg << std::endl
+              << msg << std::endl
               << std::endl;
   }
 }
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <time.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "LatencyHistogram.h"
+
+namespace android {
+
+enum class FrameStage {
+  kValidate,
+  kPlan,
+  kFbImport,
+  kTestCommit,
+  kCommit,
+  kBlit,
+  kPriorFenceWait,
+  kPresentToFlip,
+  kCount,
+};
+
+/*
+ * Per-display latency of every stage of a frame. Recorded lock-free from the
+ * HWC, the commit worker and the DRM event listener threads.
+ */
+class FrameTimings {
+ public:
+  static constexpr size_t kNumStages = static_cast<size_t>(FrameStage::kCount);
+
+  static auto GetStageName(FrameStage stage) -> const char * {
+    switch (stage) {
+      case FrameStage::kValidate:
+        return "Validate";
+      case FrameStage::kPlan:
+        return "Plan";
+      case FrameStage::kFbImport:
+        return "FB import";
+      case FrameStage::kTestCommit:
+        return "Test commit";
+      case FrameStage::kCommit:
+        return "Commit";
+      case FrameStage::kBlit:
+        return "Blit";
+      case FrameStage::kPriorFenceWait:
+        return "Prior fence wait";
+      case FrameStage::kPresentToFlip:
+        return "Present to flip";
+      default:
+        return "Unknown";
+    }
+  }
+
+  static auto Now() -> int64_t {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+  }
+
+  void Record(FrameStage stage, int64_t latency_ns) {
+    hists_.at(static_cast<size_t>(stage)).Record(latency_ns);
+  }
+
+  auto GetHistogram(FrameStage stage) const -> const LatencyHistogram & {
+    return hists_.at(static_cast<size_t>(stage));
+  }
+
+  void SetVsyncPeriod(uint32_t period_ns) {
+    vsync_period_ns_ = period_ns;
+  }
+
+  /* A frame shown more than a vsync period after its submission has missed
+   * (at least) one vsync
+   */
+  void RecordFlip(int64_t submit_ns, int64_t flip_ns) {
+    uint32_t period_ns = vsync_period_ns_;
+    if (period_ns != 0 && flip_ns > submit_ns) {
+      missed_vsyncs_ += uint64_t(flip_ns - submit_ns) / period_ns;
+    }
+  }
+
+  auto GetMissedVsyncs() const -> uint64_t {
+    return missed_vsyncs_;
+  }
+
+  auto Dump() const -> std::string {
+    std::stringstream ss;
+    ss << "  Frame timings (missed vsyncs: " << GetMissedVsyncs() << "):\n";
+    for (size_t i = 0; i < kNumStages; i++) {
+      if (hists_[i].GetCount() == 0) {
+        continue;
+      }
+      ss << "    " << GetStageName(static_cast<FrameStage>(i)) << ": "
+         << hists_[i].Dump() << "\n";
+    }
+    return ss.str();
+  }
+
+ private:
+  std::array<LatencyHistogram, kNumStages> hists_;
+  std::atomic_uint32_t vsync_period_ns_{};
+  std::atomic_uint64_t missed_vsyncs_{};
+};
+
+/* Records the time spent in the enclosing scope */
+class ScopedFrameStage {
+ public:
+  ScopedFrameStage(FrameTimings *timings, FrameStage stage)
+      : timings_(timings), stage_(stage), start_ns_(FrameTimings::Now()) {
+  }
+
+  ~ScopedFrameStage() {
+    if (timings_ != nullptr) {
+      timings_->Record(stage_, FrameTimings::Now() - start_ns_);
+    }
+  }
+
+  ScopedFrameStage(const ScopedFrameStage &) = delete;
+  ScopedFrameStage(ScopedFrameStage &&) = delete;
+  auto operator=(const ScopedFrameStage &) = delete;
+  auto operator=(ScopedFrameStage &&) = delete;
+
+ private:
+  FrameTimings *const timings_;
+  const FrameStage stage_;
+  const int64_t start_ns_;
+};
+
+}  // namespace android
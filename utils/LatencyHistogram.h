@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace android {
+
+/*
+ * Lock-free latency histogram with power-of-two microsecond buckets:
+ * [0, 64us), [64us, 128us), ... , [~33.5ms, ~67ms), [~67ms, inf).
+ * Samples may be recorded from any thread.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr int kFirstBucketShift = 6; /* 64us */
+  static constexpr size_t kNumBuckets = 12;
+
+  void Record(int64_t latency_ns) {
+    auto us = static_cast<uint64_t>(latency_ns > 0 ? latency_ns / 1000 : 0);
+    size_t bucket = 0;
+    while (bucket < kNumBuckets - 1 &&
+           us >= (uint64_t(1) << (kFirstBucketShift + bucket))) {
+      bucket++;
+    }
+
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_us_.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t max = max_us_.load(std::memory_order_relaxed);
+    while (us > max &&
+           !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+  }
+
+  auto GetCount() const -> uint64_t {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  auto GetMaxUs() const -> uint64_t {
+    return max_us_.load(std::memory_order_relaxed);
+  }
+
+  auto GetAverageUs() const -> uint64_t {
+    uint64_t count = GetCount();
+    return count != 0 ? total_us_.load(std::memory_order_relaxed) / count : 0;
+  }
+
+  /* Upper bound of the bucket holding the given percentile, in microseconds */
+  auto GetPercentileUs(unsigned percentile) const -> uint64_t {
+    uint64_t count = GetCount();
+    if (count == 0) {
+      return 0;
+    }
+
+    uint64_t max = max_us_.load(std::memory_order_relaxed);
+    uint64_t target = (count * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets - 1; i++) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= target) {
+        return std::min(uint64_t(1) << (kFirstBucketShift + i), max);
+      }
+    }
+
+    return max;
+  }
+
+  auto Dump() const -> std::string {
+    std::stringstream ss;
+    uint64_t count = GetCount();
+    ss << count << " samples";
+    if (count == 0) {
+      return ss.str();
+    }
+
+    ss << ", avg " << total_us_.load(std::memory_order_relaxed) / count
+       << "us, p50 <=" << GetPercentileUs(50) << "us, p99 <="
+       << GetPercentileUs(99) << "us, max "
+       << max_us_.load(std::memory_order_relaxed) << "us\n      [";
+
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      if (i != 0) {
+        ss << " ";
+      }
+      ss << buckets_[i].load(std::memory_order_relaxed);
+    }
+    ss << "]";
+
+    return ss.str();
+  }
+
+  void Reset() {
+    for (auto &b : buckets_) {
+      b.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    total_us_.store(0, std::memory_order_relaxed);
+    max_us_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::array<std::atomic_uint64_t, kNumBuckets> buckets_{};
+  std::atomic_uint64_t count_{};
+  std::atomic_uint64_t total_us_{};
+  std::atomic_uint64_t max_us_{};
+};
+
+}  // namespace android
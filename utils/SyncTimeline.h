@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <linux/types.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "UniqueFd.h"
+#include "log.h"
+
+namespace android {
+
+/* From the kernel's drivers/dma-buf/sync_debug.h */
+struct sw_sync_create_fence_data {
+  __u32 value;
+  char name[32];
+  __s32 fence;
+};
+
+constexpr char kSwSyncIocMagic = 'W';
+constexpr auto kSwSyncIocCreateFence = _IOWR(kSwSyncIocMagic, 0,
+                                             struct sw_sync_create_fence_data);
+constexpr auto kSwSyncIocInc = _IOW(kSwSyncIocMagic, 1, __u32);
+
+/*
+ * Software fence timeline. Lets us hand out a sync_file for a frame before it
+ * has been submitted to the kernel and signal it once the frame is on screen.
+ */
+class SyncTimeline {
+ public:
+  static auto CreateInstance() -> std::unique_ptr<SyncTimeline> {
+    static const char *const kSwSyncPaths[] = {
+        "/dev/sw_sync",
+        "/sys/kernel/debug/sync/sw_sync",
+    };
+
+    for (const auto *path : kSwSyncPaths) {
+      auto fd = UniqueFd(open(path, O_RDWR | O_CLOEXEC));
+      if (fd) {
+        return std::unique_ptr<SyncTimeline>(new SyncTimeline(std::move(fd)));
+      }
+    }
+
+    ALOGI("sw_sync is not available: errno=%i", errno);
+    return {};
+  }
+
+  /* Returns a fence, which signals once the timeline reaches the next point */
+  auto CreateNextFence(uint32_t *out_point) -> UniqueFd {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    struct sw_sync_create_fence_data data {};
+    data.value = ++last_point_;
+    strncpy(data.name, "hwc-present", sizeof(data.name) - 1);
+    if (ioctl(fd_.Get(), kSwSyncIocCreateFence, &data) != 0) {
+      ALOGE("Failed to create sw_sync fence: errno=%i", errno);
+      --last_point_;
+      return {};
+    }
+
+    *out_point = data.value;
+    return UniqueFd(data.fence);
+  }
+
+  /* Signals every fence up to and including the given point */
+  void SignalUpTo(uint32_t point) {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    auto inc = static_cast<__u32>(point - signaled_point_);
+    if (static_cast<int32_t>(inc) <= 0) {
+      return;
+    }
+
+    if (ioctl(fd_.Get(), kSwSyncIocInc, &inc) != 0) {
+      ALOGE("Failed to signal sw_sync timeline: errno=%i", errno);
+      return;
+    }
+    signaled_point_ = point;
+  }
+
+  void SignalAll() {
+    uint32_t last_point = 0;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      last_point = last_point_;
+    }
+    SignalUpTo(last_point);
+  }
+
+ private:
+  explicit SyncTimeline(UniqueFd fd) : fd_(std::move(fd)){};
+
+  UniqueFd fd_;
+  std::mutex mutex_;
+  uint32_t last_point_{};
+  uint32_t signaled_point_{};
+};
+
+}  // namespace android
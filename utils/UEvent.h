@@ -16,22 +16,137 @@
 
 #pragma once
 
+#include <linux/filter.h>
 #include <linux/netlink.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "UniqueFd.h"
 #include "log.h"
 
 namespace android {
 
+/* Fields of interest of a kernel uevent. The views point into the buffer the
+ * message was parsed from and stay valid until it is overwritten.
+ */
+struct UEventMessage {
+  std::string_view action;
+  std::string_view devpath;
+  std::string_view devname;
+  std::string_view subsystem;
+  std::string_view devtype;
+  bool hotplug = false;
+  std::optional<uint32_t> connector;
+  std::optional<uint32_t> property;
+
+  /* Parses "action@devpath\0KEY=value\0KEY=value\0..." in place */
+  static auto Parse(const char *data, size_t length) -> UEventMessage {
+    UEventMessage msg{};
+    const std::string_view buf(data, length);
+
+    size_t pos = buf.find('\0');
+    while (pos < buf.size()) {
+      size_t end = buf.find('\0', pos + 1);
+      if (end == std::string_view::npos) {
+        end = buf.size();
+      }
+      auto field = buf.substr(pos + 1, end - pos - 1);
+      pos = end;
+
+      if (field.empty()) {
+        continue;
+      }
+
+      /* Dispatch on the first character to skip most keys cheaply */
+      switch (field[0]) {
+        case 'A':
+          GetValue(field, "ACTION=", &msg.action);
+          break;
+        case 'C':
+          if (auto connector = GetNumber(field, "CONNECTOR=")) {
+            msg.connector = connector;
+          }
+          break;
+        case 'D':
+          if (!GetValue(field, "DEVPATH=", &msg.devpath) &&
+              !GetValue(field, "DEVTYPE=", &msg.devtype)) {
+            GetValue(field, "DEVNAME=", &msg.devname);
+          }
+          break;
+        case 'H':
+          msg.hotplug |= field == "HOTPLUG=1";
+          break;
+        case 'P':
+          if (auto property = GetNumber(field, "PROPERTY=")) {
+            msg.property = property;
+          }
+          break;
+        case 'S':
+          GetValue(field, "SUBSYSTEM=", &msg.subsystem);
+          break;
+        default:
+          break;
+      }
+    }
+
+    return msg;
+  }
+
+  /* Device node the event is about, e.g. "card0" for DEVNAME=dri/card0.
+   * Falls back to the last devpath component, empty if neither is known.
+   */
+  auto GetNodeName() const -> std::string_view {
+    auto path = devname.empty() ? devpath : devname;
+    auto pos = path.rfind('/');
+    return pos == std::string_view::npos ? path : path.substr(pos + 1);
+  }
+
+ private:
+  static auto GetValue(std::string_view field, std::string_view key,
+                       std::string_view *value) -> bool {
+    if (field.substr(0, key.size()) != key) {
+      return false;
+    }
+    *value = field.substr(key.size());
+    return true;
+  }
+
+  static auto GetNumber(std::string_view field, std::string_view key)
+      -> std::optional<uint32_t> {
+    std::string_view value;
+    if (!GetValue(field, key, &value) || value.empty()) {
+      return {};
+    }
+
+    uint32_t number = 0;
+    for (char c : value) {
+      if (c < '0' || c > '9') {
+        return {};
+      }
+      number = number * 10 + uint32_t(c - '0');
+    }
+    return number;
+  }
+};
+
 class UEvent {
  public:
-  static auto CreateInstance() -> std::unique_ptr<UEvent> {
+  /* With a subsystem given, the kernel drops all other uevents before they
+   * reach the socket.
+   */
+  static auto CreateInstance(const char *subsystem = nullptr)
+      -> std::unique_ptr<UEvent> {
     auto fd = UniqueFd(
         socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT));
 
@@ -40,6 +155,28 @@ class UEvent {
       return {};
     }
 
+    /* Don't lose events while the listener is busy with a hotplug,
+     * SO_RCVBUFFORCE requires CAP_NET_ADMIN.
+     */
+    constexpr int kReceiveBufferSize = 256 * 1024;
+    if (setsockopt(fd.Get(), SOL_SOCKET, SO_RCVBUFFORCE, &kReceiveBufferSize,
+                   sizeof(kReceiveBufferSize)) != 0) {
+      setsockopt(fd.Get(), SOL_SOCKET, SO_RCVBUF, &kReceiveBufferSize,
+                 sizeof(kReceiveBufferSize));
+    }
+
+    if (subsystem != nullptr) {
+      auto filter = CreateSubsystemFilter(subsystem);
+      struct sock_fprog prog {
+        .len = static_cast<uint16_t>(filter.size()), .filter = filter.data(),
+      };
+      if (setsockopt(fd.Get(), SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+                     sizeof(prog)) != 0) {
+        /* Not fatal, the messages are still checked in userspace */
+        ALOGW("Failed to attach uevent filter: errno=%i", errno);
+      }
+    }
+
     struct sockaddr_nl addr {};
     addr.nl_family = AF_NETLINK;
     addr.nl_pid = 0;
@@ -55,11 +192,10 @@ class UEvent {
     return std::unique_ptr<UEvent>(new UEvent(fd));
   }
 
-  auto ReadNext() -> std::optional<std::string> {
-    constexpr int kUEventBufferSize = 1024;
-    char buffer[kUEventBufferSize];
-    ssize_t ret = 0;
-    ret = read(fd_.Get(), &buffer, sizeof(buffer));
+  /* Returns the raw NUL-separated message, valid until the next read */
+  auto ReadNextRaw() -> std::optional<std::string_view> {
+    ssize_t ret = recv(fd_.Get(), buffer_.data(), buffer_.size() - 1,
+                       MSG_TRUNC);
     if (ret == 0)
       return {};
 
@@ -68,18 +204,100 @@ class UEvent {
       return {};
     }
 
-    for (int i = 0; i < ret - 1; i++) {
-      if (buffer[i] == '\0') {
-        buffer[i] = '\n';
+    if (size_t(ret) > buffer_.size() - 1) {
+      ALOGE("Uevent truncated: %zd bytes, buffer has %zu", ret,
+            buffer_.size() - 1);
+      return {};
+    }
+
+    buffer_[ret] = '\0';
+    return std::string_view(buffer_.data(), ret);
+  }
+
+  auto ReadNextMessage() -> std::optional<UEventMessage> {
+    auto raw = ReadNextRaw();
+    if (!raw) {
+      return {};
+    }
+
+    return UEventMessage::Parse(raw->data(), raw->size());
+  }
+
+  /* Returns the message with fields separated by new lines, for dumping */
+  auto ReadNext() -> std::optional<std::string> {
+    auto raw = ReadNextRaw();
+    if (!raw) {
+      return {};
+    }
+
+    std::string str(*raw);
+    for (size_t i = 0; i + 1 < str.size(); i++) {
+      if (str[i] == '\0') {
+        str[i] = '\n';
+      }
+    }
+
+    return str;
+  }
+
+  /*
+   * Classic BPF has no loops, so the search for "\0SUBSYSTEM=<name>\0" is
+   * unrolled over the first kMaxFilterScanOffset bytes. An out of bounds load
+   * drops the message, which is right as the key can't fit past the end.
+   * Messages longer than the scanned window are passed through.
+   */
+  static auto CreateSubsystemFilter(const char *subsystem)
+      -> std::vector<sock_filter> {
+    std::string pattern = std::string(1, '\0') + "SUBSYSTEM=" + subsystem;
+    pattern.push_back('\0');
+
+    /* Big-endian 4, 2 or 1 byte chunks, as loaded by BPF_ABS */
+    std::vector<std::pair<uint16_t, uint32_t>> chunks;
+    for (size_t i = 0; i < pattern.size();) {
+      size_t size = std::min<size_t>(pattern.size() - i, 4);
+      size = size == 3 ? 2 : size;
+      uint32_t value = 0;
+      for (size_t j = 0; j < size; j++) {
+        value = (value << 8) | uint8_t(pattern[i + j]);
+      }
+      uint16_t load_size = size == 4 ? BPF_W : (size == 2 ? BPF_H : BPF_B);
+      chunks.emplace_back(load_size, value);
+      i += size;
+    }
+
+    /* A load and a compare per chunk, plus the accepting return */
+    size_t block_size = chunks.size() * 2 + 1;
+    auto scan_size = std::min<uint32_t>(kMaxFilterScanOffset,
+                                        (BPF_MAXINSNS - 1) / block_size);
+
+    std::vector<sock_filter> filter;
+    for (uint32_t offset = 0; offset < scan_size; offset++) {
+      /* On mismatch jump over the rest of this offset's block */
+      auto remaining = uint8_t(chunks.size() * 2);
+      uint32_t chunk_offset = offset;
+      for (size_t i = 0; i < chunks.size(); i++) {
+        auto [load_size, value] = chunks[i];
+        remaining -= 2;
+        filter.push_back(BPF_STMT(BPF_LD | load_size | BPF_ABS, chunk_offset));
+        filter.push_back(
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, value, 0, remaining + 1));
+        chunk_offset += load_size == BPF_W ? 4 : (load_size == BPF_H ? 2 : 1);
       }
+      filter.push_back(BPF_STMT(BPF_RET | BPF_K, UINT32_MAX));
     }
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, UINT32_MAX));
 
-    return std::string(buffer);
+    return filter;
   }
 
  private:
+  /* Kernel uevents are limited to 2 KiB (UEVENT_BUFFER_SIZE) */
+  static constexpr size_t kBufferSize = 8 * 1024;
+  static constexpr uint32_t kMaxFilterScanOffset = 320;
+
   explicit UEvent(UniqueFd &fd) : fd_(std::move(fd)){};
   UniqueFd fd_;
+  std::array<char, kBufferSize> buffer_{};
 };
 
 }  // namespace android
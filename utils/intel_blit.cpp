@@ -28,6 +28,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <unistd.h>
 
 #include <drm_fourcc.h>
 #include <virtgpu_drm.h>
@@ -37,6 +38,7 @@
 #include "i915_prelim.h"
 
 #include "utils/UniqueFd.h"
+#include <algorithm>
 #include <chrono>
 
 #include <utils/Trace.h>
@@ -95,8 +97,30 @@ struct i915_device {
   struct iris_memregion vram, sys;
 };
 
+/* Soft-pinned GPU virtual address layout of the shared blitter context.
+ * Every buffer keeps a single address for as long as its handle is open, so
+ * the kernel never has to rebind a buffer used by an in-flight batch.
+ */
+#define BATCH_VA_BASE (16ull * _1MB)
+#define SURFACE_VA_BASE (256ull * _1MB)
+/* Keeps buffers in local and system memory apart on DG2 */
+#define SURFACE_VA_ALIGNMENT (2ull * _1MB)
+
+/* Syncobj wait for a ring slot to become free */
+#define RING_WAIT_TIMEOUT_NS (1000ll * 1000 * 1000)
+
+/* Blit commands of a single copy plus the final MI_BATCH_BUFFER_END */
+#define MAX_BLIT_DWORDS 32
+
+static struct intel_batch *batch_current(struct intel_info *info) {
+  return &info->ring[info->ring_head];
+}
+
 static void batch_reset(struct intel_info *info) {
-  info->cur = info->vaddr;
+  info->cur = batch_current(info)->vaddr;
+  info->num_objs = 0;
+  info->num_blits = 0;
+  info->num_in_fences = 0;
 }
 
 static inline void
@@ -130,7 +154,7 @@ static void prelim_i915_bo_update_meminfo(struct i915_device *i915_dev,
   }
 }
 
-static int batch_create(struct intel_info *info) {
+static int batch_create(struct intel_info *info, struct intel_batch *batch) {
   struct drm_i915_gem_create create;
   struct drm_i915_gem_mmap mmap_arg;
   int fd = info->fd.Get();
@@ -142,27 +166,38 @@ static int batch_create(struct intel_info *info) {
   ret = ioctl(fd, DRM_IOCTL_I915_GEM_CREATE, &create);
   if (ret < 0) {
     ALOGE("failed to create buffer\n");
-    info->batch_handle = 0;
+    batch->handle = 0;
     return ret;
   }
-  info->batch_handle = create.handle;
+  batch->handle = create.handle;
   mmap_arg.handle = create.handle;
   mmap_arg.size = info->size;
   ret = ioctl(fd, DRM_IOCTL_I915_GEM_MMAP, &mmap_arg);
   if (ret < 0) {
-    drmCloseBufferHandle(fd, info->batch_handle);
-    info->batch_handle = 0;
+    drmCloseBufferHandle(fd, batch->handle);
+    batch->handle = 0;
     ALOGE("buffer map failure\n");
     return ret;
   }
-  info->vaddr = (uint32_t *)mmap_arg.addr_ptr;
-  batch_reset(info);
+  batch->vaddr = (uint32_t *)mmap_arg.addr_ptr;
+
+  ret = drmSyncobjCreate(fd, 0, &batch->out_syncobj);
+  if (ret) {
+    ALOGE("failed to create sync object\n");
+    return ret;
+  }
+  for (uint32_t i = 0; i < INTEL_BLIT_MAX_BATCH; i++) {
+    ret = drmSyncobjCreate(fd, 0, &batch->in_syncobjs[i]);
+    if (ret) {
+      ALOGE("failed to create sync object\n");
+      return ret;
+    }
+  }
   return ret;
 }
 
-__attribute__((unused))
 static int batch_count(struct intel_info *info) {
-  return info->cur - info->vaddr;
+  return info->cur - batch_current(info)->vaddr;
 }
 
 static void batch_dword(struct intel_info *info, uint32_t dword) {
@@ -170,9 +205,22 @@ static void batch_dword(struct intel_info *info, uint32_t dword) {
 }
 
 static void batch_destroy(struct intel_info *info) {
-  if (info->batch_handle) {
-    drmCloseBufferHandle(info->fd.Get(), info->batch_handle);
-    info->batch_handle = 0;
+  int fd = info->fd.Get();
+  for (auto &batch : info->ring) {
+    if (batch.out_syncobj) {
+      drmSyncobjDestroy(fd, batch.out_syncobj);
+      batch.out_syncobj = 0;
+    }
+    for (auto &in_syncobj : batch.in_syncobjs) {
+      if (in_syncobj) {
+        drmSyncobjDestroy(fd, in_syncobj);
+        in_syncobj = 0;
+      }
+    }
+    if (batch.handle) {
+      drmCloseBufferHandle(fd, batch.handle);
+      batch.handle = 0;
+    }
   }
 }
 
@@ -285,64 +333,37 @@ static int batch_init(struct intel_info *info) {
     return -1;
   }
 
-  ret = batch_create(info);
+  for (auto &batch : info->ring) {
+    ret = batch_create(info, &batch);
+    if (ret) {
+      batch_destroy(info);
+      i915_gem_destroy_context(info->fd.Get(), info->context_id);
+      return ret;
+    }
+  }
+  info->ring_head = 0;
+  batch_reset(info);
   return ret;
 }
 
-static int batch_submit(struct intel_info *info, uint32_t src, uint32_t dst,
-                        uint64_t src_offset, uint64_t dst_offset,
-                        uint64_t batch_offset,
-                        uint32_t in_fence_handle, uint32_t out_fence_handle) {
-  int ret;
-  int fd = info->fd.Get();
-  struct drm_i915_gem_exec_object2 obj[3];
-  struct drm_i915_gem_execbuffer2 execbuf;
-  struct drm_i915_gem_exec_fence __attribute__((unused)) fence_array[2] = {
-    {
-      .handle = out_fence_handle,
-      .flags = I915_EXEC_FENCE_SIGNAL,
-    },
-    {
-      .handle = in_fence_handle,
-      .flags = I915_EXEC_FENCE_WAIT,
-    },
-  };
-  memset(obj, 0, sizeof(obj));
-  obj[0].handle = dst;
-  obj[0].offset = dst_offset;
-  obj[0].flags = EXEC_OBJECT_PINNED | EXEC_OBJECT_WRITE;
-
-  obj[1].handle = src;
-  obj[1].offset = src_offset;
-  obj[1].flags = EXEC_OBJECT_PINNED;
-
-  obj[2].handle = info->batch_handle;
-  obj[2].offset = batch_offset;
-  obj[2].flags = EXEC_OBJECT_PINNED;
-
-  memset(&execbuf, 0, sizeof(execbuf));
-  execbuf.buffers_ptr = (__u64)&obj;
-  execbuf.buffer_count = ARRAY_SIZE(obj);
-  execbuf.flags = I915_EXEC_BLT;
-  execbuf.flags |= I915_EXEC_NO_RELOC;
-  execbuf.flags |= I915_EXEC_FENCE_ARRAY;
-  execbuf.cliprects_ptr = (__u64)(fence_array);
-  execbuf.num_cliprects = ARRAY_SIZE(fence_array) - (in_fence_handle == 0 ? 1 : 0);
-  execbuf.rsvd1 = info->context_id;
-
-  ret = ioctl(fd, DRM_IOCTL_I915_GEM_EXECBUFFER2_WR, &execbuf);
-  if (ret < 0) {
-    ALOGE("submit batchbuffer failure, errno:%d\n", errno);
-    return -1;
+/* Adds a buffer to the execbuffer object list at its soft-pinned address */
+static void batch_add_object(struct intel_info *info, uint32_t handle,
+                             uint64_t offset, bool write) {
+  for (uint32_t i = 0; i < info->num_objs; i++) {
+    if (info->objs[i].handle == handle) {
+      if (write)
+        info->objs[i].flags |= EXEC_OBJECT_WRITE;
+      return;
+    }
   }
-  // struct drm_i915_gem_wait wait;
-  // memset(&wait, 0, sizeof(wait));
-  // wait.bo_handle = info->batch_handle;
-  // wait.timeout_ns = 1000 * 1000 * 1000;
-  // ioctl(info->fd, DRM_IOCTL_I915_GEM_WAIT, &wait);
 
-  batch_reset(info);
-  return 0;
+  struct drm_i915_gem_exec_object2 *obj = &info->objs[info->num_objs];
+  memset(obj, 0, sizeof(*obj));
+  obj->handle = handle;
+  obj->offset = offset;
+  obj->flags = EXEC_OBJECT_PINNED | EXEC_OBJECT_SUPPORTS_48B_ADDRESS |
+               (write ? EXEC_OBJECT_WRITE : 0);
+  info->num_objs++;
 }
 
 __attribute__((unused))
@@ -391,7 +412,6 @@ static int emit_fast_blit_commands(struct intel_info *info,
   batch_dword(info, 0);
   batch_dword(info, 0);
   batch_dword(info, 0);
-  batch_dword(info, MI_BATCH_BUFFER_END);
 
   return 0;
 }
@@ -446,7 +466,6 @@ static int emit_src_blit_commands(struct intel_info *info,
   batch_dword(info, 0);
   batch_dword(info, 0);
   batch_dword(info, 0);
-  batch_dword(info, MI_BATCH_BUFFER_END);
 
   return 0;
 }
@@ -534,69 +553,137 @@ static int emit_block_blit_commands(struct intel_info *info,
   batch_dword(info, 0);
   batch_dword(info, 0);
   batch_dword(info, 0);
-  batch_dword(info, MI_BATCH_BUFFER_END);
 
   return 0;
 }
 
-int intel_blit(struct intel_info *info, uint32_t dst, uint32_t src,
-               uint32_t stride, uint32_t bpp, uint32_t tiling, uint16_t width,
-               uint16_t height, int in_fence, int *out_fence) {
-  uint32_t in_fence_handle = 0;
-  uint32_t out_fence_handle = 0;
-  const uint64_t kBaseOffset = info->addr_offset * 256 * _1MB;
-  const uint64_t kBatchOffset = kBaseOffset + 16 * _1MB;
-  const uint64_t kSrcOffset = kBaseOffset + 64 * _1MB;
-  const uint64_t kDstOffset = kBaseOffset + 128 * _1MB;
-  int fd = info->fd.Get();
+int intel_blit_begin(struct intel_info *info) {
+  struct intel_batch *batch = batch_current(info);
+
+  if (batch->busy) {
+    ATRACE_NAME("WaitBlitRingSlot");
+    int ret = drmSyncobjWait(info->fd.Get(), &batch->out_syncobj, 1,
+                             RING_WAIT_TIMEOUT_NS, 0, nullptr);
+    if (ret) {
+      ALOGE("timed out waiting for blit batch %u\n", info->ring_head);
+      return ret;
+    }
+    batch->busy = 0;
+  }
+
+  batch_reset(info);
+  return 0;
+}
+
+int intel_blit_add(struct intel_info *info, uint32_t dst, uint64_t dst_offset,
+                   uint32_t src, uint64_t src_offset, uint32_t stride,
+                   uint32_t bpp, uint32_t tiling, uint16_t width,
+                   uint16_t height, int in_fence) {
+  struct intel_batch *batch = batch_current(info);
   int ret;
 
-  ATRACE_CALL();
-  ret = drmSyncobjCreate(fd, 0, &out_fence_handle);
-  if (ret) {
-    ALOGE("failed to create sync object\n");
-    goto out;
+  if (info->num_blits >= INTEL_BLIT_MAX_BATCH ||
+      (batch_count(info) + MAX_BLIT_DWORDS) * sizeof(uint32_t) > info->size) {
+    ALOGE("blit batch is full\n");
+    return -ENOSPC;
   }
 
   if (in_fence >= 0) {
-    ret = drmSyncobjCreate(fd, 0, &in_fence_handle);
-    if (ret) {
-      ALOGE("%s:%u: failed to create syncobj\n", __func__, __LINE__);
-      goto out;
-    }
-    ret = drmSyncobjImportSyncFile(fd, in_fence_handle, in_fence);
+    uint32_t in_syncobj = batch->in_syncobjs[info->num_in_fences];
+    ret = drmSyncobjImportSyncFile(info->fd.Get(), in_syncobj, in_fence);
     if (ret) {
       ALOGE("failed to import syncobj (fd=%d)\n", in_fence);
-      goto out;
+      return ret;
     }
+    info->fences[info->num_in_fences + 1] = {
+      .handle = in_syncobj,
+      .flags = I915_EXEC_FENCE_WAIT,
+    };
+    info->num_in_fences++;
   }
 
-  // ret = emit_src_blit_commands(info, stride, bpp, tiling, width, height, kSrcOffset, kDstOffset);
-  ret = emit_fast_blit_commands(info, stride, bpp, tiling, width, height, kSrcOffset, kDstOffset);
-  // ret = emit_block_blit_commands(info, stride, bpp, tiling, width, height, kSrcOffset, kDstOffset);
+  batch_add_object(info, dst, dst_offset, true);
+  batch_add_object(info, src, src_offset, false);
+
+  // ret = emit_src_blit_commands(info, stride, bpp, tiling, width, height, src_offset, dst_offset);
+  ret = emit_fast_blit_commands(info, stride, bpp, tiling, width, height, src_offset, dst_offset);
+  // ret = emit_block_blit_commands(info, stride, bpp, tiling, width, height, src_offset, dst_offset);
   if (ret) {
     ALOGE("failed to fill commands\n");
-    goto out;
+    return ret;
   }
 
-  ret = batch_submit(info, src, dst, kSrcOffset, kDstOffset, kBatchOffset, in_fence_handle, out_fence_handle);
-  if (ret) {
-    ALOGE("failed to submit batch\n");
-    goto out;
+  info->num_blits++;
+  return 0;
+}
+
+int intel_blit_submit(struct intel_info *info, int *out_fence) {
+  struct intel_batch *batch = batch_current(info);
+  struct drm_i915_gem_execbuffer2 execbuf;
+  int fd = info->fd.Get();
+  int ret;
+
+  ATRACE_CALL();
+  if (info->num_blits == 0) {
+    return -EINVAL;
+  }
+
+  batch_dword(info, MI_BATCH_BUFFER_END);
+
+  /* The batch buffer must be the last object */
+  struct drm_i915_gem_exec_object2 *obj = &info->objs[info->num_objs];
+  memset(obj, 0, sizeof(*obj));
+  obj->handle = batch->handle;
+  obj->offset = BATCH_VA_BASE + info->ring_head * info->size;
+  obj->flags = EXEC_OBJECT_PINNED;
+
+  info->fences[0] = {
+    .handle = batch->out_syncobj,
+    .flags = I915_EXEC_FENCE_SIGNAL,
+  };
+
+  memset(&execbuf, 0, sizeof(execbuf));
+  execbuf.buffers_ptr = (__u64)info->objs;
+  execbuf.buffer_count = info->num_objs + 1;
+  execbuf.flags = I915_EXEC_BLT;
+  execbuf.flags |= I915_EXEC_NO_RELOC;
+  execbuf.flags |= I915_EXEC_FENCE_ARRAY;
+  execbuf.cliprects_ptr = (__u64)info->fences;
+  execbuf.num_cliprects = info->num_in_fences + 1;
+  execbuf.rsvd1 = info->context_id;
+
+  ret = ioctl(fd, DRM_IOCTL_I915_GEM_EXECBUFFER2_WR, &execbuf);
+  if (ret < 0) {
+    ALOGE("submit batchbuffer failure, errno:%d\n", errno);
+    batch_reset(info);
+    return -1;
   }
-  ret = drmSyncobjExportSyncFile(fd, out_fence_handle, out_fence);
+  batch->busy = 1;
+  info->ring_head = (info->ring_head + 1) % INTEL_BLIT_RING_SIZE;
+
+  ret = drmSyncobjExportSyncFile(fd, batch->out_syncobj, out_fence);
   if (ret) {
-    ALOGE("failed to export syncobj (handle=%u)\n", out_fence_handle);
-    goto out;
+    ALOGE("failed to export syncobj (handle=%u)\n", batch->out_syncobj);
   }
-out:
-  if (in_fence_handle) {
-    drmSyncobjDestroy(fd, in_fence_handle);
+  return ret;
+}
+
+int intel_blit(struct intel_info *info, uint32_t dst, uint64_t dst_offset,
+               uint32_t src, uint64_t src_offset, uint32_t stride, uint32_t bpp,
+               uint32_t tiling, uint16_t width, uint16_t height, int in_fence,
+               int *out_fence) {
+  int ret = intel_blit_begin(info);
+  if (ret) {
+    return ret;
   }
-  if (out_fence_handle) {
-    drmSyncobjDestroy(fd, out_fence_handle);
+
+  ret = intel_blit_add(info, dst, dst_offset, src, src_offset, stride, bpp,
+                       tiling, width, height, in_fence);
+  if (ret) {
+    return ret;
   }
-  return ret;
+
+  return intel_blit_submit(info, out_fence);
 }
 
 int intel_blit_destroy(struct intel_info *info) {
@@ -609,7 +696,6 @@ int intel_blit_destroy(struct intel_info *info) {
 }
 
 int intel_blit_init(struct intel_info *info) {
-  static int addr_offset = 0;
   int ret;
 
   ret = batch_init(info);
@@ -618,25 +704,22 @@ int intel_blit_init(struct intel_info *info) {
   }
   info->mocs.blitter_dst = 2 << 1;
   info->mocs.blitter_src = 2 << 1;
-  info->addr_offset = (addr_offset++) % 4;
   info->init = 1;
   return 0;
 }
 
 int intel_dgpu_fd() {
-  static int fd = -1;
-
-  if (fd != -1)
-    return fd;
-
-  fd = intel_dgpu_fd_new();
+  /* Probed once, thread-safe as it's called from every display's validate */
+  static const int fd = intel_dgpu_fd_new();
   return fd;
 }
 
 int intel_create_buffer(struct intel_info *info, uint32_t width, uint32_t height,
                         __attribute__((unused)) uint32_t format,
-                        uint64_t modifier, uint32_t *out_handle) {
+                        uint64_t modifier, uint32_t *out_handle,
+                        uint64_t *out_size) {
   assert(out_handle != nullptr);
+  assert(out_size != nullptr);
   int fd = info->fd.Get();
   uint32_t total_size;
   uint32_t tiling = I915_TILING_NONE;
@@ -645,7 +728,8 @@ int intel_create_buffer(struct intel_info *info, uint32_t width, uint32_t height
   const uint32_t bpp = 4;
   uint32_t aligned_height, stride = width * bpp;
   static uint32_t alloc_count = 0;
-  struct i915_device dev{};
+  /* Memory regions don't change, query them once */
+  static struct i915_device dev{};
   intel_update_meminfo(fd, dev);
 
   switch (modifier) {
@@ -718,6 +802,7 @@ int intel_create_buffer(struct intel_info *info, uint32_t width, uint32_t height
     return -errno;
   }
   *out_handle = gem_create_ext.handle;
+  *out_size = gem_create_ext.size;
 
   ATRACE_INT("Shadow buffer count", ++alloc_count);
   return 0;
@@ -737,17 +822,169 @@ bool virtio_gpu_allow_p2p(int virtgpu_fd) {
   return true;
 }
 
+auto IntelBlitter::GetInstance() -> std::shared_ptr<IntelBlitter> {
+  static std::mutex mutex;
+  /* Released, together with the dGPU fd, once no buffer is shadowed */
+  static std::weak_ptr<IntelBlitter> weak_instance;
+
+  const std::lock_guard<std::mutex> lock(mutex);
+  auto instance = weak_instance.lock();
+  if (!instance || !instance->Initialized()) {
+    instance = std::make_shared<IntelBlitter>();
+    weak_instance = instance;
+  }
+  return instance;
+}
+
+IntelBlitter::IntelBlitter() : next_address_(SURFACE_VA_BASE) {
+  intel_blit_init(&info);
+}
+
+IntelBlitter::~IntelBlitter() {
+  for (auto &[handle, bo] : bos_) {
+    ALOGW("Closing leaked blitter buffer handle %u", handle);
+    drmCloseBufferHandle(info.fd.Get(), handle);
+  }
+  intel_blit_destroy(&info);
+}
+
+/* Called with the mutex held */
+auto IntelBlitter::AllocateAddress(uint64_t size) -> uint64_t {
+  size = ALIGN(size, SURFACE_VA_ALIGNMENT);
+  /* Buffers of a swapchain have the same size, so exact fits are common */
+  auto it = free_ranges_.lower_bound(size);
+  if (it != free_ranges_.end()) {
+    uint64_t offset = it->second;
+    uint64_t range_size = it->first;
+    free_ranges_.erase(it);
+    if (range_size > size) {
+      free_ranges_.emplace(range_size - size, offset + size);
+    }
+    return offset;
+  }
+
+  uint64_t offset = next_address_;
+  next_address_ += size;
+  return offset;
+}
+
+void IntelBlitter::FreeAddress(uint64_t offset, uint64_t size) {
+  free_ranges_.emplace(ALIGN(size, SURFACE_VA_ALIGNMENT), offset);
+}
+
+void IntelBlitter::AddBuffer(uint32_t handle, uint64_t size) {
+  auto &bo = bos_[handle];
+  if (bo.refs++ == 0) {
+    bo.size = size;
+    bo.offset = AllocateAddress(size);
+  }
+}
+
+auto IntelBlitter::GetAddress(uint32_t handle) -> std::optional<uint64_t> {
+  auto it = bos_.find(handle);
+  if (it == bos_.end()) {
+    ALOGE("Unknown blitter buffer handle %u", handle);
+    return {};
+  }
+  return it->second.offset;
+}
+
 bool IntelBlitter::Blit(
     uint32_t dst, uint32_t src, uint32_t stride, uint32_t bpp,
     uint16_t width, uint16_t height, int in_fence, int *out_fence) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto dst_offset = GetAddress(dst);
+  auto src_offset = GetAddress(src);
+  if (!dst_offset || !src_offset) {
+    return false;
+  }
   // Use any tiling mode other than linear suffers from corrupted images :/.
-  return intel_blit(&info, dst, src, stride, bpp, I915_TILING_NONE,
-                    width, height, in_fence, out_fence) == 0;
+  return intel_blit(&info, dst, *dst_offset, src, *src_offset, stride, bpp,
+                    I915_TILING_NONE, width, height, in_fence, out_fence) == 0;
+}
+
+/* Blits go in batches of at most INTEL_BLIT_MAX_BATCH. The batches run in
+ * submission order on the blitter context, so the fence of the last one
+ * signals once all of them completed.
+ */
+bool IntelBlitter::BlitBatch(const std::vector<BlitRequest> &requests,
+                             int *out_fence) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  android::UniqueFd last_fence;
+
+  for (size_t first = 0; first < requests.size();
+       first += INTEL_BLIT_MAX_BATCH) {
+    size_t last = std::min(requests.size(), first + INTEL_BLIT_MAX_BATCH);
+    if (intel_blit_begin(&info) != 0) {
+      return false;
+    }
+
+    for (size_t i = first; i < last; i++) {
+      const auto &r = requests[i];
+      auto dst_offset = GetAddress(r.dst);
+      auto src_offset = GetAddress(r.src);
+      if (!dst_offset || !src_offset) {
+        return false;
+      }
+      // Use any tiling mode other than linear suffers from corrupted images :/.
+      if (intel_blit_add(&info, r.dst, *dst_offset, r.src, *src_offset,
+                         r.stride, r.bpp, I915_TILING_NONE, r.width, r.height,
+                         r.in_fence) != 0) {
+        return false;
+      }
+    }
+
+    int fence = -1;
+    if (intel_blit_submit(&info, &fence) != 0) {
+      return false;
+    }
+    last_fence = android::UniqueFd(fence);
+  }
+
+  *out_fence = last_fence.Release();
+  return true;
 }
 
 bool IntelBlitter::CreateShadowBuffer(
     uint32_t width, uint32_t height, uint32_t format,
     uint64_t modifier, uint32_t *out_handle) {
-  return intel_create_buffer(&info, width, height, format, modifier, out_handle) == 0;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t size = 0;
+  if (intel_create_buffer(&info, width, height, format, modifier, out_handle,
+                          &size) != 0) {
+    return false;
+  }
+  AddBuffer(*out_handle, size);
+  return true;
 }
 
+bool IntelBlitter::ImportBuffer(int prime_fd, uint32_t *out_handle) {
+  off_t size = lseek(prime_fd, 0, SEEK_END);
+  if (size <= 0) {
+    ALOGE("failed to get dma-buf size (fd=%d)\n", prime_fd);
+    return false;
+  }
+
+  /* The import and the refcount update must not interleave with a close */
+  const std::lock_guard<std::mutex> lock(mutex_);
+  if (drmPrimeFDToHandle(info.fd.Get(), prime_fd, out_handle) != 0) {
+    return false;
+  }
+  AddBuffer(*out_handle, uint64_t(size));
+  return true;
+}
+
+void IntelBlitter::ReleaseBuffer(uint32_t handle) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto it = bos_.find(handle);
+  if (it == bos_.end()) {
+    ALOGE("Releasing unknown blitter buffer handle %u", handle);
+    return;
+  }
+
+  if (--it->second.refs == 0) {
+    FreeAddress(it->second.offset, it->second.size);
+    drmCloseBufferHandle(info.fd.Get(), handle);
+    bos_.erase(it);
+  }
+}
@@ -20,14 +20,35 @@
 #include <i915_drm.h>
 #include <stdint.h>
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
 #include "UniqueFd.h"
 
 #define I915_TILING_4 9
 
+/* Batches are recycled in a ring, a slot is reused once the GPU signalled
+ * the previous submission from it. */
+#define INTEL_BLIT_RING_SIZE 4
+#define INTEL_BLIT_MAX_BATCH 8
+
+struct intel_batch {
+  uint32_t handle;
+  uint32_t *vaddr;
+  /* Signalled by the GPU when the batch completes */
+  uint32_t out_syncobj;
+  uint32_t in_syncobjs[INTEL_BLIT_MAX_BATCH];
+  int busy;
+};
+
 struct intel_info {
   android::UniqueFd fd;
-  uint32_t batch_handle;
-  uint32_t *vaddr;
+  struct intel_batch ring[INTEL_BLIT_RING_SIZE];
+  uint32_t ring_head;
   uint32_t *cur;
   uint64_t size;
   int init;
@@ -35,31 +56,57 @@ struct intel_info {
     uint32_t blitter_src;
     uint32_t blitter_dst;
   } mocs;
-  uint64_t addr_offset;
   uint32_t context_id;
+
+  /* State of the batch being recorded */
+  struct drm_i915_gem_exec_object2 objs[2 * INTEL_BLIT_MAX_BATCH + 1];
+  struct drm_i915_gem_exec_fence fences[INTEL_BLIT_MAX_BATCH + 1];
+  uint32_t num_objs;
+  uint32_t num_blits;
+  uint32_t num_in_fences;
 };
 
 int intel_blit_destroy(struct intel_info *info);
 int intel_blit_init(struct intel_info *info);
-int intel_blit(struct intel_info *info, uint32_t dst, uint32_t src,
-               uint32_t stride, uint32_t bpp, uint32_t tiling, uint16_t width,
-               uint16_t height, int in_fence, int *out_fence);
+int intel_blit_begin(struct intel_info *info);
+/* Buffers are soft-pinned at the given GPU addresses */
+int intel_blit_add(struct intel_info *info, uint32_t dst, uint64_t dst_offset,
+                   uint32_t src, uint64_t src_offset, uint32_t stride,
+                   uint32_t bpp, uint32_t tiling, uint16_t width,
+                   uint16_t height, int in_fence);
+int intel_blit_submit(struct intel_info *info, int *out_fence);
+int intel_blit(struct intel_info *info, uint32_t dst, uint64_t dst_offset,
+               uint32_t src, uint64_t src_offset, uint32_t stride, uint32_t bpp,
+               uint32_t tiling, uint16_t width, uint16_t height, int in_fence,
+               int *out_fence);
 int intel_create_buffer(struct intel_info *info,
                         uint32_t width, uint32_t height, uint32_t format,
-                        uint64_t modifier, uint32_t *out_handle);
+                        uint64_t modifier, uint32_t *out_handle,
+                        uint64_t *out_size);
 int intel_dgpu_fd();
 bool virtio_gpu_allow_p2p(int virtgpu_fd);
 
 class IntelBlitter {
  public:
-  IntelBlitter() {
-    intel_blit_init(&info);
-  }
+  struct BlitRequest {
+    uint32_t dst;
+    uint32_t src;
+    uint32_t stride;
+    uint32_t bpp;
+    uint16_t width;
+    uint16_t height;
+    int in_fence;
+  };
+
+  /* One blitter (i915 context, batch ring and GEM handle namespace) is shared
+   * by all layers and displays using the dGPU, for as long as any of them
+   * holds a reference. */
+  static auto GetInstance() -> std::shared_ptr<IntelBlitter>;
+
+  IntelBlitter();
   IntelBlitter(const IntelBlitter &) = delete;
   IntelBlitter &operator=(const IntelBlitter &) = delete;
-  ~IntelBlitter() {
-    intel_blit_destroy(&info);
-  }
+  ~IntelBlitter();
   bool Initialized() {
     return info.init;
   }
@@ -68,10 +115,34 @@ class IntelBlitter {
   }
   bool Blit(uint32_t dst, uint32_t src, uint32_t stride, uint32_t bpp,
             uint16_t width, uint16_t height, int in_fence, int *out_fence);
+  /* Submits all blits as a single execbuffer, out_fence signals once every
+   * blit of the batch completed. */
+  bool BlitBatch(const std::vector<BlitRequest> &requests, int *out_fence);
+  /* The handles below must be released with ReleaseBuffer(). Importing the
+   * same dma-buf twice gives the same handle, so they are refcounted. */
   bool CreateShadowBuffer(uint32_t width, uint32_t height, uint32_t format,
                           uint64_t modifier, uint32_t *out_handle);
+  bool ImportBuffer(int prime_fd, uint32_t *out_handle);
+  void ReleaseBuffer(uint32_t handle);
+
  private:
-  struct intel_info info;
+  struct BufferObject {
+    uint32_t refs;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  void AddBuffer(uint32_t handle, uint64_t size);
+  auto GetAddress(uint32_t handle) -> std::optional<uint64_t>;
+  auto AllocateAddress(uint64_t size) -> uint64_t;
+  void FreeAddress(uint64_t offset, uint64_t size);
+
+  struct intel_info info {};
+  std::mutex mutex_;
+  std::unordered_map<uint32_t /*handle*/, BufferObject> bos_;
+  /* Released address ranges by size, reused before growing the used space */
+  std::multimap<uint64_t /*size*/, uint64_t /*offset*/> free_ranges_;
+  uint64_t next_address_{};
 };
 
 #endif  // __INTEL_BLIT_H__